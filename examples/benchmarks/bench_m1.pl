@@ -0,0 +1,150 @@
+#! /usr/bin/perl
+
+# Benchmark the compiler on programs made by gen_m1.pl. For every shape and
+# scale, a program is generated and compiled with "m1 --stats=json"; the
+# report shows lines/sec and peak RSS, and the time spent in each phase.
+# Since the program size grows linearly with the scale, lines/sec should
+# stay flat as the scale grows; if it drops, some part of the compiler is
+# worse than linear.
+#
+# A program that m1 fails to compile (e.g., because it runs into a fixed
+# limit, such as the parser's stack depth) is reported as failed.
+#
+# Usage: bench_m1.pl [--m1 <path>] [--runs N] [--json] [shape[:scale,...] ...]
+#        bench_m1.pl --frames [--m1 <path>] [--m0 <path>] [--assembler <path>] <file.m1> ...
+#
+# The default is all shapes, at scales 100, 1000 and 5000. With --json, the
+# results are printed as one JSON array instead of a table.
+#
+# With --frames, the given programs (such as calls.m1) are compiled with
+# "m1 --trace-frames", assembled and run, and the frames that their calls
+# allocate are counted. For a program that prints "<n> iterations", that's
+# also shown per iteration.
+
+use strict;
+use warnings;
+use File::Basename qw(basename dirname);
+use File::Temp qw(tempdir);
+use Getopt::Long;
+use JSON::PP;
+use Time::HiRes qw(time);
+
+my $dir       = dirname($0);
+my $m1        = "$dir/../../m1";
+my $runs      = 3;
+my $json      = 0;
+my $frames    = 0;
+my $m0        = "$dir/../../m0";
+my $assembler = "$dir/../../m0_assembler.pl";
+my @shapes    = qw(functions nesting exprs arrays types switch mixed);
+my @scales    = (100, 1000, 5000);
+
+GetOptions('m1=s' => \$m1, 'runs=i' => \$runs, 'json' => \$json,
+           'frames' => \$frames, 'm0=s' => \$m0, 'assembler=s' => \$assembler)
+    or die "Usage: $0 [--m1 <path>] [--runs N] [--json] [shape[:scale,...] ...]\n"
+         . "       $0 --frames [--m1 <path>] [--m0 <path>] [--assembler <path>] <file.m1> ...\n";
+
+die "$m1 does not exist; run make first\n" unless -x $m1;
+
+my $tmp = tempdir(CLEANUP => 1);
+
+if ($frames) {
+    die "$m0 does not exist\n" unless -x $m0;
+    die "$assembler does not exist\n" unless -e $assembler;
+    die "No programs given\n" unless @ARGV;
+
+    printf "%-24s %12s %12s %12s\n", qw(program frames iterations frames/iter);
+
+    for my $src (@ARGV) {
+        my $base = "$tmp/" . basename($src, '.m1');
+
+        system("$m1 --trace-frames -o $base.m0 $src 2>/dev/null") == 0
+            or die "could not compile $src\n";
+        system("$^X $assembler $base.m0 >/dev/null") == 0
+            or die "could not assemble $src\n";
+
+        my $output = `$m0 $base.m0b`;
+        die "could not run $src\n" if $? != 0;
+
+        my $count   = () = $output =~ /^frame allocated$/mg;
+        my ($iters) = $output =~ /^(\d+) iterations/m;
+
+        printf "%-24s %12d %12s %12s\n", basename($src), $count,
+               $iters // '-', $iters ? sprintf("%.2f", $count / $iters) : '-';
+    }
+    exit 0;
+}
+
+my @jobs;
+for my $arg (@ARGV ? @ARGV : @shapes) {
+    my ($shape, $list) = split /:/, $arg;
+    push @jobs, map { [$shape, $_] } ($list ? split(/,/, $list) : @scales);
+}
+
+my @results;
+
+printf "%-10s %6s %8s %10s %12s %10s   %s\n",
+       qw(shape scale lines ms lines/sec rss(kb)), "parse/check/codegen/emit (ms)"
+    unless $json;
+
+for my $job (@jobs) {
+    my ($shape, $scale) = @$job;
+    my $src = "$tmp/$shape-$scale.m1";
+
+    system("$^X $dir/gen_m1.pl $shape $scale > $src") == 0
+        or die "could not generate $shape program at scale $scale\n";
+
+    my $lines = 0;
+    open my $fh, '<', $src or die "$src: $!\n";
+    $lines++ while <$fh>;
+    close $fh;
+
+    # take the fastest of <runs> runs, to filter out noise.
+    my ($best, $stats, $failure);
+    for (1 .. $runs) {
+        my $start  = time;
+        my $report = `$m1 --stats=json -o $tmp/out.m0 $src 2>&1`;
+        my $wall   = time - $start;
+        my $status = $?;
+        my $text   = $report =~ s/^(\{.*^\})\n?//ms ? $1 : undef;
+        my $run    = defined $text ? decode_json($text) : undef;
+
+        # whatever is left of the report are m1's messages.
+        if ($status != 0 || !defined $run || $run->{errors}) {
+            ($failure) = $report =~ /^(.*(?:error|Assertion|exhausted).*)$/m;
+            $failure ||= "exit status " . ($status >> 8);
+            last;
+        }
+
+        if (!defined $best || $wall < $best) {
+            $best  = $wall;
+            $stats = $run;
+        }
+    }
+
+    if (defined $failure) {
+        push @results, { shape => $shape, scale => $scale + 0, lines => $lines, failed => $failure };
+        printf "%-10s %6d %8d   FAILED: %s\n", $shape, $scale, $lines, $failure unless $json;
+        next;
+    }
+
+    my $result = {
+        shape         => $shape,
+        scale         => $scale + 0,
+        lines         => $lines,
+        wall_ms       => sprintf("%.3f", $best * 1000) + 0,
+        lines_per_sec => int($lines / $best),
+        peak_rss_kb   => $stats->{peak_rss_kb},
+        phases        => $stats->{phases},
+        counters      => $stats->{counters},
+    };
+    push @results, $result;
+
+    next if $json;
+    printf "%-10s %6d %8d %10.1f %12d %10d   %s\n", $shape, $scale, $lines, $best * 1000,
+           $result->{lines_per_sec}, $result->{peak_rss_kb},
+           join('/', map { sprintf "%.1f", $stats->{phases}{$_}{wall_ms} } qw(parse check codegen emit));
+}
+
+print JSON::PP->new->pretty->canonical->encode(\@results) if $json;
+
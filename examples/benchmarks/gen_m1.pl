@@ -0,0 +1,187 @@
+#! /usr/bin/perl
+
+# Generate synthetic M1 programs to benchmark the compiler itself (not the
+# code it generates). Each shape stresses one part of the compiler; the size
+# of the program grows linearly with the scale.
+#
+# Usage: gen_m1.pl <shape> <scale>
+#
+#   functions   <scale> functions, each calling the previous one
+#   nesting     blocks nested <scale> levels deep
+#   exprs       expression chains of <scale> terms
+#   arrays      <scale> arrays, and loops over them
+#   types       <scale> structs and enums, and code using them
+#   switch      a switch statement with <scale> cases
+#   mixed       all of the above, at a tenth of the scale each
+
+use strict;
+use warnings;
+
+my %shapes = (
+    functions => \&gen_functions,
+    nesting   => \&gen_nesting,
+    exprs     => \&gen_exprs,
+    arrays    => \&gen_arrays,
+    types     => \&gen_types,
+    switch    => \&gen_switch,
+    mixed     => \&gen_mixed,
+);
+
+my ($shape, $scale) = @ARGV;
+
+die "Usage: $0 <" . join('|', sort keys %shapes) . "> <scale>\n"
+    unless defined $scale && exists $shapes{$shape} && $scale =~ /^\d+$/ && $scale > 0;
+
+my @main;   # statements of main(), filled by the generators.
+
+print $shapes{$shape}->($scale);
+print "void main() {\n", map({ "    $_\n" } @main), "}\n";
+
+sub gen_functions {
+    my ($n) = @_;
+    my $code = "int f0(int x) {\n    return x + 1;\n}\n\n";
+
+    for my $i (1 .. $n - 1) {
+        my $prev = $i - 1;
+        $code .= <<"END";
+int f$i(int x) {
+    int y = x * $i;
+    if (y > 1000)
+        y = y - 1000;
+    return f$prev(y) + $i;
+}
+
+END
+    }
+    push @main, "print(f" . ($n - 1) . "(1), \"\\n\");";
+    return $code;
+}
+
+sub gen_nesting {
+    my ($n) = @_;
+    my $code   = "int nest(int x) {\n";
+    my $indent = "    ";
+
+    for my $i (1 .. $n) {
+        my $kind = $i % 3;
+        if ($kind == 0) {
+            $code .= "${indent}if (x > $i) {\n";
+        }
+        elsif ($kind == 1) {
+            $code .= "${indent}while (x < $i) {\n";
+            $code .= "$indent    x = x + 1;\n";
+        }
+        else {
+            $code .= "${indent}{\n";
+        }
+        $code   .= "$indent    x = x + $i;\n";
+        $indent .= "    ";
+    }
+    for my $i (reverse 1 .. $n) {
+        substr($indent, -4) = "";
+        $code .= "$indent}\n";
+    }
+    $code .= "    return x;\n}\n\n";
+
+    push @main, "print(nest(0), \"\\n\");";
+    return $code;
+}
+
+sub gen_exprs {
+    my ($n) = @_;
+    my @ops  = ('+', '-', '*', '+');
+    my $code = "int chain(int a, int b) {\n    int r = a";
+
+    for my $i (1 .. $n) {
+        my $term = $i % 2 ? "b" : "($i + a)";
+        $code .= " $ops[$i % @ops] $term";
+        $code .= "\n        " if $i % 8 == 0;
+    }
+    $code .= ";\n";
+
+    # the same chains, with floats and comparisons.
+    $code .= "    num f = 0.5";
+    for my $i (1 .. $n) {
+        $code .= " + $i.25 * 2.0";
+        $code .= "\n        " if $i % 8 == 0;
+    }
+    $code .= ";\n";
+    $code .= "    if (f > 1.0 && r != 0 || a == b)\n        r = r + 1;\n";
+    $code .= "    return r;\n}\n\n";
+
+    push @main, "print(chain(1, 2), \"\\n\");";
+    return $code;
+}
+
+sub gen_arrays {
+    my ($n) = @_;
+    my $code = "";
+
+    for my $i (0 .. $n - 1) {
+        my $size = 10 + $i % 90;
+        $code .= <<"END";
+int arr$i() {
+    int a[$size];
+    int b[10][$size];
+    int i;
+    int sum = 0;
+    for (i = 0; i < $size; i++) {
+        a[i] = i * $i;
+        b[i % 10][i] = a[i];
+    }
+    for (i = 0; i < $size; i++)
+        sum = sum + a[i] + b[i % 10][i];
+    return sum;
+}
+
+END
+        push @main, "print(arr$i(), \"\\n\");";
+    }
+    return $code;
+}
+
+sub gen_types {
+    my ($n) = @_;
+    my $code = "";
+
+    for my $i (0 .. $n - 1) {
+        my $prev = $i - 1;
+        $code .= "enum color$i {\n    red$i, green$i = " . ($i + 10) . ", blue$i\n}\n\n";
+        $code .= "struct point$i {\n    int x;\n    int y;\n    num w;\n";
+        $code .= "    point$prev link;\n" if $i > 0;
+        $code .= "}\n\n";
+        $code .= <<"END";
+int use$i() {
+    point$i p = new point$i();
+    p.x = green$i;
+    p.y = blue$i + red$i;
+    return p.x + p.y;
+}
+
+END
+        push @main, "print(use$i(), \"\\n\");";
+    }
+    return $code;
+}
+
+sub gen_switch {
+    my ($n) = @_;
+    my $code = "int sw(int x) {\n    int r = 0;\n    switch (x) {\n";
+
+    for my $i (0 .. $n - 1) {
+        my $value = $i * 3;
+        $code .= "        case $value:\n            r = x + $i;\n            break;\n";
+    }
+    $code .= "        default:\n            r = -1;\n            break;\n    }\n    return r;\n}\n\n";
+
+    push @main, "print(sw(" . (3 * int($n / 2)) . "), \"\\n\");";
+    return $code;
+}
+
+sub gen_mixed {
+    my ($n) = @_;
+    my $part = int($n / 10) || 1;
+
+    return join "", map { $shapes{$_}->($part) } qw(functions nesting exprs arrays types switch);
+}
+
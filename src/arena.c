@@ -0,0 +1,93 @@
+/*
+
+Arena allocator. All memory returned by arena_alloc() is zeroed, 
+like calloc(), and is released in one go by arena_release().
+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "arena.h"
+
+#define ARENA_BLOCKSIZE     (64 * 1024)
+
+/* all objects are aligned on this boundary. */
+#define ARENA_ALIGN         sizeof (double)
+
+m1_arena *
+new_arena(void) {
+    m1_arena *arena = (m1_arena *)calloc(1, sizeof (m1_arena));
+    
+    if (arena == NULL) {
+        fprintf(stderr, "cant alloc mem for arena");
+        exit(EXIT_FAILURE);   
+    }
+    return arena;
+}
+
+/* Add a block that has room for at least C<size> bytes to C<arena>. */
+static void
+new_block(m1_arena *arena, size_t size) {
+    m1_arenablock *block;
+    
+    if (size < ARENA_BLOCKSIZE)
+        size = ARENA_BLOCKSIZE;
+        
+    block = (m1_arenablock *)malloc(sizeof (m1_arenablock) + size);
+    
+    if (block == NULL) {
+        fprintf(stderr, "cant alloc mem for arena block");
+        exit(EXIT_FAILURE);   
+    }
+    
+    block->size       = size;
+    block->used       = 0;
+    block->prev       = arena->blocks;
+    arena->blocks     = block;
+    arena->allocated += size;
+}
+
+void *
+arena_alloc(m1_arena *arena, size_t size) {
+    m1_arenablock *block;
+    void          *mem;
+    
+    assert(arena != NULL);
+    
+    /* round up, so that the next object is aligned too. */
+    size  = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    block = arena->blocks;
+    
+    if (block == NULL || block->size - block->used < size) {
+        new_block(arena, size);
+        block = arena->blocks;
+    }
+        
+    mem          = block->data + block->used;
+    block->used += size;
+    
+    memset(mem, 0, size);
+    return mem;
+}
+
+/* Release all memory in C<arena>; the arena itself can be used again. */
+void
+arena_release(m1_arena *arena) {
+    m1_arenablock *block = arena->blocks;
+    
+    while (block != NULL) {
+        m1_arenablock *prev = block->prev;
+        free(block);
+        block = prev;   
+    }
+    arena->blocks    = NULL;
+    arena->allocated = 0;
+}
+
+void
+delete_arena(m1_arena *arena) {
+    arena_release(arena);
+    free(arena);   
+}
+
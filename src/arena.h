@@ -0,0 +1,37 @@
+#ifndef __M1_ARENA_H__
+#define __M1_ARENA_H__
+
+#include <stddef.h>
+
+/*
+
+An arena (or region) hands out memory by bumping a pointer in a large 
+block; when a block is full, a new one is allocated. Individual objects
+are never freed; instead, all memory in an arena is released at once 
+when the objects' lifetime ends (e.g., all instructions of a chunk after
+the chunk was written).
+
+*/
+typedef struct m1_arenablock {
+    struct m1_arenablock *prev;     /* previously filled block. */
+    size_t                size;     /* number of bytes in data. */
+    size_t                used;     /* number of bytes handed out. */
+    char                  data[];   
+} m1_arenablock;
+
+typedef struct m1_arena {
+    m1_arenablock *blocks;          /* block currently being filled; links to older ones. */
+    size_t         allocated;       /* total bytes in blocks, for statistics. */
+} m1_arena;
+
+
+extern m1_arena *new_arena(void);
+
+extern void *arena_alloc(m1_arena *arena, size_t size);
+
+extern void arena_release(m1_arena *arena);
+
+extern void delete_arena(m1_arena *arena);
+
+#endif
+
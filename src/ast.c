@@ -12,6 +12,8 @@ AST node constructors
 #include "ast.h"
 #include "symtab.h"
 #include "compiler.h"
+#include "intern.h"
+#include "arena.h"
 
 
 #include "ann.h"
@@ -22,14 +24,10 @@ static void expr_set_expr(m1_expression *node, m1_expression *expr);
 static void expr_set_obj(m1_expression *node, m1_object *obj);
 
 
+/* All AST nodes live in the AST arena, and are released together when compilation is done. */
 static void *
-m1_malloc(size_t size) {
-    void *mem = calloc(1, size);
-    if (mem == NULL) {
-        fprintf(stderr, "Failed to allocate mem!\n");
-        exit(EXIT_FAILURE);
-    }
-    return mem;   
+m1_malloc(M1_compiler *comp, size_t size) {
+    return arena_alloc(comp->ast_arena, size);
 }
 
 
@@ -37,7 +35,7 @@ m1_malloc(size_t size) {
 m1_chunk *
 chunk( ARGIN_NOTNULL( M1_compiler * const comp ), ARGIN( char *rettype ), ARGIN_NOTNULL( char *name ), int flags) 
 {
-    m1_chunk *c = (m1_chunk *)m1_malloc(sizeof(m1_chunk));
+    m1_chunk *c = (m1_chunk *)m1_malloc(comp, sizeof(m1_chunk));
     c->rettype  = rettype;
     c->name     = name;
     c->block    = NULL;
@@ -46,10 +44,8 @@ chunk( ARGIN_NOTNULL( M1_compiler * const comp ), ARGIN( char *rettype ), ARGIN_
     
     assert(comp != NULL);
     
-    /* reset comp->constindex to 0 for each chunk. For each chunk, start
-       indexing its constants segment at 0.
-     */
-    comp->constindex = 0;
+    /* each chunk has its own constants segment, indexed from 0. */
+    init_constpool(&c->constants);
     
     return c;   
 }
@@ -67,7 +63,7 @@ expression(M1_compiler *comp, m1_expr_type type) {
     assert(comp != NULL);
     assert(comp->yyscanner != NULL);
     
-    expr        = (m1_expression *)m1_malloc(sizeof(m1_expression));
+    expr        = (m1_expression *)m1_malloc(comp, sizeof(m1_expression));
     expr->type  = type;
     /* set the current line number for error reporting. */
     expr->line  = yyget_lineno(comp->yyscanner);
@@ -76,8 +72,8 @@ expression(M1_compiler *comp, m1_expr_type type) {
 
 
 static m1_literal *
-new_literal(m1_valuetype type) {
-    m1_literal *l = (m1_literal *)m1_malloc(sizeof(m1_literal));
+new_literal(M1_compiler *comp, m1_valuetype type) {
+    m1_literal *l = (m1_literal *)m1_malloc(comp, sizeof(m1_literal));
     l->type       = type;
     return l;    
 }
@@ -86,7 +82,7 @@ new_literal(m1_valuetype type) {
 m1_expression *
 character(M1_compiler *comp, char ch) {
     m1_expression *expr                 = expression(comp, EXPR_CHAR);
-    expr->expr.as_literal               = new_literal(VAL_INT);
+    expr->expr.as_literal               = new_literal(comp, VAL_INT);
     expr->expr.as_literal->value.as_int = (int)ch;
     expr->expr.as_literal->sym          = sym_enter_int(comp, &comp->currentchunk->constants, (int)ch);
     return expr;    
@@ -97,7 +93,7 @@ number(M1_compiler *comp, double value) {
 	m1_expression *expr = expression(comp, EXPR_NUMBER);
 	
 	/* make a new literal node */
-	expr->expr.as_literal = new_literal(VAL_FLOAT);
+	expr->expr.as_literal = new_literal(comp, VAL_FLOAT);
     expr->expr.as_literal->value.as_double = value;
     /* store the constant in the constants segment. */
     expr->expr.as_literal->sym = sym_enter_num(comp, &comp->currentchunk->constants, value);   
@@ -109,7 +105,7 @@ m1_expression *
 integer(M1_compiler *comp, int value) {
 	m1_expression *expr = expression(comp, EXPR_INT);
     /* make a new literal node. */
-	expr->expr.as_literal               = new_literal(VAL_INT);
+	expr->expr.as_literal               = new_literal(comp, VAL_INT);
     expr->expr.as_literal->value.as_int = value;
     
     /* if value can't be loaded with set_imm, store it in consts segment. */
@@ -124,7 +120,7 @@ string(M1_compiler *comp, char *str) {
 	m1_expression *expr = expression(comp, EXPR_STRING);
 	assert(str != NULL);
 
-    expr->expr.as_literal = new_literal(VAL_STRING);
+    expr->expr.as_literal = new_literal(comp, VAL_STRING);
     expr->expr.as_literal->value.as_string = str;
     
     assert(comp != NULL);
@@ -173,7 +169,7 @@ unaryexpr(M1_compiler *comp, m1_unop op, m1_expression *e) {
 m1_expression *
 binexpr(M1_compiler *comp, m1_expression *e1, int op, m1_expression *e2) {
 	m1_expression *expr   = expression(comp, EXPR_BINARY);
-    m1_binexpr    *b      = (m1_binexpr *)m1_malloc(sizeof(m1_binexpr));
+    m1_binexpr    *b      = (m1_binexpr *)m1_malloc(comp, sizeof(m1_binexpr));
     b->op                 = (m1_binop)op;
     b->left               = e1;
     b->right              = e2;       
@@ -190,7 +186,7 @@ printexpr(M1_compiler *comp, m1_expression *e) {
 
 static m1_unexpr *
 unexpr(M1_compiler *comp, m1_expression *node, m1_unop op) {
-    m1_unexpr *e = (m1_unexpr *)m1_malloc(sizeof(m1_unexpr));
+    m1_unexpr *e = (m1_unexpr *)m1_malloc(comp, sizeof(m1_unexpr));
     e->expr      = node;
     e->op        = op;    
     
@@ -213,7 +209,7 @@ expr_set_unexpr(M1_compiler *comp, m1_expression *node, m1_expression *exp, m1_u
 m1_expression *
 funcall(M1_compiler *comp, m1_object *fun, m1_expression *args) {
 	m1_expression *expr   = expression(comp, EXPR_FUNCALL);
-	expr->expr.as_funcall = (m1_funcall *)m1_malloc(sizeof(m1_funcall));
+	expr->expr.as_funcall = (m1_funcall *)m1_malloc(comp, sizeof(m1_funcall));
 	
     /* XXX need to handle method calls. */	
     expr->expr.as_funcall->name       = fun->obj.as_name;
@@ -231,11 +227,16 @@ funcall(M1_compiler *comp, m1_object *fun, m1_expression *args) {
 
 
 static m1_const *
-const_decl(char *type, char *name, m1_expression *expr) {
-    m1_const *c = (m1_const *)m1_malloc(sizeof(m1_const));
+const_decl(M1_compiler *comp, char *type, char *name, m1_expression *expr) {
+    m1_const *c = (m1_const *)m1_malloc(comp, sizeof(m1_const));
     c->type     = type;
     c->name     = name;
     c->value    = expr;
+    
+    /* enter the constant into the symbol table, so that its uses can be found;
+       they are replaced by its value before code is generated (see fold.c). */
+    c->sym      = sym_new_symbol(comp, comp->currentsymtab, name, type, 1);
+    c->sym->constdecl = c;
     return c;    
 }
 
@@ -244,15 +245,15 @@ const_decl(char *type, char *name, m1_expression *expr) {
 m1_expression *
 constdecl(M1_compiler *comp, char *type, char *name, m1_expression *e) {
 	m1_expression *expr = expression(comp, EXPR_CONSTDECL);
-	expr->expr.as_const = const_decl(type, name, e);
+	expr->expr.as_const = const_decl(comp, type, name, e);
 	return expr;	
 }
 
 static void 
-expr_set_for(m1_expression *node, m1_expression *init, m1_expression *cond, m1_expression *step,
+expr_set_for(M1_compiler *comp, m1_expression *node, m1_expression *init, m1_expression *cond, m1_expression *step,
              m1_expression *stat) 
 {
-    node->expr.as_forexpr = (m1_forexpr *)m1_malloc(sizeof(m1_forexpr));
+    node->expr.as_forexpr = (m1_forexpr *)m1_malloc(comp, sizeof(m1_forexpr));
     
     node->expr.as_forexpr->init  = init;
     node->expr.as_forexpr->cond  = cond;
@@ -263,7 +264,7 @@ expr_set_for(m1_expression *node, m1_expression *init, m1_expression *cond, m1_e
 m1_expression *
 forexpr(M1_compiler *comp, m1_expression *init, m1_expression *cond, m1_expression *step, m1_expression *stat) {
 	m1_expression *expr = expression(comp, EXPR_FOR);
-	expr_set_for(expr, init, cond, step, stat);	
+	expr_set_for(comp, expr, init, cond, step, stat);	
 	return expr;
 }
 
@@ -284,7 +285,7 @@ assignexpr(M1_compiler *comp, m1_expression *lhs, int assignop, m1_expression *r
 	a = b  => normal case
 	a += b => a = a + b
 	*/
-    node->expr.as_assign      = (m1_assignment *)m1_malloc(sizeof(m1_assignment));
+    node->expr.as_assign      = (m1_assignment *)m1_malloc(comp, sizeof(m1_assignment));
     node->expr.as_assign->lhs = lhs->expr.as_object; /* unwrap the m1_object representing lhs from its m1_expression wrapper. */
     
     switch (assignop) {
@@ -320,7 +321,7 @@ returnexpr(M1_compiler *comp, m1_expression *retexp) {
 static void 
 expr_set_while(M1_compiler *comp, m1_expression *node, m1_expression *cond, m1_expression *block) {
     assert(comp != NULL);
-    node->expr.as_whileexpr        = (m1_whileexpr *)m1_malloc(sizeof(m1_whileexpr));    
+    node->expr.as_whileexpr        = (m1_whileexpr *)m1_malloc(comp, sizeof(m1_whileexpr));    
     node->expr.as_whileexpr->cond  = cond;
     node->expr.as_whileexpr->block = block;                            
 }   
@@ -330,7 +331,7 @@ expr_set_if(M1_compiler *comp, m1_expression *node, m1_expression *cond,
             m1_expression *ifblock, m1_expression *elseblock) 
 {
     assert(comp != NULL);
-    node->expr.as_ifexpr = (m1_ifexpr *)m1_malloc(sizeof(m1_ifexpr));              
+    node->expr.as_ifexpr = (m1_ifexpr *)m1_malloc(comp, sizeof(m1_ifexpr));              
     node->expr.as_ifexpr->cond      = cond;
     node->expr.as_ifexpr->ifblock   = ifblock;
     node->expr.as_ifexpr->elseblock = elseblock;
@@ -358,7 +359,7 @@ obj_set_ident(m1_object *node, char *ident) {
 
 m1_object *
 object(M1_compiler *comp, m1_object_type type) {
-    m1_object *obj = (m1_object *)m1_malloc(sizeof(m1_object));
+    m1_object *obj = (m1_object *)m1_malloc(comp, sizeof(m1_object));
     obj->type      = type;
     obj->line      = yyget_lineno(comp->yyscanner);    
     assert(comp != NULL);
@@ -367,7 +368,7 @@ object(M1_compiler *comp, m1_object_type type) {
 
 m1_object *
 lhsobj(M1_compiler *comp, m1_object *parent, m1_object *child) {
-    m1_object *lhsobj    = (m1_object *)m1_malloc(sizeof(m1_object));
+    m1_object *lhsobj    = (m1_object *)m1_malloc(comp, sizeof(m1_object));
     lhsobj->type         = OBJECT_LINK;
     
     lhsobj->obj.as_link = child;
@@ -380,7 +381,7 @@ lhsobj(M1_compiler *comp, m1_object *parent, m1_object *child) {
 m1_struct *
 newstruct(M1_compiler *comp, char *name, m1_ident *idlist) 
 {
-    m1_struct *str    = (m1_struct *)m1_malloc(sizeof(m1_struct));    
+    m1_struct *str    = (m1_struct *)m1_malloc(comp, sizeof(m1_struct));    
     str->name         = name;
     str->line_defined = yyget_lineno(comp->yyscanner);    
     
@@ -393,7 +394,7 @@ newstruct(M1_compiler *comp, char *name, m1_ident *idlist)
 
 m1_enum *
 newenum(M1_compiler *comp, char *name, m1_enumconst *enumconstants) {
-    m1_enum *en  = (m1_enum *)m1_malloc(sizeof(m1_enum));
+    m1_enum *en  = (m1_enum *)m1_malloc(comp, sizeof(m1_enum));
     en->enumname = name;
     en->enums    = enumconstants;
     
@@ -423,7 +424,7 @@ symbol entry; the symbol entry gets a pointer to this AST node.
 */
 m1_var *
 make_var(M1_compiler *comp, char *varname, m1_expression *init, unsigned num_elems) {
-    m1_var *v    = (m1_var *)m1_malloc(sizeof(m1_var));
+    m1_var *v    = (m1_var *)m1_malloc(comp, sizeof(m1_var));
     v->name      = varname;
     v->type      = comp->parsingtype;
     v->init      = init;
@@ -462,7 +463,7 @@ Parameters are also represented by m1_var nodes.
 */
 m1_var *
 parameter(M1_compiler *comp, char *paramtype, char *paramname) {
-    m1_var *p = (m1_var *)m1_malloc(sizeof(m1_var));
+    m1_var *p = (m1_var *)m1_malloc(comp, sizeof(m1_var));
     p->type   = paramtype;   	                        
     p->name   = paramname;
     /* cannot enter into a symbol table, as there is not yet an active symbol table. 
@@ -528,8 +529,8 @@ dowhileexpr(M1_compiler *comp, m1_expression *cond, m1_expression *block) {
 
 
 static void
-expr_set_switch(m1_expression *node, m1_expression *selector, m1_case *cases, m1_expression *defaultstat) {
-	node->expr.as_switch = (m1_switch *)m1_malloc(sizeof(m1_switch));
+expr_set_switch(M1_compiler *comp, m1_expression *node, m1_expression *selector, m1_case *cases, m1_expression *defaultstat) {
+	node->expr.as_switch = (m1_switch *)m1_malloc(comp, sizeof(m1_switch));
 	node->expr.as_switch->selector    = selector; 
 	node->expr.as_switch->cases       = cases;
 	node->expr.as_switch->defaultstat = defaultstat;
@@ -539,13 +540,13 @@ expr_set_switch(m1_expression *node, m1_expression *selector, m1_case *cases, m1
 m1_expression *
 switchexpr(M1_compiler *comp, m1_expression *selector, m1_case *cases, m1_expression *defaultstat) {
 	m1_expression *node = expression(comp, EXPR_SWITCH);
-	expr_set_switch(node, selector, cases, defaultstat); 
+	expr_set_switch(comp, node, selector, cases, defaultstat); 
 	return node;
 }
 
 m1_case *
 switchcase(M1_compiler *comp, int selector, m1_expression *block) {
-	m1_case *c  = (m1_case *)m1_malloc(sizeof(m1_case));
+	m1_case *c  = (m1_case *)m1_malloc(comp, sizeof(m1_case));
 	c->selector = selector;
 	c->block    = block;
 	c->next     = NULL;
@@ -558,7 +559,7 @@ switchcase(M1_compiler *comp, int selector, m1_expression *block) {
 m1_expression *
 newexpr(M1_compiler *comp, char *type, m1_expression *args) {
 	m1_expression *expr         = expression(comp, EXPR_NEW);
-	expr->expr.as_newexpr       = (m1_newexpr *)m1_malloc(sizeof(m1_newexpr));
+	expr->expr.as_newexpr       = (m1_newexpr *)m1_malloc(comp, sizeof(m1_newexpr));
 	expr->expr.as_newexpr->type = type;
 	expr->expr.as_newexpr->args = args;
 	return expr;	
@@ -567,7 +568,7 @@ newexpr(M1_compiler *comp, char *type, m1_expression *args) {
 m1_expression *
 castexpr(M1_compiler *comp, char *type, m1_expression *castedexpr) {
     m1_expression *expr = expression(comp, EXPR_CAST);
-    m1_castexpr *cast   = (m1_castexpr *)m1_malloc(sizeof(m1_castexpr));
+    m1_castexpr *cast   = (m1_castexpr *)m1_malloc(comp, sizeof(m1_castexpr));
     cast->type          = type;
     cast->expr          = castedexpr;
     expr->expr.as_cast  = cast;
@@ -576,7 +577,7 @@ castexpr(M1_compiler *comp, char *type, m1_expression *castedexpr) {
 
 m1_enumconst *
 enumconst(M1_compiler *comp, char *enumitem, int enumvalue) {
-    m1_enumconst *ec = (m1_enumconst *)m1_malloc(sizeof(m1_enumconst));
+    m1_enumconst *ec = (m1_enumconst *)m1_malloc(comp, sizeof(m1_enumconst));
     ec->name         = enumitem;
     ec->value        = enumvalue;
     ec->next         = NULL;
@@ -591,7 +592,7 @@ block( ARGIN_NOTNULL( M1_compiler *comp ) )
 {
     m1_block *block;
     assert(comp != NULL);
-    block = (m1_block *)m1_malloc(sizeof(m1_block)); 
+    block = (m1_block *)m1_malloc(comp, sizeof(m1_block)); 
     /* initialize this block's symbol table. */
     init_symtab(&block->locals);
     return block;   
@@ -628,16 +629,16 @@ close_scope(M1_compiler *comp) {
 }
 
 m1_dimension *
-array_dimension(int num_elems) {
-    m1_dimension *d = (m1_dimension *)m1_malloc(sizeof(m1_dimension));
+array_dimension(M1_compiler *comp, int num_elems) {
+    m1_dimension *d = (m1_dimension *)m1_malloc(comp, sizeof(m1_dimension));
     d->num_elems    = num_elems;
     d->next         = NULL;
     return d;    
 }
 
 m1_ident *
-identlist(m1_ident *next, char *newnode) {
-    m1_ident *id = (m1_ident *)m1_malloc(sizeof(m1_ident));
+identlist(M1_compiler *comp, m1_ident *next, char *newnode) {
+    m1_ident *id = (m1_ident *)m1_malloc(comp, sizeof(m1_ident));
     id->next     = next;
     id->name     = newnode;
     return id;   
@@ -651,7 +652,7 @@ add_chunk_parameters(M1_compiler *comp, m1_chunk *chunk, m1_var *paramlist, int
     
     if (flags & CHUNK_ISMETHOD) {
         /* add "self" parameter manually */
-        enter_param(comp, parameter(comp, "type", "self"));
+        enter_param(comp, parameter(comp, intern(comp, "type"), intern(comp, "self")));
     }
     
     /* add parameters here. */    
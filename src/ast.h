@@ -51,7 +51,14 @@ typedef struct m1_chunk {
     int                   flags;
     
     unsigned              line;         /* line of function declaration. */    
-    struct m1_symboltable constants;    /* constants used in this chunk */
+    struct m1_constpool   constants;    /* constants used in this chunk */
+    
+    /* set by the code generator. */
+    unsigned              numregs[REG_TYPE_NUM]; /* highest register of each type in the code, plus 1. */
+    unsigned              framesize;    /* registers in a frame for this chunk, including the special ones. */
+    unsigned              callframe;    /* registers that call sequences use in a callee's frame. */
+    struct m1_symbol     *calleesize;   /* constant holding the size in bytes of the frame for callees. */
+    size_t                calleesizepos; /* offset of calleesize's value in the output. */
         
 } m1_chunk;
 
@@ -255,6 +262,7 @@ typedef struct m1_const {
     char                 *type;
     char                 *name;
     struct m1_expression *value;
+    struct m1_symbol     *sym;       /* pointer to symbol in symboltable */
 } m1_const;
 
 
@@ -404,9 +412,9 @@ extern void block_set_stat(m1_block *block, m1_expression *stat);
 extern struct m1_block *open_scope(M1_compiler *comp);
 extern void close_scope(M1_compiler *comp);
 
-extern m1_dimension *array_dimension(int ival);
+extern m1_dimension *array_dimension(M1_compiler *comp, int ival);
 
-extern m1_ident *identlist(m1_ident *next, char *newnode);
+extern m1_ident *identlist(M1_compiler *comp, m1_ident *next, char *newnode);
 
 extern void add_chunk_parameters(M1_compiler *comp, m1_chunk *chunk, m1_var *paramlist, int flags);
 
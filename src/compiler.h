@@ -26,7 +26,6 @@ typedef struct M1_compiler {
 	unsigned int           warnings;
 	
 	struct m1_chunk       *ast;	    /* root of the AST */
-	unsigned int           constindex; /* constant table index counter */
 	unsigned int           label;      /* label generator */
 	unsigned int  	       regs[NUM_TYPES]; /* for the register allocator */
 	                       
@@ -37,6 +36,8 @@ typedef struct M1_compiler {
 	
     struct m1_chunk       *currentchunk; /* current chunk being parsed, if any. */
 	struct m1_type        *declarations;  /* list of declarations (eg structs) */
+	struct m1_declindex   *typeindex;     /* declarations, indexed by name. */
+	struct m1_declindex   *enumconstindex; /* constants of all enums, indexed by name. */
 
 	struct m1_regstack    *regstack; /* for storing registers in code generator */		
 	yyscan_t               yyscanner; /* pointer to the lexer structure */
@@ -45,15 +46,28 @@ typedef struct M1_compiler {
 	
 	struct m1_symboltable *globalsymtab; /* to store function names */
 	
+	struct m1_interntable *atoms; /* interned names; see intern.c */
+	
+	/* memory arenas, one per lifetime; see arena.c */
+	struct m1_arena       *ast_arena;   /* AST nodes. */
+	struct m1_arena       *sym_arena;   /* symbols, symbol tables and interned names. */
+	struct m1_arena       *type_arena;  /* type declarations. */
+	struct m1_arena       *instr_arena; /* instructions of the chunk being generated. */
+	
 	unsigned int           enum_const_counter; /* for parsing enums that don't specify values. */
 	
-	char                   registers[REG_TYPE_NUM][REG_NUM]; /* register allocation system. */
+	char                   registers[REG_TYPE_NUM][REG_NUM]; /* register allocation system, with -r. */
+	unsigned int           vregs[REG_TYPE_NUM]; /* number of virtual registers per type in current chunk. */
 	
 	int                    no_reg_opt; /* command-line option to turn off register allocator. */
+	int                    emit_m0b;   /* command-line option to write binary .m0b instead of .m0 */
+	unsigned int           unroll_budget; /* command-line option: size of unrolled loops; 0 for none. */
+	int                    trace_frames; /* command-line option: print a line for each frame that a call allocates. */
+	
+	struct m1_stats       *stats; /* counters and timings for --stats; see stats.c */
 	
 	/* code generator fields. */
-	FILE                  *outfile;
-	struct m0_instr       *lastgenerated;
+	struct m1_emitter     *emitter; /* buffered output; see emit.c */
 	struct m0_chunk       *current_m0chunk;
 	
 } M1_compiler;
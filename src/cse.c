@@ -0,0 +1,474 @@
+/*
+
+Common subexpression elimination, by value numbering over the dominator
+tree (Briggs, Cooper and Simpson, 1997). This runs on a chunk's code after
+it's generated, before dead code elimination and register allocation.
+
+Each value that an instruction computes gets a number; two instructions with
+the same opcode and operands whose values have the same numbers compute the
+same value. When an instruction computes a value that a register still holds,
+it's replaced by a copy of that register, and later uses of the instruction's
+result read that register directly. The copies are then usually dead, and
+removed by dead code elimination. This catches repeated index and field
+address computations, and repeated loads of constants.
+
+Blocks are visited in a walk of the dominator tree, and what's known at the
+end of a block is also known in the blocks that it dominates, except for
+what registers hold. The code isn't in SSA form: only registers that are set
+by a single instruction keep their value number in the blocks that its block
+dominates. Other registers, including all physical ones, start with unknown
+values in each block.
+
+Loads from memory may only be reused within a block, and not after anything
+is stored; loads from the constants segment can always be reused. Call
+sequences are left alone, and so is code that reads PC.
+
+All memory is taken from the instruction arena, which is released once the
+chunk is done.
+
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "cse.h"
+#include "compiler.h"
+#include "instr.h"
+#include "gencode.h"
+#include "arena.h"
+#include "stats.h"
+#include "flow.h"
+
+#define NONE            (~0u)
+
+#define CSE_BUCKETS     1024
+
+/* Is <op> special register <alias>? */
+#define IS_ALIAS(op, alias)     ((op).type == VAL_INTERP_REG && (op).value == (alias))
+
+/* The value computed by an expression. */
+typedef struct cse_entry {
+    unsigned char  opcode;
+    unsigned char  type;        /* type of the result. */
+    m0_operand     operands[2]; /* registers are replaced by their value numbers. */
+    unsigned       epoch;       /* for loads; 0 for values that don't depend on memory. */
+
+    unsigned       vn;
+    unsigned       next;        /* next entry in the same bucket. */
+
+} cse_entry;
+
+typedef struct cse_state {
+    M1_compiler   *comp;
+    m0_chunk      *chunk;
+
+    flow_graph    *graph;
+
+    unsigned      *num_defs;                /* per id: instructions that set it (up to 2). */
+    unsigned      *def_block;               /* per id: block of its only definition. */
+    unsigned      *single_vn;               /* per id: value number, if it's set only once. */
+    unsigned      *reg_vn;                  /* per id: value number within block <reg_stamp>. */
+    unsigned      *reg_stamp;
+
+    unsigned      *holder;                  /* value number => register that was given it. */
+    unsigned       num_vns, max_vns;
+
+    cse_entry     *entries;                 /* entries, in the order they were made. */
+    unsigned       num_entries, max_entries;
+    unsigned       buckets[CSE_BUCKETS];
+
+    unsigned       current;                 /* block that is being numbered. */
+    unsigned       epoch;                   /* changes whenever memory may have changed. */
+
+} cse_state;
+
+static void *
+cse_alloc(cse_state *c, size_t size) {
+    void *mem = arena_alloc(c->comp->instr_arena, size);
+    memset(mem, 0, size);
+    return mem;
+}
+
+/* Grow <array> of <*max> elements of <size> bytes, that holds <num> elements. */
+static void *
+grow(cse_state *c, void *array, unsigned num, unsigned *max, size_t size) {
+    void *newarray;
+
+    *max     = *max == 0 ? 256 : *max * 2;
+    newarray = cse_alloc(c, *max * size);
+
+    if (array != NULL)
+        memcpy(newarray, array, num * size);
+
+    return newarray;
+}
+
+static m0_operand
+reg_operand(cse_state *c, unsigned id) {
+    m0_operand  op;
+    unsigned    t;
+
+    if (id < REG_TYPE_NUM * REG_NUM) {
+        op.type  = id / REG_NUM;
+        op.value = id % REG_NUM;
+        return op;
+    }
+    for (t = REG_TYPE_NUM - 1; c->graph->vbase[t] > id; t--)
+        ;
+    op.type  = t;
+    op.value = id - c->graph->vbase[t] + REG_NUM;
+    return op;
+}
+
+/* Does the instruction compute a value from its operands only, or from memory? */
+static int
+is_expression(m0_instr const *ins) {
+    switch (ins->opcode) {
+        case M0_ADD_I: case M0_ADD_N: case M0_SUB_I: case M0_SUB_N:
+        case M0_MULT_I: case M0_MULT_N: case M0_DIV_I: case M0_DIV_N:
+        case M0_MOD_I: case M0_MOD_N:
+        case M0_ISGT_I: case M0_ISGT_N: case M0_ISGE_I: case M0_ISGE_N:
+        case M0_CONVERT_N_I: case M0_CONVERT_I_N:
+        case M0_ASHR: case M0_LSHR: case M0_SHL:
+        case M0_AND: case M0_OR: case M0_XOR:
+        case M0_SET_IMM:
+        case M0_DEREF: case M0_GET_BYTE: case M0_GET_WORD:
+            return IS_REG_OPERAND(ins->operands[0]);
+        default:
+            return 0;
+    }
+}
+
+static int
+is_commutative(m0_opcode op) {
+    return op == M0_ADD_I || op == M0_ADD_N || op == M0_MULT_I || op == M0_MULT_N
+        || op == M0_AND   || op == M0_OR    || op == M0_XOR;
+}
+
+/* Can the instruction change memory? Allocation counts, as new memory must not be shared. */
+static int
+is_store(m0_instr const *ins) {
+    switch (ins->opcode) {
+        case M0_SET_REF: case M0_SET_BYTE: case M0_SET_WORD: case M0_COPY_MEM:
+        case M0_GC_ALLOC: case M0_SYS_ALLOC: case M0_SYS_FREE:
+        case M0_CSYM: case M0_CCALL_ARG: case M0_CCALL_RET: case M0_CCALL:
+        case M0_GOTO_CHUNK:
+            return 1;
+        default:
+            return ins->numops > 0 && ins->operands[0].type == VAL_INTERP_REG;
+    }
+}
+
+/* Count how often each register is set, in the chunk's own frame. */
+static void
+count_definitions(cse_state *c) {
+    m0_chunk *chunk = c->chunk;
+    unsigned  i, k;
+
+    c->num_defs  = (unsigned *)cse_alloc(c, c->graph->num_ids * sizeof (unsigned));
+    c->def_block = (unsigned *)cse_alloc(c, c->graph->num_ids * sizeof (unsigned));
+    c->single_vn = (unsigned *)cse_alloc(c, c->graph->num_ids * sizeof (unsigned));
+    c->reg_vn    = (unsigned *)cse_alloc(c, c->graph->num_ids * sizeof (unsigned));
+    c->reg_stamp = (unsigned *)cse_alloc(c, c->graph->num_ids * sizeof (unsigned));
+
+    for (i = 0; i < c->graph->num_ids; i++) {
+        c->single_vn[i] = NONE;
+        c->reg_stamp[i] = NONE;
+    }
+
+    for (i = 0; i < chunk->num_instr; i++) {
+        if (c->graph->foreign[i])
+            continue;
+
+        for (k = 0; k < 3; k++) {
+            if (has_access(c->chunk, i, k, OPERAND_DEF)) {
+                unsigned id = reg_id(c->graph, &chunk->instructions[i].operands[k]);
+
+                if (c->num_defs[id] < 2)
+                    c->num_defs[id]++;
+                c->def_block[id] = c->graph->block_of[i];
+            }
+        }
+    }
+}
+
+static unsigned
+new_vn(cse_state *c, unsigned holder) {
+    if (c->num_vns == c->max_vns)
+        c->holder = (unsigned *)grow(c, c->holder, c->num_vns, &c->max_vns, sizeof (unsigned));
+
+    c->holder[c->num_vns] = holder;
+    return c->num_vns++;
+}
+
+/* Register <id> gets value number <vn>. */
+static void
+set_vn(cse_state *c, unsigned id, unsigned vn) {
+    c->reg_vn[id]    = vn;
+    c->reg_stamp[id] = c->current;
+
+    /* a register that's set once holds that value wherever its definition dominates. */
+    if (id >= REG_TYPE_NUM * REG_NUM && c->num_defs[id] == 1)
+        c->single_vn[id] = vn;
+}
+
+/* Get the value number of what register <id> holds here, or NONE if it's not known. */
+static unsigned
+known_vn(cse_state *c, unsigned id) {
+    if (c->reg_stamp[id] == c->current)
+        return c->reg_vn[id];
+
+    if (c->single_vn[id] != NONE && dominates(c->graph, c->def_block[id], c->current))
+        return c->single_vn[id];
+
+    return NONE;
+}
+
+/* Get the value number of register <id>; an unknown value gets a new one. */
+static unsigned
+get_vn(cse_state *c, unsigned id) {
+    unsigned vn = known_vn(c, id);
+
+    if (vn == NONE) {
+        vn               = new_vn(c, id);
+        c->reg_vn[id]    = vn;
+        c->reg_stamp[id] = c->current;
+    }
+    return vn;
+}
+
+/* Get a register that still holds value <vn>, or NONE. */
+static unsigned
+find_holder(cse_state *c, unsigned vn) {
+    unsigned id = c->holder[vn];
+
+    return id != NONE && known_vn(c, id) == vn ? id : NONE;
+}
+
+static unsigned
+hash_entry(cse_entry const *e) {
+    unsigned h = e->opcode * 31 + e->type;
+
+    h = h * 131 + e->operands[0].type * 65599 + e->operands[0].value;
+    h = h * 131 + e->operands[1].type * 65599 + e->operands[1].value;
+    h = h * 131 + e->epoch;
+    return h % CSE_BUCKETS;
+}
+
+static int
+same_entry(cse_entry const *a, cse_entry const *b) {
+    return a->opcode == b->opcode && a->type == b->type && a->epoch == b->epoch
+        && a->operands[0].type == b->operands[0].type && a->operands[0].value == b->operands[0].value
+        && a->operands[1].type == b->operands[1].type && a->operands[1].value == b->operands[1].value;
+}
+
+/* Describe the value that instruction <i> computes in <key>. */
+static void
+make_key(cse_state *c, unsigned i, cse_entry *key) {
+    m0_instr const *ins = &c->chunk->instructions[i];
+    unsigned        k;
+
+    memset(key, 0, sizeof (cse_entry));
+    key->opcode = ins->opcode;
+    key->type   = ins->operands[0].type;
+
+    for (k = 1; k < ins->numops; k++) {
+        m0_operand op = ins->operands[k];
+
+        if (has_access(c->chunk, i, k, OPERAND_USE)) {
+            /* value numbers may be larger than an operand; the type field is above
+               VAL_INTERP_REG, and holds the high bits. */
+            unsigned vn = get_vn(c, reg_id(c->graph, &op));
+
+            op.type  = VAL_INTERP_REG + 1 + (vn >> 16);
+            op.value = vn & 0xffff;
+        }
+        key->operands[k - 1] = op;
+    }
+
+    if (is_commutative(ins->opcode)
+    && (key->operands[0].type > key->operands[1].type
+    || (key->operands[0].type == key->operands[1].type && key->operands[0].value > key->operands[1].value))) {
+        m0_operand tmp    = key->operands[0];
+        key->operands[0]  = key->operands[1];
+        key->operands[1]  = tmp;
+    }
+
+    /* memory may change; the constants don't. */
+    if ((ins->opcode == M0_DEREF || ins->opcode == M0_GET_BYTE || ins->opcode == M0_GET_WORD)
+    &&  !IS_ALIAS(ins->operands[1], CONSTS))
+        key->epoch = c->epoch;
+}
+
+static cse_entry *
+lookup(cse_state *c, cse_entry const *key) {
+    unsigned e = c->buckets[hash_entry(key)];
+
+    while (e != NONE) {
+        if (same_entry(&c->entries[e], key))
+            return &c->entries[e];
+        e = c->entries[e].next;
+    }
+    return NULL;
+}
+
+static void
+insert(cse_state *c, cse_entry const *key, unsigned vn) {
+    unsigned   h = hash_entry(key);
+    cse_entry *e;
+
+    if (c->num_entries == c->max_entries)
+        c->entries = (cse_entry *)grow(c, c->entries, c->num_entries, &c->max_entries, sizeof (cse_entry));
+
+    e          = &c->entries[c->num_entries];
+    *e         = *key;
+    e->vn      = vn;
+    e->next    = c->buckets[h];
+    c->buckets[h] = c->num_entries++;
+}
+
+/* Remove the entries made after the first <mark> ones; they're from blocks that are done. */
+static void
+forget(cse_state *c, unsigned mark) {
+    while (c->num_entries > mark) {
+        cse_entry *e = &c->entries[--c->num_entries];
+        c->buckets[hash_entry(e)] = e->next;
+    }
+}
+
+/* Number the values of block <b>, and rewrite its instructions. */
+static void
+number_block(cse_state *c, unsigned b) {
+    m0_chunk *chunk = c->chunk;
+    unsigned  i, k;
+
+    c->current = b;
+    c->epoch++;
+
+    for (i = c->graph->blocks[b].start; i < c->graph->blocks[b].end; i++) {
+        m0_instr *ins = &chunk->instructions[i];
+
+        if (c->graph->foreign[i]) {
+            c->epoch++;
+            continue;
+        }
+
+        /* read operands from the register that first got their value. */
+        for (k = 0; k < ins->numops && !c->graph->fixed[i]; k++) {
+            if (has_access(c->chunk, i, k, OPERAND_USE)) {
+                unsigned vn = get_vn(c, reg_id(c->graph, &ins->operands[k])),
+                         h  = find_holder(c, vn);
+
+                if (h != NONE)
+                    ins->operands[k] = reg_operand(c, h);
+            }
+        }
+
+        if (c->graph->fixed[i] || !(is_expression(ins) || ins->opcode == M0_SET) || !has_access(c->chunk, i, 0, OPERAND_DEF)) {
+            if (is_store(ins))
+                c->epoch++;
+            for (k = 0; k < 3; k++) {
+                if (has_access(c->chunk, i, k, OPERAND_DEF))
+                    set_vn(c, reg_id(c->graph, &ins->operands[k]), new_vn(c, reg_id(c->graph, &ins->operands[k])));
+            }
+            continue;
+        }
+
+        if (ins->opcode == M0_SET) {
+            /* a copy has the value of its source. */
+            unsigned dst = reg_id(c->graph, &ins->operands[0]);
+
+            if (IS_REG_OPERAND(ins->operands[1]) && ins->operands[1].type == ins->operands[0].type)
+                set_vn(c, dst, get_vn(c, reg_id(c->graph, &ins->operands[1])));
+            else
+                set_vn(c, dst, new_vn(c, dst));
+        }
+        else {
+            cse_entry  key;
+            cse_entry *e;
+            unsigned   dst = reg_id(c->graph, &ins->operands[0]),
+                       h   = NONE;
+
+            make_key(c, i, &key);
+            e = lookup(c, &key);
+
+            if (e != NULL)
+                h = find_holder(c, e->vn);
+
+            if (h != NONE) {
+                /* the value is in register h already. */
+                ins->opcode      = M0_SET;
+                ins->numops      = 2;
+                ins->operands[1] = reg_operand(c, h);
+                set_vn(c, dst, e->vn);
+                STAT_INC(c->comp, values_reused);
+            }
+            else {
+                unsigned vn = new_vn(c, dst);
+
+                insert(c, &key, vn);
+                set_vn(c, dst, vn);
+            }
+        }
+    }
+}
+
+/* Visit the blocks in a walk of the dominator tree; what a block found out is kept
+   while the blocks that it dominates are numbered.
+ */
+static void
+walk_dominator_tree(cse_state *c) {
+    flow_graph *g          = c->graph;
+    unsigned   *stack      = (unsigned *)cse_alloc(c, (g->num_reachable + 1) * sizeof (unsigned));
+    unsigned   *next_child = (unsigned *)cse_alloc(c, (g->num_blocks + 1) * sizeof (unsigned));
+    unsigned   *mark       = (unsigned *)cse_alloc(c, (g->num_blocks + 1) * sizeof (unsigned));
+    unsigned    top = 0;
+
+    stack[top++]  = 0;
+    next_child[0] = g->child_index[0];
+    mark[0]       = c->num_entries;
+    number_block(c, 0);
+
+    while (top > 0) {
+        unsigned blk = stack[top - 1];
+
+        if (next_child[blk] < g->child_index[blk + 1]) {
+            unsigned child = g->children[next_child[blk]++];
+
+            next_child[child] = g->child_index[child];
+            mark[child]       = c->num_entries;
+            stack[top++]      = child;
+            number_block(c, child);
+        }
+        else {
+            forget(c, mark[blk]);
+            top--;
+        }
+    }
+}
+
+/*
+
+Replace computations in <chunk> of values that a register already holds.
+
+*/
+void
+eliminate_common_subexpressions(M1_compiler *comp, m0_chunk *chunk) {
+    cse_state c;
+    unsigned  i;
+
+    if (chunk->num_instr == 0)
+        return;
+
+    memset(&c, 0, sizeof (cse_state));
+    c.comp  = comp;
+    c.chunk = chunk;
+
+    for (i = 0; i < CSE_BUCKETS; i++)
+        c.buckets[i] = NONE;
+
+    c.graph = build_flow_graph(comp, chunk);
+    count_definitions(&c);
+    walk_dominator_tree(&c);
+}
+
@@ -0,0 +1,18 @@
+#ifndef __M1_CSE_H__
+#define __M1_CSE_H__
+
+#include "compiler.h"
+#include "instr.h"
+
+/*
+
+Common subexpression elimination replaces instructions of a chunk that
+compute a value that a register already holds by copies of that register.
+It runs before remove_dead_code(), which removes the copies that are no
+longer needed.
+
+*/
+
+extern void eliminate_common_subexpressions(M1_compiler *comp, m0_chunk *chunk);
+
+#endif
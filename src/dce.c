@@ -0,0 +1,382 @@
+/*
+
+Dead code elimination. This runs on a chunk's code after it's generated,
+before registers are allocated, so that every value still has its own
+virtual register. Two kinds of instructions are removed:
+
+ 1. Unreachable code: instructions that can't be reached from the start of
+    the chunk, such as statements after a return, break or continue, the
+    jump over the if-block after an else-block that returns, and the
+    return sequence at the end of a function that already returned.
+ 2. Dead values: instructions without side effects whose result is never
+    read, such as the value of an expression statement, the old value
+    that x++ saves when nobody uses it, and stores to local variables that
+    are never read afterwards.
+
+A goto_chunk that runs in the chunk's own frame leaves it (that's a return),
+whereas one in a call sequence comes back. As the caller reads the return value
+from the function's frame, every physical register is considered to be read
+where the chunk is left. Code in call sequences that runs in the
+callee's frame is never removed; neither is code that computes a return address,
+as that is counted in instructions.
+
+Removing a dead value may make the values that it was computed from dead
+as well, so liveness is computed again until nothing changes.
+
+All memory is taken from the instruction arena, which is released once the
+chunk is done.
+
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "dce.h"
+#include "flow.h"
+#include "compiler.h"
+#include "instr.h"
+#include "gencode.h"
+#include "arena.h"
+#include "stats.h"
+
+#define NO_POS          (~0u)
+
+#define BITS            (8 * sizeof (unsigned long))
+#define BIT_SET(s, i)   ((s)[(i) / BITS] |= 1UL << ((i) % BITS))
+#define BIT_CLEAR(s, i) ((s)[(i) / BITS] &= ~(1UL << ((i) % BITS)))
+#define BIT_TEST(s, i)  (((s)[(i) / BITS] >> ((i) % BITS)) & 1)
+
+typedef struct dce_state {
+    M1_compiler   *comp;
+    m0_chunk      *chunk;
+    flow_graph    *graph;
+
+    unsigned char *deleted;                 /* per instruction: removed. */
+
+    unsigned      *global;                  /* id => index in the bitsets, or NO_POS if local. */
+    unsigned       num_globals;
+    unsigned       num_physical;            /* the first globals are the physical registers that occur. */
+
+    unsigned long *gen;                     /* per block: globals read before being set. */
+    unsigned long *kill;                    /* per block: globals set. */
+    unsigned long *in;                      /* per block: globals live on entry. */
+    unsigned long *out;                     /* per block: globals live on exit. */
+    unsigned long *live;                    /* globals live at the current instruction. */
+    unsigned char *live_local;              /* per id: local register is live at the current instruction. */
+    unsigned       words;                   /* size of one bitset. */
+    int            again;                   /* a removed instruction read a global register. */
+
+} dce_state;
+
+static void *
+dce_alloc(dce_state *d, size_t size) {
+    void *mem = arena_alloc(d->comp->instr_arena, size);
+    memset(mem, 0, size);
+    return mem;
+}
+
+/* Get how instruction <i> accesses operand <k>: OPERAND_NONE if it's not a register of
+   this chunk's frame.
+ */
+static unsigned char
+access_of(dce_state *d, unsigned i, unsigned k) {
+    if (d->graph->foreign[i])
+        return OPERAND_NONE;
+
+    if (has_access(d->chunk, i, k, OPERAND_USE))
+        return OPERAND_USE;
+
+    return has_access(d->chunk, i, k, OPERAND_DEF) ? OPERAND_DEF : OPERAND_NONE;
+}
+
+/* Can the instruction be removed if the register that it sets isn't read? Division
+   may trap, and allocation may be observed, so those stay.
+ */
+static int
+is_pure(m0_instr const *ins) {
+    switch (ins->opcode) {
+        case M0_ADD_I: case M0_ADD_N: case M0_SUB_I: case M0_SUB_N:
+        case M0_MULT_I: case M0_MULT_N:
+        case M0_ISGT_I: case M0_ISGT_N: case M0_ISGE_I: case M0_ISGE_N:
+        case M0_CONVERT_N_I: case M0_CONVERT_I_N:
+        case M0_ASHR: case M0_LSHR: case M0_SHL:
+        case M0_AND: case M0_OR: case M0_XOR:
+        case M0_SET: case M0_SET_IMM: case M0_DEREF:
+        case M0_GET_BYTE: case M0_GET_WORD:
+            return IS_REG_OPERAND(ins->operands[0]);
+        default:
+            return 0;
+    }
+}
+
+/* Remove the blocks that can't be reached from the start of the chunk. */
+static unsigned
+remove_unreachable(dce_state *d) {
+    flow_graph *g       = d->graph;
+    unsigned    removed = 0,
+                b, i;
+
+    for (b = 0; b < g->num_blocks; b++) {
+        if (g->blocks[b].rpo != NO_BLOCK)
+            continue;
+
+        for (i = g->blocks[b].start; i < g->blocks[b].end; i++)
+            d->deleted[i] = 1;
+        removed += g->blocks[b].end - g->blocks[b].start;
+    }
+    return removed;
+}
+
+/* Decide which registers need dataflow analysis. A virtual register that is set
+   before it's used, and that only occurs within one block, is not live outside
+   that block. Everything else, including all physical registers, is analyzed.
+ */
+static void
+find_globals(dce_state *d) {
+    m0_chunk *chunk = d->chunk;
+    unsigned *first = (unsigned *)dce_alloc(d, d->graph->num_ids * sizeof (unsigned));
+    unsigned  i, k, id;
+
+    d->global = (unsigned *)dce_alloc(d, d->graph->num_ids * sizeof (unsigned));
+
+    for (id = 0; id < d->graph->num_ids; id++)
+        first[id] = NO_POS;
+
+    for (i = 0; i < chunk->num_instr; i++) {
+        if (d->deleted[i])
+            continue;
+
+        for (k = 0; k < 3; k++) {
+            unsigned char access = access_of(d, i, k);
+
+            if (access == OPERAND_NONE)
+                continue;
+
+            id = reg_id(d->graph, &chunk->instructions[i].operands[k]);
+
+            if (first[id] == NO_POS)
+                first[id] = access == OPERAND_USE ? NO_POS - 1 : i;
+            else if (first[id] != NO_POS - 1 && d->graph->block_of[first[id]] != d->graph->block_of[i])
+                first[id] = NO_POS - 1;
+        }
+    }
+
+    /* the physical registers that occur come first, so that they're easily all made live. */
+    for (id = 0; id < REG_TYPE_NUM * REG_NUM; id++)
+        d->global[id] = first[id] != NO_POS ? d->num_globals++ : NO_POS;
+
+    d->num_physical = d->num_globals;
+
+    for (; id < d->graph->num_ids; id++)
+        d->global[id] = first[id] == NO_POS - 1 ? d->num_globals++ : NO_POS;
+}
+
+static int
+is_live(dce_state *d, unsigned id) {
+    unsigned g = d->global[id];
+
+    return g == NO_POS ? d->live_local[id] : BIT_TEST(d->live, g);
+}
+
+static void
+set_live(dce_state *d, unsigned id, int live) {
+    unsigned g = d->global[id];
+
+    if (g == NO_POS)
+        d->live_local[id] = live;
+    else if (live)
+        BIT_SET(d->live, g);
+    else
+        BIT_CLEAR(d->live, g);
+}
+
+/* Walk block <b> backwards from its live-out set, and remove the instructions whose
+   result is dead. Return the number of them.
+ */
+static unsigned
+sweep_block(dce_state *d, unsigned b) {
+    m0_chunk *chunk   = d->chunk;
+    unsigned  removed = 0,
+              i       = d->graph->blocks[b].end,
+              k, w;
+
+    memcpy(d->live, &d->out[b * d->words], d->words * sizeof (unsigned long));
+
+    while (i-- > d->graph->blocks[b].start) {
+        m0_instr *ins = &chunk->instructions[i];
+
+        if (d->deleted[i])
+            continue;
+
+        if (!d->graph->fixed[i] && !d->graph->foreign[i] && is_pure(ins)
+        &&  !is_live(d, reg_id(d->graph, &ins->operands[0]))) {
+            /* values in this block that only this instruction read are found dead right away. */
+            for (k = 1; k < 3; k++) {
+                if (access_of(d, i, k) == OPERAND_USE && d->global[reg_id(d->graph, &ins->operands[k])] != NO_POS)
+                    d->again = 1;
+            }
+            d->deleted[i] = 1;
+            removed++;
+            continue;
+        }
+
+        /* the result is written after the operands are read. */
+        for (k = 0; k < 3; k++) {
+            if (access_of(d, i, k) == OPERAND_DEF)
+                set_live(d, reg_id(d->graph, &ins->operands[k]), 0);
+        }
+        for (k = 0; k < 3; k++) {
+            if (access_of(d, i, k) == OPERAND_USE)
+                set_live(d, reg_id(d->graph, &ins->operands[k]), 1);
+        }
+
+        if (leaves_chunk(chunk, d->graph, i)) {
+            for (w = 0; w < d->num_physical; w++)
+                BIT_SET(d->live, w);
+        }
+    }
+    return removed;
+}
+
+/* Find the global registers that each block reads before it sets them (gen), and the
+   ones that it sets (kill).
+ */
+static void
+compute_gen_kill(dce_state *d) {
+    m0_chunk *chunk = d->chunk;
+    unsigned  words = d->words,
+              b, i, k, g;
+
+    memset(d->gen, 0, d->graph->num_blocks * words * sizeof (unsigned long));
+    memset(d->kill, 0, d->graph->num_blocks * words * sizeof (unsigned long));
+
+    for (b = 0; b < d->graph->num_blocks; b++) {
+        unsigned long *gen  = &d->gen[b * words];
+        unsigned long *kill = &d->kill[b * words];
+
+        if (d->graph->blocks[b].rpo == NO_BLOCK)
+            continue;
+
+        for (i = d->graph->blocks[b].start; i < d->graph->blocks[b].end; i++) {
+            m0_instr *ins = &chunk->instructions[i];
+
+            if (d->deleted[i])
+                continue;
+
+            /* operands are read before the result is written. */
+            for (k = 0; k < 3; k++) {
+                if (access_of(d, i, k) != OPERAND_USE)
+                    continue;
+
+                g = d->global[reg_id(d->graph, &ins->operands[k])];
+                if (g != NO_POS && !BIT_TEST(kill, g))
+                    BIT_SET(gen, g);
+            }
+            for (k = 0; k < 3; k++) {
+                if (access_of(d, i, k) != OPERAND_DEF)
+                    continue;
+
+                g = d->global[reg_id(d->graph, &ins->operands[k])];
+                if (g != NO_POS)
+                    BIT_SET(kill, g);
+            }
+            if (leaves_chunk(chunk, d->graph, i)) {
+                for (g = 0; g < d->num_physical; g++) {
+                    if (!BIT_TEST(kill, g))
+                        BIT_SET(gen, g);
+                }
+            }
+        }
+    }
+}
+
+/* Compute which global registers are live on entry and exit of each block. */
+static void
+compute_liveness(dce_state *d) {
+    unsigned words = d->words,
+             b, k, w;
+    int      changed;
+
+    compute_gen_kill(d);
+
+    memset(d->in, 0, d->graph->num_blocks * words * sizeof (unsigned long));
+    memset(d->out, 0, d->graph->num_blocks * words * sizeof (unsigned long));
+
+    /* iterate to a fixed point; visiting blocks backwards makes that quick. */
+    do {
+        changed = 0;
+        b = d->graph->num_blocks;
+
+        while (b-- > 0) {
+            flow_block    *block = &d->graph->blocks[b];
+            unsigned long *out   = &d->out[b * words];
+            unsigned long *in    = &d->in[b * words];
+
+            if (block->rpo == NO_BLOCK)
+                continue;
+
+            for (k = 0; k < block->num_succ; k++) {
+                unsigned long *succ_in = &d->in[block->succ[k] * words];
+                for (w = 0; w < words; w++)
+                    out[w] |= succ_in[w];
+            }
+            for (w = 0; w < words; w++) {
+                unsigned long new_in = d->gen[b * words + w] | (out[w] & ~d->kill[b * words + w]);
+
+                if (new_in != in[w]) {
+                    in[w]   = new_in;
+                    changed = 1;
+                }
+            }
+        }
+    } while (changed);
+}
+
+/*
+
+Remove the code of <chunk> that can't be reached, or whose result isn't used.
+
+*/
+void
+remove_dead_code(M1_compiler *comp, m0_chunk *chunk) {
+    dce_state d;
+    unsigned  total, b;
+
+    if (chunk->num_instr == 0)
+        return;
+
+    memset(&d, 0, sizeof (dce_state));
+    d.comp  = comp;
+    d.chunk = chunk;
+
+    d.graph   = build_flow_graph(comp, chunk);
+    d.deleted = (unsigned char *)dce_alloc(&d, chunk->num_instr + 1);
+
+    total = remove_unreachable(&d);
+    find_globals(&d);
+
+    d.words      = (d.num_globals + BITS - 1) / BITS;
+    d.gen        = (unsigned long *)dce_alloc(&d, d.graph->num_blocks * d.words * sizeof (unsigned long));
+    d.kill       = (unsigned long *)dce_alloc(&d, d.graph->num_blocks * d.words * sizeof (unsigned long));
+    d.in         = (unsigned long *)dce_alloc(&d, d.graph->num_blocks * d.words * sizeof (unsigned long));
+    d.out        = (unsigned long *)dce_alloc(&d, d.graph->num_blocks * d.words * sizeof (unsigned long));
+    d.live       = (unsigned long *)dce_alloc(&d, d.words * sizeof (unsigned long));
+    d.live_local = (unsigned char *)dce_alloc(&d, d.graph->num_ids);
+
+    /* a value may only become dead when the values computed from it are removed. */
+    do {
+        compute_liveness(&d);
+
+        d.again = 0;
+        for (b = 0; b < d.graph->num_blocks; b++) {
+            if (d.graph->blocks[b].rpo != NO_BLOCK)
+                total += sweep_block(&d, b);
+        }
+    } while (d.again);
+
+    comp->stats->dead_instructions += total;
+
+    if (total > 0)
+        remove_instructions(comp, chunk, d.deleted);
+}
+
@@ -0,0 +1,18 @@
+#ifndef __M1_DCE_H__
+#define __M1_DCE_H__
+
+#include "compiler.h"
+#include "instr.h"
+
+/*
+
+Dead code elimination removes the instructions of a chunk that can't be
+reached, and the ones that compute values that are never used. It runs
+before allocate_registers(), on virtual registers.
+
+*/
+
+extern void remove_dead_code(M1_compiler *comp, m0_chunk *chunk);
+
+#endif
+
@@ -4,6 +4,8 @@
 #include <assert.h>
 #include "decl.h"
 #include "ast.h"
+#include "arena.h"
+#include "intern.h"
 
 
 void
@@ -11,43 +13,106 @@ print_type(m1_type *type) {
     fprintf(stderr, "TYPE: [%s]\n", type->name);   
 }
 
-/*
+/* 
 
-Find the declaration for type <typename>.
+Find the slot for C<name> in C<index>, or the empty slot where it should go.
+Names are interned, so they can be compared by pointer.
 
 */
-m1_type *
-type_find_def(M1_compiler *comp, char *type) {
-    m1_type *iter;
+static unsigned
+find_slot(m1_declindex *index, char *name) {
+    unsigned mask = index->size - 1;
+    unsigned slot = hash_atom(name) & mask;
     
-    assert(comp != NULL);
+    while (index->names[slot] != NULL && index->names[slot] != name)
+        slot = (slot + 1) & mask;
+    
+    return slot;
+}
 
-    iter = comp->declarations;
+/* Allocate C<size> slots for C<index>, and re-enter any existing entries. */
+static void
+resize_index(M1_compiler *comp, m1_declindex *index, unsigned size) {
+    char     **oldnames   = index->names;
+    void     **oldentries = index->entries;
+    unsigned   oldsize    = index->size;
+    unsigned   i;
     
-    while (iter != NULL) {
-        assert(iter->name != NULL);
-        assert(type != NULL);
-        
-        if (strcmp(iter->name, type) == 0) { /* found! */
-            return iter;
+    index->size    = size;
+    index->names   = (char **)arena_alloc(comp->type_arena, size * sizeof (char *));
+    index->entries = (void **)arena_alloc(comp->type_arena, size * sizeof (void *));
+    
+    for (i = 0; i < oldsize; i++) {
+        if (oldnames[i] != NULL) {
+            unsigned slot = find_slot(index, oldnames[i]);
+            index->names[slot]   = oldnames[i];
+            index->entries[slot] = oldentries[i];   
         }
-        iter = iter->next;    
     }
+}
+
+/* Enter C<entry> under C<name>; a later declaration replaces an earlier one by the same name. */
+static void
+index_enter(M1_compiler *comp, m1_declindex **indexp, char *name, void *entry) {
+    m1_declindex *index = *indexp;
+    unsigned      slot;
+    
+    if (index == NULL) 
+        index = *indexp = (m1_declindex *)arena_alloc(comp->type_arena, sizeof (m1_declindex));
     
-    return NULL;    
+    /* keep load factor at most 1/2. */
+    if ((index->count + 1) * 2 > index->size)
+        resize_index(comp, index, index->size == 0 ? 32 : index->size * 2);
+        
+    slot = find_slot(index, name);
+    
+    if (index->names[slot] == NULL) {
+        index->names[slot] = name;
+        ++index->count;
+    }
+    index->entries[slot] = entry;
+}
+
+static void *
+index_find(m1_declindex *index, char *name) {
+    unsigned slot;
+    
+    if (index == NULL)
+        return NULL;
+        
+    slot = find_slot(index, name);
+    return index->entries[slot];  /* NULL if slot is empty. */
+}
+
+/* Add C<decl> to the list of declarations, and to the index. */
+static void
+link_decl(M1_compiler *comp, m1_type *decl) {
+    decl->next         = comp->declarations;
+    comp->declarations = decl;
+    index_enter(comp, &comp->typeindex, decl->name, decl);    
+}
+
+/*
+
+Find the declaration for type <typename>. 
+
+*/
+m1_type *
+type_find_def(M1_compiler *comp, char *type) {
+    assert(comp != NULL);
+    assert(type != NULL);
+    
+    return (m1_type *)index_find(comp->typeindex, type);
 }
 
 
 static m1_type *
 make_decl(M1_compiler *comp, int type) {
-    m1_type *decl = (m1_type *)calloc(1, sizeof(m1_type));    
+    m1_type *decl;
     
     assert(comp != NULL);
     
-    if (decl == NULL) {
-        fprintf(stderr, "cant alloc mem for decl\n");
-        exit(EXIT_FAILURE);   
-    }
+    decl           = (m1_type *)arena_alloc(comp->type_arena, sizeof(m1_type));    
     decl->decltype = type;
     return decl;
 }
@@ -65,9 +130,7 @@ type_enter_struct(M1_compiler *comp, char *structname, struct m1_struct *structd
     
     structdef->size = 4; /* XXX The size of a struct or PMC is always 4 bytes, as it's stored as a pointer. */
     
-    /* link in list of declarations */
-    decl->next = comp->declarations;
-    comp->declarations = decl;
+    link_decl(comp, decl);
     
     return decl;
 }
@@ -86,12 +149,17 @@ Enter a new enumeration declaration that goes by <enumname>.
 */
 m1_type *
 type_enter_enum(M1_compiler *comp, char *enumname, struct m1_enum *enumdef) {
-    m1_type *decl   = make_decl(comp, DECL_ENUM);
+    m1_type      *decl = make_decl(comp, DECL_ENUM);
+    m1_enumconst *iter;
+    
     decl->name      = enumname;
     decl->d.as_enum = enumdef;
     
-    decl->next = comp->declarations;
-    comp->declarations = decl;
+    link_decl(comp, decl);
+    
+    /* enter the enum's constants in the flat index, so the lexer can find them quickly. */
+    for (iter = enumdef->enums; iter != NULL; iter = iter->next) 
+        index_enter(comp, &comp->enumconstindex, iter->name, iter);
     
     return decl;   
 }
@@ -99,20 +167,7 @@ type_enter_enum(M1_compiler *comp, char *enumname, struct m1_enum *enumdef) {
 
 m1_enumconst *
 type_find_enumconst(M1_compiler *comp, char *enumconst_name) {
-    m1_type *decl = comp->declarations;
-    
-    while (decl != NULL) {
-        if (decl->decltype == DECL_ENUM) {
-            m1_enumconst *iter = decl->d.as_enum->enums;
-            while (iter != NULL) {
-                if (strcmp(enumconst_name, iter->name) == 0) 
-                    return iter;
-                iter = iter->next;   
-            }       
-        }
-        decl = decl->next;   
-    }    
-    return NULL;
+    return (m1_enumconst *)index_find(comp->enumconstindex, enumconst_name);
 }
 
 /* 
@@ -122,9 +177,8 @@ Interface for declaring basic types.
 */
 m1_type *
 type_enter_type(M1_compiler *comp, char *type, m1_type_type decltype, unsigned size) {
-    m1_type *decl  = (m1_type *)calloc(1, sizeof(m1_type));    
+    m1_type *decl  = make_decl(comp, decltype);
     decl->name     = type;
-    decl->decltype = decltype;    
     decl->d.size   = size;
     
     switch (decltype) {
@@ -145,8 +199,7 @@ type_enter_type(M1_compiler *comp, char *type, m1_type_type decltype, unsigned s
             break;
     }
 
-    decl->next = comp->declarations;
-    comp->declarations = decl;
+    link_decl(comp, decl);
     
     return decl;        
 }
@@ -51,6 +51,19 @@ typedef struct m1_type {
     
 } m1_type;
 
+/* An index of declarations by (interned) name, so that types and enum 
+   constants can be found without scanning all declarations. It's an open-
+   addressing hash table; <entries> points to m1_type or m1_enumconst objects,
+   depending on what is indexed.
+ */
+typedef struct m1_declindex {
+    char     **names;       /* key of each slot; NULL if empty. */
+    void     **entries;     /* entry for each slot. */
+    unsigned   size;        /* number of slots; 0 or a power of 2. */
+    unsigned   count;       /* number of used slots. */
+    
+} m1_declindex;
+
 extern void print_type(m1_type *type);
 
 extern m1_type *type_find_def(M1_compiler *, char *type);
@@ -0,0 +1,127 @@
+/*
+
+Buffered output for the code generator. Integers are formatted by hand,
+as the code generator writes lots of them (register numbers, constant 
+indices, labels) and going through the stdio machinery for each of them
+dominates the time needed to write large files.
+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "emit.h"
+
+#define EMIT_BUFSIZE    (64 * 1024)
+
+m1_emitter *
+new_emitter(FILE *file) {
+    m1_emitter *e = (m1_emitter *)calloc(1, sizeof (m1_emitter));
+    
+    if (e == NULL) {
+        fprintf(stderr, "cant alloc mem for emitter");
+        exit(EXIT_FAILURE);   
+    }
+    
+    e->size   = EMIT_BUFSIZE;
+    e->buffer = (char *)malloc(e->size);
+    e->file   = file;
+    
+    if (e->buffer == NULL) {
+        fprintf(stderr, "cant alloc mem for output buffer");
+        exit(EXIT_FAILURE);   
+    }
+    return e;
+}
+
+void
+delete_emitter(m1_emitter *e) {
+    assert(e != NULL);
+    free(e->buffer);
+    free(e);   
+}
+
+/* Make sure there's room for C<n> more bytes in C<e>'s buffer. */
+static void
+reserve(m1_emitter *e, size_t n) {
+    if (e->length + n <= e->size)
+        return;
+        
+    while (e->length + n > e->size)
+        e->size *= 2;
+        
+    e->buffer = (char *)realloc(e->buffer, e->size);
+    
+    if (e->buffer == NULL) {
+        fprintf(stderr, "cant alloc mem for output buffer");
+        exit(EXIT_FAILURE);   
+    }
+}
+
+void
+emit_char(m1_emitter *e, char c) {
+    reserve(e, 1);
+    e->buffer[e->length++] = c;   
+}
+
+void
+emit_str(m1_emitter *e, char const *str) {
+    size_t n = strlen(str);
+    
+    reserve(e, n);
+    memcpy(e->buffer + e->length, str, n);
+    e->length += n;
+}
+
+void
+emit_int(m1_emitter *e, int value) {
+    char          digits[12]; /* enough for -2^31. */
+    char         *end = digits + sizeof (digits);
+    char         *p   = end;
+    unsigned int  u   = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
+    
+    /* write digits from the right. */
+    do {
+        *--p = (char)('0' + u % 10);
+        u   /= 10;
+    } while (u != 0);
+    
+    if (value < 0)
+        *--p = '-';
+        
+    reserve(e, end - p);
+    memcpy(e->buffer + e->length, p, end - p);
+    e->length += end - p;
+}
+
+/* Floats are rare enough to leave them to the C library; same format as "%f". */
+void
+emit_num(m1_emitter *e, double value) {
+    int n;
+    
+    reserve(e, 32);
+    n = snprintf(e->buffer + e->length, e->size - e->length, "%f", value);
+    
+    if (n >= (int)(e->size - e->length)) { /* huge number; try again with enough room. */
+        reserve(e, n + 1);
+        n = snprintf(e->buffer + e->length, e->size - e->length, "%f", value);   
+    }
+    e->length += n;
+}
+
+/* Write everything that was emitted to the output file in one go. An in-memory
+   sink keeps its contents. 
+ */
+void
+emit_flush(m1_emitter *e) {
+    if (e->file == NULL)
+        return;
+        
+    if (e->length > 0 && fwrite(e->buffer, 1, e->length, e->file) != e->length) {
+        fprintf(stderr, "Failed to write output file\n");
+        exit(EXIT_FAILURE);   
+    }
+    fflush(e->file);
+    e->length = 0;
+}
+
@@ -0,0 +1,39 @@
+#ifndef __M1_EMIT_H__
+#define __M1_EMIT_H__
+
+#include <stdio.h>
+#include <stddef.h>
+
+/*
+
+The emitter collects all output of the code generator in one growing 
+buffer, which is written with a single write when code generation is done.
+If no file is given, the emitter is an in-memory sink, and the output can 
+be taken from <buffer>.
+
+*/
+typedef struct m1_emitter {
+    char   *buffer;     /* output written so far. */
+    size_t  length;     /* number of bytes in buffer. */
+    size_t  size;       /* allocated size of buffer. */
+    FILE   *file;       /* file to flush to; NULL for an in-memory sink. */
+    
+} m1_emitter;
+
+
+extern m1_emitter *new_emitter(FILE *file);
+
+extern void delete_emitter(m1_emitter *e);
+
+extern void emit_char(m1_emitter *e, char c);
+
+extern void emit_str(m1_emitter *e, char const *str);
+
+extern void emit_int(m1_emitter *e, int value);
+
+extern void emit_num(m1_emitter *e, double value);
+
+extern void emit_flush(m1_emitter *e);
+
+#endif
+
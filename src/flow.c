@@ -0,0 +1,686 @@
+/*
+
+Control flow graph of a chunk's code, and its dominator tree.
+
+The code is split in basic blocks; a block ends at a jump, at a return
+(goto_chunk in the chunk's own frame) or exit, and before a label. Call
+sequences don't end a block: the code after the callee's goto_chunk, that
+comes back, is part of the same block.
+
+The dominators are found with the algorithm of Cooper, Harvey and Kennedy
+("A Simple, Fast Dominance Algorithm", 2001), and the dominator tree is
+numbered so that dominates() takes constant time.
+
+Loops are found as back edges: an edge to a block that dominates its
+source. The code generator doesn't make preheaders, but the loops it
+generates have one place where the code that enters the loop passes:
+either the jump to the loop's condition ("while"), or the header's own
+start, if the jumps back into the loop go to other labels than the jumps
+from before it ("for" and "do-while").
+
+Passes that change the code list what they insert and remove, and then
+call rewrite_code(), which puts the labels where they belong.
+
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "flow.h"
+#include "compiler.h"
+#include "instr.h"
+#include "gencode.h"
+#include "arena.h"
+
+/* Is <op> special register <alias>? */
+#define IS_ALIAS(op, alias)     ((op).type == VAL_INTERP_REG && (op).value == (alias))
+
+static void *
+flow_alloc(M1_compiler *comp, size_t size) {
+    void *mem = arena_alloc(comp->instr_arena, size);
+    memset(mem, 0, size);
+    return mem;
+}
+
+/* Find the code of call sequences: from where the return address is computed
+   (that's counted in instructions) until the caller's frame is active again.
+   In between, the instructions that run in the callee's frame are foreign.
+   The jump tables of switches are counted from PC too, so they're fixed.
+ */
+static void
+find_call_sequences(M1_compiler *comp, m0_chunk *chunk, flow_graph *g) {
+    int       in_call  = 0,
+              callee   = 0,
+              in_table = 0;
+    unsigned  i, k;
+
+    g->fixed   = (unsigned char *)flow_alloc(comp, chunk->num_instr + 1);
+    g->foreign = (unsigned char *)flow_alloc(comp, chunk->num_instr + 1);
+    g->removed = (unsigned char *)flow_alloc(comp, chunk->num_instr + 1);
+
+    for (i = 0; i < chunk->num_instr; i++) {
+        m0_instr *ins = &chunk->instructions[i];
+
+        if (ins->numops > 0 && IS_ALIAS(ins->operands[0], RETPC))
+            in_call = 1;
+
+        if (ins->opcode != M0_GOTO_IF)
+            in_table = IS_TABLE_JUMP(ins);
+
+        g->fixed[i]   = in_call || in_table;
+        g->foreign[i] = callee;
+
+        /* anything that reads PC depends on where it is. */
+        for (k = 1; k < ins->numops && ins->opcode != M0_SET_IMM; k++) {
+            if (IS_ALIAS(ins->operands[k], PC))
+                g->fixed[i] = 1;
+        }
+
+        if (ins->opcode == M0_SET && IS_ALIAS(ins->operands[0], CF)) {
+            callee  = !IS_ALIAS(ins->operands[1], PCF);
+            in_call = callee;
+        }
+    }
+}
+
+/*
+
+Does instruction <i> leave the chunk, rather than fall through? A goto_chunk in
+the chunk's own frame is a return, whereas one in a call sequence comes back. A
+jump into a jump table goes to one of the goto_ifs that follow it; as they all
+only jump, falling through into the first one is the same as far as the passes
+are concerned.
+
+*/
+int
+leaves_chunk(m0_chunk const *chunk, flow_graph const *g, unsigned i) {
+    m0_instr const *ins = &chunk->instructions[i];
+
+    return ins->opcode == M0_EXIT
+        || (ins->opcode == M0_GOTO_CHUNK && !g->foreign[i] && !IS_TABLE_JUMP(ins));
+}
+
+/* Number the registers that occur in the code so far. */
+static void
+number_registers(M1_compiler *comp, flow_graph *g) {
+    unsigned t;
+
+    g->num_ids = REG_TYPE_NUM * REG_NUM;
+    for (t = 0; t < REG_TYPE_NUM; t++) {
+        g->vbase[t]     = g->num_ids;
+        g->num_vregs[t] = comp->vregs[t];
+        g->num_ids     += comp->vregs[t];
+    }
+}
+
+/*
+
+Get the number that identifies register operand <op>, or NO_REG for a virtual
+register that was made after <graph> was built.
+
+*/
+unsigned
+reg_id(flow_graph const *g, m0_operand const *op) {
+    if (op->value < REG_NUM)
+        return op->type * REG_NUM + op->value;
+
+    if ((unsigned)(op->value - REG_NUM) >= g->num_vregs[op->type])
+        return NO_REG;
+
+    return g->vbase[op->type] + op->value - REG_NUM;
+}
+
+/*
+
+Does instruction <i> access register operand <k> as <access>: OPERAND_USE or
+OPERAND_DEF?
+
+*/
+int
+has_access(m0_chunk const *chunk, unsigned i, unsigned k, unsigned char access) {
+    m0_instr const *ins = &chunk->instructions[i];
+
+    return k < ins->numops && IS_REG_OPERAND(ins->operands[k])
+        && m0_operand_access[ins->opcode][k] == access;
+}
+
+/* Split the code in basic blocks, and find each block's successors. */
+static void
+build_blocks(M1_compiler *comp, m0_chunk *chunk, flow_graph *g) {
+    unsigned       n      = chunk->num_instr;
+    unsigned char *leader = (unsigned char *)flow_alloc(comp, n + 1);
+    unsigned       i, b;
+
+    leader[0] = 1;
+    for (i = 0; i < chunk->num_labelmarks; i++) {
+        if (chunk->labelmarks[i].instr < n)
+            leader[chunk->labelmarks[i].instr] = 1;
+    }
+    for (i = 0; i < n; i++) {
+        m0_opcode op = chunk->instructions[i].opcode;
+
+        if (op == M0_GOTO || op == M0_GOTO_IF || leaves_chunk(chunk, g, i))
+            leader[i + 1] = 1;
+    }
+
+    for (i = 0; i < n; i++)
+        g->num_blocks += leader[i];
+
+    g->blocks   = (flow_block *)flow_alloc(comp, g->num_blocks * sizeof (flow_block));
+    g->block_of = (unsigned *)flow_alloc(comp, n * sizeof (unsigned));
+
+    for (i = 0, b = 0; i < n; i++) {
+        if (leader[i] && i > 0) {
+            g->blocks[b].end = i;
+            g->blocks[++b].start = i;
+        }
+        g->block_of[i] = b;
+    }
+    g->blocks[b].end = n;
+
+    for (b = 0; b < g->num_blocks; b++) {
+        flow_block *block = &g->blocks[b];
+        unsigned    last  = block->end - 1;
+        m0_instr   *ins   = &chunk->instructions[last];
+
+        if (ins->opcode == M0_GOTO || ins->opcode == M0_GOTO_IF) {
+            unsigned target = label_offset(chunk, ins->operands[0].value);
+            if (target < n)
+                block->succ[block->num_succ++] = g->block_of[target];
+        }
+        if (ins->opcode != M0_GOTO && !leaves_chunk(chunk, g, last) && block->end < n)
+            block->succ[block->num_succ++] = b + 1;
+    }
+}
+
+/* Number the reachable blocks in reverse postorder. */
+static void
+order_blocks(M1_compiler *comp, flow_graph *g) {
+    unsigned *stack = (unsigned *)flow_alloc(comp, g->num_blocks * sizeof (unsigned));
+    unsigned *edge  = (unsigned *)flow_alloc(comp, g->num_blocks * sizeof (unsigned));
+    unsigned  top   = 0,
+              n     = g->num_blocks,
+              b;
+
+    g->order = (unsigned *)flow_alloc(comp, g->num_blocks * sizeof (unsigned));
+
+    for (b = 0; b < g->num_blocks; b++)
+        g->blocks[b].rpo = NO_BLOCK;
+
+    /* rpo doubles as the "seen" mark during the walk. */
+    stack[top++]     = 0;
+    g->blocks[0].rpo = 0;
+
+    while (top > 0) {
+        flow_block *block = &g->blocks[stack[top - 1]];
+
+        if (edge[stack[top - 1]] < block->num_succ) {
+            unsigned succ = block->succ[edge[stack[top - 1]]++];
+
+            if (g->blocks[succ].rpo == NO_BLOCK) {
+                g->blocks[succ].rpo = 0;
+                stack[top++] = succ;
+            }
+        }
+        else
+            g->order[--n] = stack[--top];
+    }
+
+    /* the reachable blocks were put at the end. */
+    g->num_reachable = g->num_blocks - n;
+    memmove(g->order, g->order + n, g->num_reachable * sizeof (unsigned));
+
+    for (b = 0; b < g->num_reachable; b++)
+        g->blocks[g->order[b]].rpo = b;
+}
+
+/* List the predecessors of each reachable block. */
+static void
+find_predecessors(M1_compiler *comp, flow_graph *g) {
+    unsigned b, k;
+
+    g->pred_index = (unsigned *)flow_alloc(comp, (g->num_blocks + 1) * sizeof (unsigned));
+
+    for (b = 0; b < g->num_blocks; b++) {
+        if (g->blocks[b].rpo == NO_BLOCK)
+            continue;
+        for (k = 0; k < g->blocks[b].num_succ; k++)
+            g->pred_index[g->blocks[b].succ[k] + 1]++;
+    }
+    for (b = 0; b < g->num_blocks; b++)
+        g->pred_index[b + 1] += g->pred_index[b];
+
+    g->preds = (unsigned *)flow_alloc(comp, (g->pred_index[g->num_blocks] + 1) * sizeof (unsigned));
+    for (b = 0; b < g->num_blocks; b++) {
+        if (g->blocks[b].rpo == NO_BLOCK)
+            continue;
+        for (k = 0; k < g->blocks[b].num_succ; k++)
+            g->preds[g->pred_index[g->blocks[b].succ[k]]++] = b;
+    }
+    /* pred_index now has the end of each list; shift it back. */
+    for (b = g->num_blocks; b > 0; b--)
+        g->pred_index[b] = g->pred_index[b - 1];
+    g->pred_index[0] = 0;
+}
+
+static unsigned
+intersect(flow_graph *g, unsigned a, unsigned b) {
+    while (a != b) {
+        while (g->blocks[a].rpo > g->blocks[b].rpo)
+            a = g->blocks[a].idom;
+        while (g->blocks[b].rpo > g->blocks[a].rpo)
+            b = g->blocks[b].idom;
+    }
+    return a;
+}
+
+/* Find the immediate dominator of each block. */
+static void
+compute_dominators(flow_graph *g) {
+    unsigned b, k, i;
+    int      changed;
+
+    for (b = 0; b < g->num_blocks; b++)
+        g->blocks[b].idom = NO_BLOCK;
+
+    g->blocks[0].idom = 0;
+
+    do {
+        changed = 0;
+        for (i = 1; i < g->num_reachable; i++) {
+            unsigned blk      = g->order[i],
+                     new_idom = NO_BLOCK;
+
+            for (k = g->pred_index[blk]; k < g->pred_index[blk + 1]; k++) {
+                unsigned p = g->preds[k];
+
+                if (g->blocks[p].idom == NO_BLOCK)
+                    continue;
+                new_idom = new_idom == NO_BLOCK ? p : intersect(g, p, new_idom);
+            }
+            if (new_idom != g->blocks[blk].idom) {
+                g->blocks[blk].idom = new_idom;
+                changed = 1;
+            }
+        }
+    } while (changed);
+}
+
+/* List each block's children in the dominator tree, and number the tree. */
+static void
+build_dominator_tree(M1_compiler *comp, flow_graph *g) {
+    unsigned *stack      = (unsigned *)flow_alloc(comp, (g->num_reachable + 1) * sizeof (unsigned));
+    unsigned *next_child = (unsigned *)flow_alloc(comp, (g->num_blocks + 1) * sizeof (unsigned));
+    unsigned  top = 0, clock = 0, b, i;
+
+    g->child_index = (unsigned *)flow_alloc(comp, (g->num_blocks + 1) * sizeof (unsigned));
+    g->children    = (unsigned *)flow_alloc(comp, (g->num_reachable + 1) * sizeof (unsigned));
+
+    for (i = 1; i < g->num_reachable; i++)
+        g->child_index[g->blocks[g->order[i]].idom + 1]++;
+    for (b = 0; b < g->num_blocks; b++)
+        g->child_index[b + 1] += g->child_index[b];
+    for (b = 0; b < g->num_blocks; b++)
+        next_child[b] = g->child_index[b];
+    for (i = 1; i < g->num_reachable; i++) {
+        unsigned blk = g->order[i];
+        g->children[next_child[g->blocks[blk].idom]++] = blk;
+    }
+
+    stack[top++]     = 0;
+    g->blocks[0].pre = clock++;
+    next_child[0]    = g->child_index[0];
+    while (top > 0) {
+        unsigned blk = stack[top - 1];
+
+        if (next_child[blk] < g->child_index[blk + 1]) {
+            unsigned child = g->children[next_child[blk]++];
+
+            g->blocks[child].pre = clock++;
+            next_child[child]    = g->child_index[child];
+            stack[top++]         = child;
+        }
+        else {
+            g->blocks[blk].post = clock++;
+            top--;
+        }
+    }
+}
+
+/*
+
+Does block <a> dominate block <b>? Both must be reachable.
+
+*/
+int
+dominates(flow_graph const *g, unsigned a, unsigned b) {
+    return g->blocks[a].pre <= g->blocks[b].pre && g->blocks[b].post <= g->blocks[a].post;
+}
+
+/*
+
+Build the control flow graph of <chunk>, which must have code.
+
+*/
+flow_graph *
+build_flow_graph(M1_compiler *comp, m0_chunk *chunk) {
+    flow_graph *g = (flow_graph *)flow_alloc(comp, sizeof (flow_graph));
+
+    assert(chunk->num_instr > 0);
+
+    number_registers(comp, g);
+    find_call_sequences(comp, chunk, g);
+    build_blocks(comp, chunk, g);
+    order_blocks(comp, g);
+    find_predecessors(comp, g);
+    compute_dominators(g);
+    build_dominator_tree(comp, g);
+
+    g->label_before = (unsigned char *)flow_alloc(comp, chunk->max_labels + 1);
+    return g;
+}
+
+/* Add the blocks of the loop of back edge <latch> => <header>. */
+static void
+add_loop(M1_compiler *comp, flow_graph *g, unsigned latch, unsigned header) {
+    flow_loop *loop;
+    unsigned  *stack, top = 0, i, k;
+
+    for (i = 0; i < g->num_loops && g->loops[i].header != header; i++)
+        ;
+
+    if (i == g->num_loops) {
+        loop            = &g->loops[g->num_loops++];
+        loop->header    = header;
+        loop->body      = (unsigned char *)flow_alloc(comp, g->num_blocks);
+        loop->body[header] = 1;
+        loop->size      = 1;
+        loop->preheader = NO_INSTR;
+    }
+    else
+        loop = &g->loops[i];
+
+    /* the loop has the blocks that reach the latch without passing the header. */
+    if (loop->body[latch])
+        return;
+
+    stack = (unsigned *)flow_alloc(comp, (g->num_blocks + 1) * sizeof (unsigned));
+    loop->body[latch] = 1;
+    loop->size++;
+    stack[top++] = latch;
+
+    while (top > 0) {
+        unsigned b = stack[--top];
+
+        for (k = g->pred_index[b]; k < g->pred_index[b + 1]; k++) {
+            unsigned p = g->preds[k];
+
+            if (!loop->body[p]) {
+                loop->body[p] = 1;
+                loop->size++;
+                stack[top++] = p;
+            }
+        }
+    }
+}
+
+/* Does jump instruction <i> go to the instruction at <target>? */
+static int
+jumps_to(m0_chunk *chunk, unsigned i, unsigned target) {
+    m0_instr const *ins = &chunk->instructions[i];
+
+    return (ins->opcode == M0_GOTO || ins->opcode == M0_GOTO_IF)
+        && label_offset(chunk, ins->operands[0].value) == target;
+}
+
+/* Find where the preheader code of loop <n> can go: before the header, if the code
+   from outside the loop falls through or jumps to other labels than the code in
+   the loop does; or else before the jump into the loop of its only entry. No two
+   loops get the same place, as <taken> records.
+ */
+static void
+find_preheader(m0_chunk *chunk, flow_graph *g, unsigned n, unsigned char *taken) {
+    flow_loop *loop  = &g->loops[n];
+    unsigned   start = g->blocks[loop->header].start;
+    unsigned   entry = NO_BLOCK, entries = 0;
+    unsigned   b, k, m;
+    int        ok = !taken[start] && !g->fixed[start];
+
+    /* the code in the loop may not fall through into the header. */
+    if (start > 0 && loop->body[g->block_of[start - 1]]
+    &&  chunk->instructions[start - 1].opcode != M0_GOTO) {
+        flow_block *prev = &g->blocks[g->block_of[start - 1]];
+
+        for (k = 0; k < prev->num_succ; k++) {
+            if (prev->succ[k] == loop->header)
+                ok = 0;
+        }
+    }
+
+    /* a label that's jumped to from the loop is "inside"; it goes after the preheader code. */
+    for (m = 0; m < chunk->num_labelmarks && ok; m++) {
+        if (chunk->labelmarks[m].instr == start)
+            g->label_before[chunk->labelmarks[m].label - chunk->labelbase] = 1;
+    }
+    for (b = 0; b < g->num_blocks && ok; b++) {
+        unsigned last = g->blocks[b].end - 1;
+
+        if (loop->body[b] && jumps_to(chunk, last, start))
+            g->label_before[chunk->instructions[last].operands[0].value] = 0;
+    }
+    for (b = 0; b < g->num_blocks && ok; b++) {
+        unsigned last = g->blocks[b].end - 1;
+
+        if (!loop->body[b] && jumps_to(chunk, last, start)
+        &&  !g->label_before[chunk->instructions[last].operands[0].value])
+            ok = 0;
+    }
+
+    if (ok) {
+        loop->preheader = start;
+        taken[start]    = 1;
+        return;
+    }
+    for (m = 0; m < chunk->num_labelmarks; m++) {
+        if (chunk->labelmarks[m].instr == start && !taken[start])
+            g->label_before[chunk->labelmarks[m].label - chunk->labelbase] = 0;
+    }
+
+    /* else, the loop must have one entry, that jumps to it. */
+    for (k = g->pred_index[loop->header]; k < g->pred_index[loop->header + 1]; k++) {
+        if (!loop->body[g->preds[k]]) {
+            entry = g->preds[k];
+            entries++;
+        }
+    }
+    if (entries == 1 && g->blocks[entry].num_succ == 1
+    &&  chunk->instructions[g->blocks[entry].end - 1].opcode == M0_GOTO
+    &&  !taken[g->blocks[entry].end - 1] && !g->fixed[g->blocks[entry].end - 1]) {
+        unsigned jump = g->blocks[entry].end - 1;
+
+        for (m = 0; m < chunk->num_labelmarks; m++) {
+            if (chunk->labelmarks[m].instr == jump)
+                g->label_before[chunk->labelmarks[m].label - chunk->labelbase] = 1;
+        }
+        loop->preheader = jump;
+        taken[jump]     = 1;
+    }
+}
+
+/*
+
+Find the loops of <graph>, and where each loop's preheader code can go.
+
+*/
+void
+find_loops(M1_compiler *comp, m0_chunk *chunk, flow_graph *g) {
+    unsigned char *taken = (unsigned char *)flow_alloc(comp, chunk->num_instr + 1);
+    unsigned       i, j, k;
+
+    g->loops = (flow_loop *)flow_alloc(comp, (g->num_blocks + 1) * sizeof (flow_loop));
+
+    for (i = 0; i < g->num_reachable; i++) {
+        unsigned b = g->order[i];
+
+        for (k = 0; k < g->blocks[b].num_succ; k++) {
+            unsigned h = g->blocks[b].succ[k];
+
+            if (dominates(g, h, b))
+                add_loop(comp, g, b, h);
+        }
+    }
+
+    for (i = 1; i < g->num_loops; i++) {
+        flow_loop loop = g->loops[i];
+
+        for (j = i; j > 0 && g->loops[j - 1].size > loop.size; j--)
+            g->loops[j] = g->loops[j - 1];
+        g->loops[j] = loop;
+    }
+
+    g->innermost = (unsigned *)flow_alloc(comp, (g->num_blocks + 1) * sizeof (unsigned));
+    for (j = 0; j < g->num_blocks; j++) {
+        for (i = 0; i < g->num_loops && !g->loops[i].body[j]; i++)
+            ;
+        g->innermost[j] = i < g->num_loops ? i : NO_LOOP;
+    }
+
+    for (i = 0; i < g->num_loops; i++)
+        find_preheader(chunk, g, i, taken);
+}
+
+/*
+
+Find the blocks of loop <n> that run in every iteration: the ones that dominate
+all blocks that jump back to the header. <always> gets a flag per block.
+
+*/
+void
+find_unconditional_blocks(flow_graph const *g, unsigned n, unsigned char *always) {
+    flow_loop const *loop = &g->loops[n];
+    unsigned         b, latch, k;
+
+    for (b = 0; b < g->num_blocks; b++)
+        always[b] = loop->body[b];
+
+    for (latch = 0; latch < g->num_blocks; latch++) {
+        if (!loop->body[latch])
+            continue;
+
+        for (k = 0; k < g->blocks[latch].num_succ; k++) {
+            if (g->blocks[latch].succ[k] != loop->header)
+                continue;
+
+            for (b = 0; b < g->num_blocks; b++) {
+                if (always[b] && !dominates(g, b, latch))
+                    always[b] = 0;
+            }
+        }
+    }
+}
+
+/*
+
+Insert a copy of <ins> before instruction <at>; instructions inserted at the same
+place keep their order. A label at <at> is put after the inserted code, unless
+label_before says it stays before.
+
+*/
+void
+insert_code(M1_compiler *comp, flow_graph *g, unsigned at, m0_instr const *ins) {
+    if (g->num_inserted == g->max_inserted) {
+        unsigned  max      = g->max_inserted ? 2 * g->max_inserted : 16;
+        unsigned *insert_at = (unsigned *)flow_alloc(comp, max * sizeof (unsigned));
+        m0_instr *inserted  = (m0_instr *)flow_alloc(comp, max * sizeof (m0_instr));
+
+        if (g->num_inserted > 0) {
+            memcpy(insert_at, g->insert_at, g->num_inserted * sizeof (unsigned));
+            memcpy(inserted, g->inserted, g->num_inserted * sizeof (m0_instr));
+        }
+        g->insert_at    = insert_at;
+        g->inserted     = inserted;
+        g->max_inserted = max;
+    }
+
+    g->insert_at[g->num_inserted] = at;
+    g->inserted[g->num_inserted++] = *ins;
+}
+
+/*
+
+Rebuild the code of <chunk> with the instructions that were inserted, and without
+the ones that were marked as removed. The number of instructions removed is returned.
+
+*/
+unsigned
+rewrite_code(M1_compiler *comp, m0_chunk *chunk, flow_graph *g) {
+    unsigned      n = chunk->num_instr;
+    unsigned     *first  = (unsigned *)flow_alloc(comp, (n + 2) * sizeof (unsigned));
+    unsigned     *order  = (unsigned *)flow_alloc(comp, (g->num_inserted + 1) * sizeof (unsigned));
+    unsigned     *before = (unsigned *)flow_alloc(comp, (n + 1) * sizeof (unsigned));
+    unsigned     *after  = (unsigned *)flow_alloc(comp, (n + 1) * sizeof (unsigned));
+    m0_instr     *code;
+    m0_labelmark *marks;
+    unsigned      i, k, m = 0, num = 0, removed = 0;
+
+    for (i = 0; i < n; i++)
+        removed += g->removed[i];
+
+    code = (m0_instr *)flow_alloc(comp, (n - removed + g->num_inserted + 1) * sizeof (m0_instr));
+
+    /* sort the inserted instructions by place, keeping their order. */
+    for (k = 0; k < g->num_inserted; k++)
+        first[g->insert_at[k] + 1]++;
+    for (i = 0; i <= n; i++)
+        first[i + 1] += first[i];
+    for (k = 0; k < g->num_inserted; k++)
+        order[first[g->insert_at[k]]++] = k;
+
+    for (i = 0, k = 0; i <= n; i++) {
+        before[i] = num;
+        while (k < g->num_inserted && g->insert_at[order[k]] == i)
+            code[num++] = g->inserted[order[k++]];
+        after[i] = num;
+
+        if (i < n && !g->removed[i])
+            code[num++] = chunk->instructions[i];
+    }
+
+    for (i = 0; i < chunk->max_labels; i++) {
+        if (chunk->labels[i] != NO_INSTR)
+            chunk->labels[i] = g->label_before[i] ? before[chunk->labels[i]] : after[chunk->labels[i]];
+    }
+    /* the marks must stay in the order of the code: of the labels at the same 
+       instruction, the ones that stay before the inserted code come first. 
+     */
+    marks = (m0_labelmark *)flow_alloc(comp, (chunk->num_labelmarks + 1) * sizeof (m0_labelmark));
+    
+    for (i = 0; i < chunk->num_labelmarks; i = k) {
+        unsigned at = chunk->labelmarks[i].instr;
+        unsigned j;
+        
+        for (k = i; k < chunk->num_labelmarks && chunk->labelmarks[k].instr == at; k++)
+            ;
+        
+        for (j = i; j < k; j++) {
+            if (g->label_before[chunk->labelmarks[j].label - chunk->labelbase]) {
+                marks[m].label   = chunk->labelmarks[j].label;
+                marks[m++].instr = before[at];
+            }
+        }
+        for (j = i; j < k; j++) {
+            if (!g->label_before[chunk->labelmarks[j].label - chunk->labelbase]) {
+                marks[m].label   = chunk->labelmarks[j].label;
+                marks[m++].instr = after[at];
+            }
+        }
+    }
+    chunk->labelmarks     = marks;
+    chunk->max_labelmarks = chunk->num_labelmarks + 1;
+
+    chunk->instructions = code;
+    chunk->num_instr    = num;
+    chunk->max_instr    = num + 1;
+    return removed;
+}
+
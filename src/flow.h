@@ -0,0 +1,97 @@
+#ifndef __M1_FLOW_H__
+#define __M1_FLOW_H__
+
+#include "compiler.h"
+#include "instr.h"
+
+/*
+
+Control flow graph of a chunk's code, with its dominator tree, for the
+passes that run on instructions. It's taken from the instruction arena,
+and is out of date once the code is changed.
+
+Registers are identified by a number: the physical registers of all types
+come first, then the virtual registers of each type in turn.
+
+*/
+
+#define NO_BLOCK    (~0u)
+#define NO_LOOP     (~0u)
+#define NO_REG      (~0u)
+
+typedef struct flow_block {
+    unsigned start;     /* first instruction. */
+    unsigned end;       /* one past the last instruction. */
+    unsigned succ[2];   /* successor blocks. */
+    unsigned num_succ;
+
+    unsigned idom;      /* immediate dominator, or NO_BLOCK if not reachable. */
+    unsigned rpo;       /* position in reverse postorder, or NO_BLOCK. */
+    unsigned pre, post; /* interval in the dominator tree, to check dominance. */
+
+} flow_block;
+
+typedef struct flow_loop {
+    unsigned       header;      /* block that all back edges go to. */
+    unsigned char *body;        /* per block: part of the loop. */
+    unsigned       size;        /* number of blocks in the loop. */
+    unsigned       preheader;   /* instruction before which code runs once per entry, or NO_INSTR. */
+
+} flow_loop;
+
+typedef struct flow_graph {
+    flow_block    *blocks;
+    unsigned       num_blocks;
+    unsigned      *block_of;        /* instruction => block. */
+
+    unsigned      *order;           /* reachable blocks in reverse postorder. */
+    unsigned       num_reachable;
+
+    unsigned      *pred_index;      /* predecessors of block b are preds[pred_index[b] .. pred_index[b + 1]). */
+    unsigned      *preds;
+    unsigned      *child_index;     /* children of block b in the dominator tree, likewise. */
+    unsigned      *children;
+
+    unsigned       num_ids;                 /* physical and virtual registers. */
+    unsigned       vbase[REG_TYPE_NUM];     /* id of first virtual register per type. */
+    unsigned       num_vregs[REG_TYPE_NUM]; /* virtual registers when the graph was built. */
+
+    /* per instruction: part of a call sequence, or reads PC; such code may not be changed. */
+    unsigned char *fixed;
+    /* per instruction: runs in a callee's frame, in a call sequence. */
+    unsigned char *foreign;
+
+    /* set by find_loops(); inner loops come before the loops around them. */
+    flow_loop     *loops;
+    unsigned       num_loops;
+    unsigned      *innermost;       /* per block: innermost loop it's in, or NO_LOOP. */
+
+    /* code to insert and remove, for rewrite_code(). */
+    unsigned      *insert_at;       /* per inserted instruction: the instruction it goes before. */
+    m0_instr      *inserted;
+    unsigned       num_inserted, max_inserted;
+    unsigned char *removed;         /* per instruction. */
+    unsigned char *label_before;    /* per label: stays before code that's inserted at it. */
+
+} flow_graph;
+
+extern flow_graph *build_flow_graph(M1_compiler *comp, m0_chunk *chunk);
+
+extern unsigned reg_id(flow_graph const *graph, m0_operand const *op);
+
+extern int has_access(m0_chunk const *chunk, unsigned i, unsigned k, unsigned char access);
+
+extern int leaves_chunk(m0_chunk const *chunk, flow_graph const *graph, unsigned i);
+
+extern int dominates(flow_graph const *graph, unsigned a, unsigned b);
+
+extern void find_loops(M1_compiler *comp, m0_chunk *chunk, flow_graph *graph);
+
+extern void find_unconditional_blocks(flow_graph const *graph, unsigned n, unsigned char *always);
+
+extern void insert_code(M1_compiler *comp, flow_graph *graph, unsigned at, m0_instr const *ins);
+
+extern unsigned rewrite_code(M1_compiler *comp, m0_chunk *chunk, flow_graph *graph);
+
+#endif
+
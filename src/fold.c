@@ -0,0 +1,494 @@
+/*
+
+Constant folding. After type checking, the AST is walked bottom-up, and
+every binary, unary or cast expression whose operands are literals is
+replaced by the literal it evaluates to; so is every use of a constant.
+A few identities, such as x + 0 and x * 1, are simplified as well. The
+code generator then emits a single load instead of code that computes a
+value that was known all along.
+
+Folding must not change what a program does. Integer arithmetic is done
+on 64 bits, as M0 does it; a result that doesn't fit in an int literal is
+left for the runtime, and so is a division or modulo by zero.
+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <assert.h>
+#include "fold.h"
+#include "ast.h"
+#include "symtab.h"
+#include "stats.h"
+
+static void fold_expr(M1_compiler *comp, m1_expression *e);
+
+static void
+fold_error(M1_compiler *comp, unsigned line, char *msg, ...) {
+    va_list argp;
+
+    ++comp->errors;
+    fprintf(stderr, "%s:%d: error: ", comp->current_filename, line);
+
+    va_start(argp, msg);
+    vfprintf(stderr, msg, argp);
+    va_end(argp);
+    fprintf(stderr, "\n");
+}
+
+static void
+fold_list(M1_compiler *comp, m1_expression *e) {
+    for (; e != NULL; e = e->next)
+        fold_expr(comp, e);
+}
+
+/* Turn <e> into <value>; <e> keeps its line number and its place in a list. */
+static void
+replace(M1_compiler *comp, m1_expression *e, m1_expression *value) {
+    e->type = value->type;
+    e->expr = value->expr;
+    STAT_INC(comp, folds);
+}
+
+/* Get the value of literal <e> in <val>; return 0 if <e> isn't an int, num or bool literal. */
+int
+fold_get_value(m1_expression *e, m1_constval *val) {
+    switch (e->type) {
+        case EXPR_INT:
+        case EXPR_CHAR:
+            val->type = EXPR_INT;
+            val->ival = e->expr.as_literal->value.as_int;
+            return 1;
+        case EXPR_TRUE:
+        case EXPR_FALSE:
+            val->type = e->type;
+            val->ival = e->type == EXPR_TRUE;
+            return 1;
+        case EXPR_NUMBER:
+            val->type = EXPR_NUMBER;
+            val->nval = e->expr.as_literal->value.as_double;
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/* Set <result> to the int <value>, if an int literal can hold it. */
+static int
+int_result(m1_constval *result, int64_t value) {
+    if (value < INT_MIN || value > INT_MAX)
+        return 0;
+
+    result->type = EXPR_INT;
+    result->ival = value;
+    return 1;
+}
+
+static int
+bool_result(m1_constval *result, int truth) {
+    result->type = truth ? EXPR_TRUE : EXPR_FALSE;
+    result->ival = truth != 0;
+    return 1;
+}
+
+static int
+num_result(m1_constval *result, double value) {
+    result->type = EXPR_NUMBER;
+    result->nval = value;
+    return 1;
+}
+
+/* Compute <a> <op> <b> on ints or bools. */
+static int
+int_binop(m1_binop op, int64_t a, int64_t b, m1_constval *result) {
+    switch (op) {
+        case OP_PLUS:
+            return int_result(result, a + b);
+        case OP_MINUS:
+            return int_result(result, a - b);
+        case OP_MUL:
+            return int_result(result, a * b);
+        case OP_DIV:
+            return b != 0 && int_result(result, a / b);
+        case OP_MOD:
+            return b != 0 && int_result(result, a % b);
+        case OP_XOR:
+            return int_result(result, a ^ b);
+        case OP_BAND:
+            return int_result(result, a & b);
+        case OP_BOR:
+            return int_result(result, a | b);
+        case OP_LSH:
+            return b >= 0 && b < 64 && int_result(result, (int64_t)((uint64_t)a << b));
+        case OP_RSH:
+            return b >= 0 && b < 64 && int_result(result, a < 0 ? ~(~a >> b) : a >> b);
+        case OP_LRSH:
+            return b >= 0 && b < 64 && int_result(result, (int64_t)((uint64_t)a >> b));
+        case OP_GT:
+            return bool_result(result, a > b);
+        case OP_GE:
+            return bool_result(result, a >= b);
+        case OP_LT:
+            return bool_result(result, a < b);
+        case OP_LE:
+            return bool_result(result, a <= b);
+        case OP_EQ:
+            return bool_result(result, a == b);
+        case OP_NE:
+            return bool_result(result, a != b);
+        default:
+            return 0;
+    }
+}
+
+/* Compute <a> <op> <b> on nums. == and != are left alone, as comparing
+   floating-point numbers for equality isn't reliable anyway, and so is %,
+   which would need the math library.
+ */
+static int
+num_binop(m1_binop op, double a, double b, m1_constval *result) {
+    switch (op) {
+        case OP_PLUS:
+            return num_result(result, a + b);
+        case OP_MINUS:
+            return num_result(result, a - b);
+        case OP_MUL:
+            return num_result(result, a * b);
+        case OP_DIV:
+            return b != 0.0 && num_result(result, a / b);
+        case OP_GT:
+            return bool_result(result, a > b);
+        case OP_GE:
+            return bool_result(result, a >= b);
+        case OP_LT:
+            return bool_result(result, a < b);
+        case OP_LE:
+            return bool_result(result, a <= b);
+        default:
+            return 0;
+    }
+}
+
+/*
+
+Compute <a> <op> <b>, and store it in <result>. If the result can't be
+known at compile time, or an int literal can't hold it, 0 is returned.
+
+*/
+int
+fold_binop(m1_binop op, m1_constval const *a, m1_constval const *b, m1_constval *result) {
+    /* && and || evaluate to their left operand, or to their right operand. */
+    if ((op == OP_AND || op == OP_OR) && a->type != EXPR_NUMBER) {
+        if ((a->ival != 0) == (op == OP_AND))
+            *result = *b;
+        else
+            *result = *a;
+        return 1;
+    }
+
+    if (a->type == EXPR_NUMBER && b->type == EXPR_NUMBER)
+        return num_binop(op, a->nval, b->nval, result);
+    if (a->type != EXPR_NUMBER && b->type != EXPR_NUMBER)
+        return int_binop(op, a->ival, b->ival, result);
+
+    return 0;
+}
+
+/* Compute <op> <a>. ++ and -- change a variable, so they're not done here. */
+int
+fold_unop(m1_unop op, m1_constval const *a, m1_constval *result) {
+    if (op == UNOP_NOT && a->type != EXPR_NUMBER)
+        return bool_result(result, a->ival == 0);
+
+    return 0;
+}
+
+/* Convert <a> to <target>, VAL_INT or VAL_FLOAT. */
+int
+fold_convert(m1_valuetype target, m1_constval const *a, m1_constval *result) {
+    if (target == VAL_FLOAT)
+        return num_result(result, a->type == EXPR_NUMBER ? a->nval : (double)a->ival);
+
+    if (target == VAL_INT) {
+        if (a->type != EXPR_NUMBER)
+            return int_result(result, a->ival);
+        /* the conversion truncates; it must end up in an int literal's range. */
+        if (a->nval > (double)INT_MIN - 1.0 && a->nval < (double)INT_MAX + 1.0)
+            return int_result(result, (int64_t)a->nval);
+    }
+    return 0;
+}
+
+/* Make a literal for <val>; it is entered into the current chunk's constants, if needed. */
+m1_expression *
+fold_literal(M1_compiler *comp, m1_constval const *val) {
+    switch (val->type) {
+        case EXPR_INT:
+            return integer(comp, (int)val->ival);
+        case EXPR_NUMBER:
+            return number(comp, val->nval);
+        default:
+            return expression(comp, val->type);
+    }
+}
+
+static int
+is_int_value(m1_expression *e, int value) {
+    m1_constval val;
+    return fold_get_value(e, &val) && val.type == EXPR_INT && val.ival == value;
+}
+
+static int
+is_num_one(m1_expression *e) {
+    m1_constval val;
+    return fold_get_value(e, &val) && val.type == EXPR_NUMBER && val.nval == 1.0;
+}
+
+/* Simplify <e> if it is an identity, such as x + 0, x * 1 or x || false.
+   Only literals are dropped, so any side effects of x still happen.
+ */
+static void
+simplify_binary(M1_compiler *comp, m1_expression *e, m1_binexpr *b) {
+    switch (b->op) {
+        case OP_PLUS:
+        case OP_BOR:
+        case OP_XOR:
+            if (is_int_value(b->right, 0))
+                replace(comp, e, b->left);
+            else if (is_int_value(b->left, 0))
+                replace(comp, e, b->right);
+            break;
+        case OP_MINUS:
+        case OP_LSH:
+        case OP_RSH:
+        case OP_LRSH:
+            if (is_int_value(b->right, 0))
+                replace(comp, e, b->left);
+            break;
+        case OP_MUL:
+            if (is_int_value(b->right, 1) || is_num_one(b->right))
+                replace(comp, e, b->left);
+            else if (is_int_value(b->left, 1) || is_num_one(b->left))
+                replace(comp, e, b->right);
+            break;
+        case OP_DIV:
+            if (is_int_value(b->right, 1) || is_num_one(b->right))
+                replace(comp, e, b->left);
+            break;
+        case OP_OR:
+            /* if x is 0, x || false is 0 too; otherwise it's x. */
+            if (b->right->type == EXPR_FALSE || is_int_value(b->right, 0))
+                replace(comp, e, b->left);
+            break;
+        default:
+            break;
+    }
+}
+
+static void
+fold_binary(M1_compiler *comp, m1_expression *e) {
+    m1_binexpr *b = e->expr.as_binexpr;
+    m1_constval left, right, result;
+
+    fold_expr(comp, b->left);
+    fold_expr(comp, b->right);
+
+    if (!fold_get_value(b->left, &left)) {
+        simplify_binary(comp, e, b);
+        return;
+    }
+
+    /* if the left operand of && or || is known, so is which operand is the result. */
+    if ((b->op == OP_AND || b->op == OP_OR) && left.type != EXPR_NUMBER) {
+        if ((left.ival != 0) == (b->op == OP_AND))
+            replace(comp, e, b->right);
+        else
+            replace(comp, e, b->left);
+    }
+    else if (fold_get_value(b->right, &right) && fold_binop(b->op, &left, &right, &result))
+        replace(comp, e, fold_literal(comp, &result));
+    else
+        simplify_binary(comp, e, b);
+}
+
+static void
+fold_unary(M1_compiler *comp, m1_expression *e) {
+    m1_unexpr   *u = e->expr.as_unexpr;
+    m1_constval  val, result;
+
+    fold_expr(comp, u->expr);
+
+    if (fold_get_value(u->expr, &val) && fold_unop(u->op, &val, &result))
+        replace(comp, e, fold_literal(comp, &result));
+}
+
+static void
+fold_cast(M1_compiler *comp, m1_expression *e) {
+    m1_castexpr *c = e->expr.as_cast;
+    m1_constval  val, result;
+
+    fold_expr(comp, c->expr);
+
+    if (fold_get_value(c->expr, &val) && fold_convert(c->targettype, &val, &result))
+        replace(comp, e, fold_literal(comp, &result));
+}
+
+static void
+fold_object(M1_compiler *comp, m1_object *obj) {
+    if (obj == NULL)
+        return;
+
+    switch (obj->type) {
+        case OBJECT_LINK:
+            fold_object(comp, obj->parent);
+            fold_object(comp, obj->obj.as_link);
+            break;
+        case OBJECT_INDEX:
+            fold_expr(comp, obj->obj.as_index);
+            break;
+        default:
+            break;
+    }
+}
+
+static int
+is_literal(m1_expression *e) {
+    m1_constval val;
+    return e->type == EXPR_STRING || fold_get_value(e, &val);
+}
+
+/* An object that names a constant is replaced by the constant's value. That
+   value was folded when the constant's declaration was visited; if it isn't a
+   literal, the constant was used before its declaration, or in its own value.
+ */
+static void
+fold_use(M1_compiler *comp, m1_expression *e) {
+    m1_object *obj = e->expr.as_object;
+
+    if (obj->type != OBJECT_MAIN || obj->sym == NULL || obj->sym->constdecl == NULL) {
+        fold_object(comp, obj);
+        return;
+    }
+
+    if (is_literal(obj->sym->constdecl->value))
+        replace(comp, e, obj->sym->constdecl->value);
+    else
+        fold_error(comp, e->line, "constant '%s' is used before its value is known", obj->obj.as_name);
+}
+
+/* The value of a constant must be known at compile time. */
+static void
+fold_constdecl(M1_compiler *comp, m1_const *c, unsigned line) {
+    fold_expr(comp, c->value);
+
+    if (!is_literal(c->value))
+        fold_error(comp, line, "value of constant '%s' is not known at compile time", c->name);
+}
+
+static void
+fold_vardecl(M1_compiler *comp, m1_var *v) {
+    for (; v != NULL; v = v->next)
+        fold_list(comp, v->init);
+}
+
+static void
+fold_switch(M1_compiler *comp, m1_switch *s) {
+    m1_case *c;
+
+    fold_expr(comp, s->selector);
+
+    for (c = s->cases; c != NULL; c = c->next)
+        fold_expr(comp, c->block);
+
+    fold_expr(comp, s->defaultstat);
+}
+
+static void
+fold_expr(M1_compiler *comp, m1_expression *e) {
+    if (e == NULL)
+        return;
+
+    switch (e->type) {
+        case EXPR_BINARY:
+            fold_binary(comp, e);
+            break;
+        case EXPR_UNARY:
+            fold_unary(comp, e);
+            break;
+        case EXPR_CAST:
+            fold_cast(comp, e);
+            break;
+        case EXPR_OBJECT:
+            fold_use(comp, e);
+            break;
+        case EXPR_ADDRESS:
+        case EXPR_DEREF:
+            fold_object(comp, e->expr.as_object);
+            break;
+        case EXPR_ASSIGN:
+            fold_object(comp, e->expr.as_assign->lhs);
+            fold_expr(comp, e->expr.as_assign->rhs);
+            break;
+        case EXPR_BLOCK:
+            fold_list(comp, e->expr.as_block->stats);
+            break;
+        case EXPR_WHILE:
+        case EXPR_DOWHILE:
+            fold_expr(comp, e->expr.as_whileexpr->cond);
+            fold_expr(comp, e->expr.as_whileexpr->block);
+            break;
+        case EXPR_FOR:
+            fold_list(comp, e->expr.as_forexpr->init);
+            fold_expr(comp, e->expr.as_forexpr->cond);
+            fold_list(comp, e->expr.as_forexpr->step);
+            fold_expr(comp, e->expr.as_forexpr->block);
+            break;
+        case EXPR_IF:
+            fold_expr(comp, e->expr.as_ifexpr->cond);
+            fold_expr(comp, e->expr.as_ifexpr->ifblock);
+            fold_expr(comp, e->expr.as_ifexpr->elseblock);
+            break;
+        case EXPR_SWITCH:
+            fold_switch(comp, e->expr.as_switch);
+            break;
+        case EXPR_FUNCALL:
+            fold_list(comp, e->expr.as_funcall->arguments);
+            break;
+        case EXPR_NEW:
+            fold_list(comp, e->expr.as_newexpr->args);
+            break;
+        case EXPR_PRINT:
+            fold_list(comp, e->expr.as_expr);
+            break;
+        case EXPR_RETURN:
+            fold_expr(comp, e->expr.as_expr);
+            break;
+        case EXPR_VARDECL:
+            fold_vardecl(comp, e->expr.as_var);
+            break;
+        case EXPR_CONSTDECL:
+            fold_constdecl(comp, e->expr.as_const, e->line);
+            break;
+        default: /* literals, break, continue and M0 blocks. */
+            break;
+    }
+}
+
+/* Fold the expressions in <chunk>. New literals are entered into its constants segment. */
+void
+fold_chunk(M1_compiler *comp, m1_chunk *chunk) {
+    comp->currentchunk = chunk;
+    fold_list(comp, chunk->block->stats);
+}
+
+/* Fold the expressions in all chunks. */
+void
+fold(M1_compiler *comp, m1_chunk *ast) {
+    m1_chunk *iter;
+
+    for (iter = ast; iter != NULL; iter = iter->next)
+        fold_chunk(comp, iter);
+}
+
@@ -0,0 +1,38 @@
+#ifndef __M1_FOLD_H__
+#define __M1_FOLD_H__
+
+#include <stdint.h>
+#include "compiler.h"
+#include "ast.h"
+#include "symtab.h"
+
+/*
+
+Constant folding runs on the AST after type checking. Expressions
+whose value is known at compile time are replaced by a literal, and
+uses of constants by their values.
+
+The arithmetic is available to other passes as well, on m1_constval
+values, so that they compute exactly what folding would.
+
+*/
+
+/* A value that is known at compile time. Bools are kept in <ival>, as 0 or 1. */
+typedef struct m1_constval {
+    m1_expr_type type;      /* EXPR_INT, EXPR_NUMBER, EXPR_TRUE or EXPR_FALSE. */
+    int64_t      ival;
+    double       nval;
+
+} m1_constval;
+
+extern int fold_get_value(m1_expression *e, m1_constval *val);
+extern int fold_binop(m1_binop op, m1_constval const *a, m1_constval const *b, m1_constval *result);
+extern int fold_unop(m1_unop op, m1_constval const *a, m1_constval *result);
+extern int fold_convert(m1_valuetype target, m1_constval const *a, m1_constval *result);
+extern m1_expression *fold_literal(M1_compiler *comp, m1_constval const *val);
+
+extern void fold_chunk(M1_compiler *comp, m1_chunk *chunk);
+extern void fold(M1_compiler *comp, m1_chunk *ast);
+
+#endif
+
@@ -27,12 +27,23 @@ This happens in gencode_number().
 #include "symtab.h"
 #include "decl.h"
 #include "instr.h"
+#include "arena.h"
+#include "emit.h"
+#include "intern.h"
+#include "stats.h"
+#include "regalloc.h"
+#include "peephole.h"
+#include "cse.h"
+#include "licm.h"
+#include "ivsr.h"
+#include "unroll.h"
+#include "dce.h"
 
 #include "semcheck.h" /* for warning(). */
 
 #include "ann.h"
 
-#define OUT	stdout
+#define OUT	comp->emitter
 
 
 #define M1DEBUG     1
@@ -65,34 +76,58 @@ static void
 reset_reg(M1_compiler *comp) {
     /* Set all fields in the registers table to 0. */
     memset(comp->registers, 0, sizeof(char) * REG_NUM * REG_TYPE_NUM);    
+    memset(comp->vregs, 0, sizeof(comp->vregs));
 }
 
 #define REG_UNUSED  0
 #define REG_USED    1
 #define REG_SYMBOL  2
 
+/*
+
+Registers are allocated in two steps. While generating code, alloc_reg() 
+hands out a fresh virtual register for each value; after a chunk's code
+is complete, allocate_registers() (in regalloc.c) computes where each
+virtual register is live, and maps them to physical registers, reusing
+a register as soon as its value is no longer needed.
+
+With option -r, the register allocator is switched off, and alloc_reg()
+hands out physical registers directly: the first one that isn't in use.
+Registers are then never reused within a chunk; once they run out, virtual
+registers are handed out after all, which allocate_registers() spills.
+
+*/
 static m1_reg
 alloc_reg(M1_compiler *comp, m1_valuetype type) {
     m1_reg r;
     int i = 0;
-    /* look for first empty slot. */
-    while (i < REG_NUM && comp->registers[type][i] != REG_UNUSED) {
-        i++;
-    }
-    
-    /* XXX Need to properly handle spilling when out of registers. */
-    if (i >= REG_NUM) {
-        fprintf(stderr, "Out of registers!! Resetting it, hoping for the best!\n");
-        memset(comp->registers[type], 0, sizeof(char) * REG_NUM);
-    }
     
+    STAT_INC(comp, reg_allocs);
     
-    /* set the newly allocated register to "used". */
-    comp->registers[type][i] = REG_USED;
+    if (comp->no_reg_opt) {
+        /* look for first empty slot. */
+        while (i < SPILL_BASE && comp->registers[type][i] != REG_UNUSED) {
+            i++;
+        }
+        comp->stats->reg_scans += i + 1;
+        
+        if (i < SPILL_BASE) {
+            /* set the newly allocated register to "used". */
+            comp->registers[type][i] = REG_USED;
+            
+            r.no   = i;    
+            r.type = type;
+            return r;
+        }
+    }
     
-    /* return the register. */
-    r.no        = i;    
-    r.type      = type;
+    if (REG_NUM + comp->vregs[type] > MAX_VREG) {
+        fprintf(stderr, "chunk %s is too large: out of virtual registers\n", 
+                comp->current_m0chunk->name);
+        exit(EXIT_FAILURE);   
+    }
+    r.no   = REG_NUM + comp->vregs[type]++;
+    r.type = type;
     return r;
 }
 
@@ -103,13 +138,18 @@ no longer need. Sometimes, these registers have been assigned to a symbol.
 Symbols get to keep what they get. In order to prevent very difficult code, 
 just note that the register is used by a symbol by "freezing" it. 
 When free_reg() is called on it (after it's frozen), it won't be freed by 
-free_reg().
+free_reg(). This only matters for physical registers; virtual registers 
+are released by the register allocator.
 
 */
 static void
 freeze_reg(M1_compiler *comp, m1_reg r) {
     assert(comp != NULL);
     assert(r.type < REG_TYPE_NUM);
+    
+    if (r.no >= REG_NUM) 
+        return;
+        
     assert(r.no < REG_NUM);
     assert(r.no >= 0);
     
@@ -126,7 +166,7 @@ static void
 free_reg(M1_compiler *comp, m1_reg r) {
     
     /* if m1 was invoked with -r, then switch off free_reg(). */
-    if (comp->no_reg_opt)
+    if (comp->no_reg_opt || r.no >= REG_NUM)
         return;
     
     /* if it's not frozen, it may be freed. */
@@ -151,28 +191,19 @@ free_reg(M1_compiler *comp, m1_reg r) {
 
 
 
-/* Iterate over all symbols in the symboltable <table>. Get each symbol's
-   type and register number, and unfreeze them. 
+/* Iterate over all symbols in the symboltable <table>, and warn about the
+   ones that never got a register, as they're never used. A symbol's register 
+   doesn't need to be released at the end of its block; the register allocator
+   reuses it after the symbol's last use. Constants never get a register, as
+   their uses were replaced by their values.
  */
 static void
-unfreeze_registers(M1_compiler *comp, m1_symboltable *table) {
-    if (comp->no_reg_opt) /* don't do this if option -r was specified. */
-        return;
-        
+warn_unused_symbols(M1_compiler *comp, m1_symboltable *table) {
     m1_symbol *iter = sym_get_table_iter(table);
     
     while (iter != NULL) {
-        /* if num elems == 1 take the typedecl's type, otherwise it's an array. */
-        m1_valuetype type  = iter->num_elems == 1 ? iter->typedecl->valtype : VAL_INT;
-        int          regno = iter->regno;
-    
-        if (regno != NO_REG_ALLOCATED_YET) {
-            assert(comp->registers[type][regno] == REG_SYMBOL);
-            comp->registers[type][regno] = REG_UNUSED;    
-        }
-        else { /* if no register is allocated, it's an unused variable. Emit a warning*/            
+        if (iter->regno == NO_REG_ALLOCATED_YET && iter->constdecl == NULL) 
             warning(comp, iter->line, "unused variable '%s'\n", iter->name);   
-        }
 
         iter = sym_iter_next(iter);
     }
@@ -187,6 +218,7 @@ Generate label identifiers.
 static int
 gen_label(M1_compiler *comp) {
     assert(comp != NULL);
+    STAT_INC(comp, labels);
 	return ++comp->label;	
 }
 
@@ -610,8 +642,9 @@ OBJECT_LINK------>     L3
                     m1_reg last           = popreg(comp->regstack);   /* latest added; store here for now. */
                     m1_reg field          = popreg(comp->regstack);   /* 2nd latest, this one needs to be removed. */
                     m1_reg parentreg      = popreg(comp->regstack);   /* x in x[2][3]. */                
-                    m1_reg size_reg       = alloc_reg(comp, VAL_INT); /* to hold amount to add. */
-                    m1_reg updated_parent = alloc_reg(comp, VAL_INT); /* need to copy base address from parent. */
+                    m1_reg size_reg       = alloc_reg(comp, VAL_INT); /* to hold size of the dimension. */
+                    m1_reg offset         = alloc_reg(comp, VAL_INT); /* to hold amount to add. */
+                    m1_reg updated_parent = alloc_reg(comp, VAL_INT); /* base address plus offset. */
                        
                     /* 3 registers only the case when 2 dimensions are parsed, e.g., x[10][20].
                        Find the size of the first dimension, since that's the one that's 
@@ -656,15 +689,18 @@ OBJECT_LINK------>     L3
                      
                      */ 
                     INS (M0_SET_IMM, "%I, %d, %d", size_reg.no, 0, current_dimension->num_elems);
-                    INS (M0_MULT_I,  "%I, %I, %I", field.no, field.no, size_reg.no);
                     
-                    /* Need to have the following instruction (set X, Y), otherwise it doesn't work. */
-                    INS (M0_SET,   "%I, %I",     updated_parent.no, parentreg.no);
-                    INS (M0_ADD_I, "%I, %I, %I", updated_parent.no, updated_parent.no, field.no);
+                    /* The index and the base may be variables' own registers; don't overwrite
+                       them. Each value gets its own register, so that the optimizer can tell
+                       the address is computed from the index (see src/ivsr.c).
+                     */
+                    INS (M0_MULT_I,  "%I, %I, %I", offset.no, field.no, size_reg.no);
+                    INS (M0_ADD_I,   "%I, %I, %I", updated_parent.no, parentreg.no, offset.no);
                                     
                     pushreg(comp->regstack, updated_parent);   /* push back address of "x+[2]" */
                     pushreg(comp->regstack, last);             /* push back the latest added one. */
                     
+                    free_reg(comp, offset);
                     free_reg(comp, size_reg);
                     free_reg(comp, field);
                     free_reg(comp, parentreg);
@@ -748,7 +784,7 @@ OBJECT_LINK------>     L3
             assert((*parent)->sym->typedecl != NULL);
                         
             /* parent's symbol has a typedecl node, which holds the structdef (d.s), which has a symbol table. */
-            m1_symbol *fieldsym = sym_lookup_symbol(&(*parent)->sym->typedecl->d.as_struct->sfields, obj->obj.as_name);
+            m1_symbol *fieldsym = sym_lookup_symbol(comp, &(*parent)->sym->typedecl->d.as_struct->sfields, obj->obj.as_name);
                        
             assert(fieldsym != NULL);
             
@@ -795,6 +831,215 @@ OBJECT_LINK------>     L3
 }
 
 
+/* Go to <label> if the value in <reg> is true (nonzero) and <when> is 1, or if
+   it's false and <when> is 0; fall through otherwise.
+ */
+static void
+jump_if(M1_compiler *comp, m1_reg reg, int label, int when) {
+    /*
+      goto_if LABEL, reg            # when true
+
+      goto_if LSKIP, reg            # when false
+      goto LABEL
+    LSKIP:
+    */
+    if (when) {
+        INS (M0_GOTO_IF, "%L, %R", label, reg);
+    }
+    else {
+        int skiplabel = gen_label(comp);
+
+        INS (M0_GOTO_IF, "%L, %R", skiplabel, reg);
+        INS (M0_GOTO, "%L", label);
+        LABEL (skiplabel);
+    }
+}
+
+/* Branch on comparison <b>: a > b, a >= b, a < b or a <= b. */
+static void
+gencode_compare_branch(M1_compiler *comp, m1_binexpr *b, int label, int when) {
+    /*
+      a < b is b > a; a jump if it's false tests the opposite:
+
+      isge_i  result, a, b
+      goto_if LABEL, result
+    */
+    m1_reg left, right, x, y, result;
+    int    opcode = (b->op == OP_GT || b->op == OP_LT) ? M0_ISGT_I : M0_ISGE_I;
+    
+    gencode_expr(comp, b->left);
+    left = popreg(comp->regstack);
+    
+    gencode_expr(comp, b->right);
+    right = popreg(comp->regstack);
+    
+    /* x <opcode> y */
+    x = (b->op == OP_LT || b->op == OP_LE) ? right : left;
+    y = (b->op == OP_LT || b->op == OP_LE) ? left : right;
+    
+    /* !(x > y) is (y >= x), and !(x >= y) is (y > x); not so for nums, which may be NaN. */
+    if (!when && x.type == VAL_INT && y.type == VAL_INT) {
+        m1_reg t = x;
+        
+        x      = y;
+        y      = t;
+        opcode = opcode == M0_ISGT_I ? M0_ISGE_I : M0_ISGT_I;
+        when   = 1;
+    }
+    
+    result = alloc_reg(comp, VAL_INT);
+    INS (opcode + x.type, "%I, %R, %R", result.no, x, y);
+    
+    free_reg(comp, left);
+    free_reg(comp, right);
+    
+    jump_if(comp, result, label, when);
+    free_reg(comp, result);
+}
+
+/* Can gencode_branch() jump on <e> being <when> without going around a goto? */
+static int
+is_direct_branch(m1_expression *e, int when) {
+    switch (e->type) {
+        case EXPR_TRUE:
+        case EXPR_FALSE:
+            return 1;
+        case EXPR_UNARY:
+            if (e->expr.as_unexpr->op == UNOP_NOT)
+                return is_direct_branch(e->expr.as_unexpr->expr, !when);
+            return when;
+        case EXPR_BINARY: {
+            m1_binexpr *b = e->expr.as_binexpr;
+
+            switch (b->op) {
+                case OP_AND:
+                case OP_OR:
+                    if ((b->op == OP_AND) != when)
+                        return is_direct_branch(b->left, when) && is_direct_branch(b->right, when);
+                    return is_direct_branch(b->left, !when) && is_direct_branch(b->right, when);
+                case OP_GT:
+                case OP_GE:
+                case OP_LT:
+                case OP_LE:
+                    return 1;   /* unless it compares nums. */
+                case OP_EQ:
+                    return !when;
+                case OP_NE:
+                    return when;
+                default:
+                    return when;
+            }
+        }
+        default:
+            return when;
+    }
+}
+
+/* Is <op> one that gencode_binary_branch() handles? */
+static int
+is_condition(m1_binop op) {
+    switch (op) {
+        case OP_AND: case OP_OR:
+        case OP_GT: case OP_GE: case OP_LT: case OP_LE:
+        case OP_EQ: case OP_NE:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static void gencode_branch(M1_compiler *comp, m1_expression *e, int label, int when);
+
+/* Branch on <b>, which is a condition: &&, ||, a comparison, == or !=. */
+static void
+gencode_binary_branch(M1_compiler *comp, m1_binexpr *b, int label, int when) {
+    switch (b->op) {
+        case OP_AND:
+        case OP_OR:
+            /* a && b is false, and a || b is true, as soon as a is. */
+            if ((b->op == OP_AND) != when) {
+                gencode_branch(comp, b->left, label, when);
+                gencode_branch(comp, b->right, label, when);
+            }
+            else {
+                int skiplabel = gen_label(comp);
+                
+                gencode_branch(comp, b->left, skiplabel, !when);
+                gencode_branch(comp, b->right, label, when);
+                LABEL (skiplabel);
+            }
+            break;
+        case OP_EQ:
+        case OP_NE: {
+            /* the difference is nonzero if a != b. */
+            m1_reg left, right, diff;
+            
+            gencode_expr(comp, b->left);
+            left = popreg(comp->regstack);
+            
+            gencode_expr(comp, b->right);
+            right = popreg(comp->regstack);
+            
+            diff = alloc_reg(comp, VAL_INT);
+            INS (M0_SUB_I, "%I, %R, %R", diff.no, left, right);
+            
+            free_reg(comp, left);
+            free_reg(comp, right);
+            
+            jump_if(comp, diff, label, b->op == OP_NE ? when : !when);
+            free_reg(comp, diff);
+            break;
+        }
+        default:
+            gencode_compare_branch(comp, b, label, when);
+            break;
+    }
+}
+
+/*
+
+Generate code for condition <e> that goes to <label> if <e> is true and <when>
+is 1, or if <e> is false and <when> is 0; otherwise, it falls through. The
+truth of the condition is never stored as a value: && and || jump as soon as
+the outcome is known, ! swaps what is jumped on, and the result of a
+comparison goes straight into goto_if.
+
+*/
+static void
+gencode_branch(M1_compiler *comp, m1_expression *e, int label, int when) {
+    switch (e->type) {
+        case EXPR_TRUE:
+        case EXPR_FALSE:
+            if ((e->type == EXPR_TRUE) == when)
+                INS (M0_GOTO, "%L", label);
+            return;
+        case EXPR_UNARY:
+            if (e->expr.as_unexpr->op == UNOP_NOT) {
+                gencode_branch(comp, e->expr.as_unexpr->expr, label, !when);
+                return;
+            }
+            break;
+        case EXPR_BINARY:
+            if (is_condition(e->expr.as_binexpr->op)) {
+                gencode_binary_branch(comp, e->expr.as_binexpr, label, when);
+                return;
+            }
+            break;
+        default:
+            break;
+    }
+    
+    /* any other value is true if it's nonzero. */
+    {
+        m1_reg reg;
+        
+        gencode_expr(comp, e);
+        reg = popreg(comp->regstack);
+        
+        jump_if(comp, reg, label, when);
+        free_reg(comp, reg);
+    }
+}
 
 static void
 gencode_while(M1_compiler *comp, m1_whileexpr *w) {
@@ -804,11 +1049,9 @@ gencode_while(M1_compiler *comp, m1_whileexpr *w) {
 	LBLOCK
 	  <block>	
 	LTEST:
-	   code for <cond>
-	   goto_if <cond>, LBLOCK
+	   <jump to LBLOCK if cond is true>
 	   ...	
 	*/
-	m1_reg reg;
 	int startlabel = gen_label(comp), 
 	    endlabel   = gen_label(comp);
 	
@@ -823,12 +1066,7 @@ gencode_while(M1_compiler *comp, m1_whileexpr *w) {
 	
 	LABEL (endlabel);
 	
-	gencode_expr(comp, w->cond);
-	reg = popreg(comp->regstack);
-	
-	INS (M0_GOTO_IF, "%L, %R", startlabel, reg);
-	
-	free_reg(comp, reg);
+	gencode_branch(comp, w->cond, startlabel, 1);
 			
 	/* remove break and continue labels from stack. */
 	(void)pop(comp->breakstack);
@@ -841,12 +1079,9 @@ gencode_dowhile(M1_compiler *comp, m1_whileexpr *w) {
 	
 	LSTART:
 	  <code for block>
-	  cond = <code for cond>
-	  goto_if LSTART, cond
+	  <jump to LSTART if cond is true>
 	  
 	*/
-    m1_reg reg;
-    
     int startlabel = gen_label(comp);
     int endlabel   = gen_label(comp);
     
@@ -857,20 +1092,84 @@ gencode_dowhile(M1_compiler *comp, m1_whileexpr *w) {
     
     gencode_expr(comp, w->block);
     
-    gencode_expr(comp, w->cond);
-    reg = popreg(comp->regstack);
-    
-    INS (M0_GOTO_IF, "%L, %R", startlabel, reg);
+    gencode_branch(comp, w->cond, startlabel, 1);
 
     LABEL (endlabel);
     
-    free_reg(comp, reg);
-    
     (void)pop(comp->breakstack);
     (void)pop(comp->continuestack);
 
 }
 
+/* Generate one iteration of an unrolled for loop: the block, and the step
+   that continue statements in this copy of the block go to.
+ */
+static void
+gencode_for_iteration(M1_compiler *comp, m1_forexpr *i) {
+    int steplabel = gen_label(comp);
+
+    push(comp->continuestack, steplabel);
+
+    if (i->block)
+        gencode_expr(comp, i->block);
+
+    LABEL (steplabel);
+
+    if (i->step)
+        gencode_exprlist(comp, i->step);
+
+    (void)pop(comp->continuestack);
+}
+
+static void
+gencode_unrolled_for(M1_compiler *comp, m1_forexpr *i, unsigned trips, unsigned factor) {
+    /*
+    for (init ; cond ; step) block, run <trips> times, <factor> iterations per test
+    (see src/unroll.c). If factor == trips, there's no test at all.
+
+      <code for init>
+      <block and step>      # trips % factor times
+    LSTART:
+      <jump to LEND if cond is false>
+      <block and step>      # factor times
+      goto LSTART
+    LEND:
+
+    */
+    int      startlabel = 0,
+             endlabel   = gen_label(comp);
+    unsigned n;
+
+    push(comp->breakstack, endlabel);
+
+    if (i->block->type == EXPR_BLOCK)
+        comp->currentsymtab = &i->block->expr.as_block->locals;
+
+    gencode_exprlist(comp, i->init);
+
+    for (n = 0; n < trips % factor; n++)
+        gencode_for_iteration(comp, i);
+
+    if (factor < trips) {
+        startlabel = gen_label(comp);
+
+        LABEL (startlabel);
+        gencode_branch(comp, i->cond, endlabel, 0);
+    }
+
+    for (n = 0; n < factor; n++)
+        gencode_for_iteration(comp, i);
+
+    if (factor < trips)
+        INS (M0_GOTO, "%L", startlabel);
+
+    LABEL (endlabel);
+
+    (void)pop(comp->breakstack);
+
+    STAT_INC(comp, loops_unrolled);
+}
+
 static void
 gencode_for(M1_compiler *comp, m1_forexpr *i) {
 	/*		
@@ -878,20 +1177,24 @@ gencode_for(M1_compiler *comp, m1_forexpr *i) {
 	
       <code for init>
 	LSTART:
-	  <code for cond>
-	  goto_if cond, LBLOCK
-      goto LEND
-    LBLOCK: 
+	  <jump to LEND if cond is false>
       <code for block>
       <code for step>
 	  goto LSTART
 	LEND:
 	
 	*/
-    int startlabel = gen_label(comp), 
-        endlabel   = gen_label(comp),
-        steplabel  = gen_label(comp), 
-        blocklabel = gen_label(comp); /* label where the block starts */
+    int startlabel, endlabel, steplabel;
+    unsigned trips, factor = unroll_factor(comp, i, &trips);
+
+    if (factor > 0) {
+        gencode_unrolled_for(comp, i, trips, factor);
+        return;
+    }
+
+    startlabel = gen_label(comp);
+    endlabel   = gen_label(comp);
+    steplabel  = gen_label(comp);
         
     push(comp->breakstack, endlabel);
     push(comp->continuestack, steplabel); /* continue still executes the "step" part in a for loop*/
@@ -904,19 +1207,11 @@ gencode_for(M1_compiler *comp, m1_forexpr *i) {
 
     LABEL (startlabel); 
 	
-    if (i->cond) {
-        m1_reg reg;
-        gencode_expr(comp, i->cond);
-        reg = popreg(comp->regstack);
-        
-        INS (M0_GOTO_IF, "%L, %R", blocklabel, reg);        
-
-        free_reg(comp, reg);
-    }   
-
-    INS (M0_GOTO, "%L", endlabel);
-    
-    LABEL (blocklabel);
+    /* without a condition, the loop is left right away. */
+    if (i->cond)
+        gencode_branch(comp, i->cond, endlabel, 0);
+    else
+        INS (M0_GOTO, "%L", endlabel);
     
     if (i->block) 
         gencode_expr(comp, i->block);
@@ -937,39 +1232,57 @@ gencode_for(M1_compiler *comp, m1_forexpr *i) {
 static void 
 gencode_if(M1_compiler *comp, m1_ifexpr *i) {
 	/*	
-      result = <evaluate condition>
-	  goto_if LIF, result
+	  <jump to LELSE if condition is false>
+	  <code for ifblock>
+	  goto LEND                 # if there's an else block
+    LELSE:
+	  <code for elseblock>
+	LEND:
+	
+	  or, if it takes less code to jump if the condition is true:
+	  
+	  <jump to LIF if condition is true>
 	  <code for elseblock>
 	  goto LEND
-    LIF:
+	LIF:
 	  <code for ifblock>
 	LEND:
 	
 	*/
-    m1_reg condreg;
-    int endlabel = gen_label(comp),
-        iflabel  = gen_label(comp);
+    int elselabel = gen_label(comp);
 
-	
-    gencode_expr(comp, i->cond);
+    if (!is_direct_branch(i->cond, 0) && is_direct_branch(i->cond, 1)) {
+        int iflabel  = elselabel,
+            endlabel = gen_label(comp);
+        
+        gencode_branch(comp, i->cond, iflabel, 1);
+        
+        if (i->elseblock)
+            gencode_expr(comp, i->elseblock);
+        INS (M0_GOTO, "%L", endlabel);
+        
+        LABEL (iflabel);
+        gencode_expr(comp, i->ifblock);
+        LABEL (endlabel);
+        return;
+    }
 
-    condreg = popreg(comp->regstack);
+    gencode_branch(comp, i->cond, elselabel, 0);
 
-    INS (M0_GOTO_IF, "%L, %R", iflabel, condreg);
+    /* if block */
+    gencode_expr(comp, i->ifblock);
 
-    free_reg(comp, condreg);
-    
     /* else block */
-    if (i->elseblock) {            	
-        gencode_expr(comp, i->elseblock);     
+    if (i->elseblock) {
+        int endlabel = gen_label(comp);
+
+        INS (M0_GOTO, "%L", endlabel);
+        LABEL (elselabel);
+        gencode_expr(comp, i->elseblock);
+        LABEL (endlabel);
     }
-    INS (M0_GOTO, "%L", endlabel);
-    
-    /* if block */
-    LABEL (iflabel);
-    gencode_expr(comp, i->ifblock);
-			
-    LABEL (endlabel);
+    else
+        LABEL (elselabel);
          
 }
 
@@ -991,35 +1304,13 @@ static void
 gencode_return(M1_compiler *comp, m1_expression *e) {
         
     m1_reg chunk_index,
-           retpc_reg;
+           retpc_reg,
+           retvalreg;
     
     if (e != NULL) {
-        /* returning a value:
-          
-           <code for expr> # result is stored in RY.
-           
-           set_imm IX, 0, R0   # get the number of index R0 and store in IX
-           set_ref CF, IX, RY  # store value in RY in CF[IX].
-        */
+        /* returning a value: the result is stored in RY. */
         gencode_expr(comp, e);
-
-        m1_reg retvalreg = popreg(comp->regstack);
-        m1_reg indexreg  = alloc_reg(comp, VAL_INT);
-        
-        /* load the number of register R0 */
-        m1_reg reg_zero;
-        reg_zero.type = retvalreg.type;
-        reg_zero.no   = 0;
-        INS (M0_SET_IMM, "%I, %d, %R", indexreg.no, reg_zero);
-  
-        /* index the current callframe, and set in its R0 register the value from the return expression. */
-        INS (M0_SET_REF, "%X, %I, %R", CF, indexreg.no, retvalreg);
-
-        free_reg(comp, indexreg);
-        free_reg(comp, retvalreg);
-
-        /*  make register available. XXX is this needed? */
-
+        retvalreg = popreg(comp->regstack);
     }
 
     /* instructions to return:
@@ -1028,6 +1319,7 @@ gencode_return(M1_compiler *comp, m1_expression *e) {
        deref      IX, PCF, IX
        set_imm    IY, 0, CHUNK
        deref      IY, PCF, IY
+       set        R0, RY        # if returning a value
        goto_chunk IY, IX
     */
 
@@ -1042,156 +1334,63 @@ gencode_return(M1_compiler *comp, m1_expression *e) {
     
     INS (M0_DEREF,   "%I, %X, %I", chunk_index.no, PCF, chunk_index.no);
     
+    if (e != NULL) {
+        /* the caller looks for the return value in register R0 of this frame. 
+           Store it there last, so that the registers needed to return are 
+           allocated elsewhere. 
+         */
+        m1_reg r0;
+        
+        r0.no   = 0;
+        r0.type = retvalreg.type;
+        INS (M0_SET, "%R, %R", r0, retvalreg);
+        free_reg(comp, retvalreg);
+    }
+    
     INS (M0_GOTO_CHUNK, "%I, %I", chunk_index.no, retpc_reg.no);    
     
     free_reg(comp, chunk_index);    
     free_reg(comp, retpc_reg);
 }
 
-static void
-gencode_or(M1_compiler *comp, m1_binexpr *b) {
-	/*
-	  a || b
-	  
-	  left = <evaluate a>
-	  goto_if LEND, left
-	  right = <evaluate b>
-	  left = right 
-	LEND:
-	
-	*/
-	m1_reg left, right;
-	int endlabel;
-	
-	endlabel = gen_label(comp);
-	
-	/* generate code for left and get the register holding the result. */
-	gencode_expr(comp, b->left);	
-	left = popreg(comp->regstack);
-	
-	/* if left was not true, then need to evaluate right, otherwise short-cut. */
-	INS (M0_GOTO_IF, "%L, %R", endlabel, left);
-	
-	/* generate code for right, and get the register holding the result. */
-	gencode_expr(comp, b->right);	
-	right = popreg(comp->regstack);
-	
-	/* copy the result from evaluating <right> into the reg. for left, and make it available on stack. */
-	INS (M0_SET, "%R, %R", left, right);
+/*
 
-	pushreg(comp->regstack, left);
-	free_reg(comp, right);
-	
-	LABEL (endlabel);
-		
-}
+The value of a condition: &&, ||, == or !=. It's computed with the jumps that
+gencode_binary_branch() makes, into a register that holds 1 or 0.
 
+*/
 static void
-gencode_and(M1_compiler *comp, m1_binexpr *b) {
-	/*
-	  a && b
-	  
-	  left = <evaluate a>
-	  goto_if LRIGHT, left, 
-	  goto LEND
-	LRIGHT:
-	  right = <evaluate b>
-	  left = right
-	LEND:
-	*/
-	m1_reg left, right;
-	int endlabel  = gen_label(comp);
-	int evalright = gen_label(comp);
-	
-	gencode_expr(comp, b->left);
-	left = popreg(comp->regstack);
-	
-	/* if left was false, no need to evaluate right, and go to end. */
-	INS (M0_GOTO_IF, "%L, %R", evalright, left);
-	INS (M0_GOTO,    "%L", endlabel);
-	LABEL (evalright);
-	
-	gencode_expr(comp, b->right);
-	right = popreg(comp->regstack);
-	
-	/* copy result from right to left result reg, as that's the reg that will be returned. */
-	INS (M0_SET, "%R, %R", left, right);
-	LABEL (endlabel);
-	
-	free_reg(comp, right);
-	pushreg(comp->regstack, left);
+gencode_condition_value(M1_compiler *comp, m1_binexpr *b) {
+    /*
+      result = 0
+      <jump to LEND if condition is false>
+      result = 1
+    LEND:
+    */
+    m1_reg result   = alloc_reg(comp, VAL_INT);
+    int    endlabel = gen_label(comp);
+    
+    INS (M0_SET_IMM, "%I, %d, %d", result.no, 0, 0);
+    gencode_binary_branch(comp, b, endlabel, 0);
+    INS (M0_SET_IMM, "%I, %d, %d", result.no, 0, 1);
+    LABEL (endlabel);
+    
+    pushreg(comp->regstack, result);
 }
 
+
 /*
 
-Helper function for != and == ops. The code generation template is the same,
-except for one field. This is parameterized with the parameter is_eq_op, which
-indicates whether it's the == op (is_eq_op = true) or the != op (is_eq_op = false).
+Common code generation for < and <= operators. Note that the operands <left> 
+and <right> are swapped! Therefore, even though this code is _very_ similar
+to other binary math ops (which also handle isgt and isge), this routine
+is different. This /could/ be refactored but it's better for clarity it's not.
 
 */
 static void
-ne_eq_common(M1_compiler *comp, m1_binexpr *b, int is_eq_op) {
-    /* code for EQ; NE swaps the result.
-    
-      left  = <code for left>
-      right = <code for right>
-      diff  = left - right
-      goto_if NOTEQUAL, diff # not zero
-      result = 1
-      goto END
-    NOTEQUAL:
-      result = 0
-    END:
-    
-    */
-    m1_reg reg, 
-           left, 
-           right;
-           
-    int endlabel, 
-        eq_ne_label;
-    
-    gencode_expr(comp, b->left);
-    left = popreg(comp->regstack);
-    
-    gencode_expr(comp, b->right);
-    right = popreg(comp->regstack);
-    
-    endlabel    = gen_label(comp);
-    eq_ne_label = gen_label(comp);
-    
-    reg = alloc_reg(comp, VAL_INT);
-    
-    INS (M0_SUB_I, "%I, %R, %R", reg.no, left, right);
-                                                      
-    INS (M0_GOTO_IF, "%L, %R", eq_ne_label, reg);
-    INS (M0_SET_IMM, "%R, %d, %d", reg, 0, is_eq_op);
-    INS (M0_GOTO, "%L", endlabel);                                                    
-    
-    LABEL (eq_ne_label);
-    INS (M0_SET_IMM, "%R, %d, %d", reg, 0, !is_eq_op);
-    LABEL (endlabel);
-
-    
-    free_reg(comp, left);
-    free_reg(comp, right);
-    
-    pushreg(comp->regstack, reg);
-}
-
-
-/*
-
-Common code generation for < and <= operators. Note that the operands <left> 
-and <right> are swapped! Therefore, even though this code is _very_ similar
-to other binary math ops (which also handle isgt and isge), this routine
-is different. This /could/ be refactored but it's better for clarity it's not.
-
-*/
-static void
-lt_le_common(M1_compiler *comp, m1_binexpr *b, int opcode) {
-    m1_reg result = alloc_reg(comp, VAL_INT);
-    m1_reg left, right;
+lt_le_common(M1_compiler *comp, m1_binexpr *b, int opcode) {
+    m1_reg result = alloc_reg(comp, VAL_INT);
+    m1_reg left, right;
     
     gencode_expr(comp, b->left);
     left = popreg(comp->regstack);
@@ -1294,16 +1493,10 @@ gencode_binary(M1_compiler *comp, m1_binexpr *b) {
             lt_le_common(comp, b, M0_ISGE_I);
             break;
         case OP_EQ:
-            ne_eq_common(comp, b, 1);  /* 1 means is_eq_op is true. */
-            break;
-        case OP_NE: /* a != b;*/
-            ne_eq_common(comp, b, 0); /* 0 means is_eq_op is false. */
-            break;
+        case OP_NE:
         case OP_AND: /* a && b */
-            gencode_and(comp, b);
-            break;
         case OP_OR: /* a || b */
-            gencode_or(comp, b);
+            gencode_condition_value(comp, b);
             break;
         case OP_BAND:
             gencode_binary_bitwise(comp, b, M0_AND);
@@ -1333,60 +1526,21 @@ gencode_binary(M1_compiler *comp, m1_binexpr *b) {
 
 static void
 gencode_not(M1_compiler *comp, m1_unexpr *u) {
-    m1_reg reg, 
-           temp;
-           
-    int label1, 
-        label2;
-    
-    gencode_expr(comp, u->expr);
-    reg  = popreg(comp->regstack);  
-
-      
-    /* If reg is zero, make it nonzero (false->true).
-       If it's non-zero, make it zero. (true->false). 
-    */
     /*
-      goto_if reg, L1 #non-zero, make it zero.
-      set_imm Ix, 0, 0
-      goto L2
-    L1: # nonzero, make it zero
-      set_imm Ix, 0, 1
-    L2:
-      set reg, Ix
-    
+      result = 0
+      <jump to LEND if operand is true>
+      result = 1
+    LEND:
     */
-    label1 = gen_label(comp);
-    label2 = gen_label(comp);
+    m1_reg result   = alloc_reg(comp, VAL_INT);
+    int    endlabel = gen_label(comp);
     
-    INS (M0_GOTO_IF, "%L, %R", label1, reg);
-
-#if PRELOAD01    
-    temp.no   = 1;
-    temp.type = VAL_INT;
-#else
-    temp = alloc_reg(comp, VAL_INT);
-    INS (M0_SET_IMM, "%I, %d, %d", temp.no, 0, 1);
-#endif    
-
-    INS (M0_GOTO, "%L", label2);
-    LABEL (label1);
-
-#if PRELOAD01
-    temp.no   = 0;
-    temp.type = VAL_INT;
-#else    
-    temp = alloc_reg(comp, VAL_INT);
-    INS (M0_SET_IMM, "%I, %d, %d", temp.no, 0, 0);
-#endif        
-
-    LABEL (label2);
-    INS (M0_SET, "%R, %I", reg, temp.no);
+    INS (M0_SET_IMM, "%I, %d, %d", result.no, 0, 0);
+    gencode_branch(comp, u->expr, endlabel, 1);
+    INS (M0_SET_IMM, "%I, %d, %d", result.no, 0, 1);
+    LABEL (endlabel);
     
-   
-    free_reg(comp, reg);
-    pushreg(comp->regstack, temp);
-   
+    pushreg(comp->regstack, result);
 }
 
 static void 
@@ -1491,223 +1645,253 @@ gencode_break(M1_compiler *comp) {
     INS (M0_GOTO, "%L", breaklabel);    
 }
 
-/* Generate sequence for a function call, including setting arguments
- * and retrieving return value.
- * XXX this function needs a bit of refactoring, cleaning up and comments.
+/* Get physical register <no> of type <type>, for use in a callee's frame; 
+   register 0 holds the return value, so that's never used. 
+ */
+static m1_reg
+scratch_reg(m1_valuetype type, int no) {
+    m1_reg r;
+    
+    r.type = type;
+    r.no   = no > 0 ? no : 1;
+    assert(r.no + 2 < REG_NUM);
+    return r;
+}
+
+/* Load the size of the frame for the callees of the current chunk into a new
+   register. The size is set once all chunks are generated, so it's loaded from
+   a constant of its own. Like the length that copy_mem takes, it's in bytes:
+   8 per register, while m1_chunk's framesize counts registers.
+ */
+static m1_reg
+callee_frame_size(M1_compiler *comp) {
+    m1_chunk *c   = comp->currentchunk;
+    m1_reg    reg = alloc_reg(comp, VAL_INT);
+
+    if (c->calleesize == NULL)
+        c->calleesize = sym_enter_unshared_int(comp, &c->constants);
+
+    INS (M0_SET_IMM, "%I, %d, %d", reg.no, c->calleesize->constindex >> 8, 
+                                          c->calleesize->constindex & 0xff);
+    INS (M0_DEREF,   "%I, %X, %I", reg.no, CONSTS, reg.no);
+    return reg;
+}
+
+/* With --trace-frames, print a line whenever a call allocates a frame, so that
+   the allocations a program makes can be counted (see bench_m1.pl).
  */
 static void
+trace_frame(M1_compiler *comp) {
+    m1_symbol *line = sym_enter_str(comp, &comp->currentchunk->constants, 
+                                    intern(comp, "\"frame allocated\\n\""));
+    m1_reg     index = alloc_reg(comp, VAL_INT),
+               str   = alloc_reg(comp, VAL_STRING),
+               one   = alloc_reg(comp, VAL_INT);
+
+    INS (M0_SET_IMM, "%I, %d, %d", index.no, line->constindex >> 8, line->constindex & 0xff);
+    INS (M0_DEREF,   "%S, %X, %I", str.no, CONSTS, index.no);
+    INS (M0_SET_IMM, "%I, %d, %d", one.no, 0, 1);
+    INS (M0_PRINT_S, "%I, %S", one.no, str.no);
+
+    free_reg(comp, index);
+    free_reg(comp, str);
+    free_reg(comp, one);
+}
+
+/* Load the number <value> into a new register. The constants of a call
+   sequence are set apart from the instructions that use them, so that they
+   can be shared by all calls in a chunk.
+ */
+static m1_reg
+call_constant(M1_compiler *comp, unsigned value) {
+    m1_reg reg = alloc_reg(comp, VAL_INT);
+
+    INS (M0_SET_IMM, "%I, %d, %d", reg.no, value >> 8, value & 0xff);
+    return reg;
+}
+
+/*
+
+Generate the sequence for a function call, including setting arguments and
+retrieving the return value:
+
+      <code for the arguments>
+      goto_if    L, PF              # the callee's frame, if there's
+      set_imm    IS, 0, <size>      #   none yet; <size> is a constant,
+      deref      IS, CONSTS, IS     #   in bytes, like IH
+      gc_alloc   PF, IS, IZ
+  L:
+      set_ref    PF, IA, RA         # for each argument, IA is its register
+      copy_mem   PF, CF, IH         # take this frame's header,
+      set_ref    PF, IK, CF         #   but PCF is this frame
+      set_ref    PF, IZ, PF         #   and CF the callee's own
+      add_i      RETPC, PC, IR      # return to after the goto_chunk
+      set_imm    IT, 0, 2
+      add_i      IU, PC, IT         # the callee's frame goes on after
+      set_ref    PF, IT, IU         #   the "set CF"; PC is 2 as well
+      set        CF, PF
+
+      set_imm    I1, 0, <callee>    # now in the callee's frame
+      deref      I1, CONSTS, I1
+      set_imm    I0, 0, 0
+      goto_chunk I1, I0
+
+      set_imm    I9, 0, CF          # back; make this frame's CF itself
+      set_ref    PCF, I9, PCF
+      set_imm    I9, 0, PC          # this frame goes on after the
+      add_i      I1, PC, I9         #   "set CF, PCF"; PC is 2 as well
+      set_ref    PCF, I9, I1
+      set        CF, PCF
+
+      deref      RY, PF, IA         # IA is the return value's register
+
+The header copy (the special registers CF to SPILLCF) gives the callee the
+INTERP, CONSTS and BCS that the code up to the goto_chunk needs; goto_chunk
+sets CHUNK, CONSTS, MDS and BCS to the callee's. The callee only reads its
+RETPC and SPILLCF after it set them itself, so the copied ones do no harm.
+The callee doesn't change this frame's CHUNK and the like either, so there's
+nothing to restore but PC and CF.
+
+A chunk's callees share one frame (see below), so it must be large enough
+for each of them. Their sizes are only known once all chunks are generated,
+so the size is a constant of the calling chunk whose value is filled in
+after the chunk was written (see set_frame_sizes()). The call sequence 
+itself uses registers in the callee's frame too: the arguments, the return
+value, and I0 to I2 from the goto_chunk on, above any I arguments.
+
+PF is special register SPC4RENT, which is free for such use; the arguments
+are done before it's set, so a call among them can't change it. The frame
+is kept there for all calls that this activation of the chunk makes: it's
+only used from the goto_chunk until the return value is taken, and M1 has
+no way to hold on to a frame after that, so it can be set up again for
+the next call. A chunk that calls sets PF to 0 on entry, as it has its
+caller's from the header copy (see gencode_chunk()). Recursion still
+allocates a frame per activation, as each one has its own PF. All
+constants in this frame but IT are set by call_constant(), where CSE and
+loop-invariant code motion can reuse them. From the add_i to RETPC on, the
+instructions are counted, so there must be no spill code. The passes leave
+that code alone, and IT and IU are only live for the next instruction or
+two, so register allocation never spills them (see allocate_registers()).
+They're ordinary registers, so the frame needs no more than the chunk uses.
+
+*/
+static void
 gencode_funcall(M1_compiler *comp, m1_funcall *funcall) {    
     assert(funcall->funsym != NULL);
         
-    m1_reg  pc_reg, 
-           cont_offset;
-     
-    m1_reg cf_reg   = alloc_reg(comp, VAL_CHUNK);
-    m1_reg sizereg  = alloc_reg(comp, VAL_INT);
-    m1_reg flagsreg = alloc_reg(comp, VAL_INT);
-    
-    /* create a new call frame */
-    /* alloc_cf: */
-    INS(M0_SET_IMM, "%I, %d, %d", sizereg.no, 0, 198);
-    INS(M0_SET_IMM, "%I, %d, %d", flagsreg.no, 0, 0);
-    INS(M0_GC_ALLOC, "%P, %I, %I", cf_reg.no, sizereg.no, flagsreg.no);
-   
-    free_reg(comp, sizereg);
-    free_reg(comp, flagsreg);
-
-    
-    /* store arguments in registers of new callframe.
-       XXX this still needs to be specced for M0's calling conventions. */
-       
-    m1_expression *argiter = funcall->arguments;
-
- 
+    m1_expression *argiter;
+    m1_reg        *args;
+    m1_reg         pc_index, pc_reg, sizereg, zeroreg, indexreg;
+    unsigned       num_args = 0, i, need;
+    int            havelabel;
     int regindexes[4] = { M0_REG_I0, 
                           M0_REG_N0, 
                           M0_REG_S0, 
                           M0_REG_P0};
-    
-    /* For each argument:
-    
-    set_imm IX, 0, <new register> # get value of argument type's register.
-    set_ref PY, IX, RZ # index the CF to call with that index and copy the argument into it.
-    
-    */
-    while (argiter != NULL) {
-        m1_reg argreg;
-        m1_reg indexreg = alloc_reg(comp, VAL_INT);
+
+    /* evaluate the arguments; they're stored once the callee's frame exists. */
+    for (argiter = funcall->arguments; argiter != NULL; argiter = argiter->next)
+        num_args++;
+
+    args = (m1_reg *)arena_alloc(comp->instr_arena, (num_args + 1) * sizeof (m1_reg));
+
+    for (argiter = funcall->arguments, i = 0; argiter != NULL; argiter = argiter->next, i++) {
         gencode_expr(comp, argiter);
-        argreg = popreg(comp->regstack);
-        
-        INS (M0_SET_IMM, "%I, %d, %d", indexreg.no, 0, regindexes[argreg.type]);
-        INS (M0_SET_REF, "%P, %I, %R", cf_reg.no, indexreg.no, argreg);
-     
-        regindexes[argreg.type]++;
-        
-        argiter = argiter->next;   
-    
-        /* indexreg should NOT be unused. XXX need to find out why. 
-        free_reg(comp, indexreg);
-        */
-        free_reg(comp, argreg);
-        
+        args[i] = popreg(comp->regstack);
     }
 
-    
-    /* init_cf_copy: */
-    m1_reg temp = alloc_reg(comp, VAL_INT);   
-    INS (M0_SET_IMM, "%I, %d, %X", temp.no, 0, INTERP);
-    INS (M0_SET_REF, "%P, %I, %X", cf_reg.no, temp.no, INTERP); 
-   
-    INS (M0_SET_IMM, "%I, %d, %X", temp.no, 0, CHUNK);
-    INS (M0_SET_REF, "%P, %I, %X", cf_reg.no, temp.no, CHUNK); 
-      
-    INS (M0_SET_IMM, "%I, %d, %X", temp.no, 0, CONSTS);
-    INS (M0_SET_REF, "%P, %I, %X", cf_reg.no, temp.no, CONSTS); 
-    
-    INS (M0_SET_IMM, "%I, %d, %X", temp.no, 0, MDS);
-    INS (M0_SET_REF, "%P, %I, %X", cf_reg.no, temp.no, MDS); 
-      
-    INS (M0_SET_IMM, "%I, %d, %X", temp.no, 0, BCS);
-    INS (M0_SET_REF, "%P, %I, %X", cf_reg.no, temp.no, BCS); 
-   
-    INS (M0_SET_IMM, "%I, %d, %X", temp.no, 0, PCF);
-    INS (M0_SET_REF, "%P, %I, %X", cf_reg.no, temp.no, CF); 
-
+    /* create a call frame, unless an earlier call in this activation did. */
+    havelabel = gen_label(comp);
+    zeroreg   = call_constant(comp, 0);
+    INS (M0_GOTO_IF, "%L, %X", havelabel, SPC4RENT);
+    sizereg = callee_frame_size(comp);
+    INS (M0_GC_ALLOC, "%X, %I, %I", SPC4RENT, sizereg.no, zeroreg.no);
+    if (comp->trace_frames)
+        trace_frame(comp);
+    free_reg(comp, sizereg);
+    free_reg(comp, zeroreg);
+    LABEL (havelabel);
 
-    INS (M0_SET_IMM, "%I, %d, %X", temp.no, 0, CF);
-    INS (M0_SET_REF, "%P, %I, %P", cf_reg.no, temp.no, cf_reg.no);     
-      
-    /* init_cf_zero: */
-    m1_reg temp2 = alloc_reg(comp, VAL_INT);
-    INS (M0_SET_IMM, "%I, %d, %d", temp.no, 0, 0);
-    INS (M0_SET_IMM, "%I, %d, %X", temp2.no, 0, EH);
-    INS (M0_SET_REF, "%P, %I, %I", cf_reg.no, temp2.no, temp.no);     
-  
-    INS (M0_SET_IMM, "%I, %d, %X", temp2.no, 0, RETPC);
-    INS (M0_SET_REF, "%P, %I, %I", cf_reg.no, temp2.no, temp.no);     
-   
-    INS (M0_SET_IMM, "%I, %d, %X", temp2.no, 0, SPILLCF);
-    INS (M0_SET_REF, "%P, %I, %I", cf_reg.no, temp2.no, temp.no);     
-   
-    free_reg(comp, temp2);
-
-    /* init_cf_retpc: */    
-    INS (M0_SET_IMM, "%I, %d, %d", temp.no, 0, 10);
-    INS (M0_ADD_I,   "%X, %X, %I", RETPC, PC, temp.no);         
-  
-    free_reg(comp, temp);
-
-    cont_offset = alloc_reg(comp, VAL_INT);
-    pc_reg      = alloc_reg(comp, VAL_INT);
-    
-    /* init_cf_pc */
-    INS (M0_SET_IMM, "%I, %d, %d", cont_offset.no, 0, 3);
-    INS (M0_ADD_I,   "%I, %I, %X", cont_offset.no, cont_offset.no, PC);
-    INS (M0_SET_IMM, "%I, %d, %X", pc_reg.no, 0, PC);
-    INS (M0_SET_REF, "%P, %I, %I", cf_reg.no, pc_reg.no, cont_offset.no);
-   
-    free_reg(comp, cont_offset);
-    free_reg(comp, pc_reg);
+    /* the callee's frame must fit the callee, which is found through its constant. */
+    comp->currentchunk->constants.consts[funcall->constindex]->chunk = funcall->funsym->chunk;
 
-    INS (M0_SET, "%X, %P", CF, cf_reg.no);
-  
-    /* post_set:   
-    # put the name of the target chunk into S0
-    set_imm P0, 0, 3
-    deref   P0, CONSTS, P0
-    # put the target PC into I0
-    set_imm I0, 0, 0
-    goto_chunk P0, I0, x
-*/
+    /* store arguments in registers of new callframe.
+       XXX this still needs to be specced for M0's calling conventions. */
+    need = regindexes[funcall->typedecl->valtype] + 1; /* the return value. */
+    for (i = 0; i < num_args; i++) {
+        if (regindexes[args[i].type] + 1u > need)
+            need = regindexes[args[i].type] + 1;
+        indexreg = call_constant(comp, regindexes[args[i].type]++);
+        INS (M0_SET_REF, "%X, %I, %R", SPC4RENT, indexreg.no, args[i]);
+        free_reg(comp, indexreg);
+        free_reg(comp, args[i]);
+    }
 
-    int calledfun_index = funcall->constindex;
-    INS (M0_SET_IMM, "%P, %d, %d", cf_reg.no, 0, calledfun_index);
-    INS (M0_DEREF,   "%P, %X, %P", cf_reg.no, CONSTS, cf_reg.no);
-    
-    m1_reg I0 = alloc_reg(comp, VAL_INT);    
-    INS (M0_SET_IMM, "%I, %d, %d", I0.no, 0, 0);
-    INS (M0_GOTO_CHUNK, "%P, %I", cf_reg.no, I0.no);
-    
-    free_reg(comp, I0);
+    /* copy this frame's header, then set what differs. */
+    indexreg = call_constant(comp, (SPILLCF + 1) * 8);
+    INS (M0_COPY_MEM, "%X, %X, %I", SPC4RENT, CF, indexreg.no);
+    free_reg(comp, indexreg);
 
+    indexreg = call_constant(comp, PCF);
+    INS (M0_SET_REF, "%X, %I, %X", SPC4RENT, indexreg.no, CF);
+    free_reg(comp, indexreg);
 
-    /*
-    # We're back, so fix the parent call frame's PC and activate it.
-    # The current CF's CHUNK, CONSTS, etc are updated by goto_chunk, so use
-    # those values to update PCF.
-    */
-    
-    /*
-    retpc:
-    restore_cf:
-    */
+    indexreg = call_constant(comp, CF);
+    INS (M0_SET_REF, "%X, %I, %X", SPC4RENT, indexreg.no, SPC4RENT);
+    free_reg(comp, indexreg);
 
-    m1_reg I9 = alloc_reg(comp, VAL_INT);  
-/*
-    # set PCF[CHUNK] to the current call frame's CHUNK
-    set_imm  I9,  0,  CHUNK
-    set_ref  PCF, I9, CHUNK
-    # set PCF[CONSTS] to the current call frame's CONSTS
-    set_imm  I9,  0,  CONSTS 
-    set_ref  PCF, I9, CONSTS
-    # set PCF[MDS] to the current call frame's MDS
-    set_imm  I9,  0,  MDS
-    set_ref  PCF, I9, MDS
-    # set PCF[BCS] to the current call frame's BCS
-    set_imm  I9,  0,  BCS
-    set_ref  PCF, I9, BCS
-*/
-    INS (M0_SET_IMM, "%I, %d, %X", I9.no, 0, CHUNK);
-    INS (M0_SET_REF, "%X, %I, %X", PCF, I9.no, CHUNK);
+    /* the offsets from PC count the instructions in between. */
+    indexreg = call_constant(comp, 9);
+    INS (M0_ADD_I,   "%X, %X, %I", RETPC, PC, indexreg.no);
+    free_reg(comp, indexreg);
 
-    INS (M0_SET_IMM, "%I, %d, %X", I9.no, 0, CONSTS);
-    INS (M0_SET_REF, "%X, %I, %X", PCF, I9.no, CONSTS);    
+    pc_index = alloc_reg(comp, VAL_INT);
+    pc_reg   = alloc_reg(comp, VAL_INT);
+    INS (M0_SET_IMM, "%I, %d, %X", pc_index.no, 0, PC);
+    INS (M0_ADD_I,   "%I, %X, %I", pc_reg.no, PC, pc_index.no);
+    INS (M0_SET_REF, "%X, %I, %I", SPC4RENT, pc_index.no, pc_reg.no);
+    free_reg(comp, pc_reg);
+    free_reg(comp, pc_index);
+    INS (M0_SET,     "%X, %X", CF, SPC4RENT);
+  
+    /* From here until the parent's frame is activated again, CF is the callee's 
+       frame, so all registers are the callee's. Use fixed registers that don't
+       hold the callee's arguments (before the call) or its return value (after). 
+     */
+    m1_reg I0      = scratch_reg(VAL_INT, regindexes[VAL_INT] - M0_REG_I0);
+    m1_reg I9      = scratch_reg(VAL_INT, I0.no + 1);
+    m1_reg I1      = scratch_reg(VAL_INT, I0.no + 2);
 
-    INS (M0_SET_IMM, "%I, %d, %X", I9.no, 0, MDS);
-    INS (M0_SET_REF, "%X, %I, %X", PCF, I9.no, MDS);    
+    /* the chunk goes in an I register, so that a frame without P registers will do. */
+    m1_reg I_chunk = I9;
 
-    INS (M0_SET_IMM, "%I, %d, %X", I9.no, 0, BCS);
-    INS (M0_SET_REF, "%X, %I, %X", PCF, I9.no, BCS);    
+    if (M0_REG_I0 + I1.no + 1u > need)
+        need = M0_REG_I0 + I1.no + 1;
+    if (need > comp->currentchunk->callframe)
+        comp->currentchunk->callframe = need;
+  
+    int calledfun_index = funcall->constindex;
+    INS (M0_SET_IMM, "%I, %d, %d", I_chunk.no, 0, calledfun_index);
+    INS (M0_DEREF,   "%I, %X, %I", I_chunk.no, CONSTS, I_chunk.no);
     
-    /* set_cf_pc: */
-    /*
-    # Set PCF[PC] to the invoke_cf + 1 so that when we invoke PCF with
-    # "set CF, PCF, x", control flow will continue at the next instruction.
-    */
-    /*
-    set_imm I1,  0,  5
-    add_i   I1,  PC, I1
-    set_imm I9,  0,  PC
-    set_ref PCF, I9, I1
-    set_imm I9,  0,  CF
-    set_ref PCF, I9, PCF
-    */
-    m1_reg I1 = alloc_reg(comp, VAL_INT);    
-    INS (M0_SET_IMM, "%I, %d, %d", I1.no, 0, 5);
-    INS (M0_ADD_I,   "%I, %X, %I", I1.no, PC, I1.no);
-    INS (M0_SET_IMM, "%I, %d, %X", I9.no, 0, PC);
-    INS (M0_SET_REF, "%X, %I, %I", PCF, I0.no, I1.no);
+    INS (M0_SET_IMM, "%I, %d, %d", I0.no, 0, 0);
+    INS (M0_GOTO_CHUNK, "%I, %I", I_chunk.no, I0.no);
+
+    /* We're back, so set the parent call frame's CF to itself again, and
+       its PC to the "set CF, PCF" below, so that control flow continues at
+       the next instruction.
+     */
     INS (M0_SET_IMM, "%I, %d, %X", I9.no, 0, CF);
     INS (M0_SET_REF, "%X, %I, %X", PCF, I9.no, PCF);
-  
-    free_reg(comp, I9);
-    free_reg(comp, I1);
-    /* invoke_cf: */
-    
-    /*
-    set     CF, PCF, x
-    */
+    INS (M0_SET_IMM, "%I, %d, %X", I9.no, 0, PC);
+    INS (M0_ADD_I,   "%I, %X, %I", I1.no, PC, I9.no);
+    INS (M0_SET_REF, "%X, %I, %I", PCF, I9.no, I1.no);
+
     INS (M0_SET, "%X, %X", CF, PCF);
     
-    /* generate code to get the return value. */
-    /*
-     set_imm IX, 0, R0  # get the number of register R0 into IX
-     deref   RY, PZ, IX # index the callee's CF with that index, and store result in RY
-    
-    */
-    /* retrieve the return value. */
-    m1_reg idxreg           = alloc_reg(comp, VAL_INT);
+    /* retrieve the return value: index the callee's frame with the index 
+       _of_ register X0. That's where the callee left any return value. 
+     */
     m1_reg retvaltarget_reg = alloc_reg(comp, funcall->typedecl->valtype);
 
     regindexes[VAL_INT]    = M0_REG_I0;
@@ -1715,22 +1899,12 @@ gencode_funcall(M1_compiler *comp, m1_funcall *funcall) {
     regindexes[VAL_STRING] = M0_REG_S0;
     regindexes[VAL_CHUNK]  = M0_REG_P0;
     
-    unsigned regzero = regindexes[funcall->typedecl->valtype];
-    /* load the number of register I0. */    
-    INS (M0_SET_IMM, "%I, %d, %d", idxreg.no, 0, regzero); 
-    
-    /* index the callee's frame (Px) with the index _of_ register X0. 
-       That's where the callee left any return value. 
-     */
-     
-    INS (M0_DEREF, "%R, %P, %I", retvaltarget_reg, cf_reg.no, idxreg.no);     
+    indexreg = call_constant(comp, regindexes[funcall->typedecl->valtype]);
+    INS (M0_DEREF, "%R, %X, %I", retvaltarget_reg, SPC4RENT, indexreg.no);     
+    free_reg(comp, indexreg);
                                                
     /* make it available for use by another statement. */    
     pushreg(comp->regstack, retvaltarget_reg);
-    
-    /* we're accessing the callee's CF, so only free its register now.*/
-    free_reg(comp, cf_reg);
-    free_reg(comp, idxreg);
 }
 
 
@@ -1821,6 +1995,174 @@ gencode_exprlist(M1_compiler *comp, m1_expression *expr) {
     }    
 }
 
+/* switches with fewer cases than this are a chain of tests. */
+#define SWITCH_TREE_MIN     5
+
+/* switches with at least this many cases, that take up at least half of the
+   range from the lowest to the highest, use a jump table. */
+#define SWITCH_TABLE_MIN    10
+
+/* most cases that a leaf of a compare tree tests one after another. */
+#define SWITCH_LEAF_SIZE    3
+
+typedef struct switch_case {
+    int value;
+    int label;
+
+} switch_case;
+
+static int
+compare_cases(void const *a, void const *b) {
+    int x = ((switch_case const *)a)->value,
+        y = ((switch_case const *)b)->value;
+
+    return x < y ? -1 : x > y;
+}
+
+/* Make a label for each case of <cases>, in the same order, into <*labels>;
+   and return a list of the cases sorted by value. Return NULL if the switch
+   is a chain of tests: if it has few cases, if two of them have the same
+   value, or if a value doesn't fit in set_imm.
+ */
+static switch_case *
+sort_cases(M1_compiler *comp, m1_case *cases, switch_case **labels, unsigned *num_cases) {
+    switch_case *sorted;
+    m1_case     *iter;
+    unsigned     n = 0, i;
+
+    for (iter = cases; iter != NULL; iter = iter->next) {
+        if (iter->selector < 0 || iter->selector > 0xffff)
+            return NULL;
+        n++;
+    }
+    if (n < SWITCH_TREE_MIN)
+        return NULL;
+
+    *labels = (switch_case *)arena_alloc(comp->instr_arena, 2 * n * sizeof (switch_case));
+    sorted  = *labels + n;
+
+    for (iter = cases, i = 0; iter != NULL; iter = iter->next, i++) {
+        (*labels)[i].value = iter->selector;
+        (*labels)[i].label = gen_label(comp);
+    }
+    memcpy(sorted, *labels, n * sizeof (switch_case));
+    qsort(sorted, n, sizeof (switch_case), compare_cases);
+
+    for (i = 1; i < n; i++) {
+        if (sorted[i].value == sorted[i - 1].value)
+            return NULL;
+    }
+    *num_cases = n;
+    return sorted;
+}
+
+/* Jump to the label of the case among <cases>, sorted by value, that selector
+   <sel> is equal to, or to <deflabel>: with a binary search, down to a few cases
+   that are tested one by one.
+ */
+static void
+gencode_switch_tree(M1_compiler *comp, m1_reg sel, switch_case const *cases, unsigned n, int deflabel) {
+    m1_reg   test = alloc_reg(comp, VAL_INT);
+    unsigned mid  = n / 2,
+             i;
+
+    if (n <= SWITCH_LEAF_SIZE) {
+        for (i = 0; i < n; i++) {
+            int value = cases[i].value,
+                next  = i + 1 < n ? gen_label(comp) : deflabel;
+
+            INS (M0_SET_IMM, "%I, %d, %d", test.no, value >> 8, value & 0xff);
+            INS (M0_SUB_I,   "%I, %I, %I", test.no, sel.no, test.no);
+            INS (M0_GOTO_IF, "%L, %I", next, test.no);
+            INS (M0_GOTO,    "%L", cases[i].label);
+            if (next != deflabel)
+                LABEL (next);
+        }
+        free_reg(comp, test);
+        return;
+    }
+
+    /* the cases below the middle one are on the left, the rest on the right. */
+    {
+        int value = cases[mid].value,
+            left  = gen_label(comp);
+
+        INS (M0_SET_IMM, "%I, %d, %d", test.no, value >> 8, value & 0xff);
+        INS (M0_ISGT_I,  "%I, %I, %I", test.no, test.no, sel.no);
+        INS (M0_GOTO_IF, "%L, %I", left, test.no);
+        free_reg(comp, test);
+
+        gencode_switch_tree(comp, sel, cases + mid, n - mid, deflabel);
+        LABEL (left);
+        gencode_switch_tree(comp, sel, cases, mid, deflabel);
+    }
+}
+
+/*
+
+Jump to the label of the case among <cases>, sorted by value, that selector
+<sel> is equal to, or to <deflabel>, through a jump table: a goto_if for every
+value from the lowest case to the highest, that goes to the case's label, or
+to <deflabel> for values that have no case. Once the selector is known to be
+in range, it's turned into the position of its goto_if, counted from PC:
+
+      set_imm    K, 0, <2 - lowest>      # or sub_i, with <lowest - 2>
+      add_i      K, <sel>, K
+      add_i      T, K, PC
+      goto_chunk CHUNK, T
+      goto_if    LCASE_lowest, T         # T isn't 0, so these always jump.
+      goto_if    LCASE_lowest_plus_1, T
+      ...
+
+The passes that run on the code treat goto_chunk to the chunk's own CHUNK as
+falling through into the table, and leave the table where it is. T must not
+be spilled, as that would put spill code between PC and the table; it's set
+by the add_i that reads PC, which the passes leave alone, and only read by
+the goto_chunk and the table right after it. No other register is set in
+between, so register allocation never spills it.
+
+*/
+static void
+gencode_switch_table(M1_compiler *comp, m1_reg sel, switch_case const *cases, unsigned n, int deflabel) {
+    m1_reg   test    = alloc_reg(comp, VAL_INT);
+    m1_reg   target;
+    int      lowest  = cases[0].value,
+             highest = cases[n - 1].value,
+             value;
+    unsigned i;
+
+    INS (M0_SET_IMM, "%I, %d, %d", test.no, lowest >> 8, lowest & 0xff);
+    INS (M0_ISGT_I,  "%I, %I, %I", test.no, test.no, sel.no);
+    INS (M0_GOTO_IF, "%L, %I", deflabel, test.no);
+    INS (M0_SET_IMM, "%I, %d, %d", test.no, highest >> 8, highest & 0xff);
+    INS (M0_ISGT_I,  "%I, %I, %I", test.no, sel.no, test.no);
+    INS (M0_GOTO_IF, "%L, %I", deflabel, test.no);
+
+    /* the table starts two instructions after the one that reads PC. */
+    if (lowest >= 2) {
+        INS (M0_SET_IMM, "%I, %d, %d", test.no, (lowest - 2) >> 8, (lowest - 2) & 0xff);
+        INS (M0_SUB_I,   "%I, %I, %I", test.no, sel.no, test.no);
+    }
+    else {
+        INS (M0_SET_IMM, "%I, %d, %d", test.no, 0, 2 - lowest);
+        INS (M0_ADD_I,   "%I, %I, %I", test.no, sel.no, test.no);
+    }
+
+    target = alloc_reg(comp, VAL_INT);
+    INS (M0_ADD_I,       "%I, %I, %X", target.no, test.no, PC);
+    INS (M0_GOTO_CHUNK,  "%X, %I", CHUNK, target.no);
+    free_reg(comp, test);
+
+    for (value = lowest, i = 0; value <= highest; value++) {
+        int label = deflabel;
+
+        if (value == cases[i].value)
+            label = cases[i++].label;
+        INS (M0_GOTO_IF, "%L, %I", label, target.no);
+    }
+    free_reg(comp, target);
+}
+
 static void
 gencode_switch(M1_compiler *comp, m1_switch *expr) {
     /*
@@ -1853,12 +2195,34 @@ gencode_switch(M1_compiler *comp, m1_switch *expr) {
     TEST4:
       <code for default>
     END: #break statements will go here.
+
+    Once a case's code is done, the tests of the cases after it are made; if
+    no two cases have the same value, they all fail, and the default runs.
+    So with SWITCH_TREE_MIN cases or more, a switch jumps to the right case
+    right away, from a compare tree or a jump table, and each case but the
+    last ends with a jump to the default:
+
+      sel = <evaluate selector>
+      <jump to CASE1, CASE2 or CASE3 if sel is val1, val2 or val3, else to DEFAULT>
+    CASE1:
+      <code for stat1>
+      goto DEFAULT
+    CASE2:
+      <code for stat2>
+      goto DEFAULT
+    CASE3:
+      <code for stat3>
+    DEFAULT:
+      <code for default>
+    END:
       
     */
-    m1_case *caseiter;
-    m1_reg   reg;    
-    m1_reg   test     = alloc_reg(comp, VAL_INT);    
-    int      endlabel = gen_label(comp);
+    m1_case     *caseiter;
+    m1_reg       reg;    
+    int          endlabel = gen_label(comp);
+    switch_case *labels,
+                *sorted;
+    unsigned     num_cases;
 
     
     /* evaluate selector */
@@ -1867,33 +2231,59 @@ gencode_switch(M1_compiler *comp, m1_switch *expr) {
     
     push(comp->breakstack, endlabel); /* for break statements to jump to. */    
 
-    /* iterate over cases and generate code for each. */
-    caseiter = expr->cases;    
-    while (caseiter != NULL) {
-        int testlabel;  
-        
-        /* reuse register "test". */
-        int selector  = caseiter->selector;
-        int remainder = selector % 256;
-        int num256    = (selector - remainder) / 256;
-        
-        INS (M0_SET_IMM, "%I, %d, %d", test.no, num256, selector);
-        INS (M0_SUB_I,   "%I, %I, %I", test.no, reg.no, test.no);
-        
-        testlabel = gen_label(comp);
-        INS (M0_GOTO_IF, "%L, %I", testlabel, test.no);        
-        
-        /* generate code for this case's block. Note this "block" is a list of expressions. */
-        gencode_exprlist(comp, caseiter->block);
-        
-        /* next test label. */
-        LABEL (testlabel);
-        
-        caseiter = caseiter->next;   
+    sorted = sort_cases(comp, expr->cases, &labels, &num_cases);
+    if (sorted != NULL) {
+        int      deflabel = gen_label(comp);
+        unsigned span     = sorted[num_cases - 1].value - sorted[0].value + 1,
+                 i;
+
+        if (num_cases >= SWITCH_TABLE_MIN && span <= 2 * num_cases)
+            gencode_switch_table(comp, reg, sorted, num_cases, deflabel);
+        else
+            gencode_switch_tree(comp, reg, sorted, num_cases, deflabel);
+
+        STAT_INC(comp, switches_lowered);
+        free_reg(comp, reg);
+
+        for (caseiter = expr->cases, i = 0; caseiter != NULL; caseiter = caseiter->next, i++) {
+            LABEL (labels[i].label);
+            gencode_exprlist(comp, caseiter->block);
+            if (caseiter->next != NULL)
+                INS (M0_GOTO, "%L", deflabel);
+        }
+        LABEL (deflabel);
     }
+    else {
+        m1_reg test = alloc_reg(comp, VAL_INT);    
 
-    free_reg(comp, test);
-    free_reg(comp, reg);
+        /* iterate over cases and generate code for each. */
+        caseiter = expr->cases;    
+        while (caseiter != NULL) {
+            int testlabel;  
+            
+            /* reuse register "test". */
+            int selector  = caseiter->selector;
+            int remainder = selector % 256;
+            int num256    = (selector - remainder) / 256;
+            
+            INS (M0_SET_IMM, "%I, %d, %d", test.no, num256, remainder);
+            INS (M0_SUB_I,   "%I, %I, %I", test.no, reg.no, test.no);
+            
+            testlabel = gen_label(comp);
+            INS (M0_GOTO_IF, "%L, %I", testlabel, test.no);        
+            
+            /* generate code for this case's block. Note this "block" is a list of expressions. */
+            gencode_exprlist(comp, caseiter->block);
+            
+            /* next test label. */
+            LABEL (testlabel);
+            
+            caseiter = caseiter->next;   
+        }
+
+        free_reg(comp, test);
+        free_reg(comp, reg);
+    }
     
     if (expr->defaultstat) {
        gencode_expr(comp, expr->defaultstat); 
@@ -2206,16 +2596,24 @@ gencode_block(M1_compiler *comp, m1_block *block) {
     /* set current symtab to this block's symtab. */
     comp->currentsymtab = &block->locals;
     
-    /* iterate over block's statements and generate code for each. */
+    /* iterate over block's statements and generate code for each. 
+       A statement's result isn't used, so release its registers right away;
+       otherwise a long block overflows the register stack.
+     */
     while (iter != NULL) {
         gencode_expr(comp, iter);
+        
+        while (!regstack_isempty(comp->regstack)) {
+            m1_reg r = popreg(comp->regstack);
+            free_reg(comp, r);
+        }
         iter = iter->next;
     }  
     
     /* restore parent scope; all symbols in the CURRENT block (that's being closed now) 
-       are no longer accessible; therefore, their registers can be unfrozen.        
+       are no longer accessible.
     */
-    unfreeze_registers(comp, comp->currentsymtab);
+    warn_unused_symbols(comp, comp->currentsymtab);
     comp->currentsymtab = block->locals.parentscope;
     
     /* pop all registers from the reg stack and free them. frozen regs will be unaffected. */
@@ -2242,9 +2640,11 @@ gencode_chunk_return(M1_compiler *comp, m1_chunk *chunk) {
     goto_chunk I3, I4, x
     */   
     
-    /* XXX only generate in non-main functions. */
-    
-    /* XXX only generate if not already generated for an explicit return statement. */ 
+    /* main has no caller to return to; the program ends when it runs off its end.
+       In other chunks, this is what runs when control reaches the end without a
+       return statement. After an explicit return it can't be reached anymore, and 
+       remove_dead_code() drops it.
+     */
     if (strcmp(chunk->name, "main") != 0) {        
         m1_reg chunk_index;
         m1_reg retpc_reg   = alloc_reg(comp, VAL_INT);
@@ -2266,17 +2666,133 @@ gencode_chunk_return(M1_compiler *comp, m1_chunk *chunk) {
     }
 }
 
+/* Run the passes over the code of <chunk>, once it's complete. The order matters:
+   CSE and LICM leave copies and dead values for DCE to remove, registers are
+   only allocated once the code doesn't change anymore, and the peephole 
+   optimizer cleans up what register allocation leaves.
+ */
+static void
+optimize_chunk(M1_compiler *comp, m0_chunk *chunk) {
+    eliminate_common_subexpressions(comp, chunk);
+    hoist_loop_invariants(comp, chunk);
+    reduce_induction_variables(comp, chunk);
+    remove_dead_code(comp, chunk);
+    allocate_registers(comp, chunk);
+    peephole(comp, chunk);
+}
+
+/* Find the registers that chunk <c>'s code uses, and the size of a frame for it. */
+static void
+count_registers(M1_compiler *comp, m1_chunk *c) {
+    static const unsigned regbase[REG_TYPE_NUM] = { M0_REG_I0, M0_REG_N0, M0_REG_S0, M0_REG_P0 };
+    m0_chunk *chunk = comp->current_m0chunk;
+    unsigned  i, k, type;
+
+    for (i = 0; i < chunk->num_instr; i++) {
+        m0_instr const *ins = &chunk->instructions[i];
+
+        for (k = 0; k < ins->numops; k++) {
+            if (IS_REG_OPERAND(ins->operands[k]) 
+            &&  ins->operands[k].value + 1u > c->numregs[ins->operands[k].type])
+                c->numregs[ins->operands[k].type] = ins->operands[k].value + 1;
+        }
+    }
+
+    c->framesize = SPILLCF + 1;
+    for (type = 0; type < REG_TYPE_NUM; type++) {
+        if (c->numregs[type] > 0 && regbase[type] + c->numregs[type] > c->framesize)
+            c->framesize = regbase[type] + c->numregs[type];
+    }
+}
+
+/* The code for chunk <c> is complete: record its registers, write the chunk, and 
+   then release its instructions. 
+ */
+static void
+finish_chunk(M1_compiler *comp, m1_chunk *c) {
+    count_registers(comp, c);
+    enter_metadata(comp, c);
+    
+    write_chunk(comp, c);
+    arena_release(comp->instr_arena);
+    comp->current_m0chunk = NULL;
+}
+
+/* Set the size of the frame that chunk <c> allocates for its callees: it must 
+   fit all of them, and what the call sequences use in it. The size is counted
+   in registers, and stored in bytes (see callee_frame_size()). The chunk was
+   written already, so the value is patched into the output.
+ */
+static void
+set_frame_size(M1_compiler *comp, m1_chunk *c) {
+    unsigned size = c->callframe;
+    unsigned k;
+    
+    if (c->calleesize == NULL)
+        return;
+    
+    for (k = 0; k < c->constants.num_consts; k++) {
+        m1_symbol *sym = c->constants.consts[k];
+        
+        if (sym->valtype == VAL_CHUNK && sym->chunk != NULL && sym->chunk->framesize > size)
+            size = sym->chunk->framesize;
+    }
+    c->calleesize->value.as_int = size * 8;
+    patch_frame_size(comp, c);
+}
+
+/* Set the sizes of callee frames of all chunks in <ast> and of the PMC methods. 
+   The vtable chunks of PMCs make no calls. 
+ */
+static void
+set_frame_sizes(M1_compiler *comp, m1_chunk *ast) {
+    m1_chunk *iter;
+    m1_type  *decliter;
+    
+    for (iter = ast; iter != NULL; iter = iter->next)
+        set_frame_size(comp, iter);
+        
+    for (decliter = comp->declarations; decliter != NULL; decliter = decliter->next) {
+        if (decliter->decltype == DECL_PMC) {
+            for (iter = decliter->d.as_struct->methods; iter != NULL; iter = iter->next)
+                set_frame_size(comp, iter);
+        }
+    }
+}
+
+/* Does chunk <c> call any function? Each callee is in its constants. */
+static int
+has_calls(m1_chunk *c) {
+    unsigned i;
+
+    for (i = 0; i < c->constants.num_consts; i++) {
+        if (c->constants.consts[i]->valtype == VAL_CHUNK)
+            return 1;
+    }
+    return 0;
+}
+
+/* The caller passes arguments in the first registers of each type of the 
+   callee's frame, so parameters get those physical registers. 
+ */
 static void
 gencode_parameters(M1_compiler *comp, m1_chunk *chunk) {
     m1_var *paramiter = chunk->parameters;
+    int     next[REG_TYPE_NUM] = { 0, 0, 0, 0 };
     
     if (chunk->num_params > 0)
         assert(paramiter != NULL);
     
             
     while (paramiter != NULL) {
-        /* get a new reg for this parameter. */
-        m1_reg r = alloc_reg(comp, paramiter->sym->valtype); 
+        m1_reg r;
+        
+        r.type = paramiter->sym->typedecl->valtype;
+        r.no   = next[r.type]++;
+        
+        if (comp->no_reg_opt) /* mark it as used for alloc_reg(). */
+            comp->registers[r.type][r.no] = REG_USED;
+            
         paramiter->sym->regno = r.no;
         freeze_reg(comp, r); /* parameters are like local variables; they keep their register. */        
         paramiter = paramiter->next;   
@@ -2290,8 +2806,6 @@ gencode_chunk(M1_compiler *comp, m1_chunk *c) {
     comp->current_m0chunk = CHUNK (c->name);
     /* for each chunk, reset the register allocator */
     reset_reg(comp);
-    
-    write_chunk(comp, c);
             
 #if PRELOAD01    
     m1_reg r0, r1;
@@ -2314,54 +2828,77 @@ gencode_chunk(M1_compiler *comp, m1_chunk *c) {
 #endif
 
     
+    /* no frame for callees yet; see gencode_funcall(). */
+    if (has_calls(c))
+        INS (M0_SET_IMM, "%X, %d, %d", SPC4RENT, 0, 0);
+
     gencode_parameters(comp, c);
     /* generate code for statements */
     gencode_block(comp, c->block);
     
     /* helper function to generate instructions to return. */
     gencode_chunk_return(comp, c);
+    
+    optimize_chunk(comp, comp->current_m0chunk);
+    finish_chunk(comp, c);
+}
+
+/* Get the name of the chunk that sets up the vtable for PMC <pmc>. */
+static char *
+vtable_chunk_name(M1_compiler *comp, m1_struct *pmc) {
+    static const char prefix[] = "__", suffix[] = "_init_vtable__";
+    size_t  len  = strlen(pmc->name);
+    char   *name = (char *)arena_alloc(comp->sym_arena, sizeof (prefix) + len + sizeof (suffix));
+    
+    memcpy(name, prefix, sizeof (prefix) - 1);
+    memcpy(name + sizeof (prefix) - 1, pmc->name, len);
+    memcpy(name + sizeof (prefix) - 1 + len, suffix, sizeof (suffix));
+    return intern(comp, name);
 }
 
 /* Generate a function to setup the vtable. */
 static void
 gencode_pmc_vtable(M1_compiler *comp, m1_struct *pmc) {
     m1_chunk *methoditer = pmc->methods;
+    m1_chunk *c;
+    m1_reg    indexreg, 
+              vtablereg,
+              methodreg;
     
-    /* add methods to this special init chunk's const table. 
-       Since this chunk is generated in code and not from the AST,
-       manually reset comp's constindex first, otherwise the constant segment's
-       entries get the wrong numbers.
+    /* This chunk is generated in code and not from the AST, so create an
+       AST node for it, to hold its constants. 
      */
-    comp->constindex = 0;
+    c = chunk(comp, intern(comp, "void"), vtable_chunk_name(comp, pmc), 0);
+    comp->currentchunk    = c;
+    comp->current_m0chunk = CHUNK (c->name);
+    reset_reg(comp);
+    
+    /* add methods to this special init chunk's const table. */
     while (methoditer != NULL) {
-        sym_enter_chunk(comp, &comp->currentchunk->constants, methoditer->name);
+        sym_enter_chunk(comp, &c->constants, methoditer->name);
         methoditer = methoditer->next;    
     }
     
-    fprintf(OUT, ".chunk \"__%s_init_vtable__\"\n", pmc->name);
-    fprintf(OUT, ".constants\n");
-    fprintf(OUT, ".metadata\n");
-    fprintf(OUT, ".bytecode\n");
-    
-    m1_reg indexreg      = alloc_reg(comp, VAL_INT);
-    m1_reg vtablereg     = alloc_reg(comp, VAL_CHUNK);
-    m1_reg methodreg     = alloc_reg(comp, VAL_CHUNK);
+    indexreg  = alloc_reg(comp, VAL_INT);
+    vtablereg = alloc_reg(comp, VAL_CHUNK);
+    methodreg = alloc_reg(comp, VAL_CHUNK);
 
-    
-    
-    int i = 0;
     /* allocate memory for a vtable. */
-    fprintf(OUT, "\tset_imm\tI%d, 0, 100\n", indexreg.no);    
-    fprintf(OUT, "\tgc_alloc\tP%d, I%d, x\n", vtablereg.no, indexreg.no);
+    INS (M0_SET_IMM, "%I, %d, %d", indexreg.no, 0, 100);
+    INS (M0_GC_ALLOC, "%P, %I", vtablereg.no, indexreg.no);
 
     methoditer = pmc->methods;
     
     while (methoditer != NULL) {
-        /* generate code to copy the pointer to the chunk into the vtable. */
+        /* generate code to copy the pointer to the chunk into the vtable; 
+           the chunk's index in the vtable is the same as in the constants. 
+         */
         /* XXX can we do with a memcopy? */
-        fprintf(OUT, "\tset_imm\tI%d, 0, %d\n", indexreg.no, i++);
-        fprintf(OUT, "\tderef\tP%d, CONSTS, I%d\n", methodreg.no, indexreg.no);
-        fprintf(OUT, "\tset_ref\tP%d, I%d, P%d\n", vtablereg.no, indexreg.no, methodreg.no);
+        m1_symbol *methodsym = sym_find_chunk(&c->constants, methoditer->name);
+        
+        INS (M0_SET_IMM, "%I, %d, %d", indexreg.no, 0, methodsym->constindex);
+        INS (M0_DEREF,   "%P, %X, %I", methodreg.no, CONSTS, indexreg.no);
+        INS (M0_SET_REF, "%P, %I, %P", vtablereg.no, indexreg.no, methodreg.no);
         methoditer = methoditer->next;   
     }
     
@@ -2369,7 +2906,9 @@ gencode_pmc_vtable(M1_compiler *comp, m1_struct *pmc) {
     
     free_reg(comp, methodreg);
     free_reg(comp, indexreg);
-       
+    
+    optimize_chunk(comp, comp->current_m0chunk);
+    finish_chunk(comp, c);
 }
 
 static void
@@ -2389,6 +2928,53 @@ gencode_pmc(M1_compiler *comp, m1_struct *pmc) {
     gencode_pmc_vtable(comp, pmc);
 }
 
+/* 
+
+Get the names of all chunks that will be generated, in the order in which they're 
+generated; this is needed for the directory of .m0b files. The number of chunks is
+returned in <num_chunks>.
+
+*/
+static char **
+chunk_names(M1_compiler *comp, m1_chunk *ast, unsigned *num_chunks) {
+    unsigned  pass, n = 0;
+    char    **names = NULL;
+    
+    /* first pass counts the chunks, second pass stores their names. */
+    for (pass = 0; pass < 2; pass++) {
+        m1_chunk *iter;
+        m1_type  *decliter;
+        
+        n = 0;
+        for (iter = ast; iter != NULL; iter = iter->next) {
+            if (names != NULL)
+                names[n] = iter->name;
+            ++n;
+        }
+        
+        for (decliter = comp->declarations; decliter != NULL; decliter = decliter->next) {
+            if (decliter->decltype == DECL_PMC) {
+                m1_struct *pmc = decliter->d.as_struct;
+                
+                for (iter = pmc->methods; iter != NULL; iter = iter->next) {
+                    if (names != NULL)
+                        names[n] = iter->name;
+                    ++n;
+                }
+                if (names != NULL)
+                    names[n] = vtable_chunk_name(comp, pmc);
+                ++n;
+            }
+        }
+        
+        if (names == NULL)
+            names = (char **)arena_alloc(comp->sym_arena, (n + 1) * sizeof (char *));
+    }
+    
+    *num_chunks = n;
+    return names;
+}
+
 /*
 
 Top-level function to drive the code generation phase.
@@ -2398,9 +2984,12 @@ Iterate over the list of chunks, and generate code for each.
 void 
 gencode(M1_compiler *comp, m1_chunk *ast) {
     m1_chunk *iter = ast;
-    m1_type *decliter;
-                            
-    write_m0b_file(comp);
+    m1_type  *decliter;
+    char    **names;
+    unsigned  num_chunks;
+    
+    names = chunk_names(comp, ast, &num_chunks);                        
+    write_m0b_file(comp, names, num_chunks);
         
     while (iter != NULL) {     
         /* set pointer to current chunk, so that the code generator 
@@ -2421,7 +3010,8 @@ gencode(M1_compiler *comp, m1_chunk *ast) {
         }
         decliter = decliter->next;   
     }
+    
+    /* all chunks are done, so their frame sizes are known. */
+    set_frame_sizes(comp, ast);
 }
 
-
-
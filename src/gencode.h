@@ -5,9 +5,12 @@
 #include "symtab.h"
 #include "compiler.h"
 
-/* to store registers; I42 -> no=42, type=VAL_INT */
+/* to store registers; I42 -> no=42, type=VAL_INT. Numbers below REG_NUM
+   are physical registers; higher numbers are virtual registers, which are
+   mapped to physical ones by the register allocator (see regalloc.c).
+ */
 typedef struct m1_reg {
-    short no;         /* number of register. */
+    int   no;         /* number of register. */
     short type;       /* type of register. */
     
 } m1_reg;
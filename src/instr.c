@@ -20,9 +20,14 @@ The following specifiers may be used:
 #include <stdio.h>
 #include <assert.h>
 #include <stdarg.h>
+#include <string.h>
 #include "instr.h"
 #include "compiler.h"
 #include "gencode.h"
+#include "arena.h"
+#include "emit.h"
+#include "stats.h"
+#include "intern.h"
 
 /* ensure all opers have same width for pretty printing. */
 char const * const m0_instr_names[] = {
@@ -75,6 +80,66 @@ char const * const m0_instr_names[] = {
     
 };
 
+/* How each instruction accesses its operands; operands that aren't registers 
+   (labels, immediates and special registers) are never accessed as registers.
+ */
+#define U   OPERAND_USE
+#define D   OPERAND_DEF
+#define _   OPERAND_NONE
+
+unsigned char const m0_operand_access[][3] = {
+    { _, _, _ },    /* noop */
+    { _, _, _ },    /* goto */
+    { _, U, _ },    /* goto_if */
+    { U, U, _ },    /* goto_chunk */
+    { D, U, U },    /* add_i */
+    { D, U, U },    /* add_n */
+    { D, U, U },    /* sub_i */
+    { D, U, U },    /* sub_n */
+    { D, U, U },    /* mult_i */
+    { D, U, U },    /* mult_n */
+    { D, U, U },    /* div_i */
+    { D, U, U },    /* div_n */
+    { D, U, U },    /* mod_i */
+    { D, U, U },    /* mod_n */
+    { D, U, U },    /* isgt_i */
+    { D, U, U },    /* isgt_n */
+    { D, U, U },    /* isge_i */
+    { D, U, U },    /* isge_n */
+    { D, U, _ },    /* convert_n_i */
+    { D, U, _ },    /* convert_i_n */
+    { D, U, U },    /* ashr */
+    { D, U, U },    /* lshr */
+    { D, U, U },    /* shl */
+    { D, U, U },    /* and */
+    { D, U, U },    /* or */
+    { D, U, U },    /* xor */
+    { D, U, U },    /* gc_alloc */
+    { D, U, _ },    /* sys_alloc */
+    { U, _, _ },    /* sys_free */
+    { U, U, U },    /* copy_mem */
+    { D, U, _ },    /* set */
+    { D, _, _ },    /* set_imm */
+    { D, U, U },    /* deref */
+    { U, U, U },    /* set_ref */
+    { U, U, U },    /* set_byte */
+    { D, U, U },    /* get_byte */
+    { U, U, U },    /* set_word */
+    { D, U, U },    /* get_word */
+    { D, U, _ },    /* csym */
+    { U, U, U },    /* ccall_arg */
+    { U, U, U },    /* ccall_ret */
+    { U, U, U },    /* ccall */
+    { U, U, _ },    /* print_s */
+    { U, U, _ },    /* print_i */
+    { U, U, _ },    /* print_n */
+    { U, _, _ }     /* exit */
+};
+
+#undef U
+#undef D
+#undef _
+
 /* Names of interpreter's registers. */
 static char const * const interp_regs[] = {
     "CF",
@@ -95,34 +160,29 @@ static char const * const interp_regs[] = {
 static const char regs[REG_TYPE_NUM + 2] = {'I', 'N', 'S', 'P', ' ', 'L'};
 
 
-#define OUT stdout
-//comp->outfile
+#define OUT comp->emitter
 
 
 static void
-write_operand(M1_compiler *comp, m0_operand op) {
+write_operand(M1_compiler *comp, m0_chunk *chunk, m0_operand op) {
 
     switch (op.type) {
         case VAL_INT:
-            fprintf(OUT, "I%d", op.value);
-            break;
         case VAL_FLOAT:
-            fprintf(OUT, "N%d", op.value);
-            break;        
         case VAL_STRING:
-            fprintf(OUT, "S%d", op.value);
-            break;
         case VAL_CHUNK:
-            fprintf(OUT, "P%d", op.value);
+            emit_char(OUT, regs[op.type]);
+            emit_int(OUT, op.value);
             break;        
         case VAL_VOID:
-            fprintf(OUT, "%d", op.value);
+            emit_int(OUT, op.value);
             break;
         case VAL_LABEL:
-            fprintf(OUT, "L00%d", op.value);
+            emit_str(OUT, "L00");
+            emit_int(OUT, chunk->labelbase + op.value);
             break;            
         case VAL_INTERP_REG:
-            fprintf(OUT, "%s", interp_regs[op.value]);
+            emit_str(OUT, interp_regs[op.value]);
             break;
         default:
             fprintf(stderr, "unknown m0_instr operand\n");
@@ -131,103 +191,88 @@ write_operand(M1_compiler *comp, m0_operand op) {
 }
 
 static void
-write_instr(M1_compiler *comp, m0_instr *i) {
+write_label(M1_compiler *comp, unsigned labelno) {
+    emit_str(OUT, "L00");
+    emit_int(OUT, labelno);
+    emit_str(OUT, ":\n");
+}
+
+static void
+write_instr(M1_compiler *comp, m0_chunk *chunk, m0_instr *i) {
+    unsigned index;
     
     assert(comp != NULL);
-    
-    /* write the label, if any. */
-    if (i->label != 0 && i->opcode == M0_NOOP) 
-        fprintf(OUT, "L00%d:\n", i->label);    
         
-    /* if the last node is just a label, don't emit the dummy instruction. */    
-    if (i->opcode == M0_NOOP)
-        return;
-        
-    fprintf(OUT, "\t%s ", m0_instr_names[(int)i->opcode]);
+    emit_char(OUT, '\t');
+    emit_str(OUT, m0_instr_names[(int)i->opcode]);
+    emit_char(OUT, ' ');
     
     /* write operands. */
-    unsigned index;
     for (index = 0; index < i->numops; index++) {
-        write_operand(comp, i->operands[index]);   
-        if (index < i->numops - 1)
-            fprintf(OUT, ", ");
+        write_operand(comp, chunk, i->operands[index]);   
+        if (index < i->numops - 1u)
+            emit_str(OUT, ", ");
     }        
     
     /* all instructions take 3 operands, except goto and goto_if. */
     if (i->opcode != M0_GOTO && i->opcode != M0_GOTO_IF)
         for (; index < 3; index++) 
-            fprintf(OUT, ", x");
+            emit_str(OUT, ", x");
         
-    fprintf(OUT, "\n");
+    emit_char(OUT, '\n');
                                                                                                            
 }
 
-void
-write_instructions(M1_compiler *comp, m0_instr *i) {
-
-    comp->outfile = fopen("a.m1", "w");
-    
-    if (comp->outfile == NULL) {
-        fprintf(stderr, "Failed to open output file\n");
-        exit(EXIT_FAILURE);   
-    }
+/* Write the code of chunk <chunk>, with its labels. */
+static void
+write_code(M1_compiler *comp, m0_chunk *chunk) {
+    unsigned i;
+    unsigned mark = 0;
     
-    while (i != NULL) {
-        write_instr(comp, i);
-        i = i->next;   
+    for (i = 0; i < chunk->num_instr; i++) {
+        /* labels are placed in order, so the ones before this instruction are next. */
+        while (mark < chunk->num_labelmarks && chunk->labelmarks[mark].instr == i)
+            write_label(comp, chunk->labelmarks[mark++].label);
+            
+        write_instr(comp, chunk, &chunk->instructions[i]);
     }
-    fclose(comp->outfile);
-       
+    /* labels at the very end of the chunk. */
+    while (mark < chunk->num_labelmarks)
+        write_label(comp, chunk->labelmarks[mark++].label);
 }
 
-/* Allocate a new m0_instr node in memory. */
-static m0_instr *
-new_instr(M1_compiler *comp) {
-    m0_instr *ins = (m0_instr *)calloc(1, sizeof (m0_instr));
+/* Grow array <array> of <*max> elements of <size> bytes each, that holds <num> elements. */
+static void *
+grow_array(M1_compiler *comp, void *array, unsigned num, unsigned *max, size_t size) {
+    void *newarray;
+    
+    *max     = *max == 0 ? 64 : *max * 2;
+    newarray = arena_alloc(comp->instr_arena, *max * size);
+    
+    if (array != NULL)
+        memcpy(newarray, array, num * size);
     
-    if (ins == NULL) {
-        fprintf(stderr, "cant alloc mem for instr");
-        exit(EXIT_FAILURE);
-    }    
-    return ins;
+    return newarray;
 }
 
-/* Get a new instruction node; it may already exist to store a label;
-   if not, then a new instruction node is created.
-   Whereever the instr node comes from, it's returned and usable
-   by the instr constructor. 
-*/
+/* Get a new instruction record at the end of the current chunk's code. */
 static m0_instr *
-link_instr(M1_compiler *comp) {
-    m0_instr *instr = NULL;
-    
-    /* comp keeps a pointer to the last generated one for quick access to the tail
-       of the list, so that the new one can be added in O(1) time, rather than
-       O(n) time.
-     */
-    if (comp->lastgenerated == NULL) 
-        instr = new_instr(comp);  /* first instruction. */          
-    else {
-        /* If the last generated instruction was a "noop", then it was a label;
-           noop is not generated normally, and is used as a dummy. Therefore,
-           reuse it by overwriting its opcode.
-         */
-        if (comp->lastgenerated->opcode == M0_NOOP)            
-            instr = comp->lastgenerated;        
-        else /* last one was normal so just create a new instr node. */ 
-            instr = new_instr(comp);           
-        
-        /* lastgenerated wasn't NULL, so link new instruction to it. */
-        comp->lastgenerated->next = instr;
-    }
-    /* update "last generated instruction" pointer. */
-    comp->lastgenerated = instr;  
+new_instr(M1_compiler *comp) {
+    m0_chunk *chunk = comp->current_m0chunk;
+    
+    assert(chunk != NULL);
+    
+    if (chunk->num_instr == chunk->max_instr) 
+        chunk->instructions = (m0_instr *)grow_array(comp, chunk->instructions, chunk->num_instr, 
+                                                     &chunk->max_instr, sizeof (m0_instr));
     
-    return instr;  
+    return &chunk->instructions[chunk->num_instr++];
 }
 
-/* Constructor for m0_instr; the format string parameter specifies which operands to expect. */
-m0_instr *
+/* Constructor for m0_instr; the format string parameter specifies which operands to expect. 
+   The instruction is added to the current chunk; its index in the chunk's code is returned. 
+ */
+unsigned
 mk_instr(M1_compiler *comp, m0_opcode opcode, char const * const format, ...) {
     va_list     argp;
     char const *p     = NULL;
@@ -235,8 +280,9 @@ mk_instr(M1_compiler *comp, m0_opcode opcode, char const * const format, ...) {
     m0_instr   *ins   = NULL;                
 
             
-    ins         = link_instr(comp);
+    ins         = new_instr(comp);
     ins->opcode = opcode;
+    STAT_INC(comp, instructions);
                     
     va_start(argp, format);
            
@@ -268,10 +314,19 @@ mk_instr(M1_compiler *comp, m0_opcode opcode, char const * const format, ...) {
                 ins->operands[index].value = r.no;
                 break;
             }
-            case 'L': 
+            case 'L': {
+                /* labels are numbered across all chunks; operands only hold this chunk's. */
+                unsigned slot = va_arg(argp, int) - comp->current_m0chunk->labelbase;
+                
+                if (slot > MAX_LABEL) {
+                    fprintf(stderr, "chunk %s is too large: out of labels\n", 
+                            comp->current_m0chunk->name);
+                    exit(EXIT_FAILURE);   
+                }
                 ins->operands[index].type  = VAL_LABEL;
-                ins->operands[index].value = va_arg(argp, int);
+                ins->operands[index].value = slot;
                 break;
+            }
             case 'X':
                 ins->operands[index].type  = VAL_INTERP_REG;
                 ins->operands[index].value = va_arg(argp, int);
@@ -291,93 +346,500 @@ mk_instr(M1_compiler *comp, m0_opcode opcode, char const * const format, ...) {
     }
     
     ins->numops = index;
-    ins->next   = NULL;
-    
     
     va_end(argp);
     
-
-    
-    write_instr(comp, ins);
-    return ins;
-    
+    return comp->current_m0chunk->num_instr - 1;
 }
 
-/* Make an empty m0_instr node and store the specified label. */
+/* Place label <labelno> before the next instruction to be generated. */
 void 
 mk_label(M1_compiler *comp, unsigned labelno) {
-    m0_instr *ins = link_instr(comp);
+    m0_chunk *chunk = comp->current_m0chunk;
+    unsigned  slot;
+    
+    assert(chunk != NULL);
+    assert(labelno >= chunk->labelbase);
     
-    ins->label    = labelno;            
+    slot = labelno - chunk->labelbase;
+    
+    /* make sure the label table has a slot for this label. */
+    while (slot >= chunk->max_labels) {
+        unsigned oldmax = chunk->max_labels;
+        unsigned i;
+        
+        chunk->labels = (unsigned *)grow_array(comp, chunk->labels, oldmax, 
+                                               &chunk->max_labels, sizeof (unsigned));
+        for (i = oldmax; i < chunk->max_labels; i++)
+            chunk->labels[i] = NO_INSTR;
+    }
+    chunk->labels[slot] = chunk->num_instr;
     
-    /* set this instruction's opcode to "noop", which is a signal to mk_instr
-       that this node can be used for the next instruction.       
-     */
-    ins->opcode = M0_NOOP;   
-    write_instr(comp, ins);    
+    if (chunk->num_labelmarks == chunk->max_labelmarks)
+        chunk->labelmarks = (m0_labelmark *)grow_array(comp, chunk->labelmarks, chunk->num_labelmarks,
+                                                       &chunk->max_labelmarks, sizeof (m0_labelmark));
+                                                       
+    chunk->labelmarks[chunk->num_labelmarks].label = labelno;
+    chunk->labelmarks[chunk->num_labelmarks].instr = chunk->num_instr;
+    ++chunk->num_labelmarks;
+}
+
+/* Get the index of the instruction that the label in label operand <slot> precedes (the 
+   label number minus <labelbase>), or NO_INSTR if it wasn't placed. 
+ */
+unsigned
+label_offset(m0_chunk *chunk, unsigned slot) {
+    return slot < chunk->max_labels ? chunk->labels[slot] : NO_INSTR;
+}
+
+/* Remove the instructions of <chunk> that are marked in <deleted>, and move the labels 
+   accordingly; a label of a removed instruction goes to the next one that's kept.
+ */
+void
+remove_instructions(M1_compiler *comp, m0_chunk *chunk, unsigned char const *deleted) {
+    unsigned *newindex;
+    unsigned  i, n = 0;
+
+    newindex = (unsigned *)arena_alloc(comp->instr_arena, (chunk->num_instr + 1) * sizeof (unsigned));
+
+    for (i = 0; i < chunk->num_instr; i++) {
+        newindex[i] = n;
+        if (!deleted[i])
+            chunk->instructions[n++] = chunk->instructions[i];
+    }
+    newindex[chunk->num_instr] = n;
+
+    for (i = 0; i < chunk->max_labels; i++) {
+        if (chunk->labels[i] != NO_INSTR)
+            chunk->labels[i] = newindex[chunk->labels[i]];
+    }
+    for (i = 0; i < chunk->num_labelmarks; i++)
+        chunk->labelmarks[i].instr = newindex[chunk->labelmarks[i].instr];
+
+    chunk->num_instr = n;
 }
 
 m0_chunk *
 mk_chunk(M1_compiler *comp, char *name) {
-    m0_chunk *ch = (m0_chunk *)calloc(1, sizeof(m0_chunk));
-    ch->name     = name;
+    m0_chunk *ch  = (m0_chunk *)arena_alloc(comp->instr_arena, sizeof(m0_chunk));
+    ch->name      = name;
+    ch->labelbase = comp->label + 1; /* labels are numbered across all chunks. */
     return ch;   
 }
 
+/*
+
+The metadata of a chunk records the highest register of each type that its
+code uses, as entries named "I", "N", "S" and "P". As in the M0 bytecode
+format, an entry is an offset into the code (always 0 here), and the
+constants that hold its name and its value. Types without registers in the
+code have no entry.
+
+*/
+static char const * const metadata_names[REG_TYPE_NUM] = { "\"I\"", "\"N\"", "\"S\"", "\"P\"" };
+
+/* Enter the names and values of <c>'s metadata into its constants. */
+void
+enter_metadata(M1_compiler *comp, m1_chunk *c) {
+    unsigned type;
+    
+    for (type = 0; type < REG_TYPE_NUM; type++) {
+        if (c->numregs[type] > 0) {
+            sym_enter_str(comp, &c->constants, intern(comp, metadata_names[type]));
+            sym_enter_int(comp, &c->constants, c->numregs[type] - 1);
+        }
+    }
+}
+
+/* Find the constants of <c>'s metadata entry for registers of type <type>; return 0 if 
+   there's none. 
+ */
+static int
+metadata_entry(M1_compiler *comp, m1_chunk *c, unsigned type, unsigned *name, unsigned *value) {
+    if (c->numregs[type] == 0)
+        return 0;
+    
+    *name  = sym_find_str(&c->constants, intern(comp, metadata_names[type]))->constindex;
+    *value = sym_find_int(&c->constants, c->numregs[type] - 1)->constindex;
+    return 1;
+}
+
+/* The size of a chunk's callee frames is only known once all chunks are done,
+   so it's written as a placeholder of fixed width, and filled in then. Sizes
+   are at most 256 registers of 8 bytes, so 4 digits do; the leading zeros 
+   don't change the decimal value.
+ */
+#define FRAME_SIZE_FIELD    "0000"
+
 static void
-write_consts(M1_compiler *comp, m1_symboltable *consttable) {
-    m1_symbol *iter;
+write_consts(M1_compiler *comp, m1_chunk *c) {
+    m1_constpool *consttable = &c->constants;
+    unsigned      i;
 	
-	fprintf(OUT, ".constants\n");
+	emit_str(OUT, ".constants\n");
 	
     assert(consttable != NULL);
-	iter = consttable->syms;
 	
-	while (iter != NULL) {
+	/* the pool stores constants in order of their index. */
+	for (i = 0; i < consttable->num_consts; i++) {
+		m1_symbol *iter = consttable->consts[i];
+		
+		emit_int(OUT, iter->constindex);
+		emit_char(OUT, ' ');
 		
 		switch (iter->valtype) {
 			case VAL_STRING:
-				fprintf(OUT, "%d %s\n", iter->constindex, iter->value.as_string);
+				emit_str(OUT, iter->value.as_string);
 				break;
 			case VAL_FLOAT:
-				fprintf(OUT, "%d %f\n", iter->constindex, iter->value.as_double);
+				emit_num(OUT, iter->value.as_double);
 				break;
-			case VAL_INT:			
-				fprintf(OUT, "%d %d\n", iter->constindex, iter->value.as_int);
+			case VAL_INT:
+			    if (iter == c->calleesize) {
+			        /* not known yet; see patch_frame_size(). */
+			        c->calleesizepos = OUT->length;
+			        emit_str(OUT, FRAME_SIZE_FIELD);
+			        break;
+			    }
+				emit_int(OUT, iter->value.as_int);
 				break;
 	        case VAL_CHUNK:
-	            fprintf(OUT, "%d &%s\n", iter->constindex, iter->value.as_string);
+	            emit_char(OUT, '&');
+	            emit_str(OUT, iter->value.as_string);
 	            break;
 			default:
 				fprintf(stderr, "unknown symbol type (%d)\n", iter->valtype);
 				assert(0); /* should never happen. */
 		}
-		iter = iter->next;	
+		emit_char(OUT, '\n');
 	}
 
 }
 
 static void
 write_metadata(M1_compiler *comp, m1_chunk *c) {
+    unsigned type, name, value;
+    
     assert(c != NULL);
-	fprintf(OUT, ".metadata\n");	
+	emit_str(OUT, ".metadata\n");
+	
+	for (type = 0; type < REG_TYPE_NUM; type++) {
+	    if (metadata_entry(comp, c, type, &name, &value)) {
+	        emit_str(OUT, "0 ");
+	        emit_int(OUT, name);
+	        emit_char(OUT, ' ');
+	        emit_int(OUT, value);
+	        emit_char(OUT, '\n');
+	    }
+	}
 }
 
 
+/*
+
+Writing binary .m0b files. The layout follows the M0 bytecode format:
+all numbers are little-endian, and the file starts with a 16-byte header:
+
+    magic       8 bytes: "\376M0B\r\n\032\n"
+    version     1 byte:  0
+    sizes       4 bytes: sizes of intval (8), floatval (8), opcode_t (4), void * (8)
+    endianness  1 byte:  0 (little-endian)
+    padding     2 bytes
+
+followed by a directory segment, and then for each chunk in the directory,
+its constants, metadata and bytecode segments. Each segment starts with
+3 32-bit words: the segment id, the number of entries, and the size of 
+the segment in bytes, including these 3 words.
+
+    directory   each entry is the length of the chunk name (including the
+                terminating NUL), followed by the name and a NUL.
+    constants   each entry is a type (the m1_valuetype), a length in bytes,
+                and the value: 8 bytes for integers, the exact bits of the 
+                IEEE-754 double for floats, or the bytes of the string or 
+                chunk name (with escapes resolved) and a NUL.
+    metadata    each entry is 3 words: an offset, and the indexes of the
+                constants that hold its name and its value.
+    bytecode    each entry is one instruction of 4 bytes: the opcode and 
+                3 operands. Labels are resolved to the index of the 
+                instruction they precede, stored in 2 bytes (high byte first)
+                for goto and goto_if.
+
+*/
+
+#define M0_DIR_SEG      0x01
+#define M0_CONSTS_SEG   0x02
+#define M0_META_SEG     0x03
+#define M0_BC_SEG       0x04
+
+static void
+emit_u32(m1_emitter *e, unsigned long value) {
+    emit_char(e, (char)(value & 0xff));
+    emit_char(e, (char)((value >> 8) & 0xff));
+    emit_char(e, (char)((value >> 16) & 0xff));
+    emit_char(e, (char)((value >> 24) & 0xff));
+}
+
+static void
+emit_u64(m1_emitter *e, unsigned long long value) {
+    emit_u32(e, (unsigned long)(value & 0xffffffffu));
+    emit_u32(e, (unsigned long)(value >> 32));
+}
+
+/* Start a segment; the entry count and size are filled in by end_segment(). */
+static size_t
+begin_segment(M1_compiler *comp, unsigned id) {
+    size_t start = OUT->length;
+    emit_u32(OUT, id);
+    emit_u32(OUT, 0);
+    emit_u32(OUT, 0);
+    return start;
+}
+
+/* overwrite the word at <offset> in the output buffer. */
+static void
+patch_u32(m1_emitter *e, size_t offset, unsigned long value) {
+    unsigned char *p = (unsigned char *)e->buffer + offset;
+    p[0] = value & 0xff;
+    p[1] = (value >> 8) & 0xff;
+    p[2] = (value >> 16) & 0xff;
+    p[3] = (value >> 24) & 0xff;
+}
+
+static void
+end_segment(M1_compiler *comp, size_t start, unsigned num_entries) {
+    patch_u32(OUT, start + 4, num_entries);
+    patch_u32(OUT, start + 8, OUT->length - start);
+}
+
+/* Write the bytes of string literal <str> (which includes its quotes), resolving escapes; 
+   return the number of bytes written, including a terminating NUL. 
+ */
+static unsigned
+emit_string_literal(M1_compiler *comp, char const *str) {
+    char const *p = str + 1;   /* skip opening quote. */
+    char const *end = str + strlen(str) - 1;  /* closing quote. */
+    unsigned    n = 0;
+    
+    while (p < end) {
+        char c = *p++;
+        
+        if (c == '\\' && p < end) {
+            switch (c = *p++) {
+                case 'n': c = '\n'; break;
+                case 't': c = '\t'; break;
+                case 'r': c = '\r'; break;
+                case '0': c = '\0'; break;
+                default:  break; /* \\, \" and anything else: the character itself. */
+            }
+        }
+        emit_char(OUT, c);
+        ++n;
+    }
+    emit_char(OUT, '\0');
+    return n + 1;
+}
+
+static void
+write_m0b_consts(M1_compiler *comp, m1_chunk *chunk) {
+    m1_constpool *consttable = &chunk->constants;
+    size_t        start      = begin_segment(comp, M0_CONSTS_SEG);
+    unsigned      i;
+    
+	for (i = 0; i < consttable->num_consts; i++) {
+		m1_symbol *c = consttable->consts[i];
+		size_t     lengthpos;
+		
+		emit_u32(OUT, c->valtype);
+		lengthpos = OUT->length;
+		emit_u32(OUT, 0);
+		
+		switch (c->valtype) {
+			case VAL_STRING:
+				patch_u32(OUT, lengthpos, emit_string_literal(comp, c->value.as_string));
+				break;
+			case VAL_FLOAT: {
+			    unsigned long long bits;
+			    memcpy(&bits, &c->value.as_double, sizeof (double));
+			    emit_u64(OUT, bits);
+				patch_u32(OUT, lengthpos, 8);
+				break;
+			}
+			case VAL_INT:
+				if (c == chunk->calleesize) {
+				    /* not known yet; see patch_frame_size(). */
+				    chunk->calleesizepos = OUT->length;
+				}
+				emit_u64(OUT, (unsigned long long)(long long)c->value.as_int);
+				patch_u32(OUT, lengthpos, 8);
+				break;
+	        case VAL_CHUNK:
+	            emit_str(OUT, c->value.as_string);
+	            emit_char(OUT, '\0');
+				patch_u32(OUT, lengthpos, strlen(c->value.as_string) + 1);
+	            break;
+			default:
+				fprintf(stderr, "unknown symbol type (%d)\n", c->valtype);
+				assert(0); /* should never happen. */
+		}
+	}
+	end_segment(comp, start, consttable->num_consts);
+}
+
+static void
+write_m0b_metadata(M1_compiler *comp, m1_chunk *c) {
+    size_t   start = begin_segment(comp, M0_META_SEG);
+    unsigned type, name, value, n = 0;
+    
+    for (type = 0; type < REG_TYPE_NUM; type++) {
+        if (metadata_entry(comp, c, type, &name, &value)) {
+            emit_u32(OUT, 0);
+            emit_u32(OUT, name);
+            emit_u32(OUT, value);
+            ++n;
+        }
+    }
+    end_segment(comp, start, n);
+}
+
+/* Get the byte value of operand <op>, as it's encoded in bytecode. */
+static unsigned char
+operand_byte(m0_operand op) {
+    static const unsigned char regbase[REG_TYPE_NUM] = { 12, 73, 134, 195 };
+    
+    switch (op.type) {
+        case VAL_INT:
+        case VAL_FLOAT:
+        case VAL_STRING:
+        case VAL_CHUNK:
+            return (unsigned char)(regbase[op.type] + op.value);
+        case VAL_VOID:
+        case VAL_INTERP_REG:
+            return (unsigned char)op.value;
+        default:
+            fprintf(stderr, "unknown m0_instr operand\n");
+            assert(0);
+            return 0;
+    }
+}
+
+static void
+write_m0b_code(M1_compiler *comp, m0_chunk *chunk) {
+    size_t   start = begin_segment(comp, M0_BC_SEG);
+    unsigned i;
+    
+    for (i = 0; i < chunk->num_instr; i++) {
+        m0_instr      *ins = &chunk->instructions[i];
+        unsigned char  bytes[4] = { 0, 0, 0, 0 };
+        unsigned       op   = 0;
+        unsigned       pos  = 1;
+        
+        bytes[0] = ins->opcode;
+        
+        for (op = 0; op < ins->numops; op++) {
+            if (ins->operands[op].type == VAL_LABEL) {
+                unsigned target = label_offset(chunk, ins->operands[op].value);
+                
+                assert(target != NO_INSTR);
+                if (target > 0xffff) {
+                    fprintf(stderr, "chunk %s is too large to jump to instruction %u\n", 
+                            chunk->name, target);
+                    exit(EXIT_FAILURE);   
+                }
+                bytes[pos++] = (unsigned char)(target >> 8);
+                bytes[pos++] = (unsigned char)(target & 0xff);
+            }
+            else 
+                bytes[pos++] = operand_byte(ins->operands[op]);
+        }
+        emit_char(OUT, bytes[0]);
+        emit_char(OUT, bytes[1]);
+        emit_char(OUT, bytes[2]);
+        emit_char(OUT, bytes[3]);
+    }
+    end_segment(comp, start, chunk->num_instr);
+}
+
+/* Write chunk <c>, with the code that was generated for it in comp->current_m0chunk. */
 void
 write_chunk(M1_compiler *comp, m1_chunk *c) {
-    fprintf(OUT, ".chunk \"%s\"\n", c->name);       
+    m1_phase prevphase = stats_phase(comp, PHASE_EMIT);
+    
+    /* the chunk's instructions are still in the arena; this is where it peaks. */
+    stats_sample_memory(comp);
     
-    write_consts(comp, &c->constants);
-    write_metadata(comp, c);
+    if (comp->emit_m0b) {
+        write_m0b_consts(comp, c);
+        write_m0b_metadata(comp, c);
+        write_m0b_code(comp, comp->current_m0chunk);
+    }
+    else {
+        emit_str(OUT, ".chunk \"");
+        emit_str(OUT, c->name);
+        emit_str(OUT, "\"\n");
+        
+        write_consts(comp, c);
+        write_metadata(comp, c);
+        
+        emit_str(OUT, ".bytecode\n");
+        write_code(comp, comp->current_m0chunk);
+    }
     
-    fprintf(OUT, ".bytecode\n");  
+    stats_phase(comp, prevphase);
+}
 
+/* Fill in the value of <c>'s calleesize constant in the output, where write_chunk() 
+   left room for it. 
+ */
+void
+patch_frame_size(M1_compiler *comp, m1_chunk *c) {
+    int value = c->calleesize->value.as_int;
+    
+    assert(value >= 0);
+    
+    if (comp->emit_m0b) {
+        /* the high word is 0 already. */
+        patch_u32(OUT, c->calleesizepos, (unsigned long)value);
+    }
+    else {
+        char *p = OUT->buffer + c->calleesizepos + strlen(FRAME_SIZE_FIELD);
+        
+        assert(value < 10000);
+        
+        /* write digits from the right, over the zeros. */
+        do {
+            *--p   = (char)('0' + value % 10);
+            value /= 10;
+        } while (value != 0);
+    }
 }
 
+/* Write the start of the output file. For .m0b files, that includes a directory 
+   listing the names of all <num_chunks> chunks that will be written. 
+ */
 void
-write_m0b_file(M1_compiler *comp) {
-    fprintf(OUT, ".version 0\n");
-       
+write_m0b_file(M1_compiler *comp, char **chunknames, unsigned num_chunks) {
+    static const char header[16] = { '\376', 'M', '0', 'B', '\r', '\n', '\032', '\n', 
+                                     0,               /* version */
+                                     8, 8, 4, 8,      /* sizes of intval, floatval, opcode_t, void * */
+                                     0,               /* little-endian */
+                                     0, 0 };          /* padding */
+    size_t   start;
+    unsigned i;
+    
+    if (comp->emit_m0b == 0) {
+        emit_str(OUT, ".version 0\n");
+        return;
+    }
+    
+    for (i = 0; i < sizeof (header); i++)
+        emit_char(OUT, header[i]);
+    
+    start = begin_segment(comp, M0_DIR_SEG);
+    for (i = 0; i < num_chunks; i++) {
+        emit_u32(OUT, strlen(chunknames[i]) + 1);
+        emit_str(OUT, chunknames[i]);
+        emit_char(OUT, '\0');
+    }
+    end_segment(comp, start, num_chunks);
 }
 
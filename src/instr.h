@@ -55,6 +55,16 @@ typedef enum m0_opcode {
 
 extern char const * const m0_instr_names[];
 
+/* Operand access modes, as listed per opcode in m0_operand_access. */
+#define OPERAND_NONE    0   /* not accessed as a register. */
+#define OPERAND_USE     1   /* register is read. */
+#define OPERAND_DEF     2   /* register is written. */
+
+extern unsigned char const m0_operand_access[][3];
+
+/* Is operand <op> a register that can be allocated (I, N, S or P)? */
+#define IS_REG_OPERAND(op)  ((op).type <= VAL_CHUNK)
+
     
 typedef enum M0_alias {
     CF       = 0,
@@ -72,28 +82,58 @@ typedef enum M0_alias {
     
 } M0_alias;
 
+/* Is <ins> a switch's jump into its jump table: a goto_chunk to the chunk's
+   own CHUNK, to a PC computed from the selector? See gencode_switch_table().
+ */
+#define IS_TABLE_JUMP(ins)  ((ins)->opcode == M0_GOTO_CHUNK && (ins)->operands[0].type == VAL_INTERP_REG \
+                             && (ins)->operands[0].value == CHUNK)
+
 /* struct for a single M0 operand. */
 typedef struct m0_operand {
-    unsigned char value;
-    unsigned char type;   
+    unsigned short value;   /* a label is counted from its chunk's <labelbase>. */
+    unsigned char  type;   
      
 } m0_operand;
 
-/* struct for a single instruction. */
+/* highest label that an operand can hold, counted from the chunk's <labelbase>. */
+#define MAX_LABEL   0xffff
+
+/* struct for a single instruction. Instructions are stored by value
+   in their chunk's code array.
+ */
 typedef struct m0_instr {
     unsigned char     opcode;
-    unsigned          numops;
-    unsigned int      label;       /* most instructions won't have one */
+    unsigned char     numops;
     struct m0_operand operands[3];
     
-    struct m0_instr *next;
 } m0_instr;
 
+/* A label, as it occurs in a chunk's code: label <label> is placed 
+   right before the instruction at index <instr>. 
+ */
+typedef struct m0_labelmark {
+    unsigned label;
+    unsigned instr;
+    
+} m0_labelmark;
+
+#define NO_INSTR    (~0u)   /* label not placed (yet). */
+
 /* struct representing an M0 chunk. */
 typedef struct m0_chunk {
-    char        *name;
-    unsigned int num_instr; /* number of instructions in this chunk. */
-    m0_instr *instructions; /* list of instructions. */
+    char         *name;
+    
+    m0_instr     *instructions;  /* code array of this chunk. */
+    unsigned int  num_instr;     /* number of instructions in this chunk. */
+    unsigned int  max_instr;     /* allocated size of instructions. */
+    
+    m0_labelmark *labelmarks;    /* labels in the order they were placed. */
+    unsigned int  num_labelmarks;
+    unsigned int  max_labelmarks;
+    
+    unsigned int *labels;        /* label number - <labelbase> => index of instruction. */
+    unsigned int  labelbase;     /* first label number that may be used in this chunk. */
+    unsigned int  max_labels;    /* allocated size of labels. */
     
     struct m0_chunk *next;  /* chunks are stored in a list. */
     
@@ -109,12 +149,19 @@ typedef struct m0_file {
 
 extern m0_chunk *mk_chunk(M1_compiler *comp, char *name);
 
-extern m0_instr *mk_instr(M1_compiler *comp, m0_opcode, char const * const format, ...);
+extern unsigned mk_instr(M1_compiler *comp, m0_opcode, char const * const format, ...);
 
 extern void mk_label(M1_compiler *comp, unsigned labelno);
 
+extern unsigned label_offset(m0_chunk *chunk, unsigned slot);
+
+extern void remove_instructions(M1_compiler *comp, m0_chunk *chunk, unsigned char const *deleted);
+
+extern void enter_metadata(M1_compiler *comp, struct m1_chunk *c);
+
 extern void write_chunk(M1_compiler *comp, struct m1_chunk *c);
-extern void write_m0b_file(M1_compiler *comp);
+extern void patch_frame_size(M1_compiler *comp, struct m1_chunk *c);
+extern void write_m0b_file(M1_compiler *comp, char **chunknames, unsigned num_chunks);
 
 #endif
 
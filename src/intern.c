@@ -0,0 +1,142 @@
+/*
+
+String interning. All names that the compiler compares (symbol names,
+type names, enum constants, string literals) are interned, so that
+name comparisons are pointer comparisons.
+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "intern.h"
+#include "arena.h"
+
+#define INITIAL_ATOMS   256
+
+m1_interntable *
+new_interntable(void) {
+    m1_interntable *table = (m1_interntable *)calloc(1, sizeof(m1_interntable));
+    
+    if (table == NULL) {
+        fprintf(stderr, "cant alloc mem for intern table");
+        exit(EXIT_FAILURE);   
+    }
+    
+    table->size  = INITIAL_ATOMS;
+    table->atoms = (char **)calloc(table->size, sizeof(char *));
+    
+    if (table->atoms == NULL) {
+        fprintf(stderr, "cant alloc mem for intern table");
+        exit(EXIT_FAILURE);   
+    }
+    return table;
+}
+
+/* Release the table; the strings themselves live in the symbol arena. */
+void
+delete_interntable(m1_interntable *table) {
+    assert(table != NULL);
+    free(table->atoms);
+    free(table);   
+}
+
+/* FNV-1a hash. */
+static unsigned
+hash_str(char const *str) {
+    unsigned hash = 2166136261u;
+    
+    while (*str != '\0') {
+        hash ^= (unsigned char)*str++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/* Find the slot holding C<str>, or the empty slot where it should go. */
+static char **
+find_atom(m1_interntable *table, char const *str, unsigned hash) {
+    unsigned mask  = table->size - 1;
+    unsigned index = hash & mask;
+    
+    while (table->atoms[index] != NULL) {
+        if (strcmp(table->atoms[index], str) == 0)
+            break;
+        index = (index + 1) & mask;
+    }
+    return &table->atoms[index];
+}
+
+static void
+grow_atoms(m1_interntable *table) {
+    char     **oldatoms = table->atoms;
+    unsigned   oldsize  = table->size;
+    unsigned   i;
+    
+    table->size *= 2;
+    table->atoms = (char **)calloc(table->size, sizeof(char *));
+    
+    if (table->atoms == NULL) {
+        fprintf(stderr, "cant alloc mem for intern table");
+        exit(EXIT_FAILURE);   
+    }
+    
+    for (i = 0; i < oldsize; i++) {
+        if (oldatoms[i] != NULL)
+            *find_atom(table, oldatoms[i], hash_str(oldatoms[i])) = oldatoms[i];
+    }
+    free(oldatoms);
+}
+
+/* 
+
+Hash an interned string. Interned strings are unique, so the address
+identifies the string; drop the low bits, which are always 0 due to
+alignment, and mix the rest.
+
+*/
+unsigned
+hash_atom(char const *atom) {
+    unsigned long addr = (unsigned long)atom;
+    return (unsigned)((addr >> 4) ^ (addr >> 16)) * 2654435761u;
+}
+
+/*
+
+Return the canonical copy of C<str>. If C<str> wasn't seen before, a copy 
+is stored in the symbol arena; C<str> itself is never kept, so it may be a 
+temporary buffer such as the lexer's yytext.
+
+*/
+char *
+intern(M1_compiler *comp, char const *str) {
+    m1_interntable  *table;
+    char           **atom;
+    unsigned         hash;
+    size_t           len;
+    
+    assert(comp != NULL);
+    assert(comp->atoms != NULL);
+    assert(str != NULL);
+    
+    table = comp->atoms;
+    hash  = hash_str(str);
+    atom  = find_atom(table, str, hash);
+    
+    if (*atom != NULL) 
+        return *atom;
+    
+    /* keep load factor at most 1/2. */
+    if ((table->count + 1) * 2 > table->size) {
+        grow_atoms(table);
+        atom = find_atom(table, str, hash);
+    }
+    
+    len   = strlen(str) + 1;
+    *atom = (char *)arena_alloc(comp->sym_arena, len);
+    memcpy(*atom, str, len);
+    ++table->count;
+    
+    return *atom;
+}
+
@@ -0,0 +1,29 @@
+#ifndef __M1_INTERN_H__
+#define __M1_INTERN_H__
+
+#include "compiler.h"
+
+/* 
+
+The intern table keeps exactly one copy of each distinct name (identifier,
+type name or string literal) in the program. Once a name is interned, it can
+be compared to other interned names by comparing pointers.
+
+*/
+typedef struct m1_interntable {
+    char     **atoms;       /* open-addressing hash table of strings. */
+    unsigned   size;        /* number of slots in atoms; always a power of 2. */
+    unsigned   count;       /* number of strings stored. */
+} m1_interntable;
+
+
+extern m1_interntable *new_interntable(void);
+
+extern void delete_interntable(m1_interntable *table);
+
+extern char *intern(M1_compiler *comp, char const *str);
+
+extern unsigned hash_atom(char const *atom);
+
+#endif
+
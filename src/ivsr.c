@@ -0,0 +1,736 @@
+/*
+
+Induction variable strength reduction. This runs on a chunk's code after
+loop-invariant code motion, and before dead code elimination and register
+allocation.
+
+A basic induction variable of a loop is a register that is only changed in
+the loop by adding or subtracting an invariant step, such as i in a "for"
+loop with i++. The element address of x[i][j] is computed as
+
+    mult_i  t, i, k         # k is the size of a row
+    add_i   u, x, t         # x is the base address
+
+and u changes by step * k whenever i changes. Such an address gets its own
+register p, which is computed before the loop, and incremented by step * k
+right after each increment of i; the multiply and add in the loop are
+removed, and the code that reads u reads p instead. That's done when:
+
+ - k, x and the step don't change in the loop;
+ - t is read only by the add, and u is set only there;
+ - u is read only in the loop, and i doesn't change between the add and
+   those reads;
+ - the multiply and add run in every iteration.
+
+If i is then only read by its increments and by comparisons with invariant
+values, and isn't read after the loop, the comparisons are done on p
+instead (as x + i * k < x + n * k when k is positive), and i's increments
+are removed.
+
+New code goes to the loop's preheader, as found by find_loops() (src/flow.c).
+Inner loops are done first. Call sequences are left alone.
+
+All memory is taken from the instruction arena, which is released once the
+chunk is done.
+
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "ivsr.h"
+#include "compiler.h"
+#include "instr.h"
+#include "gencode.h"
+#include "regalloc.h"
+#include "arena.h"
+#include "stats.h"
+#include "flow.h"
+
+#define NONE            (~0u)
+
+/* An address that was reduced to a register of its own. */
+typedef struct ivsr_family {
+    unsigned   iv;          /* id of the induction variable. */
+    m0_operand base;        /* x, the base address. */
+    int        base_first;  /* x is the add's first operand. */
+    m0_operand size;        /* k, what i is multiplied by. */
+    m0_operand reg;         /* the new register, p. */
+
+} ivsr_family;
+
+typedef struct ivsr_state {
+    M1_compiler   *comp;
+    m0_chunk      *chunk;
+    flow_graph    *graph;
+
+    unsigned      *num_defs;                /* per id: instructions that set it (up to 2). */
+    unsigned      *def_instr;               /* per id: its only definition. */
+    unsigned      *num_uses;                /* per id: instructions that read it (up to 2). */
+    unsigned      *use_instr;               /* per id: the only instruction that reads it. */
+    unsigned char *dominating;              /* per id: its only definition dominates all uses. */
+    unsigned char *defined;                 /* per id: set in the loop that is being done. */
+    unsigned char *always;                  /* per block: runs in every iteration of that loop. */
+
+    unsigned char *is_preheader;            /* per instruction: preheader code goes before it. */
+    unsigned      *reduced_in;              /* per instruction: 1 + loop whose reduction removed it. */
+    unsigned char *visited;                 /* per block, for searches. */
+    unsigned      *stack;
+
+    ivsr_family   *families;                /* reduced in the loop that is being done. */
+    unsigned       num_families;
+
+} ivsr_state;
+
+static void *
+ivsr_alloc(ivsr_state *v, size_t size) {
+    void *mem = arena_alloc(v->comp->instr_arena, size);
+    memset(mem, 0, size);
+    return mem;
+}
+
+/* Does instruction <i> read register <id>? */
+static int
+reads(ivsr_state *v, unsigned i, unsigned id) {
+    unsigned k;
+
+    for (k = 0; k < 3; k++) {
+        if (has_access(v->chunk, i, k, OPERAND_USE) && reg_id(v->graph, &v->chunk->instructions[i].operands[k]) == id)
+            return 1;
+    }
+    return 0;
+}
+
+/* Does instruction <i> set register <id>? */
+static int
+writes(ivsr_state *v, unsigned i, unsigned id) {
+    unsigned k;
+
+    for (k = 0; k < 3; k++) {
+        if (has_access(v->chunk, i, k, OPERAND_DEF) && reg_id(v->graph, &v->chunk->instructions[i].operands[k]) == id)
+            return 1;
+    }
+    return 0;
+}
+
+/* Is instruction <i> in loop <n>? */
+static int
+in_loop(ivsr_state *v, unsigned n, unsigned i) {
+    return v->graph->loops[n].body[v->graph->block_of[i]];
+}
+
+/* Is <op> a virtual int register that was there before this pass? */
+static int
+is_vreg(ivsr_state *v, m0_operand const *op) {
+    return op->type == VAL_INT && op->value >= REG_NUM && reg_id(v->graph, op) != NO_REG;
+}
+
+/* Is <op> a register that doesn't change in the loop that is being done? */
+static int
+is_invariant(ivsr_state *v, m0_operand const *op) {
+    unsigned id;
+
+    if (!IS_REG_OPERAND(*op))
+        return 0;
+
+    id = reg_id(v->graph, op);
+    return id != NO_REG && !v->defined[id];
+}
+
+/* Get the value of <op>, if it's a register that's only set by a set_imm that
+   dominates where it's read.
+ */
+static int
+constant_value(ivsr_state *v, m0_operand const *op, unsigned *value) {
+    unsigned        id = IS_REG_OPERAND(*op) ? reg_id(v->graph, op) : NO_REG;
+    m0_instr const *def;
+
+    if (id == NO_REG || v->num_defs[id] != 1 || !v->dominating[id])
+        return 0;
+
+    def = &v->chunk->instructions[v->def_instr[id]];
+    if (def->opcode != M0_SET_IMM)
+        return 0;
+
+    *value = def->operands[1].value * 256 + def->operands[2].value;
+    return 1;
+}
+
+/* Find the registers that are set once, by an instruction that dominates where
+   they're read, and the registers that are read once.
+ */
+static void
+find_definitions(ivsr_state *v) {
+    m0_chunk   *chunk = v->chunk;
+    flow_graph *g     = v->graph;
+    unsigned    i, k;
+
+    v->num_defs   = (unsigned *)ivsr_alloc(v, v->graph->num_ids * sizeof (unsigned));
+    v->def_instr  = (unsigned *)ivsr_alloc(v, v->graph->num_ids * sizeof (unsigned));
+    v->num_uses   = (unsigned *)ivsr_alloc(v, v->graph->num_ids * sizeof (unsigned));
+    v->use_instr  = (unsigned *)ivsr_alloc(v, v->graph->num_ids * sizeof (unsigned));
+    v->dominating = (unsigned char *)ivsr_alloc(v, v->graph->num_ids);
+    v->defined    = (unsigned char *)ivsr_alloc(v, v->graph->num_ids);
+
+    for (i = 0; i < chunk->num_instr; i++) {
+        if (g->foreign[i])
+            continue;
+
+        for (k = 0; k < 3; k++) {
+            unsigned id;
+
+            if (has_access(v->chunk, i, k, OPERAND_DEF)) {
+                id = reg_id(v->graph, &chunk->instructions[i].operands[k]);
+                if (v->num_defs[id] < 2)
+                    v->num_defs[id]++;
+                v->def_instr[id]  = i;
+                v->dominating[id] = 1;
+            }
+            else if (has_access(v->chunk, i, k, OPERAND_USE)) {
+                id = reg_id(v->graph, &chunk->instructions[i].operands[k]);
+                if (v->num_uses[id] < 2)
+                    v->num_uses[id]++;
+                v->use_instr[id] = i;
+            }
+        }
+    }
+
+    for (i = 0; i < chunk->num_instr; i++) {
+        unsigned use_block = g->block_of[i];
+
+        if (g->foreign[i] || g->blocks[use_block].rpo == NO_BLOCK)
+            continue;
+
+        for (k = 0; k < 3; k++) {
+            unsigned id, def, def_block;
+
+            if (!has_access(v->chunk, i, k, OPERAND_USE))
+                continue;
+
+            id = reg_id(v->graph, &chunk->instructions[i].operands[k]);
+            if (v->num_defs[id] != 1)
+                continue;
+
+            def       = v->def_instr[id];
+            def_block = g->block_of[def];
+
+            if (g->blocks[def_block].rpo == NO_BLOCK
+            || (def_block == use_block ? def >= i : !dominates(g, def_block, use_block)))
+                v->dominating[id] = 0;
+        }
+    }
+}
+
+/* Get a new virtual int register. */
+static m0_operand
+new_register(ivsr_state *v) {
+    M1_compiler *comp = v->comp;
+    m0_operand   op;
+
+    if (REG_NUM + comp->vregs[VAL_INT] > MAX_VREG) {
+        fprintf(stderr, "chunk %s is too large: out of virtual registers\n", v->chunk->name);
+        exit(EXIT_FAILURE);
+    }
+    op.value = REG_NUM + comp->vregs[VAL_INT]++;
+    op.type  = VAL_INT;
+    return op;
+}
+
+static void
+insert_instr(ivsr_state *v, unsigned at, m0_opcode opcode, m0_operand a, m0_operand b, m0_operand c) {
+    m0_instr ins;
+
+    ins.opcode      = opcode;
+    ins.numops      = 3;
+    ins.operands[0] = a;
+    ins.operands[1] = b;
+    ins.operands[2] = c;
+    insert_code(v->comp, v->graph, at, &ins);
+}
+
+/* Insert code that sets <dst> to <a> * <b> before instruction <at>. */
+static void
+insert_product(ivsr_state *v, unsigned at, m0_operand dst, m0_operand a, m0_operand b) {
+    unsigned x, y;
+
+    if (constant_value(v, &a, &x) && constant_value(v, &b, &y) && x * y < 256 * 255) {
+        m0_operand hi, lo;
+
+        hi.type  = lo.type = VAL_VOID;
+        hi.value = (x * y) / 256;
+        lo.value = (x * y) % 256;
+        insert_instr(v, at, M0_SET_IMM, dst, hi, lo);
+    }
+    else
+        insert_instr(v, at, M0_MULT_I, dst, a, b);
+}
+
+/* If instruction <i> adds an invariant step to register <id>, or subtracts it,
+   return the operand that holds the step; else return 0.
+ */
+static unsigned
+step_operand(ivsr_state *v, unsigned i, unsigned id) {
+    m0_instr const *ins = &v->chunk->instructions[i];
+
+    if (ins->opcode != M0_ADD_I && ins->opcode != M0_SUB_I)
+        return 0;
+
+    if (reg_id(v->graph, &ins->operands[1]) == id && is_invariant(v, &ins->operands[2]))
+        return 2;
+
+    if (ins->opcode == M0_ADD_I && reg_id(v->graph, &ins->operands[2]) == id && is_invariant(v, &ins->operands[1]))
+        return 1;
+
+    return 0;
+}
+
+/* If instruction <i> sets register <id> to itself plus or minus an invariant step,
+   return the instruction that does the arithmetic: <i> itself (i++), or the add
+   whose result <i> copies (i = i + 1). Else return NONE.
+ */
+static unsigned
+increment_of(ivsr_state *v, unsigned i, unsigned id) {
+    m0_instr const *ins = &v->chunk->instructions[i];
+    unsigned        t, arith;
+
+    if (v->graph->fixed[i] || reg_id(v->graph, &ins->operands[0]) != id)
+        return NONE;
+
+    if (ins->opcode != M0_SET)
+        return step_operand(v, i, id) ? i : NONE;
+
+    if (!is_vreg(v, &ins->operands[1]))
+        return NONE;
+
+    t = reg_id(v->graph, &ins->operands[1]);
+    if (v->num_defs[t] != 1)
+        return NONE;
+
+    /* the add comes right before, in the same block. */
+    arith = v->def_instr[t];
+    if (arith + 1 != i || v->graph->block_of[arith] != v->graph->block_of[i]
+    ||  v->graph->fixed[arith] || !step_operand(v, arith, id))
+        return NONE;
+
+    return arith;
+}
+
+/* Is instruction <i> the arithmetic of an increment of register <id> that copies
+   its result, and is that copy the only one that reads the result?
+ */
+static int
+is_increment_arith(ivsr_state *v, unsigned i, unsigned id) {
+    return i + 1 < v->chunk->num_instr && increment_of(v, i + 1, id) == i
+        && v->num_uses[reg_id(v->graph, &v->chunk->instructions[i].operands[0])] == 1;
+}
+
+/* Is register <id> a basic induction variable of loop <n>? Code goes right
+   after each increment, which may not be where preheader code goes.
+ */
+static int
+is_basic_iv(ivsr_state *v, unsigned n, unsigned id) {
+    flow_graph *g = v->graph;
+    unsigned    b, i, increments = 0;
+
+    for (b = 0; b < g->num_blocks; b++) {
+        if (!g->loops[n].body[b])
+            continue;
+
+        for (i = g->blocks[b].start; i < g->blocks[b].end; i++) {
+            if (g->foreign[i] || !writes(v, i, id))
+                continue;
+
+            if (g->removed[i] || v->is_preheader[i + 1] || increment_of(v, i, id) == NONE)
+                return 0;
+            increments++;
+        }
+    }
+    return increments > 0;
+}
+
+/* Can code that runs after instruction <from> in loop <n> read register <id>
+   without passing instruction <stop>, or going round the loop?
+ */
+static int
+reaches_use(ivsr_state *v, unsigned n, unsigned from, unsigned stop, unsigned id) {
+    flow_graph *g     = v->graph;
+    flow_loop  *loop  = &g->loops[n];
+    unsigned    top   = 0,
+                block = g->block_of[from],
+                i     = from + 1,
+                k;
+
+    memset(v->visited, 0, g->num_blocks);
+
+    for (;;) {
+        for (; i < g->blocks[block].end; i++) {
+            if (i == stop)
+                break;
+            if (!g->foreign[i] && reads(v, i, id))
+                return 1;
+        }
+
+        if (i != stop) {
+            for (k = 0; k < g->blocks[block].num_succ; k++) {
+                unsigned succ = g->blocks[block].succ[k];
+
+                if (succ != loop->header && loop->body[succ] && !v->visited[succ]) {
+                    v->visited[succ] = 1;
+                    v->stack[top++]  = succ;
+                }
+            }
+        }
+
+        if (top == 0)
+            return 0;
+
+        block = v->stack[--top];
+        i     = g->blocks[block].start;
+    }
+}
+
+/* Is register <id> read after loop <n>, before it's set? */
+static int
+live_after_loop(ivsr_state *v, unsigned n, unsigned id) {
+    flow_graph *g    = v->graph;
+    flow_loop  *loop = &g->loops[n];
+    unsigned    top  = 0, b, i, k;
+
+    memset(v->visited, 0, g->num_blocks);
+
+    for (b = 0; b < g->num_blocks; b++) {
+        if (!loop->body[b])
+            continue;
+
+        for (k = 0; k < g->blocks[b].num_succ; k++) {
+            unsigned succ = g->blocks[b].succ[k];
+
+            if (!loop->body[succ] && !v->visited[succ]) {
+                v->visited[succ] = 1;
+                v->stack[top++]  = succ;
+            }
+        }
+    }
+
+    while (top > 0) {
+        b = v->stack[--top];
+
+        for (i = g->blocks[b].start; i < g->blocks[b].end; i++) {
+            if (g->foreign[i])
+                continue;
+            if (reads(v, i, id))
+                return 1;
+            /* removed code doesn't set it anymore. */
+            if (writes(v, i, id) && !g->removed[i])
+                break;
+        }
+
+        if (i < g->blocks[b].end)
+            continue;
+
+        for (k = 0; k < g->blocks[b].num_succ; k++) {
+            unsigned succ = g->blocks[b].succ[k];
+
+            if (!v->visited[succ]) {
+                v->visited[succ] = 1;
+                v->stack[top++]  = succ;
+            }
+        }
+    }
+    return 0;
+}
+
+/* Reduce the address that's computed from instruction <mult> in loop <n>, if it
+   can be done.
+ */
+static void
+reduce_address(ivsr_state *v, unsigned n, unsigned mult) {
+    m0_chunk   *chunk = v->chunk;
+    flow_graph *g     = v->graph;
+    m0_instr   *ins   = &chunk->instructions[mult];
+    unsigned    pre   = g->loops[n].preheader;
+    unsigned    which, iv = NONE, t, u, add, i, b;
+    m0_operand  size, reg;
+    m0_instr    copy;
+    ivsr_family *family;
+
+    if (ins->opcode != M0_MULT_I || g->fixed[mult] || g->removed[mult] || !is_vreg(v, &ins->operands[0]))
+        return;
+
+    for (which = 1; which <= 2 && iv == NONE; which++) {
+        if (is_vreg(v, &ins->operands[which]) && is_invariant(v, &ins->operands[3 - which])
+        &&  is_basic_iv(v, n, reg_id(v->graph, &ins->operands[which])))
+            iv = reg_id(v->graph, &ins->operands[which]);
+    }
+    if (iv == NONE)
+        return;
+    size = ins->operands[reg_id(v->graph, &ins->operands[1]) == iv ? 2 : 1];
+
+    /* t is only read by an add of an invariant base: u = x + t. */
+    t = reg_id(v->graph, &ins->operands[0]);
+    if (v->num_defs[t] != 1 || !v->dominating[t] || v->num_uses[t] != 1)
+        return;
+
+    /* the address must be needed in every iteration, or stepping it costs more. */
+    add = v->use_instr[t];
+    if (!v->always[g->block_of[mult]] || !v->always[g->block_of[add]])
+        return;
+
+    if (chunk->instructions[add].opcode != M0_ADD_I || !in_loop(v, n, add)
+    ||  g->fixed[add] || g->foreign[add] || g->removed[add]
+    ||  !is_vreg(v, &chunk->instructions[add].operands[0])
+    ||  !is_invariant(v, &chunk->instructions[add].operands[reg_id(v->graph, &chunk->instructions[add].operands[1]) == t ? 2 : 1]))
+        return;
+
+    u = reg_id(v->graph, &chunk->instructions[add].operands[0]);
+    if (v->num_defs[u] != 1 || !v->dominating[u])
+        return;
+
+    /* u is read in the loop, where i didn't change since the add. */
+    for (i = 0; i < chunk->num_instr; i++) {
+        if (!g->foreign[i] && reads(v, i, u) && !in_loop(v, n, i))
+            return;
+    }
+    for (b = 0; b < g->num_blocks; b++) {
+        if (!g->loops[n].body[b])
+            continue;
+
+        for (i = g->blocks[b].start; i < g->blocks[b].end; i++) {
+            if (!g->foreign[i] && writes(v, i, iv) && reaches_use(v, n, i, add, u))
+                return;
+        }
+    }
+
+    /* compute p before the loop, ... */
+    reg  = new_register(v);
+    copy = *ins;
+    copy.operands[0] = reg;
+    insert_code(v->comp, g, pre, &copy);
+
+    copy = chunk->instructions[add];
+    copy.operands[0] = reg;
+    copy.operands[reg_id(v->graph, &copy.operands[1]) == t ? 1 : 2] = reg;
+    insert_code(v->comp, g, pre, &copy);
+
+    /* ... step it along with i, ... */
+    for (b = 0; b < g->num_blocks; b++) {
+        if (!g->loops[n].body[b])
+            continue;
+
+        for (i = g->blocks[b].start; i < g->blocks[b].end; i++) {
+            if (!g->foreign[i] && writes(v, i, iv)) {
+                unsigned   arith = increment_of(v, i, iv);
+                m0_operand by    = chunk->instructions[arith].operands[step_operand(v, arith, iv)];
+                m0_operand step  = size;
+                unsigned   value;
+
+                /* a step of one moves p by the size itself. */
+                if (!constant_value(v, &by, &value) || value != 1) {
+                    step = new_register(v);
+                    insert_product(v, pre, step, by, size);
+                }
+                insert_instr(v, i + 1, chunk->instructions[arith].opcode, reg, reg, step);
+            }
+        }
+    }
+
+    /* ... and read it where u was read. */
+    for (i = 0; i < chunk->num_instr; i++) {
+        unsigned k;
+
+        for (k = 0; k < 3 && !g->foreign[i]; k++) {
+            if (has_access(v->chunk, i, k, OPERAND_USE) && reg_id(v->graph, &chunk->instructions[i].operands[k]) == u)
+                chunk->instructions[i].operands[k] = reg;
+        }
+    }
+
+    g->removed[mult]   = 1;
+    g->removed[add]    = 1;
+    v->reduced_in[mult] = n + 1;
+    v->reduced_in[add]  = n + 1;
+
+    family             = &v->families[v->num_families++];
+    family->iv         = iv;
+    family->base_first = reg_id(v->graph, &chunk->instructions[add].operands[2]) == t;
+    family->base       = chunk->instructions[add].operands[family->base_first ? 1 : 2];
+    family->size       = size;
+    family->reg        = reg;
+
+    STAT_INC(v->comp, strength_reduced);
+}
+
+/* Is instruction <i> a comparison of register <id> with an invariant value? */
+static int
+is_bound_check(ivsr_state *v, unsigned i, unsigned id) {
+    m0_instr const *ins = &v->chunk->instructions[i];
+
+    if ((ins->opcode != M0_ISGT_I && ins->opcode != M0_ISGE_I) || v->graph->fixed[i] || v->graph->removed[i])
+        return 0;
+
+    return (reg_id(v->graph, &ins->operands[1]) == id && is_invariant(v, &ins->operands[2]))
+        || (reg_id(v->graph, &ins->operands[2]) == id && is_invariant(v, &ins->operands[1]));
+}
+
+/* Is instruction <i> a copy that's never read, such as the old value that i++ saves? */
+static int
+is_unused_copy(ivsr_state *v, unsigned i) {
+    m0_instr const *ins = &v->chunk->instructions[i];
+
+    return ins->opcode == M0_SET && is_vreg(v, &ins->operands[0])
+        && v->num_uses[reg_id(v->graph, &ins->operands[0])] == 0;
+}
+
+/* If the induction variable of <family> is only needed for the loop's test,
+   test the family's register instead, and remove the induction variable.
+ */
+static void
+replace_test(ivsr_state *v, unsigned n, ivsr_family const *family) {
+    m0_chunk   *chunk = v->chunk;
+    flow_graph *g     = v->graph;
+    unsigned    pre   = g->loops[n].preheader;
+    unsigned    size, b, i;
+
+    if (!constant_value(v, &family->size, &size) || size == 0)
+        return;
+
+    for (b = 0; b < g->num_blocks; b++) {
+        if (!g->loops[n].body[b])
+            continue;
+
+        for (i = g->blocks[b].start; i < g->blocks[b].end; i++) {
+            if (g->foreign[i] || !reads(v, i, family->iv) || v->reduced_in[i] == n + 1)
+                continue;
+            if (!is_bound_check(v, i, family->iv) && !is_unused_copy(v, i)
+            &&  increment_of(v, i, family->iv) == NONE && !is_increment_arith(v, i, family->iv))
+                return;
+        }
+    }
+
+    if (live_after_loop(v, n, family->iv))
+        return;
+
+    for (b = 0; b < g->num_blocks; b++) {
+        if (!g->loops[n].body[b])
+            continue;
+
+        for (i = g->blocks[b].start; i < g->blocks[b].end; i++) {
+            m0_instr *ins = &chunk->instructions[i];
+
+            if (g->foreign[i] || v->reduced_in[i] == n + 1)
+                continue;
+
+            if (writes(v, i, family->iv) || is_increment_arith(v, i, family->iv))
+                g->removed[i] = 1;
+            else if (is_bound_check(v, i, family->iv)) {
+                /* i < bound becomes x + i * k < x + bound * k. */
+                unsigned   which = reg_id(v->graph, &ins->operands[1]) == family->iv ? 1 : 2;
+                m0_operand limit = new_register(v);
+
+                insert_product(v, pre, limit, ins->operands[3 - which], family->size);
+                if (family->base_first)
+                    insert_instr(v, pre, M0_ADD_I, limit, family->base, limit);
+                else
+                    insert_instr(v, pre, M0_ADD_I, limit, limit, family->base);
+
+                ins->operands[which]     = family->reg;
+                ins->operands[3 - which] = limit;
+            }
+        }
+    }
+}
+
+/* Reduce the addresses computed in loop <n>. */
+static void
+reduce_loop(ivsr_state *v, unsigned n) {
+    m0_chunk   *chunk = v->chunk;
+    flow_graph *g     = v->graph;
+    unsigned    b, i, k, f;
+
+    memset(v->defined, 0, v->graph->num_ids);
+    for (b = 0; b < g->num_blocks; b++) {
+        if (!g->loops[n].body[b])
+            continue;
+
+        for (i = g->blocks[b].start; i < g->blocks[b].end; i++) {
+            for (k = 0; k < 3 && !g->foreign[i]; k++) {
+                if (has_access(v->chunk, i, k, OPERAND_DEF)) {
+                    unsigned id = reg_id(v->graph, &chunk->instructions[i].operands[k]);
+
+                    if (id != NO_REG)
+                        v->defined[id] = 1;
+                }
+            }
+        }
+    }
+
+    find_unconditional_blocks(g, n, v->always);
+
+    v->num_families = 0;
+    for (b = 0; b < g->num_blocks; b++) {
+        if (!g->loops[n].body[b])
+            continue;
+
+        for (i = g->blocks[b].start; i < g->blocks[b].end; i++) {
+            if (!g->foreign[i])
+                reduce_address(v, n, i);
+        }
+    }
+
+    /* the test can be replaced once for each induction variable. */
+    for (f = 0; f < v->num_families; f++) {
+        unsigned e;
+
+        for (e = 0; e < f && v->families[e].iv != v->families[f].iv; e++)
+            ;
+        if (e == f)
+            replace_test(v, n, &v->families[f]);
+    }
+}
+
+/*
+
+Replace multiplications of induction variables in the loops of <chunk> by
+additions.
+
+*/
+void
+reduce_induction_variables(M1_compiler *comp, m0_chunk *chunk) {
+    ivsr_state v;
+    unsigned   n;
+
+    if (chunk->num_instr == 0)
+        return;
+
+    memset(&v, 0, sizeof (ivsr_state));
+    v.comp  = comp;
+    v.chunk = chunk;
+
+    v.graph = build_flow_graph(comp, chunk);
+    find_loops(comp, chunk, v.graph);
+
+    if (v.graph->num_loops == 0)
+        return;
+
+    find_definitions(&v);
+
+    v.is_preheader = (unsigned char *)ivsr_alloc(&v, chunk->num_instr + 2);
+    v.reduced_in   = (unsigned *)ivsr_alloc(&v, (chunk->num_instr + 1) * sizeof (unsigned));
+    v.visited      = (unsigned char *)ivsr_alloc(&v, v.graph->num_blocks + 1);
+    v.always       = (unsigned char *)ivsr_alloc(&v, v.graph->num_blocks + 1);
+    v.stack        = (unsigned *)ivsr_alloc(&v, (v.graph->num_blocks + 1) * sizeof (unsigned));
+    v.families     = (ivsr_family *)ivsr_alloc(&v, (chunk->num_instr + 1) * sizeof (ivsr_family));
+
+    for (n = 0; n < v.graph->num_loops; n++) {
+        if (v.graph->loops[n].preheader != NO_INSTR)
+            v.is_preheader[v.graph->loops[n].preheader] = 1;
+    }
+
+    for (n = 0; n < v.graph->num_loops; n++) {
+        if (v.graph->loops[n].preheader != NO_INSTR)
+            reduce_loop(&v, n);
+    }
+
+    if (v.graph->num_inserted > 0)
+        rewrite_code(comp, chunk, v.graph);
+}
+
@@ -0,0 +1,19 @@
+#ifndef __M1_IVSR_H__
+#define __M1_IVSR_H__
+
+#include "compiler.h"
+#include "instr.h"
+
+/*
+
+Induction variable strength reduction replaces the address computations
+of array elements in loops, base + i * size, by a register that is
+incremented along with i. It runs after hoist_loop_invariants(), on
+virtual registers.
+
+*/
+
+extern void reduce_induction_variables(M1_compiler *comp, m0_chunk *chunk);
+
+#endif
+
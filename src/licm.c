@@ -0,0 +1,318 @@
+/*
+
+Loop-invariant code motion. This runs on a chunk's code after common
+subexpression elimination, and before dead code elimination and register
+allocation.
+
+Loops are found as back edges in the control flow graph: an edge to a
+block that dominates its source. Instructions in a loop that compute the
+same value in every iteration are moved to the loop's preheader, where they
+run once each time the loop is entered. Inner loops are done first, so that
+an instruction can move out of several loops at once.
+
+An instruction is moved when:
+
+ - it's free of side effects, and can't fail: arithmetic except division,
+   a copy, set_imm, or a load from the constants segment;
+ - it sets a virtual register that isn't set anywhere else, and that value
+   is read only where the instruction dominates the read;
+ - the registers it reads aren't set in the loop, except by instructions
+   that were moved out before;
+ - it runs in every iteration, or the loop is the innermost one it's in.
+
+The loops and their preheaders are found by find_loops() (src/flow.c).
+
+All memory is taken from the instruction arena, which is released once the
+chunk is done.
+
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "licm.h"
+#include "compiler.h"
+#include "instr.h"
+#include "gencode.h"
+#include "arena.h"
+#include "stats.h"
+#include "flow.h"
+
+#define NONE            (~0u)
+
+/* An instruction that was moved out of a loop. */
+typedef struct licm_move {
+    unsigned instr;
+    unsigned loop;
+
+} licm_move;
+
+typedef struct licm_state {
+    M1_compiler   *comp;
+    m0_chunk      *chunk;
+    flow_graph    *graph;
+
+    unsigned      *num_defs;                /* per id: instructions that set it (up to 2). */
+    unsigned      *def_instr;               /* per id: its only definition. */
+    unsigned char *dominating;              /* per id: its only definition dominates all uses. */
+    unsigned char *defined;                 /* per id: set in the loop that is being done. */
+    unsigned char *always;                  /* per block: runs in every iteration of that loop. */
+
+    unsigned      *moved_to;                /* per instruction: loop it's moved out of, or NONE. */
+    licm_move     *moves;                   /* in the order they were made. */
+    unsigned       num_moves, max_moves;
+
+} licm_state;
+
+static void *
+licm_alloc(licm_state *l, size_t size) {
+    void *mem = arena_alloc(l->comp->instr_arena, size);
+    memset(mem, 0, size);
+    return mem;
+}
+
+/* Can the instruction be run where it wasn't, without changing anything but its target? */
+static int
+is_movable(m0_instr const *ins) {
+    switch (ins->opcode) {
+        case M0_ADD_I: case M0_ADD_N: case M0_SUB_I: case M0_SUB_N:
+        case M0_MULT_I: case M0_MULT_N:
+        case M0_ISGT_I: case M0_ISGT_N: case M0_ISGE_I: case M0_ISGE_N:
+        case M0_CONVERT_N_I: case M0_CONVERT_I_N:
+        case M0_ASHR: case M0_LSHR: case M0_SHL:
+        case M0_AND: case M0_OR: case M0_XOR:
+        case M0_SET: case M0_SET_IMM:
+            return IS_REG_OPERAND(ins->operands[0]);
+        case M0_DEREF:
+            return IS_REG_OPERAND(ins->operands[0])
+                && ins->operands[1].type == VAL_INTERP_REG && ins->operands[1].value == CONSTS;
+        default:
+            return 0;
+    }
+}
+
+/* Find the registers that are set once, by an instruction that dominates where they're read. */
+static void
+find_definitions(licm_state *l) {
+    m0_chunk   *chunk = l->chunk;
+    flow_graph *g     = l->graph;
+    unsigned    i, k;
+
+    l->num_defs   = (unsigned *)licm_alloc(l, l->graph->num_ids * sizeof (unsigned));
+    l->def_instr  = (unsigned *)licm_alloc(l, l->graph->num_ids * sizeof (unsigned));
+    l->dominating = (unsigned char *)licm_alloc(l, l->graph->num_ids);
+    l->defined    = (unsigned char *)licm_alloc(l, l->graph->num_ids);
+
+    for (i = 0; i < chunk->num_instr; i++) {
+        if (g->foreign[i])
+            continue;
+
+        for (k = 0; k < 3; k++) {
+            if (has_access(l->chunk, i, k, OPERAND_DEF)) {
+                unsigned id = reg_id(l->graph, &chunk->instructions[i].operands[k]);
+
+                if (l->num_defs[id] < 2)
+                    l->num_defs[id]++;
+                l->def_instr[id]  = i;
+                l->dominating[id] = 1;
+            }
+        }
+    }
+
+    for (i = 0; i < chunk->num_instr; i++) {
+        unsigned use_block = g->block_of[i];
+
+        if (g->foreign[i] || g->blocks[use_block].rpo == NO_BLOCK)
+            continue;
+
+        for (k = 0; k < 3; k++) {
+            unsigned id, def, def_block;
+
+            if (!has_access(l->chunk, i, k, OPERAND_USE))
+                continue;
+
+            id = reg_id(l->graph, &chunk->instructions[i].operands[k]);
+            if (l->num_defs[id] != 1)
+                continue;
+
+            def       = l->def_instr[id];
+            def_block = g->block_of[def];
+
+            if (g->blocks[def_block].rpo == NO_BLOCK
+            || (def_block == use_block ? def >= i : !dominates(g, def_block, use_block)))
+                l->dominating[id] = 0;
+        }
+    }
+}
+
+/* Get the block where instruction <i> is now; that's its preheader's, if it was moved. */
+static unsigned
+location(licm_state *l, unsigned i) {
+    unsigned m = l->moved_to[i];
+
+    return l->graph->block_of[m == NONE ? i : l->graph->loops[m].preheader];
+}
+
+/* Is instruction <i> in loop <n>, where it is now? */
+static int
+in_loop(licm_state *l, unsigned n, unsigned i) {
+    return l->moved_to[i] != n && l->graph->loops[n].body[location(l, i)];
+}
+
+/* Is it worth to move instruction <i> out of loop <n>? Code that doesn't run in
+   every iteration is only moved out of its innermost loop; moving it further
+   would make it run for every entry of the outer loops, which may be more often
+   than the code would have run.
+ */
+static int
+is_profitable(licm_state *l, unsigned n, unsigned i) {
+    unsigned b = location(l, i);
+
+    return l->always[b] || (l->moved_to[i] == NONE && l->graph->innermost[b] == n);
+}
+
+/* Can instruction <i> be moved out of loop <n>? */
+static int
+is_invariant(licm_state *l, unsigned n, unsigned i) {
+    m0_instr const *ins = &l->chunk->instructions[i];
+    unsigned        dst, k;
+
+    if (l->graph->fixed[i] || l->graph->foreign[i] || !is_movable(ins)
+    ||  ins->operands[0].value < REG_NUM)
+        return 0;
+
+    dst = reg_id(l->graph, &ins->operands[0]);
+    if (l->num_defs[dst] != 1 || !l->dominating[dst])
+        return 0;
+
+    if (ins->opcode == M0_SET_IMM)
+        return 1;
+
+    for (k = 1; k < ins->numops; k++) {
+        unsigned id;
+
+        /* the constants segment is the same everywhere; the index into it must be invariant too. */
+        if (ins->operands[k].type == VAL_INTERP_REG) {
+            if (ins->opcode != M0_DEREF || k != 1)
+                return 0;
+            continue;
+        }
+
+        if (!has_access(l->chunk, i, k, OPERAND_USE))
+            continue;
+
+        id = reg_id(l->graph, &ins->operands[k]);
+        if (l->defined[id]
+        && (l->num_defs[id] != 1 || l->moved_to[l->def_instr[id]] != n))
+            return 0;
+    }
+    return 1;
+}
+
+/* Move what's invariant out of loop <n>. */
+static void
+hoist_loop(licm_state *l, unsigned n) {
+    m0_chunk *chunk = l->chunk;
+    unsigned  i, k;
+    int       changed;
+
+    memset(l->defined, 0, l->graph->num_ids);
+
+    for (i = 0; i < chunk->num_instr; i++) {
+        if (l->graph->foreign[i] || !in_loop(l, n, i))
+            continue;
+
+        for (k = 0; k < 3; k++) {
+            if (has_access(l->chunk, i, k, OPERAND_DEF))
+                l->defined[reg_id(l->graph, &chunk->instructions[i].operands[k])] = 1;
+        }
+    }
+
+    find_unconditional_blocks(l->graph, n, l->always);
+
+    /* an instruction is moved once the ones that set what it reads are. */
+    do {
+        changed = 0;
+        for (i = 0; i < chunk->num_instr; i++) {
+            if (!in_loop(l, n, i) || !is_profitable(l, n, i) || !is_invariant(l, n, i))
+                continue;
+
+            /* an instruction that moves out of several loops is listed for each. */
+            if (l->num_moves == l->max_moves) {
+                licm_move *moves = (licm_move *)licm_alloc(l, 2 * l->max_moves * sizeof (licm_move));
+
+                memcpy(moves, l->moves, l->num_moves * sizeof (licm_move));
+                l->moves      = moves;
+                l->max_moves *= 2;
+            }
+
+            l->moved_to[i]                = n;
+            l->moves[l->num_moves].instr  = i;
+            l->moves[l->num_moves++].loop = n;
+            changed = 1;
+        }
+    } while (changed);
+}
+
+/* Put the moved instructions in their preheaders. */
+static unsigned
+move_code(licm_state *l) {
+    flow_graph *g = l->graph;
+    unsigned    m, moved = 0;
+
+    for (m = 0; m < l->num_moves; m++) {
+        unsigned instr = l->moves[m].instr;
+
+        if (l->moved_to[instr] == l->moves[m].loop) {
+            insert_code(l->comp, g, g->loops[l->moves[m].loop].preheader, &l->chunk->instructions[instr]);
+            g->removed[instr] = 1;
+            moved++;
+        }
+    }
+
+    rewrite_code(l->comp, l->chunk, g);
+    return moved;
+}
+
+/*
+
+Move loop-invariant instructions of <chunk> to the preheaders of their loops.
+
+*/
+void
+hoist_loop_invariants(M1_compiler *comp, m0_chunk *chunk) {
+    licm_state l;
+    unsigned   i, n;
+
+    if (chunk->num_instr == 0)
+        return;
+
+    memset(&l, 0, sizeof (licm_state));
+    l.comp  = comp;
+    l.chunk = chunk;
+
+    l.graph = build_flow_graph(comp, chunk);
+    find_loops(comp, chunk, l.graph);
+
+    if (l.graph->num_loops == 0)
+        return;
+
+    find_definitions(&l);
+
+    l.moved_to  = (unsigned *)licm_alloc(&l, (chunk->num_instr + 1) * sizeof (unsigned));
+    l.always    = (unsigned char *)licm_alloc(&l, l.graph->num_blocks);
+    l.max_moves = chunk->num_instr + 1;
+    l.moves     = (licm_move *)licm_alloc(&l, l.max_moves * sizeof (licm_move));
+
+    for (i = 0; i <= chunk->num_instr; i++)
+        l.moved_to[i] = NONE;
+
+    for (n = 0; n < l.graph->num_loops; n++) {
+        if (l.graph->loops[n].preheader != NO_INSTR)
+            hoist_loop(&l, n);
+    }
+
+    if (l.num_moves > 0)
+        comp->stats->hoisted += move_code(&l);
+}
+
@@ -0,0 +1,17 @@
+#ifndef __M1_LICM_H__
+#define __M1_LICM_H__
+
+#include "compiler.h"
+#include "instr.h"
+
+/*
+
+Loop-invariant code motion moves instructions that compute the same value
+in every iteration of a loop to before the loop. It runs after
+eliminate_common_subexpressions(), on virtual registers.
+
+*/
+
+extern void hoist_loop_invariants(M1_compiler *comp, m0_chunk *chunk);
+
+#endif
@@ -15,6 +15,7 @@
 #include "compiler.h"
 #include "decl.h"
 #include "symtab.h"
+#include "intern.h"
 
 
 extern int yylex(YYSTYPE *yylval, yyscan_t yyscanner);
@@ -433,9 +434,9 @@ extends_clause	: /* empty */
                 ;
                 
 id_list			: TK_IDENT
-                    { $$ = identlist(NULL, $1); }
+                    { $$ = identlist(comp, NULL, $1); }
                 | id_list ',' TK_IDENT
-                    { $$ = identlist($1, $3); }
+                    { $$ = identlist(comp, $1, $3); }
                 ;                
 
                 
@@ -604,7 +605,8 @@ print_stat  : "print" '(' arguments ')' ';'
             ;
 
                   
-const_declaration   : "const" vartype TK_IDENT '=' constexpr ';'
+/* the value of a constant may be an expression, as long as it can be folded. */
+const_declaration   : "const" vartype TK_IDENT '=' expression ';'
                         { $$ = constdecl(comp, $2, $3, $5); }
                     ;                  
                         
@@ -631,14 +633,14 @@ var         : TK_IDENT opt_init
             ;           
             
 dimension   : '[' TK_INT ']'
-                { $$ = array_dimension($2); }
+                { $$ = array_dimension(comp, $2); }
             | dimension '[' TK_INT ']'
                 { 
                   m1_dimension *iter = $1;
                   while (iter->next != NULL)
                     iter = iter->next;
                   /* out of while loop; iter->next is now NULL */   
-                  iter->next = array_dimension($3);
+                  iter->next = array_dimension(comp, $3);
                   $$ = $1;  
                 }
             ;
@@ -1040,12 +1042,12 @@ vartype     : native_type  { $$ = comp->parsingtype = $1; }
             ;            
 
         
-native_type : "int"     { $$ = "int"; }
-            | "num"     { $$ = "num"; }
-            | "string"  { $$ = "string"; }
-            | "bool"    { $$ = "bool"; }
-            | "char"    { $$ = "char"; }
-            | "void"    { $$ = "void"; }
+native_type : "int"     { $$ = intern(comp, "int"); }
+            | "num"     { $$ = intern(comp, "num"); }
+            | "string"  { $$ = intern(comp, "string"); }
+            | "bool"    { $$ = intern(comp, "bool"); }
+            | "char"    { $$ = intern(comp, "char"); }
+            | "void"    { $$ = intern(comp, "void"); }
             ;
             
 
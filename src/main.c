@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 
 /* m1parser.h needs to be included /before/ m1lexer.h. */
@@ -13,6 +14,13 @@
 #include "stack.h"
 #include "gencode.h"
 #include "decl.h"
+#include "intern.h"
+#include "arena.h"
+#include "emit.h"
+#include "stats.h"
+#include "fold.h"
+#include "sccp.h"
+#include "unroll.h"
 
 #include <assert.h>
 
@@ -20,23 +28,46 @@ extern int yyparse(yyscan_t yyscanner, struct M1_compiler * const comp);
 
 
 static void
-init_compiler(M1_compiler *comp) {
+init_compiler(M1_compiler *comp, m1_statsformat statsformat) {
    	memset(comp, 0, sizeof(M1_compiler)); 
    	
+    /* create stats first, so that everything below is counted. */
+    comp->stats           = new_stats(statsformat);
+
     comp->breakstack      = new_intstack();   
     comp->regstack        = new_regstack();	   
     comp->continuestack   = new_intstack();   
+    comp->ast_arena       = new_arena();
+    comp->sym_arena       = new_arena();
+    comp->type_arena      = new_arena();
+    comp->instr_arena     = new_arena();
+    comp->atoms           = new_interntable();
     
     /* register built-in types in type declaration module. */
-    type_enter_type(comp, "void", DECL_VOID, 0);
-    type_enter_type(comp, "int", DECL_INT, 4);
-    type_enter_type(comp, "num", DECL_NUM, 8);
-    type_enter_type(comp, "bool", DECL_BOOL, 4); /* bools are stored in ints. */
-    type_enter_type(comp, "string", DECL_STRING, 4);  /* strings are pointers, so size is 4. */
-    type_enter_type(comp, "char", DECL_CHAR, 4); /* XXX can this be 1? what about padding in structs? */
+    type_enter_type(comp, intern(comp, "void"), DECL_VOID, 0);
+    type_enter_type(comp, intern(comp, "int"), DECL_INT, 4);
+    type_enter_type(comp, intern(comp, "num"), DECL_NUM, 8);
+    type_enter_type(comp, intern(comp, "bool"), DECL_BOOL, 4); /* bools are stored in ints. */
+    type_enter_type(comp, intern(comp, "string"), DECL_STRING, 4);  /* strings are pointers, so size is 4. */
+    type_enter_type(comp, intern(comp, "char"), DECL_CHAR, 4); /* XXX can this be 1? what about padding in structs? */
     
     /* global symbol table for functions, as they need a return type m1_type pointer. */
-    comp->globalsymtab = new_symtab();
+    comp->globalsymtab = new_symtab(comp);
+}
+
+/* Release all memory held by the compiler. */
+static void
+fini_compiler(M1_compiler *comp) {
+    delete_stack(comp->breakstack);
+    delete_stack(comp->continuestack);
+    delete_regstack(comp->regstack);
+    delete_interntable(comp->atoms);
+    
+    delete_arena(comp->ast_arena);
+    delete_arena(comp->sym_arena);
+    delete_arena(comp->type_arena);
+    delete_arena(comp->instr_arena);
+    delete_stats(comp->stats);
 }
 
 int
@@ -45,23 +76,58 @@ main(int argc, char *argv[]) {
     yyscan_t     yyscanner;
     M1_compiler  comp;
     int          turnoff_reg_opt = 0;
-    char        *outputfile = "a.m0";
+    int          emit_m0b        = 0;
+    unsigned     unroll_budget   = UNROLL_BUDGET;
+    int          trace_frames    = 0;
+    m1_statsformat statsformat   = STATS_NONE;
+    char        *outputfile = NULL;  /* write to stdout by default. */
     
-    if (argc <= 1) {
-        fprintf(stderr, "Usage: m1 <file>\n");
-        exit(EXIT_FAILURE);    
-    }
-    
-    if (strcmp(argv[1], "-r") == 0) {
-        /* turn of register optimization. */
-        turnoff_reg_opt = 1;   
+    /* handle options. */
+    while (argc > 1 && argv[1][0] == '-') {
+        if (strcmp(argv[1], "-r") == 0) {
+            /* turn of register optimization. */
+            turnoff_reg_opt = 1;   
+        }
+        else if (strcmp(argv[1], "-o") == 0 && argc > 2) {
+            argv++;
+            argc--;
+            outputfile = argv[1];
+        }
+        else if (strcmp(argv[1], "--emit=m0b") == 0) {
+            emit_m0b = 1;   
+        }
+        else if (strcmp(argv[1], "--emit=m0") == 0) {
+            emit_m0b = 0;   
+        }
+        else if (strncmp(argv[1], "--unroll=", 9) == 0) {
+            char *end;
+            
+            unroll_budget = (unsigned)strtoul(argv[1] + 9, &end, 10);
+            if (argv[1][9] == '\0' || *end != '\0') {
+                fprintf(stderr, "Invalid unroll budget %s\n", argv[1] + 9);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strcmp(argv[1], "--trace-frames") == 0) {
+            trace_frames = 1;
+        }
+        else if (strcmp(argv[1], "--stats") == 0) {
+            statsformat = STATS_TEXT;   
+        }
+        else if (strcmp(argv[1], "--stats=json") == 0) {
+            statsformat = STATS_JSON;   
+        }
+        else {
+            fprintf(stderr, "Unknown option %s\n", argv[1]);
+            exit(EXIT_FAILURE);
+        }
         argv++; /* go to next arg. */
+        argc--;
     }
     
-    if (strcmp(argv[1], "-o") == 0) {
-        argv++;
-        outputfile = argv[1];
-        argv++;   
+    if (argc <= 1) {
+        fprintf(stderr, "Usage: m1 [-r] [-o <outputfile>] [--emit=m0|m0b] [--unroll=<n>] [--trace-frames] [--stats[=json]] <file>\n");
+        exit(EXIT_FAILURE);    
     }
     
     fp = fopen(argv[1], "r");
@@ -71,8 +137,11 @@ main(int argc, char *argv[]) {
     }
    
     /* set up compiler */
-    init_compiler(&comp);
+    init_compiler(&comp, statsformat);
     comp.no_reg_opt       = turnoff_reg_opt;
+    comp.emit_m0b         = emit_m0b;
+    comp.unroll_budget    = unroll_budget;
+    comp.trace_frames     = trace_frames;
     comp.current_filename = argv[1];
                                        
     /* set up lexer and parser */   	
@@ -82,7 +151,9 @@ main(int argc, char *argv[]) {
     
     comp.yyscanner = yyscanner; /* yyscanner has a pointer to comp, and vice versa. */
     
+    stats_phase(&comp, PHASE_PARSE);
     yyparse(yyscanner, &comp);
+    stats_sample_memory(&comp);
     
     fprintf(stderr, "parsing done\n");
     if (comp.errors == 0) 
@@ -90,20 +161,50 @@ main(int argc, char *argv[]) {
         assert(intstack_isempty(comp.breakstack) != 0);
         assert(intstack_isempty(comp.continuestack) != 0);
         
+        stats_phase(&comp, PHASE_CHECK);
     	check(&comp, comp.ast); /*  need to finish */
+    	if (comp.errors == 0) {
+    	    fold(&comp, comp.ast);
+    	    sccp(&comp, comp.ast);
+    	}
+    	    
     	if (comp.errors == 0) 
     	{
+            FILE *out = stdout;
+            
         	fprintf(stderr, "generating code...\n");
-        	comp.outfile = fopen(outputfile, "w");
+        	
+        	if (outputfile != NULL) {
+        	    out = fopen(outputfile, emit_m0b ? "wb" : "w");
+        	    if (out == NULL) {
+        	        fprintf(stderr, "Could not open output file %s\n", outputfile);
+        	        exit(EXIT_FAILURE);   
+        	    }
+        	}
+        	
+        	comp.emitter = new_emitter(out);
+        	stats_phase(&comp, PHASE_CODEGEN);
 	        gencode(&comp, comp.ast);
-	        fclose(comp.outfile);
+	        
+	        stats_phase(&comp, PHASE_EMIT);
+	        comp.stats->output_bytes = comp.emitter->length;
+	        emit_flush(comp.emitter);
+	        delete_emitter(comp.emitter);
+	        
+	        if (out != stdout)
+	            fclose(out);
     	}
     	else {
     	   fprintf(stderr, "%d errors and %d warnings\n", comp.errors, comp.warnings);
     	}
     }
     
+    stats_phase(&comp, PHASE_NONE);
+    stats_sample_memory(&comp);
+    print_stats(&comp, stderr);
+    
     fclose(fp);
+    fini_compiler(&comp);
     fprintf(stderr, "compilation done\n");
     return 0;
 }
@@ -0,0 +1,318 @@
+/*
+
+Peephole optimizer. Each rule in the table below is tried on every
+instruction of a chunk; a rule either leaves the code alone, or rewrites
+it and returns the number of instructions it removed. This is repeated
+until no rule applies anymore.
+
+Instructions are not removed from the code array right away, but only
+marked as deleted; once all rules are done, the code is compacted, and
+the labels are moved along.
+
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "peephole.h"
+#include "compiler.h"
+#include "instr.h"
+#include "gencode.h"
+#include "arena.h"
+#include "stats.h"
+
+/* how far to look for an earlier set_imm, and whether a register is still used. */
+#define PEEP_WINDOW     32
+
+typedef struct peephole_state {
+    M1_compiler   *comp;
+    m0_chunk      *chunk;
+    unsigned char *deleted;     /* per instruction: removed by a rule. */
+    unsigned char *labelled;    /* per instruction: a label is placed before it. */
+    unsigned char *pinned;      /* per instruction: part of a call sequence. */
+
+} peephole_state;
+
+typedef unsigned (*peephole_fn)(peephole_state *ph, unsigned i);
+
+char const * const peephole_rule_names[NUM_PEEPHOLE_RULES] = {
+    "self-move",
+    "repeated-set-imm",
+    "goto-next",
+    "goto-if-over-goto"
+};
+
+#define SAME_REG(a, b)  (IS_REG_OPERAND(a) && (a).type == (b).type && (a).value == (b).value)
+
+/* Get the index of the first instruction after <i> that wasn't deleted. */
+static unsigned
+next_live(peephole_state *ph, unsigned i) {
+    do {
+        i++;
+    } while (i < ph->chunk->num_instr && ph->deleted[i]);
+    return i;
+}
+
+/* Does instruction <ins> read (<access> is OPERAND_USE) or write register <reg>? */
+static int
+accesses(m0_instr const *ins, m0_operand reg, unsigned char access) {
+    unsigned k;
+
+    for (k = 0; k < ins->numops; k++) {
+        if (m0_operand_access[ins->opcode][k] == access && SAME_REG(ins->operands[k], reg))
+            return 1;
+    }
+    return 0;
+}
+
+/* Can <ins> change registers in ways that aren't listed in its operands?
+   That's true for instructions that switch frames or chunks.
+ */
+static int
+is_barrier(m0_instr const *ins) {
+    if (ins->opcode == M0_GOTO_CHUNK)
+        return 1;
+    if (ins->opcode == M0_SET && ins->operands[0].type == VAL_INTERP_REG && ins->operands[0].value == CF)
+        return 1;
+    return 0;
+}
+
+/* Is register <reg> not read anymore from instruction <i> onward? <budget> is
+   the number of instructions that may still be inspected; if it runs out, the
+   answer is no.
+ */
+static int
+dead_from(peephole_state *ph, unsigned i, m0_operand reg, unsigned *budget) {
+    m0_chunk *chunk = ph->chunk;
+
+    if (i == NO_INSTR)
+        return 0;
+
+    while (i < chunk->num_instr) {
+        m0_instr *ins = &chunk->instructions[i];
+
+        if (ph->deleted[i]) {
+            i++;
+            continue;
+        }
+        if ((*budget)-- == 0 || is_barrier(ins) || accesses(ins, reg, OPERAND_USE))
+            return 0;
+        if (accesses(ins, reg, OPERAND_DEF) || ins->opcode == M0_EXIT)
+            return 1;
+
+        if (ins->opcode == M0_GOTO) {
+            i = label_offset(chunk, ins->operands[0].value);
+            if (i == NO_INSTR)
+                return 0;
+            continue;
+        }
+        if (ins->opcode == M0_GOTO_IF && !dead_from(ph, label_offset(chunk, ins->operands[0].value), reg, budget))
+            return 0;
+        i++;
+    }
+    return 1;
+}
+
+/* Pin the code of call sequences, from where the return address is computed
+   until the caller's frame is active again. Return addresses are counted in
+   instructions from PC, so nothing in between may be removed.
+ */
+static void
+pin_call_sequences(peephole_state *ph) {
+    m0_chunk *chunk   = ph->chunk;
+    int       in_call = 0;
+    unsigned  i;
+
+    for (i = 0; i < chunk->num_instr; i++) {
+        m0_instr *ins = &chunk->instructions[i];
+
+        if (ins->numops > 0 && ins->operands[0].type == VAL_INTERP_REG && ins->operands[0].value == RETPC)
+            in_call = 1;
+
+        ph->pinned[i] = in_call;
+
+        if (ins->opcode == M0_SET && ins->operands[0].type == VAL_INTERP_REG && ins->operands[0].value == CF
+        &&  ins->operands[1].type == VAL_INTERP_REG && ins->operands[1].value == PCF)
+            in_call = 0;
+    }
+}
+
+/* set X, X */
+static unsigned
+remove_self_move(peephole_state *ph, unsigned i) {
+    m0_instr *ins = &ph->chunk->instructions[i];
+
+    if (ins->opcode != M0_SET || !SAME_REG(ins->operands[0], ins->operands[1]))
+        return 0;
+
+    ph->deleted[i] = 1;
+    return 1;
+}
+
+/* set_imm X, a, b, when an earlier set_imm X, a, b in the same block is still valid. */
+static unsigned
+remove_repeated_set_imm(peephole_state *ph, unsigned i) {
+    m0_instr *code = ph->chunk->instructions;
+    m0_instr *ins  = &code[i];
+    unsigned  j    = i,
+              steps;
+
+    if (ins->opcode != M0_SET_IMM || !IS_REG_OPERAND(ins->operands[0]))
+        return 0;
+
+    for (steps = 0; steps < PEEP_WINDOW && j > 0 && !ph->labelled[j]; steps++) {
+        m0_instr *prev = &code[--j];
+
+        if (ph->deleted[j])
+            continue;
+        if (is_barrier(prev))
+            return 0;
+        if (accesses(prev, ins->operands[0], OPERAND_DEF)) {
+            if (prev->opcode != M0_SET_IMM
+            ||  prev->operands[1].value != ins->operands[1].value
+            ||  prev->operands[2].value != ins->operands[2].value)
+                return 0;
+
+            ph->deleted[i] = 1;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* goto L, with nothing but deleted instructions before L. */
+static unsigned
+remove_goto_next(peephole_state *ph, unsigned i) {
+    m0_instr *ins = &ph->chunk->instructions[i];
+    unsigned  target;
+
+    if (ins->opcode != M0_GOTO)
+        return 0;
+
+    target = label_offset(ph->chunk, ins->operands[0].value);
+    if (target == NO_INSTR || target <= i || next_live(ph, i) < target)
+        return 0;
+
+    ph->deleted[i] = 1;
+    return 1;
+}
+
+/*
+   isgt_i  C, A, B              isge_i  C, B, A
+   goto_if L1, C        =>      goto_if L2, C
+   goto    L2
+ L1:                          L1:
+
+   when C isn't used anymore. M0 has no way to branch if a condition is false,
+   so this only works if the condition is a comparison that can be inverted.
+ */
+static unsigned
+invert_goto_if_over_goto(peephole_state *ph, unsigned i) {
+    m0_chunk *chunk = ph->chunk;
+    m0_instr *code  = chunk->instructions;
+    m0_instr *ins   = &code[i];
+    m0_instr *jump, *cmp;
+    unsigned  j, k, c, target, budget = PEEP_WINDOW;
+
+    if (ins->opcode != M0_GOTO_IF)
+        return 0;
+
+    /* the goto must follow right away, and L1 right after it. */
+    j = next_live(ph, i);
+    if (j >= chunk->num_instr || code[j].opcode != M0_GOTO)
+        return 0;
+
+    for (k = i + 1; k <= j; k++) {
+        if (ph->labelled[k])
+            return 0;
+    }
+
+    k      = next_live(ph, j);
+    target = label_offset(chunk, ins->operands[0].value);
+    if (target == NO_INSTR || target <= j || k < target)
+        return 0;
+
+    /* find the comparison that computed the condition, right before the goto_if. */
+    c = i;
+    do {
+        if (c == 0 || ph->labelled[c])
+            return 0;
+        c--;
+    } while (ph->deleted[c]);
+
+    cmp = &code[c];
+    if ((cmp->opcode != M0_ISGT_I && cmp->opcode != M0_ISGE_I)
+    ||  !SAME_REG(cmp->operands[0], ins->operands[1]))
+        return 0;
+
+    jump = &code[j];
+    if (!dead_from(ph, k, ins->operands[1], &budget)
+    ||  !dead_from(ph, label_offset(chunk, jump->operands[0].value), ins->operands[1], &budget))
+        return 0;
+
+    /* !(a > b) is (b >= a), and !(a >= b) is (b > a). */
+    {
+        m0_operand a = cmp->operands[1];
+
+        cmp->opcode      = cmp->opcode == M0_ISGT_I ? M0_ISGE_I : M0_ISGT_I;
+        cmp->operands[1] = cmp->operands[2];
+        cmp->operands[2] = a;
+    }
+    ins->operands[0] = jump->operands[0];
+    ph->deleted[j]   = 1;
+    return 1;
+}
+
+static peephole_fn const rules[NUM_PEEPHOLE_RULES] = {
+    remove_self_move,
+    remove_repeated_set_imm,
+    remove_goto_next,
+    invert_goto_if_over_goto
+};
+
+/*
+
+Apply the peephole rules to the code of <chunk>.
+
+*/
+void
+peephole(M1_compiler *comp, m0_chunk *chunk) {
+    peephole_state ph;
+    unsigned       i, r, removed = 0;
+    int            changed;
+
+    ph.comp     = comp;
+    ph.chunk    = chunk;
+    ph.deleted  = (unsigned char *)arena_alloc(comp->instr_arena, chunk->num_instr + 1);
+    ph.labelled = (unsigned char *)arena_alloc(comp->instr_arena, chunk->num_instr + 1);
+    ph.pinned   = (unsigned char *)arena_alloc(comp->instr_arena, chunk->num_instr + 1);
+
+    memset(ph.deleted, 0, chunk->num_instr + 1);
+    memset(ph.labelled, 0, chunk->num_instr + 1);
+    memset(ph.pinned, 0, chunk->num_instr + 1);
+
+    pin_call_sequences(&ph);
+
+    for (i = 0; i < chunk->num_labelmarks; i++) {
+        if (chunk->labelmarks[i].instr <= chunk->num_instr)
+            ph.labelled[chunk->labelmarks[i].instr] = 1;
+    }
+
+    /* every rule removes an instruction, so this ends. */
+    do {
+        changed = 0;
+        for (i = 0; i < chunk->num_instr; i++) {
+            for (r = 0; r < NUM_PEEPHOLE_RULES && !ph.deleted[i] && !ph.pinned[i]; r++) {
+                unsigned n = rules[r](&ph, i);
+
+                comp->stats->peephole[r] += n;
+                removed                  += n;
+                changed                  |= n != 0;
+            }
+        }
+    } while (changed);
+
+    if (removed > 0)
+        remove_instructions(comp, chunk, ph.deleted);
+}
+
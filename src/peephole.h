@@ -0,0 +1,28 @@
+#ifndef __M1_PEEPHOLE_H__
+#define __M1_PEEPHOLE_H__
+
+#include "compiler.h"
+#include "instr.h"
+
+/*
+
+The peephole optimizer looks for wasteful patterns in a chunk's code,
+after registers have been allocated, and removes them. The patterns are
+listed in a table in peephole.c; add a rule there, and its name here.
+
+*/
+typedef enum m1_peephole_rule {
+    PEEP_SELF_MOVE,         /* set X, X */
+    PEEP_REPEATED_SET_IMM,  /* set_imm of the value that a register already holds. */
+    PEEP_GOTO_NEXT,         /* goto to the label that follows it. */
+    PEEP_GOTO_IF_OVER_GOTO, /* goto_if L1; goto L2; L1: => goto_if !cond, L2 */
+
+    NUM_PEEPHOLE_RULES
+} m1_peephole_rule;
+
+extern char const * const peephole_rule_names[NUM_PEEPHOLE_RULES];
+
+extern void peephole(M1_compiler *comp, m0_chunk *chunk);
+
+#endif
+
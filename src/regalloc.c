@@ -0,0 +1,739 @@
+/*
+
+Linear scan register allocation (Poletto and Sarkar, 1999).
+
+The code generator hands out a fresh virtual register for every value, and
+only after a chunk's code is complete it is decided which physical register
+holds each of them. This works in a few steps:
+
+ 1. The code is split into basic blocks, by build_flow_graph().
+ 2. Virtual registers that are only used within the block where they are
+    set (which are almost all temporaries) are "local": their live interval
+    is simply the range from their first to their last occurrence.
+ 3. For all others, and for the physical registers that occur in the code,
+    liveness is computed with the usual backward dataflow analysis.
+ 4. The intervals are sorted by start, and each one gets the lowest
+    physical register that is free at that point.
+ 5. If none is free, the register among the ones that are live (including
+    the new one) whose next use is furthest away is spilled: it is stored
+    in a spill frame whenever it is set, and loaded from there whenever
+    it is used. The spill frame is allocated once, on entry to the chunk,
+    and each spilled register has its own slot in it; so every occurrence
+    of a spilled register costs two instructions.
+
+Positions in the code are numbered so that operands that are read by
+instruction i are at 2i, and operands that are written at 2i+1; that way,
+the target of "add_i I3, I1, I2" can share a register with I1 or I2 if
+those aren't used afterwards.
+
+All memory is taken from the instruction arena, which is released once the
+chunk is done.
+
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "regalloc.h"
+#include "flow.h"
+#include "compiler.h"
+#include "instr.h"
+#include "gencode.h"
+#include "arena.h"
+#include "stats.h"
+
+#define NO_POS          (~0u)
+
+#define BITS            (8 * sizeof (unsigned long))
+#define BIT_SET(s, i)   ((s)[(i) / BITS] |= 1UL << ((i) % BITS))
+#define BIT_TEST(s, i)  (((s)[(i) / BITS] >> ((i) % BITS)) & 1)
+
+/* live interval of a virtual register. */
+typedef struct ra_interval {
+    unsigned       start;
+    unsigned       end;
+    unsigned       id;
+    unsigned char  type;
+
+} ra_interval;
+
+/* a range where a physical register is live. */
+typedef struct ra_range {
+    unsigned global;    /* index of the register among the global registers. */
+    unsigned start;
+    unsigned end;
+
+} ra_range;
+
+typedef struct regalloc {
+    M1_compiler   *comp;
+    m0_chunk      *chunk;
+
+    flow_graph    *graph;
+
+    unsigned      *first;                   /* id => position of first occurrence. */
+    unsigned      *last;                    /* id => position of last occurrence. */
+    unsigned      *global;                  /* id => index in the bitsets, or NO_POS if local. */
+    unsigned       num_globals;
+
+    unsigned long *gen;                     /* per block: globals read before being set. */
+    unsigned long *kill;                    /* per block: globals set. */
+    unsigned long *in;                      /* per block: globals live on entry. */
+    unsigned long *out;                     /* per block: globals live on exit. */
+    unsigned       words;                   /* size of one bitset. */
+
+    ra_range      *ranges;                  /* live ranges of physical registers, by global. */
+    unsigned       num_ranges;
+    unsigned      *range_index;             /* global => first range. */
+
+    unsigned      *occ;                     /* positions of virtual registers, by id. */
+    unsigned      *occ_index;               /* id => first position in occ. */
+
+} regalloc;
+
+static void *
+ra_alloc(regalloc *ra, size_t size) {
+    void *mem = arena_alloc(ra->comp->instr_arena, size);
+    memset(mem, 0, size);
+    return mem;
+}
+
+/* Get the position of operand <k> of instruction <i>, or NO_POS if it's not a register
+   of this chunk's frame. 
+ */
+static unsigned
+operand_pos(regalloc *ra, unsigned i, unsigned k) {
+    if (ra->graph->foreign[i])
+        return NO_POS;
+
+    if (has_access(ra->chunk, i, k, OPERAND_DEF))
+        return 2 * i + 1;
+
+    return has_access(ra->chunk, i, k, OPERAND_USE) ? 2 * i : NO_POS;
+}
+
+/* Find the first and last occurrence of each register, and decide which
+   registers need dataflow analysis.
+ */
+static void
+scan_occurrences(regalloc *ra) {
+    m0_chunk      *chunk = ra->chunk;
+    unsigned char *multi = (unsigned char *)ra_alloc(ra, ra->graph->num_ids);
+    unsigned       i, k, id;
+
+    ra->first  = (unsigned *)ra_alloc(ra, ra->graph->num_ids * sizeof (unsigned));
+    ra->last   = (unsigned *)ra_alloc(ra, ra->graph->num_ids * sizeof (unsigned));
+    ra->global = (unsigned *)ra_alloc(ra, ra->graph->num_ids * sizeof (unsigned));
+
+    for (id = 0; id < ra->graph->num_ids; id++)
+        ra->first[id] = NO_POS;
+
+    for (i = 0; i < chunk->num_instr; i++) {
+        m0_instr *ins = &chunk->instructions[i];
+
+        for (k = 0; k < 3; k++) {
+            unsigned pos = operand_pos(ra, i, k);
+
+            if (pos == NO_POS)
+                continue;
+
+            id = reg_id(ra->graph, &ins->operands[k]);
+
+            if (ra->first[id] == NO_POS || pos < ra->first[id])
+                ra->first[id] = pos;
+            if (pos > ra->last[id])
+                ra->last[id] = pos;
+            if (ra->graph->block_of[ra->first[id] / 2] != ra->graph->block_of[i])
+                multi[id] = 1;
+        }
+    }
+
+    /* A virtual register that is set before it's used, and that only occurs
+       within one block, is not live outside that block. Everything else,
+       including all physical registers, is analyzed.
+     */
+    for (id = 0; id < ra->graph->num_ids; id++) {
+        int local = id >= ra->graph->vbase[0] && (ra->first[id] & 1) && multi[id] == 0;
+
+        if (ra->first[id] == NO_POS || local)
+            ra->global[id] = NO_POS;
+        else
+            ra->global[id] = ra->num_globals++;
+    }
+}
+
+/* Compute which global registers are live on entry and exit of each block. */
+static void
+compute_liveness(regalloc *ra) {
+    m0_chunk *chunk = ra->chunk;
+    unsigned  words, b, i, k, w;
+    int       changed;
+
+    words = ra->words = (ra->num_globals + BITS - 1) / BITS;
+
+    ra->gen  = (unsigned long *)ra_alloc(ra, ra->graph->num_blocks * words * sizeof (unsigned long));
+    ra->kill = (unsigned long *)ra_alloc(ra, ra->graph->num_blocks * words * sizeof (unsigned long));
+    ra->in   = (unsigned long *)ra_alloc(ra, ra->graph->num_blocks * words * sizeof (unsigned long));
+    ra->out  = (unsigned long *)ra_alloc(ra, ra->graph->num_blocks * words * sizeof (unsigned long));
+
+    for (b = 0; b < ra->graph->num_blocks; b++) {
+        unsigned long *gen  = &ra->gen[b * words];
+        unsigned long *kill = &ra->kill[b * words];
+
+        for (i = ra->graph->blocks[b].start; i < ra->graph->blocks[b].end; i++) {
+            m0_instr *ins = &chunk->instructions[i];
+
+            /* operands are read before the result is written. */
+            for (k = 0; k < 3; k++) {
+                unsigned pos = operand_pos(ra, i, k), g;
+
+                if (pos == NO_POS || (pos & 1))
+                    continue;
+
+                g = ra->global[reg_id(ra->graph, &ins->operands[k])];
+                if (g != NO_POS && !BIT_TEST(kill, g))
+                    BIT_SET(gen, g);
+            }
+            for (k = 0; k < 3; k++) {
+                unsigned pos = operand_pos(ra, i, k), g;
+
+                if (pos == NO_POS || !(pos & 1))
+                    continue;
+
+                g = ra->global[reg_id(ra->graph, &ins->operands[k])];
+                if (g != NO_POS)
+                    BIT_SET(kill, g);
+            }
+        }
+    }
+
+    /* iterate to a fixed point; visiting blocks backwards makes that quick. */
+    do {
+        changed = 0;
+        b = ra->graph->num_blocks;
+
+        while (b-- > 0) {
+            flow_block    *block = &ra->graph->blocks[b];
+            unsigned long *out   = &ra->out[b * words];
+            unsigned long *in    = &ra->in[b * words];
+
+            for (k = 0; k < block->num_succ; k++) {
+                unsigned long *succ_in = &ra->in[block->succ[k] * words];
+                for (w = 0; w < words; w++)
+                    out[w] |= succ_in[w];
+            }
+            for (w = 0; w < words; w++) {
+                unsigned long new_in = ra->gen[b * words + w] | (out[w] & ~ra->kill[b * words + w]);
+
+                if (new_in != in[w]) {
+                    in[w]   = new_in;
+                    changed = 1;
+                }
+            }
+        }
+    } while (changed);
+}
+
+static int
+compare_ranges(void const *a, void const *b) {
+    ra_range const *x = (ra_range const *)a;
+    ra_range const *y = (ra_range const *)b;
+
+    if (x->global != y->global)
+        return x->global < y->global ? -1 : 1;
+    if (x->start != y->start)
+        return x->start < y->start ? -1 : 1;
+    return 0;
+}
+
+/* Physical registers in the code can't be moved, so virtual registers must
+   not be given the same register while it's live. Collect the exact ranges
+   where each one is live, by walking each block backwards.
+ */
+static void
+build_fixed_ranges(regalloc *ra) {
+    m0_chunk *chunk      = ra->chunk;
+    unsigned  num_phys   = 0;
+    unsigned  max_ranges;
+    unsigned *live_end   = (unsigned *)ra_alloc(ra, ra->num_globals * sizeof (unsigned));
+    unsigned  id, b, i, k, g, r;
+
+    for (id = 0; id < ra->graph->vbase[0]; id++) {
+        if (ra->global[id] != NO_POS)
+            num_phys++;
+    }
+    /* at most one range per operand, and one per block for each register live on entry. */
+    max_ranges = 3 * chunk->num_instr + ra->graph->num_blocks * num_phys;
+
+    ra->ranges      = (ra_range *)ra_alloc(ra, (max_ranges + 1) * sizeof (ra_range));
+    ra->range_index = (unsigned *)ra_alloc(ra, (ra->num_globals + 1) * sizeof (unsigned));
+
+    if (num_phys == 0)
+        return;
+
+    for (b = 0; b < ra->graph->num_blocks; b++) {
+        flow_block *block = &ra->graph->blocks[b];
+
+        for (id = 0; id < ra->graph->vbase[0]; id++) {
+            g = ra->global[id];
+            if (g != NO_POS)
+                live_end[g] = BIT_TEST(&ra->out[b * ra->words], g) ? 2 * block->end - 1 : NO_POS;
+        }
+
+        i = block->end;
+        while (i-- > block->start) {
+            m0_instr *ins = &chunk->instructions[i];
+
+            for (k = 0; k < 3; k++) {
+                unsigned pos = operand_pos(ra, i, k);
+
+                if (pos == NO_POS || ins->operands[k].value >= REG_NUM)
+                    continue;
+
+                g = ra->global[reg_id(ra->graph, &ins->operands[k])];
+
+                if (pos & 1) {
+                    /* a register that is set but not used is still clobbered. */
+                    ra_range *range = &ra->ranges[ra->num_ranges++];
+                    range->global   = g;
+                    range->start    = pos;
+                    range->end      = live_end[g] != NO_POS ? live_end[g] : pos;
+                    live_end[g]     = NO_POS;
+                }
+            }
+            for (k = 0; k < 3; k++) {
+                unsigned pos = operand_pos(ra, i, k);
+
+                if (pos == NO_POS || (pos & 1) || ins->operands[k].value >= REG_NUM)
+                    continue;
+
+                g = ra->global[reg_id(ra->graph, &ins->operands[k])];
+                if (live_end[g] == NO_POS)
+                    live_end[g] = pos;
+            }
+        }
+
+        for (id = 0; id < ra->graph->vbase[0]; id++) {
+            g = ra->global[id];
+            if (g != NO_POS && live_end[g] != NO_POS) {
+                ra_range *range = &ra->ranges[ra->num_ranges++];
+                range->global   = g;
+                range->start    = 2 * block->start;
+                range->end      = live_end[g];
+            }
+        }
+    }
+    assert(ra->num_ranges <= max_ranges);
+
+    qsort(ra->ranges, ra->num_ranges, sizeof (ra_range), compare_ranges);
+
+    /* merge overlapping ranges, so that they can be searched. */
+    for (i = 0, r = 0; i < ra->num_ranges; i++) {
+        if (r > 0 && ra->ranges[r - 1].global == ra->ranges[i].global
+                  && ra->ranges[i].start <= ra->ranges[r - 1].end + 1) {
+            if (ra->ranges[i].end > ra->ranges[r - 1].end)
+                ra->ranges[r - 1].end = ra->ranges[i].end;
+        }
+        else {
+            ra->ranges[r++] = ra->ranges[i];
+        }
+    }
+    ra->num_ranges = r;
+
+    /* range_index[g] is the first range of global g; the list ends at range_index[g + 1]. */
+    for (g = 0, r = 0; g <= ra->num_globals; g++) {
+        while (r < ra->num_ranges && ra->ranges[r].global < g)
+            r++;
+        ra->range_index[g] = r;
+    }
+}
+
+/* Is physical register <no> of type <type> live anywhere in [start, end]? */
+static int
+fixed_conflict(regalloc *ra, unsigned type, unsigned no, unsigned start, unsigned end) {
+    unsigned g = ra->global[type * REG_NUM + no];
+    unsigned lo, hi;
+
+    if (g == NO_POS)
+        return 0;
+
+    /* find the first range that ends at or after <start>. */
+    lo = ra->range_index[g];
+    hi = ra->range_index[g + 1];
+    while (lo < hi) {
+        unsigned mid = lo + (hi - lo) / 2;
+
+        if (ra->ranges[mid].end < start)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < ra->range_index[g + 1] && ra->ranges[lo].start <= end;
+}
+
+static int
+compare_intervals(void const *a, void const *b) {
+    ra_interval const *x = (ra_interval const *)a;
+    ra_interval const *y = (ra_interval const *)b;
+
+    if (x->start != y->start)
+        return x->start < y->start ? -1 : 1;
+    return x->id < y->id ? -1 : x->id > y->id;
+}
+
+/* Compute the live interval of each virtual register that occurs in the code. */
+static ra_interval *
+build_intervals(regalloc *ra, unsigned *num_intervals) {
+    ra_interval *intervals;
+    unsigned     id, b, t, n = 0;
+
+    intervals = (ra_interval *)ra_alloc(ra, (ra->graph->num_ids - ra->graph->vbase[0] + 1) * sizeof (ra_interval));
+
+    for (t = 0; t < REG_TYPE_NUM; t++) {
+        unsigned endid = t + 1 < REG_TYPE_NUM ? ra->graph->vbase[t + 1] : ra->graph->num_ids;
+
+        for (id = ra->graph->vbase[t]; id < endid; id++) {
+            ra_interval *iv = &intervals[n];
+            unsigned     g  = ra->global[id];
+
+            if (ra->first[id] == NO_POS)
+                continue;
+
+            iv->id    = id;
+            iv->type  = t;
+            iv->start = ra->first[id];
+            iv->end   = ra->last[id];
+
+            /* for registers that live across blocks, take the hull of all blocks where they're live. */
+            if (g != NO_POS) {
+                for (b = 0; b < ra->graph->num_blocks; b++) {
+                    if (BIT_TEST(&ra->in[b * ra->words], g) && 2 * ra->graph->blocks[b].start < iv->start)
+                        iv->start = 2 * ra->graph->blocks[b].start;
+                    if (BIT_TEST(&ra->out[b * ra->words], g) && 2 * ra->graph->blocks[b].end - 1 > iv->end)
+                        iv->end = 2 * ra->graph->blocks[b].end - 1;
+                }
+            }
+            n++;
+        }
+    }
+
+    qsort(intervals, n, sizeof (ra_interval), compare_intervals);
+    *num_intervals = n;
+    return intervals;
+}
+
+/* List the positions where each virtual register occurs, in order. */
+static void
+build_occurrences(regalloc *ra) {
+    m0_chunk *chunk = ra->chunk;
+    unsigned *fill;
+    unsigned  i, k, id, total = 0;
+
+    ra->occ_index = (unsigned *)ra_alloc(ra, (ra->graph->num_ids + 1) * sizeof (unsigned));
+    fill          = (unsigned *)ra_alloc(ra, ra->graph->num_ids * sizeof (unsigned));
+
+    for (i = 0; i < chunk->num_instr; i++) {
+        for (k = 0; k < 3; k++) {
+            if (operand_pos(ra, i, k) != NO_POS)
+                ra->occ_index[reg_id(ra->graph, &chunk->instructions[i].operands[k])]++;
+        }
+    }
+    for (id = 0; id <= ra->graph->num_ids; id++) {
+        unsigned count = ra->occ_index[id];
+        ra->occ_index[id] = total;
+        if (id < ra->graph->num_ids)
+            fill[id] = total;
+        total += count;
+    }
+
+    ra->occ = (unsigned *)ra_alloc(ra, (total + 1) * sizeof (unsigned));
+
+    for (i = 0; i < chunk->num_instr; i++) {
+        for (k = 0; k < 3; k++) {
+            unsigned pos = operand_pos(ra, i, k), j;
+
+            if (pos == NO_POS)
+                continue;
+
+            /* within an instruction, uses come before defs. */
+            id = reg_id(ra->graph, &chunk->instructions[i].operands[k]);
+            for (j = fill[id]++; j > ra->occ_index[id] && ra->occ[j - 1] > pos; j--)
+                ra->occ[j] = ra->occ[j - 1];
+            ra->occ[j] = pos;
+        }
+    }
+}
+
+/* Get the first position at or after <pos> where register <id> occurs, or NO_POS. */
+static unsigned
+next_use(regalloc *ra, unsigned id, unsigned pos) {
+    unsigned lo = ra->occ_index[id],
+             hi = ra->occ_index[id + 1];
+
+    while (lo < hi) {
+        unsigned mid = lo + (hi - lo) / 2;
+
+        if (ra->occ[mid] < pos)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < ra->occ_index[id + 1] ? ra->occ[lo] : NO_POS;
+}
+
+/* No register is free for interval <current>; find the register whose value
+   is needed furthest in the future, to be spilled. If that's <current> itself, 
+   NO_POS is returned. <owner> has the interval that was last given each register.
+ */
+static unsigned
+choose_victim(regalloc *ra, ra_interval *intervals, unsigned current, 
+              unsigned const *phys_end, unsigned const *owner) 
+{
+    ra_interval *iv     = &intervals[current];
+    unsigned     victim = NO_POS;
+    unsigned     furthest, p;
+
+    if (ra->occ == NULL)
+        build_occurrences(ra);
+
+    furthest = next_use(ra, iv->id, iv->start + 1);
+
+    for (p = 0; p < SPILL_BASE; p++) {
+        unsigned use;
+
+        /* registers that are taken by a physical register can't be had. */
+        if (phys_end[p] == NO_POS || phys_end[p] < iv->start
+        ||  fixed_conflict(ra, iv->type, p, iv->start, iv->end))
+            continue;
+
+        use = next_use(ra, intervals[owner[p]].id, iv->start);
+        if (use > furthest) {
+            furthest = use;
+            victim   = p;
+        }
+    }
+    return victim;
+}
+
+static m0_operand
+operand(unsigned char type, unsigned value) {
+    m0_operand op;
+
+    op.type  = type;
+    op.value = value;
+    return op;
+}
+
+/* Add an instruction with operands <a>, <b> and <c> to <code>. */
+static void
+add_instr(m0_instr *code, unsigned *n, m0_opcode opcode, m0_operand a, m0_operand b, m0_operand c) {
+    m0_instr *ins = &code[(*n)++];
+
+    ins->opcode      = opcode;
+    ins->numops      = 3;
+    ins->operands[0] = a;
+    ins->operands[1] = b;
+    ins->operands[2] = c;
+}
+
+/* Add instructions to <code> to load register <reg> from spill slot <slot> 
+   (<opcode> is M0_DEREF), or to store it there (M0_SET_REF). 
+ */
+static void
+add_spill_code(m0_instr *code, unsigned *n, m0_opcode opcode, m0_operand reg, unsigned slot) {
+    m0_operand index = operand(VAL_INT, REG_NUM - 1);
+
+    add_instr(code, n, M0_SET_IMM, index, operand(VAL_VOID, slot >> 8), operand(VAL_VOID, slot & 0xff));
+    if (opcode == M0_DEREF)
+        add_instr(code, n, M0_DEREF, reg, operand(VAL_INTERP_REG, SPILLCF), index);
+    else
+        add_instr(code, n, M0_SET_REF, operand(VAL_INTERP_REG, SPILLCF), index, reg);
+}
+
+/* Rewrite the code of the chunk so that spilled registers are loaded before 
+   they are used, and stored after they are set. <slot> has each virtual 
+   register's slot in the spill frame, or NO_POS. The other virtual registers
+   are replaced by their <assigned> physical registers.
+ */
+static void
+insert_spill_code(regalloc *ra, unsigned const *assigned, unsigned const *slot, unsigned num_slots) {
+    m0_chunk *chunk = ra->chunk;
+    m0_instr *code;
+    unsigned *newindex;
+    unsigned  size = 6, n = 0, i, k;
+    m0_operand size_reg  = operand(VAL_INT, REG_NUM - 1),
+               flags_reg = operand(VAL_INT, REG_NUM - 2);
+
+    for (i = 0; i < chunk->num_instr; i++) {
+        for (k = 0; k < 3; k++) {
+            m0_instr *ins = &chunk->instructions[i];
+
+            if (operand_pos(ra, i, k) != NO_POS && ins->operands[k].value >= REG_NUM 
+            &&  slot[reg_id(ra->graph, &ins->operands[k])] != NO_POS)
+                size += 2;
+        }
+    }
+
+    code     = (m0_instr *)ra_alloc(ra, (chunk->num_instr + size) * sizeof (m0_instr));
+    newindex = (unsigned *)ra_alloc(ra, (chunk->num_instr + 1) * sizeof (unsigned));
+
+    /* allocate the spill frame, of 8 bytes per slot. */
+    add_instr(code, &n, M0_SET_IMM, size_reg, operand(VAL_VOID, num_slots >> 8), operand(VAL_VOID, num_slots & 0xff));
+    add_instr(code, &n, M0_SET_IMM, flags_reg, operand(VAL_VOID, 0), operand(VAL_VOID, 8));
+    add_instr(code, &n, M0_MULT_I, size_reg, size_reg, flags_reg);
+    add_instr(code, &n, M0_SET_IMM, flags_reg, operand(VAL_VOID, 0), operand(VAL_VOID, 0));
+    add_instr(code, &n, M0_GC_ALLOC, operand(VAL_INTERP_REG, SPILLCF), size_reg, flags_reg);
+
+    for (i = 0; i < chunk->num_instr; i++) {
+        m0_instr   ins = chunk->instructions[i];
+        m0_operand stores[3];
+        unsigned   num_stores = 0, store_slots[3];
+
+        /* jumps to this instruction must go to its loads, but not to the prologue. */
+        newindex[i] = n;
+
+        for (k = 0; k < ins.numops; k++) {
+            unsigned pos, id;
+
+            if (!IS_REG_OPERAND(ins.operands[k]) || ins.operands[k].value < REG_NUM)
+                continue;
+
+            pos = operand_pos(ra, i, k);
+            id  = reg_id(ra->graph, &ins.operands[k]);
+            assert(pos != NO_POS);
+
+            if (slot[id] == NO_POS) {
+                ins.operands[k].value = assigned[id];
+                continue;
+            }
+
+            /* each operand has its own reserved register. */
+            ins.operands[k].value = SPILL_BASE + k;
+
+            if (pos & 1) {
+                store_slots[num_stores] = slot[id];
+                stores[num_stores++]    = ins.operands[k];
+            }
+            else {
+                add_spill_code(code, &n, M0_DEREF, ins.operands[k], slot[id]);
+            }
+        }
+
+        code[n++] = ins;
+
+        for (k = 0; k < num_stores; k++)
+            add_spill_code(code, &n, M0_SET_REF, stores[k], store_slots[k]);
+    }
+    newindex[chunk->num_instr] = n;
+    assert(n <= chunk->num_instr + size);
+
+    for (i = 0; i < chunk->max_labels; i++) {
+        if (chunk->labels[i] != NO_INSTR)
+            chunk->labels[i] = newindex[chunk->labels[i]];
+    }
+    for (i = 0; i < chunk->num_labelmarks; i++)
+        chunk->labelmarks[i].instr = newindex[chunk->labelmarks[i].instr];
+
+    ra->comp->stats->instructions += n - chunk->num_instr;
+
+    chunk->instructions = code;
+    chunk->num_instr    = n;
+    chunk->max_instr    = chunk->num_instr + size;
+}
+
+/*
+
+Map the virtual registers in <chunk> onto physical registers.
+
+*/
+void
+allocate_registers(M1_compiler *comp, m0_chunk *chunk) {
+    regalloc     ra;
+    ra_interval *intervals;
+    unsigned     num_intervals;
+    unsigned     phys_end[REG_TYPE_NUM][REG_NUM];
+    unsigned     owner[REG_TYPE_NUM][REG_NUM];
+    unsigned    *assigned, 
+                *slot;
+    unsigned     num_slots = 0;
+    unsigned     i, k, t, p;
+
+    if (chunk->num_instr == 0)
+        return;
+        
+    for (t = 0, k = 0; t < REG_TYPE_NUM; t++)
+        k += comp->vregs[t];
+    
+    /* only physical registers; that's the case with option -r. */
+    if (k == 0)
+        return;
+
+    memset(&ra, 0, sizeof (regalloc));
+    ra.comp  = comp;
+    ra.chunk = chunk;
+
+    ra.graph = build_flow_graph(comp, chunk);
+    scan_occurrences(&ra);
+    compute_liveness(&ra);
+    build_fixed_ranges(&ra);
+    intervals = build_intervals(&ra, &num_intervals);
+
+    /* phys_end holds the end of the interval that was last given each register. */
+    for (t = 0; t < REG_TYPE_NUM; t++)
+        for (p = 0; p < REG_NUM; p++)
+            phys_end[t][p] = NO_POS;
+
+    assigned = (unsigned *)ra_alloc(&ra, ra.graph->num_ids * sizeof (unsigned));
+    slot     = (unsigned *)ra_alloc(&ra, ra.graph->num_ids * sizeof (unsigned));
+    
+    for (i = 0; i < ra.graph->num_ids; i++)
+        slot[i] = NO_POS;
+
+    for (i = 0; i < num_intervals; i++) {
+        ra_interval *iv = &intervals[i];
+
+        for (p = 0; p < SPILL_BASE; p++) {
+            unsigned end = phys_end[iv->type][p];
+
+            STAT_INC(comp, reg_scans);
+            if ((end == NO_POS || end < iv->start)
+            &&  !fixed_conflict(&ra, iv->type, p, iv->start, iv->end))
+                break;
+        }
+
+        if (p == SPILL_BASE) {
+            p = choose_victim(&ra, intervals, i, phys_end[iv->type], owner[iv->type]);
+            
+            STAT_INC(comp, spills);
+            if (p == NO_POS) {
+                /* registers that are set in code that's counted, like the 
+                   call sequences, are used right away, so they're never the 
+                   ones to spill. */
+                assert(!ra.graph->fixed[iv->start / 2]);
+                slot[iv->id] = num_slots++;
+                continue;
+            }
+            slot[intervals[owner[iv->type][p]].id] = num_slots++;
+        }
+
+        phys_end[iv->type][p] = iv->end;
+        owner[iv->type][p]    = i;
+        assigned[iv->id]      = p;
+    }
+    
+    if (num_slots > 0) {
+        insert_spill_code(&ra, assigned, slot, num_slots);
+        return;
+    }
+
+    /* rewrite the code. */
+    for (i = 0; i < chunk->num_instr; i++) {
+        m0_instr *ins = &chunk->instructions[i];
+
+        for (k = 0; k < ins->numops; k++) {
+            if (IS_REG_OPERAND(ins->operands[k]) && ins->operands[k].value >= REG_NUM)
+                ins->operands[k].value = assigned[reg_id(ra.graph, &ins->operands[k])];
+        }
+    }
+}
+
@@ -0,0 +1,33 @@
+#ifndef __M1_REGALLOC_H__
+#define __M1_REGALLOC_H__
+
+#include "compiler.h"
+#include "instr.h"
+
+/*
+
+Register allocation. The code generator uses an unlimited number of virtual
+registers, numbered from REG_NUM upward; allocate_registers() maps them onto 
+the REG_NUM physical registers of each type. Registers below REG_NUM that
+occur in the code (parameters, return values, scratch registers of the call
+sequence) are left as they are.
+
+If there are not enough registers, some virtual registers are spilled: they
+are kept in a frame that SPILLCF points to, and loaded into one of the top
+SPILL_REGS registers of their type whenever they are used.
+
+*/
+
+/* highest virtual register number; operands are 16 bits wide. */
+#define MAX_VREG    0xffff
+
+/* registers per type that are reserved for loading spilled registers. */
+#define SPILL_REGS  4
+
+/* first register that is reserved for spilling. */
+#define SPILL_BASE  (REG_NUM - SPILL_REGS)
+
+extern void allocate_registers(M1_compiler *comp, m0_chunk *chunk);
+
+#endif
+
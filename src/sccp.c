@@ -0,0 +1,1249 @@
+/*
+
+Sparse conditional constant propagation (Wegman and Zadeck, 1991).
+
+For every chunk, a control-flow graph is built from the AST. Its nodes
+are basic blocks: runs of statements that end in a jump, a branch on a
+condition, a test of a switch case, or a return. The graph follows the
+code that gencode.c generates, down to where break and continue go.
+
+Starting at the entry, the values of the chunk's scalar variables are
+propagated along the edges that can be taken. A branch whose condition
+is known only passes values to the successor that it goes to; the other
+one isn't visited, unless it is reached in another way. Each block has
+the values of the variables at its entry, which are "known" or
+"varying"; a block that wasn't visited yet has no values at all. Values
+are kept per variable, so the AST doesn't need to be in SSA form.
+
+Once nothing changes anymore, uses of variables whose value is known are
+replaced by that value, and the chunk is folded again. Then the arms of
+if statements, cases of switch statements and while loops that are never
+run are removed, so that no code is generated for them.
+
+Variables whose address is taken, and aggregates, aren't tracked. All
+memory is taken from an arena that is released when the chunk is done.
+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "sccp.h"
+#include "fold.h"
+#include "ast.h"
+#include "symtab.h"
+#include "decl.h"
+#include "intern.h"
+#include "arena.h"
+#include "stats.h"
+
+/* values of blocks times variables that may be tracked in one chunk. */
+#define SCCP_MAX_CELLS  (1 << 18)
+
+#define NO_BLOCK        (~0U)
+
+/* markers in the variable map, until indices are assigned. */
+#define VAR_CANDIDATE   (-1)
+#define VAR_EXCLUDED    (-2)
+
+typedef enum sccp_level {
+    SCCP_UNSEEN,    /* no value reached this point yet. */
+    SCCP_CONST,     /* always the same value. */
+    SCCP_VARYING    /* not known at compile time. */
+} sccp_level;
+
+typedef struct sccp_value {
+    sccp_level   level;
+    m1_constval  val;
+} sccp_value;
+
+typedef enum sccp_exit {
+    EXIT_GOTO,      /* go to succ[0]. */
+    EXIT_BRANCH,    /* go to succ[0] if <cond> is true, otherwise to succ[1]. */
+    EXIT_SELECT,    /* evaluate switch selector <cond>, then go to succ[0]. */
+    EXIT_CASE,      /* go to succ[0] if the selector equals <selector>, otherwise to succ[1]. */
+    EXIT_RETURN     /* leave the chunk. */
+} sccp_exit;
+
+typedef struct sccp_block {
+    unsigned        first_stat;     /* index of the block's first statement in stats. */
+    unsigned        num_stats;
+
+    sccp_exit       exit;
+    m1_expression  *cond;           /* condition of a branch, or selector of a switch. */
+    unsigned        sw;             /* number of the switch, for selects and case tests. */
+    int             selector;       /* value of a case. */
+    unsigned        succ[2];
+
+    int             visited;
+    int             queued;
+} sccp_block;
+
+typedef enum sccp_branchkind {
+    BRANCH_IF,
+    BRANCH_WHILE,
+    BRANCH_CASE,
+    BRANCH_DEFAULT
+} sccp_branchkind;
+
+/* A statement that may have code that is never run; checked once the values are known. */
+typedef struct sccp_branch {
+    sccp_branchkind  kind;
+    m1_expression   *node;          /* the if, while or switch statement. */
+    m1_case         *cse;           /* the case, for BRANCH_CASE. */
+    unsigned         head;          /* block that decides. */
+    unsigned         taken[2];      /* first block of the then and else arms, loop body, or case. */
+    m1_symboltable  *scope;         /* scope that the statement is in. */
+} sccp_branch;
+
+typedef struct sccp_var {
+    m1_symbol *sym;
+    int        index;
+} sccp_var;
+
+typedef struct sccp_state {
+    M1_compiler     *comp;
+    m1_arena        *arena;
+
+    sccp_block      *blocks;
+    unsigned         num_blocks, max_blocks;
+    m1_expression  **stats;
+    unsigned         num_stats, max_stats;
+    sccp_branch     *branches;
+    unsigned         num_branches, max_branches;
+
+    /* while building the graph. */
+    unsigned         current;       /* block that statements are added to. */
+    unsigned         breakto;       /* where break and continue go. */
+    unsigned         continueto;
+    unsigned         num_switches;
+    m1_symboltable  *scope;
+
+    /* variables that are tracked, in a hash table. Switch selectors come after them. */
+    sccp_var        *vars;
+    m1_symbol      **tracked;       /* the variable of each index. */
+    unsigned         num_buckets, num_entries;
+    unsigned         num_tracked;
+    unsigned         num_values;    /* num_tracked + num_switches. */
+
+    sccp_value      *in;            /* values at the entry of each block. */
+    unsigned        *queue;
+    unsigned         queue_head, queue_count;
+
+    sccp_value     **spare;         /* environments for evaluating parts of expressions. */
+    unsigned         num_spare, max_spare;
+
+    m1_type         *inttype, *booltype, *numtype;
+
+} sccp_state;
+
+static void *
+sccp_alloc(sccp_state *s, size_t size) {
+    return arena_alloc(s->arena, size);
+}
+
+/* Grow <array> of <*max> elements of <size> bytes, that holds <num> elements. */
+static void *
+grow(sccp_state *s, void *array, unsigned num, unsigned *max, size_t size) {
+    void *newarray;
+
+    *max     = *max == 0 ? 64 : *max * 2;
+    newarray = sccp_alloc(s, *max * size);
+
+    if (array != NULL)
+        memcpy(newarray, array, num * size);
+
+    return newarray;
+}
+
+/*
+
+The variable map.
+
+*/
+static sccp_var *
+find_var(sccp_state *s, m1_symbol *sym) {
+    unsigned i;
+
+    if (s->num_buckets == 0)
+        return NULL;
+
+    i = ((unsigned long)sym >> 4) & (s->num_buckets - 1);
+    while (s->vars[i].sym != NULL) {
+        if (s->vars[i].sym == sym)
+            return &s->vars[i];
+        i = (i + 1) & (s->num_buckets - 1);
+    }
+    return NULL;
+}
+
+static void
+enter_var(sccp_state *s, m1_symbol *sym, int mark) {
+    sccp_var *var = find_var(s, sym);
+    unsigned  i;
+
+    if (var != NULL) {
+        if (mark == VAR_EXCLUDED)
+            var->index = VAR_EXCLUDED;
+        return;
+    }
+
+    /* keep the table at most half full. */
+    if (2 * (s->num_entries + 1) > s->num_buckets) {
+        sccp_var *old         = s->vars;
+        unsigned  old_buckets = s->num_buckets;
+
+        s->num_buckets = old_buckets == 0 ? 64 : old_buckets * 2;
+        s->vars        = (sccp_var *)sccp_alloc(s, s->num_buckets * sizeof (sccp_var));
+        s->num_entries = 0;
+
+        for (i = 0; i < old_buckets; i++) {
+            if (old[i].sym != NULL)
+                enter_var(s, old[i].sym, old[i].index);
+        }
+    }
+
+    i = ((unsigned long)sym >> 4) & (s->num_buckets - 1);
+    while (s->vars[i].sym != NULL)
+        i = (i + 1) & (s->num_buckets - 1);
+
+    s->vars[i].sym   = sym;
+    s->vars[i].index = mark;
+    s->num_entries++;
+}
+
+/* Get the index of <sym>'s value, or -1 if it isn't tracked. */
+static int
+var_index(sccp_state *s, m1_symbol *sym) {
+    sccp_var *var = sym != NULL ? find_var(s, sym) : NULL;
+
+    return var != NULL && var->index >= 0 ? var->index : -1;
+}
+
+/* A scalar variable is tracked, unless it turns out to be used in other ways. */
+static void
+add_candidate(sccp_state *s, m1_var *v) {
+    m1_symbol *sym = v->sym;
+
+    if (sym == NULL || v->num_elems != 1)
+        return;
+
+    if (sym->typedecl == s->inttype || sym->typedecl == s->booltype || sym->typedecl == s->numtype)
+        enter_var(s, sym, VAR_CANDIDATE);
+    else
+        enter_var(s, sym, VAR_EXCLUDED);
+}
+
+/* Find the object in a.b.c that names the variable. */
+static m1_object *
+main_object(m1_object *obj) {
+    while (obj != NULL && obj->type == OBJECT_LINK)
+        obj = obj->parent;
+    return obj;
+}
+
+static void scan_expr(sccp_state *s, m1_expression *e);
+
+static void
+scan_list(sccp_state *s, m1_expression *e) {
+    for (; e != NULL; e = e->next)
+        scan_expr(s, e);
+}
+
+/* Don't track a variable that is an aggregate, or whose address is taken. */
+static void
+scan_object(sccp_state *s, m1_object *obj, int whole) {
+    m1_object *main = main_object(obj);
+
+    if (main != NULL && main->type == OBJECT_MAIN && main->sym != NULL && (!whole || main != obj))
+        enter_var(s, main->sym, VAR_EXCLUDED);
+
+    for (; obj != NULL && obj->type == OBJECT_LINK; obj = obj->parent) {
+        if (obj->obj.as_link->type == OBJECT_INDEX)
+            scan_expr(s, obj->obj.as_link->obj.as_index);
+    }
+}
+
+/* Find the variables that are declared in an expression, and the ones that can't be tracked. */
+static void
+scan_expr(sccp_state *s, m1_expression *e) {
+    if (e == NULL)
+        return;
+
+    switch (e->type) {
+        case EXPR_VARDECL: {
+            m1_var *v;
+            for (v = e->expr.as_var; v != NULL; v = v->next) {
+                add_candidate(s, v);
+                scan_list(s, v->init);
+            }
+            break;
+        }
+        case EXPR_OBJECT:
+            scan_object(s, e->expr.as_object, 1);
+            break;
+        case EXPR_ADDRESS:
+        case EXPR_DEREF:
+            scan_object(s, e->expr.as_object, 0);
+            break;
+        case EXPR_ASSIGN:
+            scan_object(s, e->expr.as_assign->lhs, 1);
+            scan_expr(s, e->expr.as_assign->rhs);
+            break;
+        case EXPR_BINARY:
+            scan_expr(s, e->expr.as_binexpr->left);
+            scan_expr(s, e->expr.as_binexpr->right);
+            break;
+        case EXPR_UNARY:
+            scan_expr(s, e->expr.as_unexpr->expr);
+            break;
+        case EXPR_CAST:
+            scan_expr(s, e->expr.as_cast->expr);
+            break;
+        case EXPR_IF:
+            scan_expr(s, e->expr.as_ifexpr->cond);
+            scan_expr(s, e->expr.as_ifexpr->ifblock);
+            scan_expr(s, e->expr.as_ifexpr->elseblock);
+            break;
+        case EXPR_FUNCALL:
+            scan_list(s, e->expr.as_funcall->arguments);
+            break;
+        case EXPR_NEW:
+            scan_list(s, e->expr.as_newexpr->args);
+            break;
+        case EXPR_PRINT:
+            scan_list(s, e->expr.as_expr);
+            break;
+        case EXPR_RETURN:
+            scan_expr(s, e->expr.as_expr);
+            break;
+        default:
+            break;
+    }
+}
+
+/*
+
+Building the control-flow graph.
+
+*/
+static unsigned
+new_block(sccp_state *s) {
+    sccp_block *b;
+
+    if (s->num_blocks == s->max_blocks)
+        s->blocks = (sccp_block *)grow(s, s->blocks, s->num_blocks, &s->max_blocks, sizeof (sccp_block));
+
+    b = &s->blocks[s->num_blocks];
+    memset(b, 0, sizeof (sccp_block));
+    b->exit    = EXIT_RETURN;
+    b->succ[0] = b->succ[1] = NO_BLOCK;
+    return s->num_blocks++;
+}
+
+/* Make <b> the block that statements are added to; the previous one must have ended. */
+static void
+start_block(sccp_state *s, unsigned b) {
+    s->current                = b;
+    s->blocks[b].first_stat   = s->num_stats;
+}
+
+static void
+add_stat(sccp_state *s, m1_expression *e) {
+    assert(s->blocks[s->current].first_stat + s->blocks[s->current].num_stats == s->num_stats);
+
+    if (s->num_stats == s->max_stats)
+        s->stats = (m1_expression **)grow(s, s->stats, s->num_stats, &s->max_stats, sizeof (m1_expression *));
+
+    scan_expr(s, e);
+    s->stats[s->num_stats++] = e;
+    s->blocks[s->current].num_stats++;
+}
+
+static void
+end_block(sccp_state *s, sccp_exit exit, m1_expression *cond, unsigned succ0, unsigned succ1) {
+    sccp_block *b = &s->blocks[s->current];
+
+    scan_expr(s, cond);
+    b->exit    = exit;
+    b->cond    = cond;
+    b->succ[0] = succ0;
+    b->succ[1] = succ1;
+}
+
+/* End the current block with a jump to <target>; what follows can only be reached through a label. */
+static void
+end_with_jump(sccp_state *s, unsigned target) {
+    end_block(s, EXIT_GOTO, NULL, target, NO_BLOCK);
+    start_block(s, new_block(s));
+}
+
+static sccp_branch *
+add_branch(sccp_state *s, sccp_branchkind kind, m1_expression *node, unsigned head) {
+    sccp_branch *br;
+
+    if (s->num_branches == s->max_branches)
+        s->branches = (sccp_branch *)grow(s, s->branches, s->num_branches, &s->max_branches,
+                                          sizeof (sccp_branch));
+
+    br           = &s->branches[s->num_branches++];
+    br->kind     = kind;
+    br->node     = node;
+    br->cse      = NULL;
+    br->head     = head;
+    br->taken[0] = br->taken[1] = NO_BLOCK;
+    br->scope    = s->scope;
+    return br;
+}
+
+static void build_stat(sccp_state *s, m1_expression *e);
+
+static void
+build_list(sccp_state *s, m1_expression *e) {
+    for (; e != NULL; e = e->next)
+        build_stat(s, e);
+}
+
+static void
+build_if(sccp_state *s, m1_expression *e) {
+    m1_ifexpr   *i       = e->expr.as_ifexpr;
+    unsigned     thenb   = new_block(s),
+                 elseb   = i->elseblock != NULL ? new_block(s) : NO_BLOCK,
+                 join    = new_block(s);
+    sccp_branch *br      = add_branch(s, BRANCH_IF, e, s->current);
+
+    br->taken[0] = thenb;
+    br->taken[1] = elseb;
+
+    end_block(s, EXIT_BRANCH, i->cond, thenb, elseb != NO_BLOCK ? elseb : join);
+
+    start_block(s, thenb);
+    build_stat(s, i->ifblock);
+    end_block(s, EXIT_GOTO, NULL, join, NO_BLOCK);
+
+    if (elseb != NO_BLOCK) {
+        start_block(s, elseb);
+        build_stat(s, i->elseblock);
+        end_block(s, EXIT_GOTO, NULL, join, NO_BLOCK);
+    }
+    start_block(s, join);
+}
+
+/* Build a loop body that break and continue in it leave for <breakto> and <continueto>. */
+static void
+build_body(sccp_state *s, m1_expression *body, unsigned breakto, unsigned continueto) {
+    unsigned oldbreak    = s->breakto,
+             oldcontinue = s->continueto;
+
+    s->breakto    = breakto;
+    s->continueto = continueto;
+    build_stat(s, body);
+    s->breakto    = oldbreak;
+    s->continueto = oldcontinue;
+}
+
+static void
+build_while(sccp_state *s, m1_expression *e) {
+    m1_whileexpr *w    = e->expr.as_whileexpr;
+    unsigned      head = new_block(s),
+                  body = new_block(s),
+                  exit = new_block(s);
+    sccp_branch  *br   = add_branch(s, BRANCH_WHILE, e, head);
+
+    br->taken[0] = body;
+
+    /* the condition is tested at the end, but the loop starts with a jump there. */
+    end_block(s, EXIT_GOTO, NULL, head, NO_BLOCK);
+    start_block(s, head);
+    end_block(s, EXIT_BRANCH, w->cond, body, exit);
+
+    /* like the code generator, break goes to the test, and continue to the start of the body. */
+    start_block(s, body);
+    build_body(s, w->block, head, body);
+    end_block(s, EXIT_GOTO, NULL, head, NO_BLOCK);
+
+    start_block(s, exit);
+}
+
+static void
+build_dowhile(sccp_state *s, m1_expression *e) {
+    m1_whileexpr *w    = e->expr.as_whileexpr;
+    unsigned      body = new_block(s),
+                  test = new_block(s),
+                  exit = new_block(s);
+
+    end_block(s, EXIT_GOTO, NULL, body, NO_BLOCK);
+    start_block(s, body);
+    build_body(s, w->block, exit, body);
+    end_block(s, EXIT_GOTO, NULL, test, NO_BLOCK);
+
+    start_block(s, test);
+    end_block(s, EXIT_BRANCH, w->cond, body, exit);
+    start_block(s, exit);
+}
+
+static void
+build_for(sccp_state *s, m1_expression *e) {
+    m1_forexpr *f    = e->expr.as_forexpr;
+    unsigned    head, body, step, exit;
+
+    build_list(s, f->init);
+
+    head = new_block(s);
+    body = new_block(s);
+    step = new_block(s);
+    exit = new_block(s);
+
+    end_block(s, EXIT_GOTO, NULL, head, NO_BLOCK);
+    start_block(s, head);
+    /* without a condition, the code generator jumps to the end right away. */
+    if (f->cond != NULL)
+        end_block(s, EXIT_BRANCH, f->cond, body, exit);
+    else
+        end_block(s, EXIT_GOTO, NULL, exit, NO_BLOCK);
+
+    start_block(s, body);
+    build_body(s, f->block, exit, step);
+    end_block(s, EXIT_GOTO, NULL, step, NO_BLOCK);
+
+    start_block(s, step);
+    build_list(s, f->step);
+    end_block(s, EXIT_GOTO, NULL, head, NO_BLOCK);
+
+    start_block(s, exit);
+}
+
+/* Cases are tested one after the other; after a case's statements, the next
+   cases are tested as well, and then the default statement runs. Only break
+   jumps to the end.
+ */
+static void
+build_switch(sccp_state *s, m1_expression *e) {
+    m1_switch   *sw          = e->expr.as_switch;
+    unsigned     no          = s->num_switches++,
+                 end         = new_block(s),
+                 header      = s->current,
+                 oldbreak    = s->breakto,
+                 next;
+    m1_case     *c;
+    sccp_branch *br;
+
+    s->breakto = end;
+
+    next = new_block(s);
+    end_block(s, EXIT_SELECT, sw->selector, next, NO_BLOCK);
+    s->blocks[header].sw = no;
+
+    for (c = sw->cases; c != NULL; c = c->next) {
+        unsigned test = next,
+                 body = new_block(s);
+
+        next = new_block(s);
+
+        start_block(s, test);
+        end_block(s, EXIT_CASE, NULL, body, next);
+        s->blocks[test].sw       = no;
+        s->blocks[test].selector = c->selector;
+
+        br           = add_branch(s, BRANCH_CASE, e, test);
+        br->cse      = c;
+        br->taken[0] = body;
+
+        start_block(s, body);
+        build_list(s, c->block);
+        end_block(s, EXIT_GOTO, NULL, next, NO_BLOCK);
+    }
+
+    /* the code generator only does the first statement after "default:". */
+    start_block(s, next);
+    if (sw->defaultstat != NULL) {
+        br           = add_branch(s, BRANCH_DEFAULT, e, header);
+        br->taken[0] = next;
+        build_stat(s, sw->defaultstat);
+    }
+    end_block(s, EXIT_GOTO, NULL, end, NO_BLOCK);
+
+    s->breakto = oldbreak;
+    start_block(s, end);
+}
+
+static void
+build_stat(sccp_state *s, m1_expression *e) {
+    if (e == NULL)
+        return;
+
+    switch (e->type) {
+        case EXPR_BLOCK: {
+            m1_symboltable *oldscope = s->scope;
+
+            s->scope = &e->expr.as_block->locals;
+            build_list(s, e->expr.as_block->stats);
+            s->scope = oldscope;
+            break;
+        }
+        case EXPR_IF:
+            build_if(s, e);
+            break;
+        case EXPR_WHILE:
+            build_while(s, e);
+            break;
+        case EXPR_DOWHILE:
+            build_dowhile(s, e);
+            break;
+        case EXPR_FOR:
+            build_for(s, e);
+            break;
+        case EXPR_SWITCH:
+            build_switch(s, e);
+            break;
+        case EXPR_BREAK:
+            end_with_jump(s, s->breakto);
+            break;
+        case EXPR_CONTINUE:
+            end_with_jump(s, s->continueto);
+            break;
+        case EXPR_RETURN:
+            add_stat(s, e);
+            end_block(s, EXIT_RETURN, NULL, NO_BLOCK, NO_BLOCK);
+            start_block(s, new_block(s));
+            break;
+        default:
+            add_stat(s, e);
+            break;
+    }
+}
+
+/*
+
+Values.
+
+*/
+static sccp_value
+varying(void) {
+    sccp_value v;
+
+    memset(&v, 0, sizeof (sccp_value));
+    v.level = SCCP_VARYING;
+    return v;
+}
+
+static sccp_value
+known(m1_constval const *val) {
+    sccp_value v;
+
+    v.level = SCCP_CONST;
+    v.val   = *val;
+    return v;
+}
+
+static int
+same_value(sccp_value const *a, sccp_value const *b) {
+    if (a->level != b->level)
+        return 0;
+    if (a->level != SCCP_CONST)
+        return 1;
+    if (a->val.type != b->val.type)
+        return 0;
+    if (a->val.type == EXPR_NUMBER)
+        return memcmp(&a->val.nval, &b->val.nval, sizeof (double)) == 0;
+    return a->val.ival == b->val.ival;
+}
+
+static sccp_value
+meet(sccp_value a, sccp_value b) {
+    if (a.level == SCCP_UNSEEN)
+        return b;
+    if (b.level == SCCP_UNSEEN || same_value(&a, &b))
+        return a;
+    return varying();
+}
+
+static sccp_value
+combine(m1_binop op, sccp_value a, sccp_value b) {
+    sccp_value r;
+
+    if (a.level == SCCP_UNSEEN || b.level == SCCP_UNSEEN)
+        return a.level == SCCP_UNSEEN ? a : b;
+    if (a.level == SCCP_CONST && b.level == SCCP_CONST && fold_binop(op, &a.val, &b.val, &r.val)) {
+        r.level = SCCP_CONST;
+        return r;
+    }
+    return varying();
+}
+
+/* Get whether <v> is a known condition; if so, <truth> is set. */
+static int
+known_truth(sccp_value v, int *truth) {
+    if (v.level != SCCP_CONST || v.val.type == EXPR_NUMBER)
+        return 0;
+    *truth = v.val.ival != 0;
+    return 1;
+}
+
+static sccp_value *
+get_env(sccp_state *s) {
+    if (s->num_spare > 0)
+        return s->spare[--s->num_spare];
+    return (sccp_value *)sccp_alloc(s, (s->num_values + 1) * sizeof (sccp_value));
+}
+
+static void
+put_env(sccp_state *s, sccp_value *env) {
+    if (s->num_spare == s->max_spare)
+        s->spare = (sccp_value **)grow(s, s->spare, s->num_spare, &s->max_spare, sizeof (sccp_value *));
+    s->spare[s->num_spare++] = env;
+}
+
+static sccp_value *
+copy_env(sccp_state *s, sccp_value const *env) {
+    sccp_value *copy = get_env(s);
+    memcpy(copy, env, s->num_values * sizeof (sccp_value));
+    return copy;
+}
+
+/* Merge the values of <other> into <env>; return whether <env> changed. */
+static int
+merge_env(sccp_state *s, sccp_value *env, sccp_value const *other) {
+    unsigned i;
+    int      changed = 0;
+
+    for (i = 0; i < s->num_values; i++) {
+        sccp_value v = meet(env[i], other[i]);
+
+        if (!same_value(&v, &env[i])) {
+            env[i]  = v;
+            changed = 1;
+        }
+    }
+    return changed;
+}
+
+/*
+
+Evaluating expressions. When <rewrite> is set, every use of a variable
+whose value is known is replaced by a literal.
+
+*/
+static sccp_value eval(sccp_state *s, m1_expression *e, sccp_value *env, int rewrite);
+
+static void
+eval_list(sccp_state *s, m1_expression *e, sccp_value *env, int rewrite) {
+    for (; e != NULL; e = e->next)
+        (void)eval(s, e, env, rewrite);
+}
+
+/* Evaluate the index expressions in an object. */
+static void
+eval_object(sccp_state *s, m1_object *obj, sccp_value *env, int rewrite) {
+    if (obj == NULL)
+        return;
+
+    switch (obj->type) {
+        case OBJECT_LINK:
+            eval_object(s, obj->parent, env, rewrite);
+            eval_object(s, obj->obj.as_link, env, rewrite);
+            break;
+        case OBJECT_INDEX:
+            (void)eval(s, obj->obj.as_index, env, rewrite);
+            break;
+        default:
+            break;
+    }
+}
+
+/* Get the index of the tracked variable that <obj> names, or -1. */
+static int
+object_index(sccp_state *s, m1_object *obj) {
+    return obj->type == OBJECT_MAIN ? var_index(s, obj->sym) : -1;
+}
+
+static sccp_value
+eval_use(sccp_state *s, m1_expression *e, sccp_value *env, int rewrite) {
+    int idx = object_index(s, e->expr.as_object);
+
+    if (idx < 0) {
+        eval_object(s, e->expr.as_object, env, rewrite);
+        return varying();
+    }
+
+    if (rewrite && env[idx].level == SCCP_CONST) {
+        sccp_value     v   = env[idx];
+        m1_expression *lit = fold_literal(s->comp, &v.val);
+
+        e->type = lit->type;
+        e->expr = lit->expr;
+        return v;
+    }
+    return env[idx];
+}
+
+/* Give tracked variable <idx> value <v>; a value of another type isn't kept as it is. */
+static void
+store(sccp_state *s, int idx, sccp_value v, sccp_value *env) {
+    m1_type *type = s->tracked[idx]->typedecl;
+
+    if (v.level == SCCP_CONST) {
+        if (v.val.type == EXPR_NUMBER ? type != s->numtype
+          : v.val.type == EXPR_INT    ? type != s->inttype
+          :                             type != s->booltype)
+            v = varying();
+    }
+    env[idx] = v;
+}
+
+/* <e> is evaluated or not, depending on a condition that isn't known. */
+static void
+eval_maybe(sccp_state *s, m1_expression *e, sccp_value *env, int rewrite) {
+    sccp_value *other = copy_env(s, env);
+
+    (void)eval(s, e, other, rewrite);
+    merge_env(s, env, other);
+    put_env(s, other);
+}
+
+static sccp_value
+eval_binary(sccp_state *s, m1_binexpr *b, sccp_value *env, int rewrite) {
+    sccp_value left = eval(s, b->left, env, rewrite);
+    int        truth;
+
+    if (b->op != OP_AND && b->op != OP_OR)
+        return combine(b->op, left, eval(s, b->right, env, rewrite));
+
+    /* && and || only evaluate their right operand if the left one doesn't decide. */
+    if (known_truth(left, &truth)) {
+        if (truth == (b->op == OP_OR))
+            return left;
+        return eval(s, b->right, env, rewrite);
+    }
+    if (left.level == SCCP_VARYING)
+        eval_maybe(s, b->right, env, rewrite);
+
+    return left;
+}
+
+static sccp_value
+eval_unary(sccp_state *s, m1_unexpr *u, sccp_value *env, int rewrite) {
+    sccp_value  old, val, one;
+    m1_constval result;
+    int         idx;
+
+    switch (u->op) {
+        case UNOP_POSTINC:
+        case UNOP_POSTDEC:
+        case UNOP_PREINC:
+        case UNOP_PREDEC:
+            /* the operand is changed, so it's never replaced. */
+            idx = u->expr->type == EXPR_OBJECT ? object_index(s, u->expr->expr.as_object) : -1;
+            if (idx < 0) {
+                (void)eval(s, u->expr, env, rewrite);
+                return varying();
+            }
+
+            one.level    = SCCP_CONST;
+            one.val.type = EXPR_INT;
+            one.val.ival = 1;
+
+            old = env[idx];
+            store(s, idx, combine(u->op == UNOP_POSTINC || u->op == UNOP_PREINC ? OP_PLUS : OP_MINUS, old, one), env);
+            return u->op == UNOP_POSTINC || u->op == UNOP_POSTDEC ? old : env[idx];
+        default:
+            val = eval(s, u->expr, env, rewrite);
+            if (val.level == SCCP_CONST && fold_unop(u->op, &val.val, &result))
+                return known(&result);
+            return val.level == SCCP_UNSEEN ? val : varying();
+    }
+}
+
+static sccp_value
+eval_cast(sccp_state *s, m1_castexpr *c, sccp_value *env, int rewrite) {
+    sccp_value  val = eval(s, c->expr, env, rewrite);
+    m1_constval result;
+
+    if (val.level == SCCP_CONST && fold_convert(c->targettype, &val.val, &result))
+        return known(&result);
+    return val.level == SCCP_UNSEEN ? val : varying();
+}
+
+static void
+eval_vardecl(sccp_state *s, m1_var *v, sccp_value *env, int rewrite) {
+    for (; v != NULL; v = v->next) {
+        int idx = var_index(s, v->sym);
+
+        if (idx < 0)
+            eval_list(s, v->init, env, rewrite);
+        else if (v->init != NULL)
+            store(s, idx, eval(s, v->init, env, rewrite), env);
+        else /* whatever the register held before. */
+            env[idx] = varying();
+    }
+}
+
+/* A ?: expression; the code generator handles it as an if statement. */
+static void
+eval_ifexpr(sccp_state *s, m1_ifexpr *i, sccp_value *env, int rewrite) {
+    sccp_value cond = eval(s, i->cond, env, rewrite);
+    int        truth;
+
+    if (known_truth(cond, &truth))
+        (void)eval(s, truth ? i->ifblock : i->elseblock, env, rewrite);
+    else if (cond.level == SCCP_VARYING) {
+        sccp_value *other = copy_env(s, env);
+
+        (void)eval(s, i->ifblock, env, rewrite);
+        (void)eval(s, i->elseblock, other, rewrite);
+        merge_env(s, env, other);
+        put_env(s, other);
+    }
+}
+
+static sccp_value
+eval(sccp_state *s, m1_expression *e, sccp_value *env, int rewrite) {
+    m1_constval val;
+
+    if (e == NULL)
+        return varying();
+
+    if (fold_get_value(e, &val))
+        return known(&val);
+
+    switch (e->type) {
+        case EXPR_OBJECT:
+            return eval_use(s, e, env, rewrite);
+        case EXPR_ASSIGN: {
+            /* the right-hand side is evaluated first. */
+            m1_assignment *a   = e->expr.as_assign;
+            sccp_value     rhs = eval(s, a->rhs, env, rewrite);
+            int            idx = object_index(s, a->lhs);
+
+            if (idx >= 0)
+                store(s, idx, rhs, env);
+            else
+                eval_object(s, a->lhs, env, rewrite);
+            return rhs;
+        }
+        case EXPR_BINARY:
+            return eval_binary(s, e->expr.as_binexpr, env, rewrite);
+        case EXPR_UNARY:
+            return eval_unary(s, e->expr.as_unexpr, env, rewrite);
+        case EXPR_CAST:
+            return eval_cast(s, e->expr.as_cast, env, rewrite);
+        case EXPR_ADDRESS:
+        case EXPR_DEREF:
+            eval_object(s, e->expr.as_object, env, rewrite);
+            break;
+        case EXPR_FUNCALL:
+            eval_list(s, e->expr.as_funcall->arguments, env, rewrite);
+            break;
+        case EXPR_NEW:
+            eval_list(s, e->expr.as_newexpr->args, env, rewrite);
+            break;
+        case EXPR_PRINT:
+            eval_list(s, e->expr.as_expr, env, rewrite);
+            break;
+        case EXPR_RETURN:
+            (void)eval(s, e->expr.as_expr, env, rewrite);
+            break;
+        case EXPR_VARDECL:
+            eval_vardecl(s, e->expr.as_var, env, rewrite);
+            break;
+        case EXPR_IF:
+            eval_ifexpr(s, e->expr.as_ifexpr, env, rewrite);
+            break;
+        default:
+            break;
+    }
+    return varying();
+}
+
+/*
+
+The solver.
+
+*/
+static sccp_value *
+block_in(sccp_state *s, unsigned b) {
+    return &s->in[(size_t)b * s->num_values];
+}
+
+/* Let the values in <env> flow into block <b>. */
+static void
+flow(sccp_state *s, unsigned b, sccp_value const *env) {
+    sccp_block *block = &s->blocks[b];
+    int         changed;
+
+    if (!block->visited) {
+        memcpy(block_in(s, b), env, s->num_values * sizeof (sccp_value));
+        block->visited = 1;
+        changed        = 1;
+    }
+    else
+        changed = merge_env(s, block_in(s, b), env);
+
+    if (changed && !block->queued) {
+        block->queued = 1;
+        s->queue[(s->queue_head + s->queue_count++) % s->num_blocks] = b;
+    }
+}
+
+/* Evaluate block <b>; when <rewrite> is set, the uses of known values are replaced. */
+static void
+eval_block(sccp_state *s, unsigned b, int rewrite) {
+    sccp_block *block = &s->blocks[b];
+    sccp_value *env   = copy_env(s, block_in(s, b));
+    sccp_value  v;
+    unsigned    i;
+    int         truth;
+
+    for (i = 0; i < block->num_stats; i++)
+        (void)eval(s, s->stats[block->first_stat + i], env, rewrite);
+
+    switch (block->exit) {
+        case EXIT_GOTO:
+            if (!rewrite)
+                flow(s, block->succ[0], env);
+            break;
+        case EXIT_BRANCH:
+            v = eval(s, block->cond, env, rewrite);
+            if (rewrite)
+                break;
+            if (known_truth(v, &truth))
+                flow(s, block->succ[truth ? 0 : 1], env);
+            else if (v.level == SCCP_VARYING) {
+                flow(s, block->succ[0], env);
+                flow(s, block->succ[1], env);
+            }
+            break;
+        case EXIT_SELECT:
+            env[s->num_tracked + block->sw] = eval(s, block->cond, env, rewrite);
+            if (!rewrite)
+                flow(s, block->succ[0], env);
+            break;
+        case EXIT_CASE:
+            if (rewrite)
+                break;
+            v = env[s->num_tracked + block->sw];
+            /* the code generator only gets case values of 0 to 255 right; leave the others alone. */
+            if (v.level == SCCP_CONST && v.val.type == EXPR_INT && block->selector >= 0 && block->selector < 256)
+                flow(s, block->succ[v.val.ival == block->selector ? 0 : 1], env);
+            else if (v.level != SCCP_UNSEEN) {
+                flow(s, block->succ[0], env);
+                flow(s, block->succ[1], env);
+            }
+            break;
+        default:
+            break;
+    }
+    put_env(s, env);
+}
+
+static void
+solve(sccp_state *s) {
+    sccp_value *entry = get_env(s);
+    unsigned    i;
+
+    s->in    = (sccp_value *)sccp_alloc(s, ((size_t)s->num_blocks * s->num_values + 1) * sizeof (sccp_value));
+    s->queue = (unsigned *)sccp_alloc(s, s->num_blocks * sizeof (unsigned));
+
+    /* parameters, and locals that aren't declared yet, hold unknown values. */
+    for (i = 0; i < s->num_values; i++)
+        entry[i] = varying();
+
+    flow(s, 0, entry);
+    put_env(s, entry);
+
+    while (s->queue_count > 0) {
+        unsigned b = s->queue[s->queue_head];
+
+        s->queue_head = (s->queue_head + 1) % s->num_blocks;
+        s->queue_count--;
+        s->blocks[b].queued = 0;
+        eval_block(s, b, 0);
+    }
+}
+
+/*
+
+Pruning.
+
+*/
+static int
+visited(sccp_state *s, unsigned b) {
+    return b != NO_BLOCK && s->blocks[b].visited;
+}
+
+/* Turn <e> into an empty block in <scope>. */
+static void
+make_empty(sccp_state *s, m1_expression *e, m1_symboltable *scope) {
+    m1_block *b = block(s->comp);
+
+    b->locals.parentscope = scope;
+    e->type               = EXPR_BLOCK;
+    e->expr.as_block      = b;
+}
+
+static void
+prune_if(sccp_state *s, sccp_branch *br) {
+    m1_ifexpr  *i = br->node->expr.as_ifexpr;
+    m1_constval cond;
+
+    if (fold_get_value(i->cond, &cond) && cond.type != EXPR_NUMBER) {
+        m1_expression *arm = cond.ival != 0 ? i->ifblock : i->elseblock;
+
+        if (arm != NULL) {
+            br->node->type = arm->type;
+            br->node->expr = arm->expr;
+        }
+        else
+            make_empty(s, br->node, br->scope);
+
+        STAT_INC(s->comp, branches_pruned);
+        return;
+    }
+
+    /* the condition has side effects, so it stays. */
+    if (!visited(s, br->taken[0])) {
+        make_empty(s, i->ifblock, br->scope);
+        STAT_INC(s->comp, branches_pruned);
+    }
+    if (i->elseblock != NULL && !visited(s, br->taken[1])) {
+        i->elseblock = NULL;
+        STAT_INC(s->comp, branches_pruned);
+    }
+}
+
+static void
+prune_while(sccp_state *s, sccp_branch *br) {
+    m1_constval cond;
+
+    if (!visited(s, br->taken[0]) && fold_get_value(br->node->expr.as_whileexpr->cond, &cond)
+    &&  cond.type != EXPR_NUMBER && cond.ival == 0) {
+        make_empty(s, br->node, br->scope);
+        STAT_INC(s->comp, branches_pruned);
+    }
+}
+
+static void
+prune_case(sccp_state *s, sccp_branch *br) {
+    m1_switch *sw = br->node->expr.as_switch;
+    m1_case  **link;
+
+    if (visited(s, br->taken[0]))
+        return;
+
+    for (link = &sw->cases; *link != NULL; link = &(*link)->next) {
+        if (*link == br->cse) {
+            *link = br->cse->next;
+            STAT_INC(s->comp, branches_pruned);
+            return;
+        }
+    }
+}
+
+static void
+prune(sccp_state *s) {
+    unsigned i = s->num_branches;
+
+    /* inner statements first, as an outer if may be replaced by a copy of an inner one. */
+    while (i-- > 0) {
+        sccp_branch *br = &s->branches[i];
+
+        if (!visited(s, br->head))
+            continue;
+
+        switch (br->kind) {
+            case BRANCH_IF:
+                prune_if(s, br);
+                break;
+            case BRANCH_WHILE:
+                prune_while(s, br);
+                break;
+            case BRANCH_CASE:
+                prune_case(s, br);
+                break;
+            case BRANCH_DEFAULT:
+                if (!visited(s, br->taken[0])) {
+                    br->node->expr.as_switch->defaultstat = NULL;
+                    STAT_INC(s->comp, branches_pruned);
+                }
+                break;
+        }
+    }
+}
+
+/* Assign an index to every variable that is tracked. */
+static void
+number_vars(sccp_state *s) {
+    unsigned i;
+
+    s->num_tracked = 0;
+    s->tracked     = (m1_symbol **)sccp_alloc(s, (s->num_entries + 1) * sizeof (m1_symbol *));
+    for (i = 0; i < s->num_buckets; i++) {
+        if (s->vars[i].sym != NULL && s->vars[i].index == VAR_CANDIDATE) {
+            s->tracked[s->num_tracked] = s->vars[i].sym;
+            s->vars[i].index           = s->num_tracked++;
+        }
+    }
+
+    /* if there are too many values to keep, only the switch selectors are tracked. */
+    if ((size_t)s->num_blocks * (s->num_tracked + s->num_switches) > SCCP_MAX_CELLS) {
+        for (i = 0; i < s->num_buckets; i++) {
+            if (s->vars[i].sym != NULL)
+                s->vars[i].index = VAR_EXCLUDED;
+        }
+        s->num_tracked = 0;
+    }
+    s->num_values = s->num_tracked + s->num_switches;
+}
+
+static void
+sccp_chunk(M1_compiler *comp, m1_chunk *chunk) {
+    sccp_state s;
+    m1_var    *param;
+    unsigned   b;
+
+    memset(&s, 0, sizeof (sccp_state));
+    s.comp       = comp;
+    s.arena      = new_arena();
+    s.breakto    = NO_BLOCK;
+    s.continueto = NO_BLOCK;
+    s.scope      = &chunk->block->locals;
+    s.inttype    = type_find_def(comp, intern(comp, "int"));
+    s.booltype   = type_find_def(comp, intern(comp, "bool"));
+    s.numtype    = type_find_def(comp, intern(comp, "num"));
+
+    for (param = chunk->parameters; param != NULL; param = param->next)
+        add_candidate(&s, param);
+
+    start_block(&s, new_block(&s));
+    build_list(&s, chunk->block->stats);
+
+    number_vars(&s);
+
+    if ((size_t)s.num_blocks * s.num_values <= SCCP_MAX_CELLS) {
+        comp->currentchunk = chunk;
+        solve(&s);
+
+        for (b = 0; b < s.num_blocks; b++) {
+            if (s.blocks[b].visited)
+                eval_block(&s, b, 1);
+        }
+
+        fold_chunk(comp, chunk);
+        prune(&s);
+    }
+    delete_arena(s.arena);
+}
+
+/*
+
+Propagate constants in all chunks, and remove the code that never runs.
+
+*/
+void
+sccp(M1_compiler *comp, m1_chunk *ast) {
+    m1_chunk *iter;
+
+    for (iter = ast; iter != NULL; iter = iter->next)
+        sccp_chunk(comp, iter);
+}
+
@@ -0,0 +1,18 @@
+#ifndef __M1_SCCP_H__
+#define __M1_SCCP_H__
+
+#include "compiler.h"
+#include "ast.h"
+
+/*
+
+Sparse conditional constant propagation runs after constant folding.
+Uses of variables whose value is known are replaced by that value, and
+branches that are never taken are removed from the AST.
+
+*/
+
+extern void sccp(M1_compiler *comp, m1_chunk *ast);
+
+#endif
+
@@ -21,6 +21,7 @@ point to the same m1_type object.
 #include "ast.h"
 #include "decl.h"
 #include "stack.h"
+#include "intern.h"
 
 
 
@@ -30,6 +31,7 @@ static void check_block(M1_compiler *comp, m1_block *expr);
 static m1_type *check_obj(M1_compiler *comp, m1_object *obj, unsigned line, m1_object **parent);
 static void check_exprlist(M1_compiler *comp, m1_expression *expr);
 static m1_type * check_vardecl(M1_compiler *comp, m1_var *v, unsigned line);
+static void check_not_constant(M1_compiler *comp, m1_object *obj, unsigned line, char *what);
 
 /* Cache these built-in types. Read-only. */
 static m1_type *BOOLTYPE;
@@ -41,11 +43,11 @@ static m1_type *VOIDTYPE;
 /* XXX is this init routine thread-safe? */
 static void
 init_typechecker(M1_compiler *comp) {
-    BOOLTYPE   = type_find_def(comp, "bool"); 
-    INTTYPE    = type_find_def(comp, "int");
-    NUMTYPE    = type_find_def(comp, "num");
-    STRINGTYPE = type_find_def(comp, "string");  
-    VOIDTYPE   = type_find_def(comp, "void");
+    BOOLTYPE   = type_find_def(comp, intern(comp, "bool")); 
+    INTTYPE    = type_find_def(comp, intern(comp, "int"));
+    NUMTYPE    = type_find_def(comp, intern(comp, "num"));
+    STRINGTYPE = type_find_def(comp, intern(comp, "string"));  
+    VOIDTYPE   = type_find_def(comp, intern(comp, "void"));
 }
 
 /* Emit a type error. */
@@ -92,6 +94,8 @@ check_assign(M1_compiler *comp, m1_assignment *a, unsigned line) {
     m1_type *ltype = check_obj(comp, a->lhs, line, &parent);
     m1_type *rtype = check_expr(comp, a->rhs);
     
+    check_not_constant(comp, a->lhs, line, "assign to");
+    
     assert(ltype != NULL);
     assert(rtype != NULL);
     
@@ -121,6 +125,12 @@ check_obj(M1_compiler *comp, m1_object *obj, unsigned line, m1_object **parent)
             *parent = obj;
             
             t = check_obj(comp, obj->parent, line, parent);   
+            
+            /* a constant is a single value, it has no fields or elements. */
+            if ((*parent)->type == OBJECT_MAIN && (*parent)->sym != NULL && (*parent)->sym->constdecl != NULL) {
+                type_error(comp, line, "constant '%s' has no fields or elements", (*parent)->obj.as_name);
+                t = VOIDTYPE;
+            }
             /* in case field is a member of a struct, get _that_ type;
                when it's an index, return the type of obj->parent. 
              */
@@ -138,7 +148,7 @@ check_obj(M1_compiler *comp, m1_object *obj, unsigned line, m1_object **parent)
         case OBJECT_MAIN: {
 
             /* look up identifier's declaration. */
-            obj->sym = sym_lookup_symbol(comp->currentsymtab, obj->obj.as_name);            
+            obj->sym = sym_lookup_symbol(comp, comp->currentsymtab, obj->obj.as_name);            
 
             if (obj->sym == NULL) {                                                
                 type_error(comp, line, "undeclared variable '%s'", obj->obj.as_name);
@@ -163,7 +173,7 @@ check_obj(M1_compiler *comp, m1_object *obj, unsigned line, m1_object **parent)
             assert((*parent)->sym != NULL);
             assert((*parent)->sym->typedecl != NULL);
             /* look up symbol for this field in parent's symbol table (which is a struct/PMC). */
-            obj->sym = sym_lookup_symbol( &(*parent)->sym->typedecl->d.as_struct->sfields, obj->obj.as_name);
+            obj->sym = sym_lookup_symbol(comp, &(*parent)->sym->typedecl->d.as_struct->sfields, obj->obj.as_name);
 
             if (obj->sym == NULL) {
                 type_error(comp, line, "struct %s has no member %s", 
@@ -289,6 +299,8 @@ check_address(M1_compiler *comp, m1_object *o, unsigned line) {
     /* declared here to use the storage space on C runtime stack. */
     m1_object *parent; 
     m1_type *t = check_obj(comp, o, line, &parent);   
+    
+    check_not_constant(comp, o, line, "take the address of");
     /* XXX &obj not implemented yet. */
     return t;
 }
@@ -398,11 +410,15 @@ check_unary(M1_compiler *comp, m1_unexpr *u, unsigned line) {
         case UNOP_PREINC:
             if (t != INTTYPE) 
                 type_error(comp, line, "cannot apply '++' operator on non-integer expression");      
+            else if (u->expr->type == EXPR_OBJECT)
+                check_not_constant(comp, u->expr->expr.as_object, line, "increment");
             break;        
         case UNOP_POSTDEC:
         case UNOP_PREDEC:   
             if (t != INTTYPE) 
                 type_error(comp, line, "cannot apply '--' operator on non-integer expression");      
+            else if (u->expr->type == EXPR_OBJECT)
+                check_not_constant(comp, u->expr->expr.as_object, line, "decrement");
             break;        
         case UNOP_NOT:
             if (t != BOOLTYPE) 
@@ -437,7 +453,7 @@ check_funcall(M1_compiler *comp, m1_funcall *funcall, unsigned line) {
     /* look up declaration of function in compiler's global symbol table. 
        XXX if not found, it must be handled by the linker, which is yet to be written.
        */    
-    funcall->funsym = sym_lookup_symbol(comp->globalsymtab, funcall->name);
+    funcall->funsym = sym_lookup_symbol(comp, comp->globalsymtab, funcall->name);
 
     
     if (funcall->funsym == NULL) {
@@ -587,14 +603,41 @@ check_vardecl(M1_compiler *comp, m1_var *v, unsigned line) {
     return v->sym->typedecl;
 }
 
+/* Check that the value of a constant matches its declared type. */
+static void
+check_constdecl(M1_compiler *comp, m1_const *c, unsigned line) {
+    m1_type *valuetype = check_expr(comp, c->value);
+    
+    assert(c->sym != NULL);
+    c->sym->typedecl = type_find_def(comp, c->type);
+    
+    if (c->sym->typedecl == NULL) {
+        type_error(comp, line, "cannot find type '%s' for constant '%s'", c->type, c->name);
+    }
+    else if (valuetype != c->sym->typedecl) {
+        type_error(comp, line, 
+                   "incompatible types in initialization type '%s' of "
+                   "constant '%s', which is type '%s'", 
+                   valuetype->name, c->name, c->sym->typedecl->name);
+    }
+}
+
+/* Report an error if <obj> is a constant; <what> is done to it, which needs a variable. */
+static void
+check_not_constant(M1_compiler *comp, m1_object *obj, unsigned line, char *what) {
+    if (obj->type == OBJECT_MAIN && obj->sym != NULL && obj->sym->constdecl != NULL)
+        type_error(comp, line, "cannot %s constant '%s'", what, obj->obj.as_name);
+}
+
 static m1_type *
 check_cast(M1_compiler *comp, m1_castexpr *expr, unsigned line) {
     m1_type *type = check_expr(comp, expr->expr);
-    if (strcmp(expr->type, "int") == 0) {
+    /* type names are interned, so compare pointers. */
+    if (expr->type == INTTYPE->name) {
         expr->targettype = VAL_INT;
         type = INTTYPE;
     }
-    else if (strcmp(expr->type, "num") == 0) {
+    else if (expr->type == NUMTYPE->name) {
         expr->targettype = VAL_FLOAT;
         type = NUMTYPE;
     }
@@ -639,6 +682,7 @@ check_expr(M1_compiler *comp, m1_expression *e) {
             check_continue(comp, e->line);
             break;               
         case EXPR_CONSTDECL:
+            check_constdecl(comp, e->expr.as_const, e->line);
             break;            
         case EXPR_CAST:
             return check_cast(comp, e->expr.as_cast, e->line);
@@ -11,15 +11,35 @@ Needed by code generator to store labels for break statements, etc.
 
 #define STACKDEBUG  0
 
+/* Resize <store> to hold <size> elements of <elemsize> bytes. */
+static void *
+resize_store(void *store, int size, size_t elemsize) {
+    store = realloc(store, size * elemsize);
+    
+    if (store == NULL) {
+        fprintf(stderr, "cant alloc mem for stack");
+        exit(EXIT_FAILURE);   
+    }
+    return store;
+}
+
 m1_intstack *
 new_intstack(void) {
     m1_intstack *stack = (m1_intstack *)calloc(1, sizeof(m1_intstack));
-    stack->sp          = 0;
+    
+    if (stack == NULL) {
+        fprintf(stderr, "cant alloc mem for stack");
+        exit(EXIT_FAILURE);   
+    }
+    stack->sp    = 0;
+    stack->size  = STACKSIZE;
+    stack->store = (int *)resize_store(NULL, stack->size, sizeof(int));
     return stack;
 }
 
 void 
 delete_stack(m1_intstack *stack) {
+    free(stack->store);
     free(stack);
     stack = NULL;
 }
@@ -27,8 +47,11 @@ delete_stack(m1_intstack *stack) {
 void 
 push(m1_intstack *stack, int value) {
     assert(stack != NULL);
-    assert(stack->sp < STACKSIZE);
     
+    if (stack->sp == stack->size) {
+        stack->size *= 2;
+        stack->store = (int *)resize_store(stack->store, stack->size, sizeof(int));
+    }
     stack->store[stack->sp++] = value;
 }
 
@@ -51,7 +74,14 @@ top(m1_intstack *stack) {
 m1_regstack *
 new_regstack(void) {
     m1_regstack *stack = (m1_regstack *)calloc(1, sizeof(m1_regstack));
-    stack->sp = 0;
+    
+    if (stack == NULL) {
+        fprintf(stderr, "cant alloc mem for stack");
+        exit(EXIT_FAILURE);   
+    }
+    stack->sp    = 0;
+    stack->size  = STACKSIZE;
+    stack->store = (m1_reg *)resize_store(NULL, stack->size, sizeof(m1_reg));
     return stack;   
 }
 
@@ -75,6 +105,7 @@ print_stack(m1_regstack *stack, char *message) {
 void
 delete_regstack(m1_regstack *stack) {
     assert(stack != NULL);
+    free(stack->store);
     free(stack);
     stack = NULL;   
 }
@@ -82,8 +113,11 @@ delete_regstack(m1_regstack *stack) {
 void
 pushreg(m1_regstack *stack, m1_reg reg) {
     assert(stack != NULL);
-    assert(stack->sp < STACKSIZE);
     
+    if (stack->sp == stack->size) {
+        stack->size *= 2;
+        stack->store = (m1_reg *)resize_store(stack->store, stack->size, sizeof(m1_reg));
+    }
     stack->store[stack->sp++] = reg;
     //print_stack(stack, "push (after)");
 }
@@ -3,19 +3,21 @@
 
 #include "gencode.h"
 
-/* XXX make this flexible later */
+/* initial size of stacks; they grow as needed, e.g. for deeply nested loops. */
 #define STACKSIZE   128
 
 typedef struct m1_intstack {
-    int store[STACKSIZE];
-    int sp; /* stack pointer */        
+    int *store;
+    int  sp;   /* stack pointer */        
+    int  size; /* allocated size of store. */
     
 } m1_intstack;
 
 
 typedef struct m1_regstack {
-    struct m1_reg store[STACKSIZE];
-    int           sp; /* stack pointer */
+    struct m1_reg *store;
+    int            sp;   /* stack pointer */
+    int            size; /* allocated size of store. */
     
 } m1_regstack;
 
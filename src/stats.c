@@ -0,0 +1,224 @@
+/*
+
+Compile statistics. Counters are always kept, as they cost next to
+nothing; timing is only done when statistics were requested. Output
+is either a human-readable table, or JSON for automated tracking.
+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <assert.h>
+#include "stats.h"
+#include "arena.h"
+
+static char const * const phase_names[NUM_PHASES] = {
+    "none",
+    "parse",
+    "check",
+    "codegen",
+    "emit"
+};
+
+static char const * const phase_descriptions[NUM_PHASES] = {
+    "",
+    "lex/parse",
+    "type check",
+    "codegen",
+    "emission"
+};
+
+m1_stats *
+new_stats(m1_statsformat format) {
+    m1_stats *stats = (m1_stats *)calloc(1, sizeof (m1_stats));
+
+    if (stats == NULL) {
+        fprintf(stderr, "cant alloc mem for stats");
+        exit(EXIT_FAILURE);
+    }
+    stats->format = format;
+    stats->phase  = PHASE_NONE;
+    return stats;
+}
+
+void
+delete_stats(m1_stats *stats) {
+    free(stats);
+}
+
+static double
+seconds(clockid_t clock) {
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+
+Enter phase C<phase>; the time since the previous phase was entered is
+added to that phase. The previous phase is returned, so that a nested
+phase can restore it when it's done.
+
+*/
+m1_phase
+stats_phase(M1_compiler *comp, m1_phase phase) {
+    m1_stats *stats = comp->stats;
+    m1_phase  prev  = stats->phase;
+    double    wall, cpu;
+
+    if (stats->format == STATS_NONE)
+        return prev;
+
+    wall = seconds(CLOCK_MONOTONIC);
+    cpu  = seconds(CLOCK_PROCESS_CPUTIME_ID);
+
+    stats->wall[prev] += wall - stats->phase_wall;
+    stats->cpu[prev]  += cpu - stats->phase_cpu;
+
+    stats->phase      = phase;
+    stats->phase_wall = wall;
+    stats->phase_cpu  = cpu;
+    return prev;
+}
+
+/* Record the memory currently held by the arenas, if that's a new maximum. */
+void
+stats_sample_memory(M1_compiler *comp) {
+    size_t bytes = comp->ast_arena->allocated
+                 + comp->sym_arena->allocated
+                 + comp->type_arena->allocated
+                 + comp->instr_arena->allocated;
+
+    if (bytes > comp->stats->peak_bytes)
+        comp->stats->peak_bytes = bytes;
+}
+
+/* Record the peak resident set size of the process; ru_maxrss is in kilobytes. */
+static void
+sample_rss(m1_stats *stats) {
+    struct rusage usage;
+    
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+        stats->peak_rss_kb = usage.ru_maxrss;
+}
+
+/* Print <str> as a JSON string. */
+static void
+print_json_string(FILE *out, char const *str) {
+    fputc('"', out);
+    for (; *str != '\0'; str++) {
+        if (*str == '"' || *str == '\\')
+            fprintf(out, "\\%c", *str);
+        else if ((unsigned char)*str < 0x20)
+            fprintf(out, "\\u%04x", (unsigned char)*str);
+        else
+            fputc(*str, out);
+    }
+    fputc('"', out);
+}
+
+static void
+print_stats_json(M1_compiler *comp, FILE *out) {
+    m1_stats *stats = comp->stats;
+    int       i;
+
+    fprintf(out, "{\n  \"file\": ");
+    print_json_string(out, comp->current_filename);
+    fprintf(out, ",\n  \"errors\": %u,\n  \"phases\": {\n", comp->errors);
+
+    for (i = PHASE_PARSE; i < NUM_PHASES; i++)
+        fprintf(out, "    \"%s\": { \"wall_ms\": %.3f, \"cpu_ms\": %.3f }%s\n",
+                phase_names[i], stats->wall[i] * 1000, stats->cpu[i] * 1000,
+                i + 1 < NUM_PHASES ? "," : "");
+
+    fprintf(out, "  },\n  \"counters\": {\n");
+    fprintf(out, "    \"symbol_lookups\": %lu,\n", stats->symbol_lookups);
+    fprintf(out, "    \"reg_allocs\": %lu,\n", stats->reg_allocs);
+    fprintf(out, "    \"reg_scans\": %lu,\n", stats->reg_scans);
+    fprintf(out, "    \"spills\": %lu,\n", stats->spills);
+    fprintf(out, "    \"consts_entered\": %lu,\n", stats->consts_entered);
+    fprintf(out, "    \"instructions\": %lu,\n", stats->instructions);
+    fprintf(out, "    \"labels\": %lu,\n", stats->labels);
+    fprintf(out, "    \"folds\": %lu,\n", stats->folds);
+    fprintf(out, "    \"branches_pruned\": %lu,\n", stats->branches_pruned);
+    fprintf(out, "    \"loops_unrolled\": %lu,\n", stats->loops_unrolled);
+    fprintf(out, "    \"switches_lowered\": %lu,\n", stats->switches_lowered);
+    fprintf(out, "    \"values_reused\": %lu,\n", stats->values_reused);
+    fprintf(out, "    \"hoisted\": %lu,\n", stats->hoisted);
+    fprintf(out, "    \"strength_reduced\": %lu,\n", stats->strength_reduced);
+    fprintf(out, "    \"dead_instructions\": %lu\n", stats->dead_instructions);
+    fprintf(out, "  },\n  \"peephole\": {\n");
+    
+    for (i = 0; i < NUM_PEEPHOLE_RULES; i++)
+        fprintf(out, "    \"%s\": %lu%s\n", peephole_rule_names[i], stats->peephole[i],
+                i + 1 < NUM_PEEPHOLE_RULES ? "," : "");
+                
+    fprintf(out, "  },\n");
+    fprintf(out, "  \"peak_arena_bytes\": %lu,\n", (unsigned long)stats->peak_bytes);
+    fprintf(out, "  \"output_bytes\": %lu,\n", (unsigned long)stats->output_bytes);
+    fprintf(out, "  \"peak_rss_kb\": %ld\n}\n", stats->peak_rss_kb);
+}
+
+static void
+print_stats_text(M1_compiler *comp, FILE *out) {
+    m1_stats *stats = comp->stats;
+    double    totalwall = 0.0,
+              totalcpu  = 0.0;
+    int       i;
+
+    fprintf(out, "statistics for %s\n", comp->current_filename);
+    fprintf(out, "  %-20s %12s %12s\n", "phase", "wall (ms)", "cpu (ms)");
+
+    for (i = PHASE_PARSE; i < NUM_PHASES; i++) {
+        fprintf(out, "  %-20s %12.3f %12.3f\n", phase_descriptions[i],
+                stats->wall[i] * 1000, stats->cpu[i] * 1000);
+        totalwall += stats->wall[i];
+        totalcpu  += stats->cpu[i];
+    }
+    fprintf(out, "  %-20s %12.3f %12.3f\n", "total", totalwall * 1000, totalcpu * 1000);
+
+    fprintf(out, "  %-20s %12lu\n", "symbol lookups", stats->symbol_lookups);
+    fprintf(out, "  %-20s %12lu\n", "register allocs", stats->reg_allocs);
+    fprintf(out, "  %-20s %12lu\n", "register scans", stats->reg_scans);
+    fprintf(out, "  %-20s %12lu\n", "registers spilled", stats->spills);
+    fprintf(out, "  %-20s %12lu\n", "constants entered", stats->consts_entered);
+    fprintf(out, "  %-20s %12lu\n", "instructions", stats->instructions);
+    fprintf(out, "  %-20s %12lu\n", "labels", stats->labels);
+    fprintf(out, "  %-20s %12lu\n", "expressions folded", stats->folds);
+    fprintf(out, "  %-20s %12lu\n", "branches pruned", stats->branches_pruned);
+    fprintf(out, "  %-20s %12lu\n", "loops unrolled", stats->loops_unrolled);
+    fprintf(out, "  %-20s %12lu\n", "switches lowered", stats->switches_lowered);
+    fprintf(out, "  %-20s %12lu\n", "values reused", stats->values_reused);
+    fprintf(out, "  %-20s %12lu\n", "instructions hoisted", stats->hoisted);
+    fprintf(out, "  %-20s %12lu\n", "strength reduced", stats->strength_reduced);
+    fprintf(out, "  %-20s %12lu\n", "dead instructions", stats->dead_instructions);
+    
+    fprintf(out, "  removed by peephole rules:\n");
+    for (i = 0; i < NUM_PEEPHOLE_RULES; i++)
+        fprintf(out, "    %-18s %12lu\n", peephole_rule_names[i], stats->peephole[i]);
+        
+    fprintf(out, "  %-20s %12lu\n", "peak arena bytes", (unsigned long)stats->peak_bytes);
+    fprintf(out, "  %-20s %12lu\n", "output bytes", (unsigned long)stats->output_bytes);
+    fprintf(out, "  %-20s %12ld\n", "peak rss (kb)", stats->peak_rss_kb);
+}
+
+void
+print_stats(M1_compiler *comp, FILE *out) {
+    assert(comp->stats != NULL);
+    
+    sample_rss(comp->stats);
+
+    switch (comp->stats->format) {
+        case STATS_TEXT:
+            print_stats_text(comp, out);
+            break;
+        case STATS_JSON:
+            print_stats_json(comp, out);
+            break;
+        default:
+            break;
+    }
+}
+
@@ -0,0 +1,79 @@
+#ifndef __M1_STATS_H__
+#define __M1_STATS_H__
+
+#include <stddef.h>
+#include "compiler.h"
+#include "peephole.h"
+
+/*
+
+Compile statistics, as reported with the --stats option. Time is
+attributed to a phase from the moment that phase is entered until
+another phase is entered; so nested work, such as writing a chunk
+during code generation, is only counted for the innermost phase.
+
+*/
+typedef enum m1_phase {
+    PHASE_NONE,     /* not timing anything. */
+    PHASE_PARSE,    /* lexing and parsing. */
+    PHASE_CHECK,    /* type checking. */
+    PHASE_CODEGEN,  /* code generation. */
+    PHASE_EMIT,     /* writing the output. */
+
+    NUM_PHASES
+} m1_phase;
+
+typedef enum m1_statsformat {
+    STATS_NONE,
+    STATS_TEXT,
+    STATS_JSON
+
+} m1_statsformat;
+
+typedef struct m1_stats {
+    m1_statsformat format;              /* STATS_NONE means no timing is done. */
+
+    m1_phase       phase;               /* phase that is being timed. */
+    double         phase_wall;          /* wall clock time when <phase> was entered. */
+    double         phase_cpu;           /* cpu time when <phase> was entered. */
+    double         wall[NUM_PHASES];    /* seconds spent per phase. */
+    double         cpu[NUM_PHASES];
+
+    /* counters. */
+    unsigned long  symbol_lookups;      /* calls to sym_lookup_symbol(). */
+    unsigned long  reg_allocs;          /* calls to alloc_reg(). */
+    unsigned long  reg_scans;           /* register slots inspected by the register allocator. */
+    unsigned long  spills;              /* virtual registers that were spilled. */
+    unsigned long  consts_entered;      /* constants added to constant pools. */
+    unsigned long  instructions;        /* instructions generated. */
+    unsigned long  labels;              /* labels generated. */
+    unsigned long  folds;               /* expressions replaced by constant folding. */
+    unsigned long  branches_pruned;     /* if/switch arms and loops removed as never run. */
+    unsigned long  loops_unrolled;      /* for loops unrolled, fully or partially. */
+    unsigned long  switches_lowered;    /* switches that jump to their case through a compare tree or jump table. */
+    unsigned long  values_reused;       /* computations replaced by a copy of an earlier result. */
+    unsigned long  hoisted;             /* loop-invariant instructions moved out of loops. */
+    unsigned long  strength_reduced;    /* addresses in loops computed by increments, not multiplies. */
+    unsigned long  dead_instructions;   /* instructions removed as unreachable or unused. */
+    unsigned long  peephole[NUM_PEEPHOLE_RULES]; /* instructions removed by each peephole rule. */
+
+    size_t         peak_bytes;          /* maximum bytes held by the arenas. */
+    size_t         output_bytes;        /* size of the output. */
+    long           peak_rss_kb;         /* maximum resident set size of the process. */
+
+} m1_stats;
+
+#define STAT_INC(comp, counter)     (++(comp)->stats->counter)
+
+extern m1_stats *new_stats(m1_statsformat format);
+
+extern void delete_stats(m1_stats *stats);
+
+extern m1_phase stats_phase(M1_compiler *comp, m1_phase phase);
+
+extern void stats_sample_memory(M1_compiler *comp);
+
+extern void print_stats(M1_compiler *comp, FILE *out);
+
+#endif
+
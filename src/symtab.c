@@ -10,16 +10,15 @@
 #include "symtab.h"
 #include "decl.h"
 #include "stack.h"
+#include "arena.h"
+#include "intern.h"
+#include "stats.h"
 
 #include "ann.h"
 
 m1_symboltable *
-new_symtab(void) {
-    m1_symboltable *table = (m1_symboltable *)calloc(1, sizeof (m1_symboltable));
-    if (table == NULL) {
-        fprintf(stderr, "cant alloc new symtab");
-        exit(EXIT_FAILURE);   
-    }
+new_symtab(M1_compiler *comp) {
+    m1_symboltable *table = (m1_symboltable *)arena_alloc(comp->sym_arena, sizeof (m1_symboltable));
     init_symtab(table);
     return table;   
 }
@@ -27,50 +26,92 @@ new_symtab(void) {
 void 
 init_symtab(m1_symboltable *symtab) {
     symtab->syms        = NULL;
+    symtab->lastsym     = NULL;
+    symtab->buckets     = NULL;
+    symtab->num_buckets = 0;
+    symtab->num_syms    = 0;
     symtab->parentscope = NULL;    
 }
 
 /*
 
-Add symbol C<sym> to symboltable C<table>. 
+Add symbol C<sym> to the end of symboltable C<table>'s list of symbols. 
+Struct members must be stored in-order, as their offsets are assigned
+by iterating over the list.
 
 */
 static void
 link_sym(m1_symboltable *table, m1_symbol *sym) {
-    m1_symbol *iter;
     
     assert(table != NULL);
     assert(sym != NULL);
     
-    iter = table->syms;
-    
-    if (iter == NULL) {
+    if (table->lastsym == NULL) 
         table->syms = sym;
+    else 
+        table->lastsym->next = sym;
+    
+    table->lastsym = sym;
+}
+
+/* 
+
+Find the bucket in C<table> where a symbol called C<name> is, or where it should go.
+The table must have buckets allocated, and at least one bucket must be empty, 
+otherwise this will loop forever (hash_sym() keeps it at most half full).
+
+*/
+static m1_symbol **
+find_bucket(m1_symboltable *table, char *name, unsigned hash) {
+    unsigned mask  = table->num_buckets - 1;
+    unsigned index = hash & mask;
+    
+    while (table->buckets[index] != NULL) {
+        if (table->buckets[index]->name == name) /* interned. */
+            break;
+        /* linear probing. */
+        index = (index + 1) & mask;
     }
-    else {
-        
-        /* go to end of list, and hook on symbol at the end 
-        This is needed because the symbols in the constants segment 
-        must be stored in-order. XXX Make this more efficient.
-        
-        */
-        while (iter->next != NULL) {
-            iter = iter->next;
-        }      
-        iter->next = sym;
+    return &table->buckets[index];
+}
+
+/* Double the number of buckets in C<table> (or create the initial set), and rehash. 
+   The old buckets stay in the symbol arena until it's released. 
+ */
+static void
+grow_buckets(M1_compiler *comp, m1_symboltable *table) {
+    m1_symbol **oldbuckets = table->buckets;
+    unsigned    oldnum     = table->num_buckets;
+    unsigned    i;
+    
+    table->num_buckets = oldnum == 0 ? 8 : oldnum * 2;
+    table->buckets     = (m1_symbol **)arena_alloc(comp->sym_arena, 
+                                                   table->num_buckets * sizeof (m1_symbol *));
+    
+    for (i = 0; i < oldnum; i++) {
+        if (oldbuckets[i] != NULL) {
+            m1_symbol *sym = oldbuckets[i];
+            *find_bucket(table, sym->name, hash_atom(sym->name)) = sym;
+        }
     }
+}
 
+/* Enter the named symbol C<sym> into C<table>'s hash table. */
+static void
+hash_sym(M1_compiler *comp, m1_symboltable *table, m1_symbol *sym) {
+    assert(sym->name != NULL);
+    
+    /* keep load factor at most 1/2 so that probe sequences stay short. */
+    if ((table->num_syms + 1) * 2 > table->num_buckets)
+        grow_buckets(comp, table);
+        
+    *find_bucket(table, sym->name, hash_atom(sym->name)) = sym;
+    ++table->num_syms;
 }
 
 static m1_symbol *
-mk_sym(void) {
-    m1_symbol *sym = (m1_symbol *)calloc(1, sizeof(m1_symbol));
-   	
-    if (sym == NULL) {
-        fprintf(stderr, "cant alloc mem for sym");
-        exit(EXIT_FAILURE);
-    }      
-    return sym;
+mk_sym(M1_compiler *comp) {
+    return (m1_symbol *)arena_alloc(comp->sym_arena, sizeof(m1_symbol));
 }
 
 /* Return an iterator for symbol table <table>. For now that's just the first
@@ -96,7 +137,7 @@ sym_new_symbol(M1_compiler *comp, m1_symboltable *table, char *varname, char *ty
     assert(table != NULL);
     
     /* check whether symbol exists already. */
-    sym = sym_lookup_symbol(table, varname);
+    sym = sym_lookup_symbol(comp, table, varname);
     
     if (sym != NULL) {
         fprintf(stderr, "%s:%d: error: already declared a variable '%s'\n", 
@@ -105,7 +146,7 @@ sym_new_symbol(M1_compiler *comp, m1_symboltable *table, char *varname, char *ty
         return sym;  
     }
     /* if it existed, the function would have returned by now. */
-    sym = mk_sym();
+    sym = mk_sym(comp);
     
     sym->num_elems = num_elems;  /* for arrays. */
     sym->name      = varname;    /* name of this symbol */
@@ -115,35 +156,30 @@ sym_new_symbol(M1_compiler *comp, m1_symboltable *table, char *varname, char *ty
     sym->line      = yyget_lineno(comp->yyscanner);
     
     link_sym(table, sym);
+    hash_sym(comp, table, sym);
     
     return sym;   
 }
 
 m1_symbol *
-sym_lookup_symbol(m1_symboltable *table, char *name) {
-    m1_symbol *sym = NULL;
+sym_lookup_symbol(M1_compiler *comp, m1_symboltable *table, char *name) {
+    unsigned hash;
     
     assert(table != NULL);
     assert(name != NULL);
     
-    sym = table->syms;
-        
-    while (sym != NULL) {        
-    
-        assert(sym->name != NULL);
-        assert(name != NULL);  
-   
-        if (strcmp(sym->name, name) == 0) {     
-            return sym;
-        }   
-            
-        sym = sym->next;   
-    }
+    STAT_INC(comp, symbol_lookups);
+    
+    hash = hash_atom(name);
     
-    /* try and find the symbol in the parent scope, recursively. */
-    if (table->parentscope != NULL) {
-        fprintf(stderr, "looking for %s; going to parent table\n", name);
-        return sym_lookup_symbol(table->parentscope, name);
+    /* try and find the symbol in this scope, then in the parent scopes. */
+    while (table != NULL) {
+        if (table->num_syms > 0) {
+            m1_symbol *sym = *find_bucket(table, name, hash);
+            if (sym != NULL)
+                return sym;
+        }
+        table = table->parentscope;
     }
         
     return NULL;
@@ -163,141 +199,234 @@ print_symboltable(m1_symboltable *table) {
     }   
 }
 
-m1_symbol *
-sym_enter_str(M1_compiler *comp, m1_symboltable *table, char *str) {
-    m1_symbol *sym;
-    
-    assert(table != NULL);
-    
-    sym = sym_find_str(table, str);
-    
-    if (sym) {     
-    	return sym;
+/*
+
+Constant pools. Each chunk has a constant pool, which stores the constants
+in the order of their constant index (which is the order in which they 
+are written to the constants segment), and a hash table to find constants
+by value. Strings and chunk names are interned, so they're hashed and
+compared by pointer. Strings and chunks share one "kind", as do all 
+other values of the same valtype.
+
+*/
+
+void
+init_constpool(m1_constpool *pool) {
+    pool->consts      = NULL;
+    pool->num_consts  = 0;
+    pool->max_consts  = 0;
+    pool->buckets     = NULL;
+    pool->num_buckets = 0;
+}
+
+static int
+const_kind(m1_valuetype type) {
+    return type == VAL_CHUNK ? VAL_STRING : type;   
+}
+
+static unsigned
+hash_const(m1_valuetype type, m1_value *value) {
+    switch (const_kind(type)) {
+        case VAL_STRING:
+            return hash_atom(value->as_string);
+        case VAL_FLOAT: {
+            unsigned long long bits;
+            double             d = value->as_double;
+            
+            /* 0.0 and -0.0 compare equal, so they must hash equally. */
+            if (d == 0.0)
+                return 0;
+            
+            memcpy(&bits, &d, sizeof (double));
+            return (unsigned)(bits ^ (bits >> 32)) * 2654435761u;
+        }
+        default:
+            return (unsigned)value->as_int * 2654435761u;
     }
-    	
-   	sym = mk_sym();   
+}
+
+static int
+const_equals(m1_symbol *sym, m1_valuetype type, m1_value *value) {
+    if (const_kind(sym->valtype) != const_kind(type))
+        return 0;
     
-    sym->value.as_string = str;
-    sym->valtype         = VAL_STRING;
-    sym->constindex      = comp->constindex++;
+    switch (const_kind(type)) {
+        case VAL_STRING:
+            return sym->value.as_string == value->as_string; /* interned. */
+        case VAL_FLOAT:
+            /* exact comparison on floats usually doesn't work, but 
+               this does work for the exact literal constant floats
+               that are used in a program.
+             */
+            return sym->value.as_double == value->as_double;
+        default:
+            return sym->value.as_int == value->as_int;
+    }
+}
+
+/* Find the bucket holding the constant <value> of type <type>, or the empty bucket where it should go. */
+static m1_symbol **
+find_const(m1_constpool *pool, m1_valuetype type, m1_value *value) {
+    unsigned mask  = pool->num_buckets - 1;
+    unsigned index = hash_const(type, value) & mask;
     
-    link_sym(table, sym);
-    return sym;    
+    while (pool->buckets[index] != NULL) {
+        if (const_equals(pool->buckets[index], type, value))
+            break;
+        index = (index + 1) & mask;
+    }
+    return &pool->buckets[index];
 }
 
-m1_symbol *
-sym_enter_chunk(M1_compiler *comp, m1_symboltable *table, char *name) {
-    m1_symbol *sym;
-    /* a chunk is just stored as a name, but override the type. */
-    sym          = sym_enter_str(comp, table, name);        
-    sym->valtype = VAL_CHUNK;
-    return sym;       
+static m1_symbol *
+lookup_const(m1_constpool *pool, m1_valuetype type, m1_value *value) {
+    assert(pool != NULL);
+    
+    if (pool->num_consts == 0)
+        return NULL;
+    
+    return *find_const(pool, type, value);
 }
 
-m1_symbol *
-sym_find_chunk(m1_symboltable *table, char *name) {
-    return sym_find_str(table, name);   
+/* Make sure there's room for one more constant in <pool>. */
+static void
+grow_constpool(M1_compiler *comp, m1_constpool *pool) {
+    
+    if (pool->num_consts == pool->max_consts) {
+        m1_symbol **oldconsts = pool->consts;
+        
+        pool->max_consts = pool->max_consts == 0 ? 16 : pool->max_consts * 2;
+        pool->consts     = (m1_symbol **)arena_alloc(comp->sym_arena, 
+                                                     pool->max_consts * sizeof (m1_symbol *));
+        if (oldconsts != NULL)
+            memcpy(pool->consts, oldconsts, pool->num_consts * sizeof (m1_symbol *));
+    }
+    
+    /* keep load factor of hash table at most 1/2. */
+    if ((pool->num_consts + 1) * 2 > pool->num_buckets) {
+        m1_symbol **oldbuckets     = pool->buckets;
+        unsigned    old_numbuckets = pool->num_buckets;
+        unsigned    i;
+        
+        pool->num_buckets = pool->num_buckets == 0 ? 32 : pool->num_buckets * 2;
+        pool->buckets     = (m1_symbol **)arena_alloc(comp->sym_arena, 
+                                                      pool->num_buckets * sizeof (m1_symbol *));
+        
+        /* rehash what's in the old table; unshared constants aren't. */
+        for (i = 0; i < old_numbuckets; i++) {
+            m1_symbol *sym = oldbuckets[i];
+            if (sym != NULL)
+                *find_const(pool, sym->valtype, &sym->value) = sym;
+        }
+    }
 }
 
-m1_symbol *
-sym_enter_num(M1_compiler *comp, m1_symboltable *table, double val) {
+/* Enter constant <value> of type <type> into <pool>, unless it's in there already. */
+static m1_symbol *
+enter_const(M1_compiler *comp, m1_constpool *pool, m1_valuetype type, m1_value *value) {
     m1_symbol *sym;
     
-    sym = sym_find_num(table, val);
-    if (sym)
-    	return sym;
-    	
-    sym = mk_sym();
+    assert(pool != NULL);
     
-    sym->value.as_double = val;
-    sym->valtype         = VAL_FLOAT;
-    sym->constindex      = comp->constindex++;
+    sym = lookup_const(pool, type, value);
+    if (sym != NULL)
+        return sym;
     
-    link_sym(table, sym);
+    grow_constpool(comp, pool);
+    STAT_INC(comp, consts_entered);
+    
+    sym             = mk_sym(comp);
+    sym->value      = *value;
+    sym->valtype    = type;
+    sym->constindex = pool->num_consts;
+    
+    *find_const(pool, type, value)   = sym;
+    pool->consts[pool->num_consts++] = sym;
     
     return sym;    
 }
 
+/* Add an integer constant to <pool> that is never found by value, so that it
+   isn't shared with any other use of that value. Its value can be set once
+   it's known, which may be after the code that loads it is generated.
+ */
 m1_symbol *
-sym_enter_int(M1_compiler *comp, m1_symboltable *table, int val) {
+sym_enter_unshared_int(M1_compiler *comp, m1_constpool *pool) {
     m1_symbol *sym;
-           
-    sym = sym_find_int(table, val);
-    if (sym) {
-    	return sym;
-    }
-        	
-    sym = mk_sym();
     
-    sym->value.as_int = val;
-    sym->valtype      = VAL_INT;    
-    sym->constindex   = comp->constindex++;
-    sym->next         = NULL;
+    assert(pool != NULL);
+    grow_constpool(comp, pool);
+    STAT_INC(comp, consts_entered);
     
-    link_sym(table, sym);
-    return sym;    
+    sym             = mk_sym(comp);
+    sym->valtype    = VAL_INT;
+    sym->constindex = pool->num_consts;
+    
+    pool->consts[pool->num_consts++] = sym;
+    return sym;
 }
 
 m1_symbol *
-sym_find_str(NOTNULL(m1_symboltable *table), char *name) {
-    m1_symbol *sym;
-    
-    assert(table != NULL);
-    assert(name != NULL);
+sym_enter_str(M1_compiler *comp, m1_constpool *pool, char *str) {
+    m1_value value;
     
-    sym = table->syms;
-        
-    while (sym != NULL) {        
-        if (sym->valtype == VAL_STRING || sym->valtype == VAL_CHUNK) {
-            assert(sym->value.as_string != NULL);
-            assert(name != NULL);  
-                           
-            if (strcmp(sym->value.as_string, name) == 0) {     
-                return sym;
-            }   
-        }
-            
-        sym = sym->next;   
-    }
-    return NULL;
+    assert(str != NULL);
+    value.as_string = str;
+    return enter_const(comp, pool, VAL_STRING, &value);
 }
 
+m1_symbol *
+sym_enter_chunk(M1_compiler *comp, m1_constpool *pool, char *name) {
+    m1_symbol *sym;
+    /* a chunk is just stored as a name, but override the type. */
+    sym          = sym_enter_str(comp, pool, name);        
+    sym->valtype = VAL_CHUNK;
+    return sym;       
+}
 
+m1_symbol *
+sym_enter_num(M1_compiler *comp, m1_constpool *pool, double val) {
+    m1_value value;
+    
+    value.as_double = val;
+    return enter_const(comp, pool, VAL_FLOAT, &value);
+}
 
 m1_symbol *
-sym_find_num(NOTNULL(m1_symboltable *table), double fval) {
-    m1_symbol *sym = table->syms;
-    
-    while (sym != NULL) {
-        /* exact comparison on floats usually doesn't work, but 
-           this does work for the exact literal constant floats
-           that are used in a program.
-         */
-        if (sym->valtype == VAL_FLOAT) {
-            if (sym->value.as_double == fval) {        	
-                return sym;            
-            }
-        }
-            
-        sym = sym->next;   
-    }
-    return NULL;
+sym_enter_int(M1_compiler *comp, m1_constpool *pool, int val) {
+    m1_value value;
+    
+    value.as_int = val;
+    return enter_const(comp, pool, VAL_INT, &value);
 }
 
 m1_symbol *
-sym_find_int(NOTNULL(m1_symboltable *table), int ival) {
-    m1_symbol *sym = table->syms;
+sym_find_str(NOTNULL(m1_constpool *pool), char *name) {
+    m1_value value;
     
-    while (sym != NULL) {
-        if (sym->valtype == VAL_INT) {
-            if (sym->value.as_int == ival) {
-                return sym;
-            }
-        }    
-        sym = sym->next;   
-    }
-    return NULL;
+    assert(name != NULL);
+    value.as_string = name;
+    return lookup_const(pool, VAL_STRING, &value);
 }
 
+m1_symbol *
+sym_find_chunk(m1_constpool *pool, char *name) {
+    return sym_find_str(pool, name);   
+}
 
+m1_symbol *
+sym_find_num(NOTNULL(m1_constpool *pool), double fval) {
+    m1_value value;
+    
+    value.as_double = fval;
+    return lookup_const(pool, VAL_FLOAT, &value);
+}
+
+m1_symbol *
+sym_find_int(NOTNULL(m1_constpool *pool), int ival) {
+    m1_value value;
+    
+    value.as_int = ival;
+    return lookup_const(pool, VAL_INT, &value);
+}
 
@@ -43,7 +43,7 @@ typedef union m1_value {
 
 
 /* Structure for representing symbols in the symbol table, as well as constant
-   declarations, which are just symbols in a "constants" symboltable. 
+   declarations, which are just symbols in a constant pool. 
    
    The symbol struct has a pointer to a declaration node of a variable.
    So, for this declaration:
@@ -80,6 +80,7 @@ typedef struct m1_symbol {
         struct m1_var    *var;          /* pointer to declaration AST node for var */
         struct m1_chunk  *chunk;        /* pointer to chunk AST node for functions. */
     };
+    struct m1_const  *constdecl;    /* pointer to const declaration AST node; NULL for variables. */
     struct m1_type   *typedecl;     /* pointer to declaration of type. */
     
     struct m1_symbol *next;         /* symbols are stored in a list. */
@@ -88,33 +89,61 @@ typedef struct m1_symbol {
 
 
 
-/* A symboltable is just a list of symbols, and a constant-counter, in case the 
-   symbol represents a constant.   
+/* A symboltable stores its symbols in a list, which keeps them in the order in
+   which they were entered (this order is needed for struct member offsets). Named symbols are also stored in an open-addressing
+   hash table, so that finding a symbol by name doesn't require a walk over the list.
+   The hash table is allocated lazily; tables that never get a named symbol (e.g.
+   empty blocks) don't have one. Scopes are chained through <parentscope>.
  */
 typedef struct m1_symboltable {
-    struct m1_symbol      *syms;            /* list of symbols. */
+    struct m1_symbol      *syms;            /* list of symbols, in insertion order. */
+    struct m1_symbol      *lastsym;         /* tail of list, to append in O(1). */
+    
+    struct m1_symbol     **buckets;         /* hash table of named symbols. */
+    unsigned               num_buckets;     /* size of buckets; always 0 or a power of 2. */
+    unsigned               num_syms;        /* number of symbols in buckets. */
+    
     struct m1_symboltable *parentscope;     /* pointer to outer scope */
 } m1_symboltable;
 
 
 
-extern m1_symboltable *new_symtab(void);
+/* A constant pool holds the constants of a chunk. <consts> stores them in 
+   order of their constant index, which is the order in which they're written
+   to the constants segment. The hash table <buckets> indexes them by type and 
+   value, so entering a constant doesn't need a walk over all constants.
+ */
+typedef struct m1_constpool {
+    struct m1_symbol     **consts;          /* constants, indexed by constindex. */
+    unsigned               num_consts;      /* number of constants in pool. */
+    unsigned               max_consts;      /* allocated size of consts. */
+    
+    struct m1_symbol     **buckets;         /* hash table of constants. */
+    unsigned               num_buckets;     /* size of buckets; always 0 or a power of 2. */
+    
+} m1_constpool;
+
+
+extern m1_symboltable *new_symtab(M1_compiler *comp);
 extern void init_symtab(m1_symboltable *symtab);
 
-extern m1_symbol *sym_enter_str(M1_compiler *comp, m1_symboltable *table, char *name);
-extern m1_symbol *sym_enter_num(M1_compiler *comp, m1_symboltable *table, double val);
-extern m1_symbol *sym_enter_int(M1_compiler *comp, m1_symboltable *table, int val);
-extern m1_symbol *sym_enter_chunk(M1_compiler *comp, m1_symboltable *table, char *name);
+extern void init_constpool(m1_constpool *pool);
+
+extern m1_symbol *sym_enter_str(M1_compiler *comp, m1_constpool *pool, char *name);
+extern m1_symbol *sym_enter_num(M1_compiler *comp, m1_constpool *pool, double val);
+extern m1_symbol *sym_enter_int(M1_compiler *comp, m1_constpool *pool, int val);
+extern m1_symbol *sym_enter_chunk(M1_compiler *comp, m1_constpool *pool, char *name);
+extern m1_symbol *sym_enter_unshared_int(M1_compiler *comp, m1_constpool *pool);
 
-extern m1_symbol *sym_find_str(m1_symboltable *table, char *name);
-extern m1_symbol *sym_find_num(m1_symboltable *table, double val);
-extern m1_symbol *sym_find_int(m1_symboltable *table, int val);
-extern m1_symbol *sym_find_chunk(m1_symboltable *table, char *name);
+extern m1_symbol *sym_find_str(m1_constpool *pool, char *name);
+extern m1_symbol *sym_find_num(m1_constpool *pool, double val);
+extern m1_symbol *sym_find_int(m1_constpool *pool, int val);
+extern m1_symbol *sym_find_chunk(m1_constpool *pool, char *name);
 
 extern m1_symbol *sym_new_symbol(M1_compiler *comp, m1_symboltable *table, char *varname, 
                                  char *type, unsigned num_elems);
                                  
-extern m1_symbol *sym_lookup_symbol(m1_symboltable *table, char *name);
+extern m1_symbol *sym_lookup_symbol(M1_compiler *comp, m1_symboltable *table, char *name);
 
 extern void print_symboltable(m1_symboltable *table);
 
@@ -0,0 +1,310 @@
+/*
+
+Loop unrolling. The test of a loop's condition and the jump back run in
+every iteration, and in an interpreter each of them costs a dispatch. A
+for loop that runs a number of times that is known at compile time can do
+without most of them.
+
+A loop like
+
+    for (k = 0; k < 8; k++) <body>
+
+is fully unrolled if 8 copies of its body and step fit in the budget: the
+code generator writes them one after another, without any test. Otherwise
+it's partially unrolled by a factor f: the body and step are written f
+times between the test and the jump back. The iterations that are left
+over, trips % f, are written before the loop; after them, the number of
+iterations left is a multiple of f, so testing the condition once per f
+iterations is enough. Each copy has its own label for continue to go to.
+
+The number of iterations is found by running the loop's init, condition
+and step on the loop variable, with the arithmetic of constant folding
+(src/fold.c), so any condition and step on just the variable and literals
+will do. A loop isn't unrolled when:
+
+ - its init is anything but the assignment of a literal to an int variable;
+ - its body changes that variable, or may change it through a pointer;
+ - its body declares variables, or has M0 code;
+ - the unrolled code wouldn't fit in the budget even for a factor of 2.
+
+The size of a body is counted in AST nodes; a loop in the body counts with
+the size it has once it's unrolled itself.
+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "unroll.h"
+#include "fold.h"
+#include "ast.h"
+#include "symtab.h"
+#include "decl.h"
+
+/* most copies of a body between two tests, for partial unrolling. */
+#define UNROLL_MAX_FACTOR   8
+
+/* loops that run more often than this aren't simulated. */
+#define UNROLL_MAX_TRIPS    (1 << 16)
+
+/* Find the object in a.b.c that names the variable. */
+static m1_object *
+main_object(m1_object *obj) {
+    while (obj != NULL && obj->type == OBJECT_LINK)
+        obj = obj->parent;
+    return obj;
+}
+
+/* Is <e> a use of variable <var> as a whole? */
+static int
+is_variable(m1_expression const *e, m1_symbol const *var) {
+    return e->type == EXPR_OBJECT && e->expr.as_object->type == OBJECT_MAIN
+        && e->expr.as_object->sym == var;
+}
+
+static int expr_size(M1_compiler *comp, m1_expression *e, m1_symbol *var, unsigned long *size);
+
+static int
+list_size(M1_compiler *comp, m1_expression *e, m1_symbol *var, unsigned long *size) {
+    for (; e != NULL; e = e->next) {
+        if (!expr_size(comp, e, var, size))
+            return 0;
+    }
+    return 1;
+}
+
+/* Add the size of object <obj> to <*size>, with its index expressions. */
+static int
+object_size(M1_compiler *comp, m1_object *obj, m1_symbol *var, unsigned long *size) {
+    for (; obj != NULL && obj->type == OBJECT_LINK; obj = obj->parent) {
+        *size += 2;
+        if (obj->obj.as_link->type == OBJECT_INDEX
+        && !expr_size(comp, obj->obj.as_link->obj.as_index, var, size))
+            return 0;
+    }
+    ++*size;
+    return 1;
+}
+
+/* Add the size of for loop <loop> to <*size>, once it's unrolled. */
+static int
+for_size(M1_compiler *comp, m1_forexpr *loop, m1_symbol *var, unsigned long *size) {
+    unsigned long body = 0,
+                  rest = 0;
+    unsigned      factor, trips;
+
+    if (!list_size(comp, loop->init, var, &rest)
+    || (loop->cond != NULL && !expr_size(comp, loop->cond, var, &rest))
+    || !list_size(comp, loop->step, var, &body)
+    || (loop->block != NULL && !expr_size(comp, loop->block, var, &body)))
+        return 0;
+
+    factor = unroll_factor(comp, loop, &trips);
+    if (factor == 0)
+        *size += rest + body;
+    else if (factor == trips)
+        *size += rest + trips * body;
+    else
+        *size += rest + (factor + trips % factor) * body;
+
+    return 1;
+}
+
+/* Add the size of <e> to <*size>. Return 0 if <e> may change <var> (if that's
+   not NULL), or can't be generated more than once.
+ */
+static int
+expr_size(M1_compiler *comp, m1_expression *e, m1_symbol *var, unsigned long *size) {
+    ++*size;
+
+    switch (e->type) {
+        case EXPR_ADDRESS:
+        case EXPR_DEREF:
+        case EXPR_M0BLOCK:
+        case EXPR_VARDECL:
+            return 0;
+        case EXPR_ASSIGN: {
+            m1_object *lhs = main_object(e->expr.as_assign->lhs);
+
+            if (var != NULL && lhs != NULL && lhs->sym == var)
+                return 0;
+            return object_size(comp, e->expr.as_assign->lhs, var, size)
+                && expr_size(comp, e->expr.as_assign->rhs, var, size);
+        }
+        case EXPR_UNARY: {
+            m1_expression *operand = e->expr.as_unexpr->expr;
+
+            /* ++ and -- change their operand. */
+            if (var != NULL && e->expr.as_unexpr->op != UNOP_NOT && e->expr.as_unexpr->op != UNOP_BNOT
+            &&  operand->type == EXPR_OBJECT && main_object(operand->expr.as_object) != NULL
+            &&  main_object(operand->expr.as_object)->sym == var)
+                return 0;
+            return expr_size(comp, operand, var, size);
+        }
+        case EXPR_OBJECT:
+            --*size;
+            return object_size(comp, e->expr.as_object, var, size);
+        case EXPR_BINARY:
+            return expr_size(comp, e->expr.as_binexpr->left, var, size)
+                && expr_size(comp, e->expr.as_binexpr->right, var, size);
+        case EXPR_CAST:
+            return expr_size(comp, e->expr.as_cast->expr, var, size);
+        case EXPR_BLOCK:
+            return list_size(comp, e->expr.as_block->stats, var, size);
+        case EXPR_IF:
+            return expr_size(comp, e->expr.as_ifexpr->cond, var, size)
+                && expr_size(comp, e->expr.as_ifexpr->ifblock, var, size)
+                && (e->expr.as_ifexpr->elseblock == NULL
+                    || expr_size(comp, e->expr.as_ifexpr->elseblock, var, size));
+        case EXPR_WHILE:
+        case EXPR_DOWHILE:
+            return expr_size(comp, e->expr.as_whileexpr->cond, var, size)
+                && expr_size(comp, e->expr.as_whileexpr->block, var, size);
+        case EXPR_FOR:
+            return for_size(comp, e->expr.as_forexpr, var, size);
+        case EXPR_FUNCALL:
+            return list_size(comp, e->expr.as_funcall->arguments, var, size);
+        case EXPR_NEW:
+            return list_size(comp, e->expr.as_newexpr->args, var, size);
+        case EXPR_PRINT:
+            return list_size(comp, e->expr.as_expr, var, size);
+        case EXPR_RETURN:
+            return e->expr.as_expr == NULL || expr_size(comp, e->expr.as_expr, var, size);
+        case EXPR_SWITCH: {
+            m1_case *c;
+
+            if (!expr_size(comp, e->expr.as_switch->selector, var, size))
+                return 0;
+            for (c = e->expr.as_switch->cases; c != NULL; c = c->next) {
+                if (!list_size(comp, c->block, var, size))
+                    return 0;
+            }
+            return e->expr.as_switch->defaultstat == NULL
+                || expr_size(comp, e->expr.as_switch->defaultstat, var, size);
+        }
+        default:
+            return 1;
+    }
+}
+
+/* Compute the value of <e>, where loop variable <var> is <val>. */
+static int
+evaluate(m1_expression *e, m1_symbol const *var, m1_constval const *val, m1_constval *result) {
+    m1_constval left, right;
+
+    if (is_variable(e, var)) {
+        *result = *val;
+        return 1;
+    }
+
+    if (e->type == EXPR_BINARY)
+        return evaluate(e->expr.as_binexpr->left, var, val, &left)
+            && evaluate(e->expr.as_binexpr->right, var, val, &right)
+            && fold_binop(e->expr.as_binexpr->op, &left, &right, result);
+
+    return fold_get_value(e, result);
+}
+
+/* Run step <step> of a loop over <var> on <*val>. */
+static int
+step_value(m1_expression *step, m1_symbol const *var, m1_constval *val) {
+    m1_constval one, next;
+
+    one.type = EXPR_INT;
+    one.ival = 1;
+
+    if (step->type == EXPR_UNARY && is_variable(step->expr.as_unexpr->expr, var)) {
+        switch (step->expr.as_unexpr->op) {
+            case UNOP_POSTINC: case UNOP_PREINC:
+                if (!fold_binop(OP_PLUS, val, &one, &next))
+                    return 0;
+                break;
+            case UNOP_POSTDEC: case UNOP_PREDEC:
+                if (!fold_binop(OP_MINUS, val, &one, &next))
+                    return 0;
+                break;
+            default:
+                return 0;
+        }
+    }
+    else if (step->type == EXPR_ASSIGN && step->expr.as_assign->lhs->type == OBJECT_MAIN
+         &&  step->expr.as_assign->lhs->sym == var) {
+        if (!evaluate(step->expr.as_assign->rhs, var, val, &next))
+            return 0;
+    }
+    else
+        return 0;
+
+    if (next.type != EXPR_INT)
+        return 0;
+
+    *val = next;
+    return 1;
+}
+
+/* Find the number of times that <loop> runs; return 0 if it isn't known. Set
+   <*var> to the loop's variable.
+ */
+static int
+count_trips(m1_forexpr *loop, m1_symbol **var, unsigned *trips) {
+    m1_assignment *init;
+    m1_constval    val, truth;
+
+    if (loop->init == NULL || loop->init->next != NULL || loop->init->type != EXPR_ASSIGN
+    ||  loop->cond == NULL || loop->step == NULL || loop->step->next != NULL)
+        return 0;
+
+    init = loop->init->expr.as_assign;
+    if (init->lhs->type != OBJECT_MAIN || init->lhs->sym == NULL
+    ||  init->lhs->sym->num_elems != 1 || init->lhs->sym->typedecl == NULL
+    ||  init->lhs->sym->typedecl->decltype != DECL_INT)
+        return 0;
+
+    *var = init->lhs->sym;
+    if (!fold_get_value(init->rhs, &val) || val.type != EXPR_INT)
+        return 0;
+
+    for (*trips = 0; *trips <= UNROLL_MAX_TRIPS; ++*trips) {
+        if (!evaluate(loop->cond, *var, &val, &truth)
+        || (truth.type != EXPR_TRUE && truth.type != EXPR_FALSE))
+            return 0;
+
+        if (truth.type == EXPR_FALSE)
+            return 1;
+
+        if (!step_value(loop->step, *var, &val))
+            return 0;
+    }
+    return 0;
+}
+
+/*
+
+Decide how for loop <loop> is unrolled. Return the number of copies of its
+body to write between tests of the condition, or 0 if it's not unrolled.
+<*trips> is set to the number of iterations; if that's what is returned,
+the loop is unrolled fully.
+
+*/
+unsigned
+unroll_factor(M1_compiler *comp, m1_forexpr *loop, unsigned *trips) {
+    m1_symbol     *var;
+    unsigned long  body = 0;
+    unsigned       factor;
+
+    if (comp->unroll_budget == 0 || !count_trips(loop, &var, trips) || *trips == 0)
+        return 0;
+
+    if ((loop->block != NULL && !expr_size(comp, loop->block, var, &body))
+    ||  !expr_size(comp, loop->step, NULL, &body))
+        return 0;
+
+    if (*trips * body <= comp->unroll_budget)
+        return *trips;
+
+    for (factor = UNROLL_MAX_FACTOR; factor >= 2; factor--) {
+        if ((factor + *trips % factor) * body <= comp->unroll_budget)
+            return factor;
+    }
+    return 0;
+}
+
@@ -0,0 +1,23 @@
+#ifndef __M1_UNROLL_H__
+#define __M1_UNROLL_H__
+
+#include "compiler.h"
+#include "ast.h"
+
+/*
+
+Loop unrolling decides which for loops the code generator writes out more
+than once per test of the condition. A loop is unrolled when the number of
+times it runs is known at compile time, and its body doesn't change the
+loop's variable. The unrolled code may be <unroll_budget> AST nodes large;
+option --unroll=<n> sets that, and --unroll=0 switches unrolling off.
+
+*/
+
+/* default size of an unrolled loop, in AST nodes. */
+#define UNROLL_BUDGET       128
+
+extern unsigned unroll_factor(M1_compiler *comp, m1_forexpr *loop, unsigned *trips);
+
+#endif
+